@@ -6,18 +6,37 @@ make clean
 
 make wasmjit
 
-./wasmjit -p "$1" > src/wasmjit/static_emscripten_runtime_helper.c
-
-./wasmjit -o "$1" > "$1.o"
-
-SUPPORT="static_runtime emscripten_runtime emscripten_runtime_sys_posix runtime vector static_emscripten_runtime static_emscripten_runtime_helper"
+# WASMJIT_ZEROCOPY_THRESHOLD=<bytes> sends large socket writes with
+# MSG_ZEROCOPY, WASMJIT_MEMFS=<archive> serves the files packed with
+# `wasmjit -P` from memory
+./wasmjit -p ${WASMJIT_ZEROCOPY_THRESHOLD:+-z "$WASMJIT_ZEROCOPY_THRESHOLD"} ${WASMJIT_MEMFS:+-F "$WASMJIT_MEMFS"} "$1" > src/wasmjit/static_emscripten_runtime_helper.c
+
+# WASMJIT_C_BACKEND=1 translates function bodies to C and lets the
+# system compiler optimize them instead of reusing the JIT's code.
+# Host imports are then called directly and the whole image is built
+# with LTO, so trivial host functions are inlined into the module.
+EXTRA_FILES=""
+LTO_CFLAGS=""
+if [ "${WASMJIT_C_BACKEND:-0}" = 1 ]
+then
+    LTO_CFLAGS="-O2 -flto"
+    ./wasmjit -c -l "$1" > "$1.c"
+    ${CC:-cc} $LTO_CFLAGS -Isrc -c -o "$1.c.o" "$1.c"
+    ./wasmjit -o -c "$1" > "$1.o"
+    EXTRA_FILES="$1.c.o"
+else
+    ./wasmjit -o "$1" > "$1.o"
+fi
+
+# the heatmap profiler is only started by the wasmjit binary
+SUPPORT="static_runtime emscripten_runtime emscripten_runtime_sys_posix emscripten_checkpoint emscripten_memfs log_ring runtime vector static_emscripten_runtime static_emscripten_runtime_helper"
 SUPPORT_FILES=""
 for FILE in $SUPPORT
 do
     rm -f src/wasmjit/${FILE}.o
-    make src/wasmjit/${FILE}.o
+    make LCFLAGS="-Isrc -g -Wall -Wextra -Werror -DWASMJIT_NO_HEATMAP $LTO_CFLAGS" src/wasmjit/${FILE}.o
     SUPPORT_FILES="$SUPPORT_FILES src/wasmjit/${FILE}.o"
 done
 
 
-cc -o "$1.exe" "$1.o" $SUPPORT_FILES
+${CC:-cc} $LTO_CFLAGS -o "$1.exe" "$1.o" $EXTRA_FILES $SUPPORT_FILES -lm -pthread
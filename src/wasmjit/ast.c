@@ -81,6 +81,15 @@ void wasmjit_init_module(struct Module *module)
 
 void wasmjit_free_module(struct Module *module)
 {
+	if (module->custom_section.customs) {
+		uint32_t i;
+		for (i = 0; i < module->custom_section.n_customs; ++i) {
+			free(module->custom_section.customs[i].name);
+			free(module->custom_section.customs[i].payload);
+		}
+		free(module->custom_section.customs);
+	}
+
 	if (module->type_section.types) {
 		free(module->type_section.types);
 	}
@@ -161,6 +170,10 @@ void wasmjit_free_module(struct Module *module)
 		free(module->code_section.codes);
 	}
 
+	if (module->code_section.buf) {
+		free(module->code_section.buf);
+	}
+
 	if (module->data_section.datas) {
 		uint32_t i;
 		for (i = 0; i < module->data_section.n_datas; ++i) {
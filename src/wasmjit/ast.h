@@ -450,8 +450,13 @@ struct ElementSection {
 
 struct CodeSection {
 	uint32_t n_codes;
+	/* raw section contents, bodies are decoded lazily from here */
+	size_t buf_size;
+	char *buf;
 	struct CodeSectionCode {
 		uint32_t size;
+		const char *body;
+		int decoded;
 		uint32_t n_locals;
 		struct CodeSectionCodeLocal {
 			uint32_t count;
@@ -473,7 +478,18 @@ struct DataSection {
 	} *datas;
 };
 
+struct CustomSection {
+	uint32_t n_customs;
+	struct CustomSectionCustom {
+		char *name;
+		uint32_t payload_size;
+		/* NULL unless the runtime reads this section */
+		char *payload;
+	} *customs;
+};
+
 struct Module {
+	struct CustomSection custom_section;
 	struct TypeSection type_section;
 	struct ImportSection import_section;
 	struct FunctionSection function_section;
@@ -0,0 +1,1495 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/c_source.h>
+
+#include <wasmjit/ast.h>
+#include <wasmjit/parse.h>
+#include <wasmjit/util.h>
+#include <wasmjit/vector.h>
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+  Translates each function body to portable C. Every wasm stack slot
+  becomes a C local named after its depth and type, blocks become
+  labels, and all module state is reached through the StaticModuleInst
+  emitted by the ELF writer, so the system compiler is free to
+  register-allocate and optimize the result.
+ */
+
+static const char c_source_prologue[] =
+	"/* generated by wasmjit, do not edit */\n"
+	"\n"
+	"#include <wasmjit/static_runtime.h>\n"
+	"\n"
+	"#include <math.h>\n"
+	"#include <stdint.h>\n"
+	"#include <string.h>\n"
+	"\n"
+	"/* define WASMJIT_C_GUARD_REGION only if every memory is backed by a\n"
+	"   reservation covering the full 33-bit effective address range */\n"
+	"#ifdef WASMJIT_C_GUARD_REGION\n"
+	"#define WASM_CHECK_BOUNDS(mem, ea, n) ((void)0)\n"
+	"#else\n"
+	"#define WASM_CHECK_BOUNDS(mem, ea, n)\t\t\t\t\t\\\n"
+	"\tdo {\t\t\t\t\t\t\t\\\n"
+	"\t\tif ((ea) + (n) > (mem)->size)\t\t\t\t\\\n"
+	"\t\t\twasmjit_trap(WASMJIT_TRAP_MEMORY_OVERFLOW);\t\\\n"
+	"\t} while (0)\n"
+	"#endif\n"
+	"\n"
+	"#define WASM_DEFINE_LOAD(name, type)\t\t\t\t\t\\\n"
+	"\tstatic inline type name(struct MemInst *mem, uint32_t addr,\t\\\n"
+	"\t\t\t\tuint32_t offset)\t\t\t\\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tuint64_t ea = (uint64_t)addr + offset;\t\t\t\\\n"
+	"\t\ttype v;\t\t\t\t\t\t\t\\\n"
+	"\t\tWASM_CHECK_BOUNDS(mem, ea, sizeof(v));\t\t\t\\\n"
+	"\t\tmemcpy(&v, mem->data + ea, sizeof(v));\t\t\t\\\n"
+	"\t\treturn v;\t\t\t\t\t\t\\\n"
+	"\t}\n"
+	"\n"
+	"#define WASM_DEFINE_STORE(name, type)\t\t\t\t\t\\\n"
+	"\tstatic inline void name(struct MemInst *mem, uint32_t addr,\t\\\n"
+	"\t\t\t\tuint32_t offset, type v)\t\t\\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tuint64_t ea = (uint64_t)addr + offset;\t\t\t\\\n"
+	"\t\tWASM_CHECK_BOUNDS(mem, ea, sizeof(v));\t\t\t\\\n"
+	"\t\tmemcpy(mem->data + ea, &v, sizeof(v));\t\t\t\\\n"
+	"\t}\n"
+	"\n"
+	"WASM_DEFINE_LOAD(wasm_load_s8, int8_t)\n"
+	"WASM_DEFINE_LOAD(wasm_load_u8, uint8_t)\n"
+	"WASM_DEFINE_LOAD(wasm_load_s16, int16_t)\n"
+	"WASM_DEFINE_LOAD(wasm_load_u16, uint16_t)\n"
+	"WASM_DEFINE_LOAD(wasm_load_s32, int32_t)\n"
+	"WASM_DEFINE_LOAD(wasm_load_u32, uint32_t)\n"
+	"WASM_DEFINE_LOAD(wasm_load_u64, uint64_t)\n"
+	"WASM_DEFINE_LOAD(wasm_load_f32, float)\n"
+	"WASM_DEFINE_LOAD(wasm_load_f64, double)\n"
+	"\n"
+	"WASM_DEFINE_STORE(wasm_store_u8, uint8_t)\n"
+	"WASM_DEFINE_STORE(wasm_store_u16, uint16_t)\n"
+	"WASM_DEFINE_STORE(wasm_store_u32, uint32_t)\n"
+	"WASM_DEFINE_STORE(wasm_store_u64, uint64_t)\n"
+	"WASM_DEFINE_STORE(wasm_store_f32, float)\n"
+	"WASM_DEFINE_STORE(wasm_store_f64, double)\n"
+	"\n"
+	"#define WASM_DEFINE_DIV(bits, stype)\t\t\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _div_s(uint ## bits ## _t a, uint ## bits ## _t b) \\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tif (!b || (a == (uint ## bits ## _t)1 << (bits - 1) &&\t\\\n"
+	"\t\t\t   b == (uint ## bits ## _t)-1))\t\t\t\\\n"
+	"\t\t\twasmjit_trap(WASMJIT_TRAP_INTEGER_OVERFLOW);\t\\\n"
+	"\t\treturn (stype)a / (stype)b;\t\t\t\t\\\n"
+	"\t}\t\t\t\t\t\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _div_u(uint ## bits ## _t a, uint ## bits ## _t b) \\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tif (!b)\t\t\t\t\t\t\\\n"
+	"\t\t\twasmjit_trap(WASMJIT_TRAP_INTEGER_OVERFLOW);\t\\\n"
+	"\t\treturn a / b;\t\t\t\t\t\t\\\n"
+	"\t}\t\t\t\t\t\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _rem_s(uint ## bits ## _t a, uint ## bits ## _t b) \\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tif (!b)\t\t\t\t\t\t\\\n"
+	"\t\t\twasmjit_trap(WASMJIT_TRAP_INTEGER_OVERFLOW);\t\\\n"
+	"\t\tif (b == (uint ## bits ## _t)-1)\t\t\t\\\n"
+	"\t\t\treturn 0;\t\t\t\t\t\\\n"
+	"\t\treturn (stype)a % (stype)b;\t\t\t\t\\\n"
+	"\t}\t\t\t\t\t\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _rem_u(uint ## bits ## _t a, uint ## bits ## _t b) \\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tif (!b)\t\t\t\t\t\t\\\n"
+	"\t\t\twasmjit_trap(WASMJIT_TRAP_INTEGER_OVERFLOW);\t\\\n"
+	"\t\treturn a % b;\t\t\t\t\t\t\\\n"
+	"\t}\n"
+	"\n"
+	"WASM_DEFINE_DIV(32, int32_t)\n"
+	"WASM_DEFINE_DIV(64, int64_t)\n"
+	"\n"
+	"/* bounds are exclusive and exact as doubles */\n"
+	"#define WASM_DEFINE_TRUNC(name, rtype, ctype, ftype, lo, hi)\t\t\\\n"
+	"\tstatic inline rtype name(ftype v)\t\t\t\t\\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tif (!((double)v > (lo) && (double)v < (hi)))\t\t\\\n"
+	"\t\t\twasmjit_trap(WASMJIT_TRAP_INTEGER_OVERFLOW);\t\\\n"
+	"\t\treturn (rtype)(ctype)v;\t\t\t\t\\\n"
+	"\t}\n"
+	"\n"
+	"WASM_DEFINE_TRUNC(wasm_i32_trunc_s_f32, uint32_t, int32_t, float, -2147483649.0, 2147483648.0)\n"
+	"WASM_DEFINE_TRUNC(wasm_i32_trunc_u_f32, uint32_t, uint32_t, float, -1.0, 4294967296.0)\n"
+	"WASM_DEFINE_TRUNC(wasm_i32_trunc_s_f64, uint32_t, int32_t, double, -2147483649.0, 2147483648.0)\n"
+	"WASM_DEFINE_TRUNC(wasm_i32_trunc_u_f64, uint32_t, uint32_t, double, -1.0, 4294967296.0)\n"
+	"WASM_DEFINE_TRUNC(wasm_i64_trunc_s_f32, uint64_t, int64_t, float, -9223372036854777856.0, 9223372036854775808.0)\n"
+	"WASM_DEFINE_TRUNC(wasm_i64_trunc_u_f32, uint64_t, uint64_t, float, -1.0, 18446744073709551616.0)\n"
+	"WASM_DEFINE_TRUNC(wasm_i64_trunc_s_f64, uint64_t, int64_t, double, -9223372036854777856.0, 9223372036854775808.0)\n"
+	"WASM_DEFINE_TRUNC(wasm_i64_trunc_u_f64, uint64_t, uint64_t, double, -1.0, 18446744073709551616.0)\n"
+	"\n"
+	"#define WASM_DEFINE_BITS(bits, clz, ctz, popcnt)\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _clz(uint ## bits ## _t a)\t\t\t\\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\treturn a ? clz(a) : bits;\t\t\t\t\\\n"
+	"\t}\t\t\t\t\t\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _ctz(uint ## bits ## _t a)\t\t\t\\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\treturn a ? ctz(a) : bits;\t\t\t\t\\\n"
+	"\t}\t\t\t\t\t\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _popcnt(uint ## bits ## _t a)\t\t\t\\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\treturn popcnt(a);\t\t\t\t\t\\\n"
+	"\t}\t\t\t\t\t\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _rotl(uint ## bits ## _t a, uint ## bits ## _t b) \\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tb &= bits - 1;\t\t\t\t\t\t\\\n"
+	"\t\treturn (a << b) | (a >> ((bits - b) & (bits - 1)));\t\\\n"
+	"\t}\t\t\t\t\t\t\t\t\\\n"
+	"\tstatic inline uint ## bits ## _t\t\t\t\t\\\n"
+	"\twasm_i ## bits ## _rotr(uint ## bits ## _t a, uint ## bits ## _t b) \\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tb &= bits - 1;\t\t\t\t\t\t\\\n"
+	"\t\treturn (a >> b) | (a << ((bits - b) & (bits - 1)));\t\\\n"
+	"\t}\n"
+	"\n"
+	"WASM_DEFINE_BITS(32, __builtin_clz, __builtin_ctz, __builtin_popcount)\n"
+	"WASM_DEFINE_BITS(64, __builtin_clzll, __builtin_ctzll, __builtin_popcountll)\n"
+	"\n"
+	"/* min/max propagate NaN and order -0 below +0 */\n"
+	"#define WASM_DEFINE_MINMAX(name, type)\t\t\t\t\t\\\n"
+	"\tstatic inline type name ## _min(type a, type b)\t\t\t\\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tif (a != a || b != b)\t\t\t\t\t\\\n"
+	"\t\t\treturn a + b;\t\t\t\t\t\\\n"
+	"\t\tif (a == b)\t\t\t\t\t\t\\\n"
+	"\t\t\treturn signbit(a) ? a : b;\t\t\t\\\n"
+	"\t\treturn a < b ? a : b;\t\t\t\t\t\\\n"
+	"\t}\t\t\t\t\t\t\t\t\\\n"
+	"\tstatic inline type name ## _max(type a, type b)\t\t\t\\\n"
+	"\t{\t\t\t\t\t\t\t\t\\\n"
+	"\t\tif (a != a || b != b)\t\t\t\t\t\\\n"
+	"\t\t\treturn a + b;\t\t\t\t\t\\\n"
+	"\t\tif (a == b)\t\t\t\t\t\t\\\n"
+	"\t\t\treturn signbit(a) ? b : a;\t\t\t\\\n"
+	"\t\treturn a > b ? a : b;\t\t\t\t\t\\\n"
+	"\t}\n"
+	"\n"
+	"WASM_DEFINE_MINMAX(wasm_f32, float)\n"
+	"WASM_DEFINE_MINMAX(wasm_f64, double)\n"
+	"\n"
+	"static inline float wasm_f32_from_bits(uint32_t v)\n"
+	"{\n"
+	"\tfloat f;\n"
+	"\tmemcpy(&f, &v, sizeof(f));\n"
+	"\treturn f;\n"
+	"}\n"
+	"\n"
+	"static inline uint32_t wasm_f32_to_bits(float f)\n"
+	"{\n"
+	"\tuint32_t v;\n"
+	"\tmemcpy(&v, &f, sizeof(v));\n"
+	"\treturn v;\n"
+	"}\n"
+	"\n"
+	"static inline double wasm_f64_from_bits(uint64_t v)\n"
+	"{\n"
+	"\tdouble f;\n"
+	"\tmemcpy(&f, &v, sizeof(f));\n"
+	"\treturn f;\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t wasm_f64_to_bits(double f)\n"
+	"{\n"
+	"\tuint64_t v;\n"
+	"\tmemcpy(&v, &f, sizeof(v));\n"
+	"\treturn v;\n"
+	"}\n"
+	"\n"
+	"/* memories in static images are fixed-size */\n"
+	"static inline uint32_t wasm_memory_grow(struct MemInst *mem, uint32_t delta)\n"
+	"{\n"
+	"\treturn delta ? (uint32_t)-1 : (uint32_t)(mem->size / WASM_PAGE_SIZE);\n"
+	"}\n"
+	"\n";
+
+struct CLabel {
+	unsigned kind;
+	unsigned id;
+	size_t depth;
+	wasmjit_valtype_t type;
+	int used;
+};
+
+enum {
+	C_LABEL_FUNCTION,
+	C_LABEL_BLOCK,
+	C_LABEL_LOOP,
+};
+
+struct CValueStack {
+	size_t n_elts;
+	wasmjit_valtype_t *elts;
+};
+
+struct CLabelStack {
+	size_t n_elts;
+	struct CLabel *elts;
+};
+
+static DEFINE_VECTOR_GROW(c_value_stack, struct CValueStack);
+static DEFINE_VECTOR_GROW(c_label_stack, struct CLabelStack);
+
+struct CFunction {
+	struct SizedBuffer *output;
+	const char *module_name;
+	const struct Module *module;
+	const struct FuncType **func_types;
+	const struct ImportSectionImport **func_imports;
+	const char *direct_host_calls;
+	const wasmjit_valtype_t *global_types;
+	const wasmjit_valtype_t *local_types;
+	size_t n_locals, n_globals, n_imported_funcs;
+	struct CValueStack stack;
+	struct CLabelStack labels;
+	size_t max_depth[4];
+	unsigned next_label;
+	int reachable;
+	int uses_memory;
+};
+
+__attribute__((format(printf, 2, 3)))
+static int outf(struct SizedBuffer *output, const char *fmt, ...)
+{
+	char buf[0x100];
+	char *out = buf;
+	va_list ap;
+	int ret, size;
+
+	va_start(ap, fmt);
+	size = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (size < 0)
+		return 0;
+
+	if ((size_t) size >= sizeof(buf)) {
+		out = malloc(size + 1);
+		if (!out)
+			return 0;
+		va_start(ap, fmt);
+		vsnprintf(out, size + 1, fmt, ap);
+		va_end(ap);
+	}
+
+	ret = output_buf(output, out, size);
+
+	if (out != buf)
+		free(out);
+
+	return ret;
+}
+
+static const char *c_type(wasmjit_valtype_t valtype)
+{
+	switch (valtype) {
+	case VALTYPE_I32:
+		return "uint32_t";
+	case VALTYPE_I64:
+		return "uint64_t";
+	case VALTYPE_F32:
+		return "float";
+	case VALTYPE_F64:
+		return "double";
+	case VALTYPE_NULL:
+		return "void";
+	default:
+		assert(0);
+		__builtin_unreachable();
+	}
+}
+
+static unsigned c_type_idx(wasmjit_valtype_t valtype)
+{
+	switch (valtype) {
+	case VALTYPE_I32:
+		return 0;
+	case VALTYPE_I64:
+		return 1;
+	case VALTYPE_F32:
+		return 2;
+	case VALTYPE_F64:
+		return 3;
+	default:
+		assert(0);
+		__builtin_unreachable();
+	}
+}
+
+static const char *const c_stack_prefix[] = { "si", "sl", "sf", "sd" };
+static const char *const c_value_member[] = { "i32", "i64", "f32", "f64" };
+
+static int is_c_identifier(const char *name)
+{
+	if (!((*name >= 'a' && *name <= 'z') ||
+	      (*name >= 'A' && *name <= 'Z') ||
+	      *name == '_'))
+		return 0;
+
+	for (; *name; ++name) {
+		if (!((*name >= 'a' && *name <= 'z') ||
+		      (*name >= 'A' && *name <= 'Z') ||
+		      (*name >= '0' && *name <= '9') ||
+		      *name == '_'))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+  Host functions of the static emscripten runtime. With
+  WASMJIT_OUTPUT_C_SOURCE_FLAGS_DIRECT_HOST_CALLS, imports matching an
+  entry here call wasmjit_emscripten_<name>() directly instead of
+  going through the FuncInst's trampoline, so the system compiler (or
+  its LTO pass) can see and inline the implementation.
+ */
+
+struct CHostFunction {
+	const char *module;
+	const char *name;
+	wasmjit_valtype_t output_type;
+	size_t n_inputs;
+	wasmjit_valtype_t input_types[FUNC_TYPE_MAX_INPUTS];
+};
+
+#define __STRINGIFY(x) #x
+#define STRINGIFY(x) __STRINGIFY(x)
+
+#define DEFINE_WASM_FUNCTION(_name, _fptr, _output, _n, ...)	\
+	{ STRINGIFY(CURRENT_MODULE), #_name, _output, _n, { __VA_ARGS__ } },
+
+#define START_MODULE()
+#define END_MODULE()
+#define START_FUNCTION_DEFS()
+#define END_FUNCTION_DEFS()
+#define START_TABLE_DEFS()
+#define END_TABLE_DEFS()
+#define START_MEMORY_DEFS()
+#define END_MEMORY_DEFS()
+#define START_GLOBAL_DEFS()
+#define END_GLOBAL_DEFS()
+#define DEFINE_WASM_START_FUNCTION(...)
+#define DEFINE_WASM_GLOBAL(...)
+#define DEFINE_WASM_TABLE(...)
+#define DEFINE_WASM_MEMORY(...)
+#define DEFINE_EXTERNAL_WASM_GLOBAL(...)
+#define DEFINE_EXTERNAL_WASM_TABLE(...)
+
+static const struct CHostFunction c_host_functions[] = {
+#include <wasmjit/emscripten_runtime_def.h>
+};
+
+#undef START_MODULE
+#undef END_MODULE
+#undef DEFINE_WASM_GLOBAL
+#undef DEFINE_WASM_FUNCTION
+#undef DEFINE_WASM_TABLE
+#undef DEFINE_WASM_MEMORY
+#undef START_TABLE_DEFS
+#undef END_TABLE_DEFS
+#undef START_MEMORY_DEFS
+#undef END_MEMORY_DEFS
+#undef START_GLOBAL_DEFS
+#undef END_GLOBAL_DEFS
+#undef START_FUNCTION_DEFS
+#undef END_FUNCTION_DEFS
+#undef DEFINE_WASM_START_FUNCTION
+#undef DEFINE_EXTERNAL_WASM_TABLE
+#undef DEFINE_EXTERNAL_WASM_GLOBAL
+#undef STRINGIFY
+#undef __STRINGIFY
+
+static int is_direct_host_function(const struct ImportSectionImport *import,
+				   const struct FuncType *ft)
+{
+	size_t i, j;
+
+	for (i = 0; i < ARRAY_LEN(c_host_functions); ++i) {
+		const struct CHostFunction *hf = &c_host_functions[i];
+
+		if (strcmp(hf->module, import->module) ||
+		    strcmp(hf->name, import->name))
+			continue;
+
+		/* a mismatched import is left to fail at link time */
+		if (hf->output_type != ft->output_type ||
+		    hf->n_inputs != ft->n_inputs)
+			return 0;
+		for (j = 0; j < hf->n_inputs; ++j) {
+			if (hf->input_types[j] != ft->input_types[j])
+				return 0;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/* name of the C variable holding stack slot idx */
+#define SV(idx)								\
+	c_stack_prefix[c_type_idx(f->stack.elts[idx])], (size_t) (idx)
+
+#define TOP(n) (f->stack.n_elts - 1 - (n))
+
+#define OUTF(...)					\
+	do {						\
+		if (!outf(f->output, __VA_ARGS__))	\
+			return 0;			\
+	}						\
+	while (0)
+
+static int push_value(struct CFunction *f, wasmjit_valtype_t valtype)
+{
+	unsigned tidx = c_type_idx(valtype);
+
+	if (!c_value_stack_grow(&f->stack, 1))
+		return 0;
+	f->stack.elts[f->stack.n_elts - 1] = valtype;
+
+	if (f->max_depth[tidx] < f->stack.n_elts)
+		f->max_depth[tidx] = f->stack.n_elts;
+
+	return 1;
+}
+
+/* stack state at the end of a block, whether or not it fell through */
+static int reset_stack(struct CFunction *f, size_t depth,
+		       wasmjit_valtype_t type)
+{
+	f->stack.n_elts = depth;
+	return type == VALTYPE_NULL || push_value(f, type);
+}
+
+static int push_label(struct CFunction *f, unsigned kind,
+		      wasmjit_valtype_t type)
+{
+	struct CLabel *label;
+
+	if (!c_label_stack_grow(&f->labels, 1))
+		return 0;
+
+	label = &f->labels.elts[f->labels.n_elts - 1];
+	label->kind = kind;
+	label->id = f->next_label++;
+	label->depth = f->stack.n_elts;
+	label->type = type;
+	label->used = 0;
+
+	return 1;
+}
+
+static int emit_return(struct CFunction *f, const char *indent)
+{
+	const struct CLabel *label = &f->labels.elts[0];
+
+	if (label->type == VALTYPE_NULL)
+		OUTF("%sreturn;\n", indent);
+	else if (!f->stack.n_elts)
+		return 0;
+	else
+		OUTF("%sreturn %s%zu;\n", indent, SV(TOP(0)));
+
+	return 1;
+}
+
+static int emit_branch(struct CFunction *f, uint32_t labelidx,
+		       const char *indent)
+{
+	struct CLabel *label;
+
+	if (labelidx >= f->labels.n_elts)
+		return 0;
+
+	label = &f->labels.elts[f->labels.n_elts - 1 - labelidx];
+
+	if (label->kind == C_LABEL_FUNCTION)
+		return emit_return(f, indent);
+
+	if (label->kind != C_LABEL_LOOP &&
+	    label->type != VALTYPE_NULL &&
+	    TOP(0) != label->depth) {
+		OUTF("%s%s%zu = %s%zu;\n", indent,
+		     c_stack_prefix[c_type_idx(label->type)], label->depth,
+		     SV(TOP(0)));
+	}
+
+	OUTF("%sgoto L%u;\n", indent, label->id);
+	label->used = 1;
+
+	return 1;
+}
+
+static int emit_fptr_type(struct CFunction *f, const struct FuncType *ft)
+{
+	size_t i;
+
+	OUTF("%s (*)(", c_type(ft->output_type));
+	if (!ft->n_inputs)
+		OUTF("void");
+	for (i = 0; i < ft->n_inputs; ++i)
+		OUTF("%s%s", i ? ", " : "", c_type(ft->input_types[i]));
+	OUTF(")");
+
+	return 1;
+}
+
+static int emit_call(struct CFunction *f, const struct FuncType *ft,
+		     uint32_t funcidx, size_t table_idx_slot, uint32_t typeidx,
+		     int indirect)
+{
+	size_t i, first_arg;
+	int has_output = ft->output_type != VALTYPE_NULL;
+	const struct ImportSectionImport *host_import = NULL;
+
+	if (f->stack.n_elts < ft->n_inputs)
+		return 0;
+	first_arg = f->stack.n_elts - ft->n_inputs;
+
+	OUTF("\t");
+	if (has_output) {
+		OUTF("%s%zu = ", c_stack_prefix[c_type_idx(ft->output_type)],
+		     first_arg);
+	}
+
+	if (indirect) {
+		OUTF("((");
+		if (!emit_fptr_type(f, ft))
+			return 0;
+		OUTF(")wasmjit_resolve_indirect_call(MODULE_INST->tables.elts[0], "
+		     "&MODULE_INST->types.elts[%" PRIu32 "], si%zu)->compiled_code)(",
+		     typeidx, table_idx_slot);
+	} else if (funcidx < f->n_imported_funcs &&
+		   f->direct_host_calls[funcidx]) {
+		host_import = f->func_imports[funcidx];
+		OUTF("wasmjit_emscripten_%s(", host_import->name);
+	} else if (funcidx < f->n_imported_funcs) {
+		const struct ImportSectionImport *import =
+			f->func_imports[funcidx];
+		OUTF("((");
+		if (!emit_fptr_type(f, ft))
+			return 0;
+		OUTF(")WASM_FUNC_SYMBOL(%s, %s).compiled_code)(",
+		     import->module, import->name);
+	} else {
+		OUTF(WASMJIT_C_SOURCE_CODE_SYMBOL_FORMAT "(",
+		     f->module_name,
+		     (size_t) (funcidx - f->n_imported_funcs));
+	}
+
+	for (i = first_arg; i < f->stack.n_elts; ++i)
+		OUTF("%s%s%zu", i != first_arg ? ", " : "", SV(i));
+	/* host functions also take their own FuncInst */
+	if (host_import) {
+		OUTF("%s&WASM_FUNC_SYMBOL(%s, %s)",
+		     ft->n_inputs ? ", " : "",
+		     host_import->module, host_import->name);
+	}
+	OUTF(");\n");
+
+	f->stack.n_elts = first_arg;
+	if (has_output && !push_value(f, ft->output_type))
+		return 0;
+
+	return 1;
+}
+
+static int emit_unop(struct CFunction *f,
+		     wasmjit_valtype_t in, wasmjit_valtype_t out,
+		     const char *prefix, const char *suffix)
+{
+	size_t slot = TOP(0);
+
+	if (!f->stack.n_elts || f->stack.elts[slot] != in)
+		return 0;
+
+	OUTF("\t%s%zu = %s%s%zu%s;\n",
+	     c_stack_prefix[c_type_idx(out)], slot,
+	     prefix, SV(slot), suffix);
+
+	f->stack.n_elts--;
+	return push_value(f, out);
+}
+
+static int emit_binop(struct CFunction *f,
+		      wasmjit_valtype_t in, wasmjit_valtype_t out,
+		      const char *prefix, const char *infix,
+		      const char *suffix)
+{
+	size_t a, b;
+
+	if (f->stack.n_elts < 2)
+		return 0;
+
+	a = TOP(1);
+	b = TOP(0);
+	if (f->stack.elts[a] != in || f->stack.elts[b] != in)
+		return 0;
+
+	OUTF("\t%s%zu = %s%s%zu%s%s%zu%s;\n",
+	     c_stack_prefix[c_type_idx(out)], a,
+	     prefix, SV(a), infix, SV(b), suffix);
+
+	f->stack.n_elts -= 2;
+	return push_value(f, out);
+}
+
+static int emit_load(struct CFunction *f, const struct LoadStoreExtra *extra,
+		     wasmjit_valtype_t out, const char *cast, const char *fn)
+{
+	size_t slot = TOP(0);
+
+	if (!f->stack.n_elts || f->stack.elts[slot] != VALTYPE_I32)
+		return 0;
+
+	OUTF("\t%s%zu = %s%s(mem0, si%zu, %" PRIu32 "U);\n",
+	     c_stack_prefix[c_type_idx(out)], slot,
+	     cast, fn, slot, extra->offset);
+
+	f->stack.n_elts--;
+	f->uses_memory = 1;
+	return push_value(f, out);
+}
+
+static int emit_store(struct CFunction *f, const struct LoadStoreExtra *extra,
+		      wasmjit_valtype_t in, const char *cast, const char *fn)
+{
+	size_t addr, value;
+
+	if (f->stack.n_elts < 2)
+		return 0;
+
+	addr = TOP(1);
+	value = TOP(0);
+	if (f->stack.elts[addr] != VALTYPE_I32 || f->stack.elts[value] != in)
+		return 0;
+
+	OUTF("\t%s(mem0, si%zu, %" PRIu32 "U, %s%s%zu);\n",
+	     fn, addr, extra->offset, cast, SV(value));
+
+	f->stack.n_elts -= 2;
+	f->uses_memory = 1;
+	return 1;
+}
+
+static int emit_instructions(struct CFunction *f,
+			     size_t n_instructions,
+			     const struct Instr *instructions);
+
+static int emit_instruction(struct CFunction *f,
+			    const struct Instr *instruction)
+{
+	switch (instruction->opcode) {
+	case OPCODE_UNREACHABLE:
+		OUTF("\twasmjit_trap(WASMJIT_TRAP_UNREACHABLE);\n");
+		f->reachable = 0;
+		break;
+	case OPCODE_NOP:
+		break;
+	case OPCODE_BLOCK:
+	case OPCODE_LOOP: {
+		const struct BlockLoopExtra *extra =
+			instruction->opcode == OPCODE_BLOCK
+			? &instruction->data.block
+			: &instruction->data.loop;
+		struct CLabel label;
+		int is_loop = instruction->opcode == OPCODE_LOOP;
+
+		if (!push_label(f, is_loop ? C_LABEL_LOOP : C_LABEL_BLOCK,
+				extra->blocktype))
+			return 0;
+
+		if (is_loop)
+			OUTF("L%u:;\n", f->labels.elts[f->labels.n_elts - 1].id);
+
+		if (!emit_instructions(f, extra->n_instructions,
+				       extra->instructions))
+			return 0;
+
+		label = f->labels.elts[--f->labels.n_elts];
+		if (!reset_stack(f, label.depth, label.type))
+			return 0;
+
+		if (!is_loop && label.used) {
+			OUTF("L%u:;\n", label.id);
+			f->reachable = 1;
+		}
+		break;
+	}
+	case OPCODE_IF: {
+		const struct IfExtra *extra = &instruction->data.if_;
+		struct CLabel label;
+		unsigned else_id;
+		size_t cond = TOP(0);
+		int then_reachable;
+
+		if (!f->stack.n_elts || f->stack.elts[cond] != VALTYPE_I32)
+			return 0;
+		f->stack.n_elts--;
+
+		if (!push_label(f, C_LABEL_BLOCK, extra->blocktype))
+			return 0;
+
+		if (!extra->n_instructions_else) {
+			else_id = f->labels.elts[f->labels.n_elts - 1].id;
+			f->labels.elts[f->labels.n_elts - 1].used = 1;
+		} else {
+			else_id = f->next_label++;
+		}
+		OUTF("\tif (!si%zu) goto L%u;\n", cond, else_id);
+
+		if (!emit_instructions(f, extra->n_instructions_then,
+				       extra->instructions_then))
+			return 0;
+		then_reachable = f->reachable;
+
+		if (extra->n_instructions_else) {
+			label = f->labels.elts[f->labels.n_elts - 1];
+			if (!reset_stack(f, label.depth, label.type))
+				return 0;
+			if (then_reachable) {
+				OUTF("\tgoto L%u;\n", label.id);
+				f->labels.elts[f->labels.n_elts - 1].used = 1;
+			}
+
+			OUTF("L%u:;\n", else_id);
+			f->reachable = 1;
+			f->stack.n_elts = label.depth;
+
+			if (!emit_instructions(f, extra->n_instructions_else,
+					       extra->instructions_else))
+				return 0;
+		}
+
+		label = f->labels.elts[--f->labels.n_elts];
+		if (!reset_stack(f, label.depth, label.type))
+			return 0;
+
+		if (label.used) {
+			OUTF("L%u:;\n", label.id);
+			f->reachable = 1;
+		}
+		break;
+	}
+	case OPCODE_BR:
+		if (!emit_branch(f, instruction->data.br.labelidx, "\t"))
+			return 0;
+		f->reachable = 0;
+		break;
+	case OPCODE_BR_IF: {
+		size_t cond = TOP(0);
+
+		if (!f->stack.n_elts || f->stack.elts[cond] != VALTYPE_I32)
+			return 0;
+		f->stack.n_elts--;
+
+		OUTF("\tif (si%zu) {\n", cond);
+		if (!emit_branch(f, instruction->data.br_if.labelidx, "\t\t"))
+			return 0;
+		OUTF("\t}\n");
+		break;
+	}
+	case OPCODE_BR_TABLE: {
+		size_t idx = TOP(0);
+		uint32_t i;
+
+		if (!f->stack.n_elts || f->stack.elts[idx] != VALTYPE_I32)
+			return 0;
+		f->stack.n_elts--;
+
+		OUTF("\tswitch (si%zu) {\n", idx);
+		for (i = 0; i < instruction->data.br_table.n_labelidxs; ++i) {
+			OUTF("\tcase %" PRIu32 "U:\n", i);
+			if (!emit_branch(f,
+					 instruction->data.br_table.labelidxs[i],
+					 "\t\t"))
+				return 0;
+		}
+		OUTF("\tdefault:\n");
+		if (!emit_branch(f, instruction->data.br_table.labelidx, "\t\t"))
+			return 0;
+		OUTF("\t}\n");
+		f->reachable = 0;
+		break;
+	}
+	case OPCODE_RETURN:
+		if (!emit_return(f, "\t"))
+			return 0;
+		f->reachable = 0;
+		break;
+	case OPCODE_CALL: {
+		uint32_t funcidx = instruction->data.call.funcidx;
+
+		if (funcidx >= f->n_imported_funcs +
+		    f->module->function_section.n_typeidxs)
+			return 0;
+
+		if (!emit_call(f, f->func_types[funcidx], funcidx, 0, 0, 0))
+			return 0;
+		break;
+	}
+	case OPCODE_CALL_INDIRECT: {
+		uint32_t typeidx = instruction->data.call_indirect.typeidx;
+		size_t idx = TOP(0);
+
+		if (typeidx >= f->module->type_section.n_types)
+			return 0;
+
+		if (!f->stack.n_elts || f->stack.elts[idx] != VALTYPE_I32)
+			return 0;
+		f->stack.n_elts--;
+
+		if (!emit_call(f, &f->module->type_section.types[typeidx],
+			       0, idx, typeidx, 1))
+			return 0;
+		break;
+	}
+	case OPCODE_DROP:
+		if (!f->stack.n_elts)
+			return 0;
+		f->stack.n_elts--;
+		break;
+	case OPCODE_SELECT: {
+		size_t cond = TOP(0), a = TOP(2), b = TOP(1);
+
+		if (f->stack.n_elts < 3 ||
+		    f->stack.elts[cond] != VALTYPE_I32 ||
+		    f->stack.elts[a] != f->stack.elts[b])
+			return 0;
+
+		OUTF("\t%s%zu = si%zu ? %s%zu : %s%zu;\n",
+		     SV(a), cond, SV(a), SV(b));
+		f->stack.n_elts -= 2;
+		break;
+	}
+	case OPCODE_GET_LOCAL:
+		if (instruction->data.get_local.localidx >= f->n_locals)
+			return 0;
+		if (!push_value(f, f->local_types[instruction->data.get_local.localidx]))
+			return 0;
+		OUTF("\t%s%zu = loc%" PRIu32 ";\n",
+		     SV(TOP(0)), instruction->data.get_local.localidx);
+		break;
+	case OPCODE_SET_LOCAL:
+		if (instruction->data.set_local.localidx >= f->n_locals ||
+		    !f->stack.n_elts)
+			return 0;
+		OUTF("\tloc%" PRIu32 " = %s%zu;\n",
+		     instruction->data.set_local.localidx, SV(TOP(0)));
+		f->stack.n_elts--;
+		break;
+	case OPCODE_TEE_LOCAL:
+		if (instruction->data.tee_local.localidx >= f->n_locals ||
+		    !f->stack.n_elts)
+			return 0;
+		OUTF("\tloc%" PRIu32 " = %s%zu;\n",
+		     instruction->data.tee_local.localidx, SV(TOP(0)));
+		break;
+	case OPCODE_GET_GLOBAL: {
+		uint32_t globalidx = instruction->data.get_global.globalidx;
+		wasmjit_valtype_t type;
+
+		if (globalidx >= f->n_globals)
+			return 0;
+		type = f->global_types[globalidx];
+		if (!push_value(f, type))
+			return 0;
+		OUTF("\t%s%zu = MODULE_INST->globals.elts[%" PRIu32 "]->value.data.%s;\n",
+		     SV(TOP(0)), globalidx, c_value_member[c_type_idx(type)]);
+		break;
+	}
+	case OPCODE_SET_GLOBAL: {
+		uint32_t globalidx = instruction->data.set_global.globalidx;
+		wasmjit_valtype_t type;
+
+		if (globalidx >= f->n_globals)
+			return 0;
+		type = f->global_types[globalidx];
+		if (!f->stack.n_elts || f->stack.elts[TOP(0)] != type)
+			return 0;
+		OUTF("\tMODULE_INST->globals.elts[%" PRIu32 "]->value.data.%s = %s%zu;\n",
+		     globalidx, c_value_member[c_type_idx(type)], SV(TOP(0)));
+		f->stack.n_elts--;
+		break;
+	}
+	case OPCODE_I32_LOAD:
+		return emit_load(f, &instruction->data.i32_load, VALTYPE_I32,
+				 "", "wasm_load_u32");
+	case OPCODE_I64_LOAD:
+		return emit_load(f, &instruction->data.i64_load, VALTYPE_I64,
+				 "", "wasm_load_u64");
+	case OPCODE_F32_LOAD:
+		return emit_load(f, &instruction->data.f32_load, VALTYPE_F32,
+				 "", "wasm_load_f32");
+	case OPCODE_F64_LOAD:
+		return emit_load(f, &instruction->data.f64_load, VALTYPE_F64,
+				 "", "wasm_load_f64");
+	case OPCODE_I32_LOAD8_S:
+		return emit_load(f, &instruction->data.i32_load8_s, VALTYPE_I32,
+				 "(uint32_t)(int32_t)", "wasm_load_s8");
+	case OPCODE_I32_LOAD8_U:
+		return emit_load(f, &instruction->data.i32_load8_u, VALTYPE_I32,
+				 "", "wasm_load_u8");
+	case OPCODE_I32_LOAD16_S:
+		return emit_load(f, &instruction->data.i32_load16_s, VALTYPE_I32,
+				 "(uint32_t)(int32_t)", "wasm_load_s16");
+	case OPCODE_I32_LOAD16_U:
+		return emit_load(f, &instruction->data.i32_load16_u, VALTYPE_I32,
+				 "", "wasm_load_u16");
+	case OPCODE_I64_LOAD8_S:
+		return emit_load(f, &instruction->data.i64_load8_s, VALTYPE_I64,
+				 "(uint64_t)(int64_t)", "wasm_load_s8");
+	case OPCODE_I64_LOAD8_U:
+		return emit_load(f, &instruction->data.i64_load8_u, VALTYPE_I64,
+				 "", "wasm_load_u8");
+	case OPCODE_I64_LOAD16_S:
+		return emit_load(f, &instruction->data.i64_load16_s, VALTYPE_I64,
+				 "(uint64_t)(int64_t)", "wasm_load_s16");
+	case OPCODE_I64_LOAD16_U:
+		return emit_load(f, &instruction->data.i64_load16_u, VALTYPE_I64,
+				 "", "wasm_load_u16");
+	case OPCODE_I64_LOAD32_S:
+		return emit_load(f, &instruction->data.i64_load32_s, VALTYPE_I64,
+				 "(uint64_t)(int64_t)", "wasm_load_s32");
+	case OPCODE_I64_LOAD32_U:
+		return emit_load(f, &instruction->data.i64_load32_u, VALTYPE_I64,
+				 "", "wasm_load_u32");
+	case OPCODE_I32_STORE:
+		return emit_store(f, &instruction->data.i32_store, VALTYPE_I32,
+				  "", "wasm_store_u32");
+	case OPCODE_I64_STORE:
+		return emit_store(f, &instruction->data.i64_store, VALTYPE_I64,
+				  "", "wasm_store_u64");
+	case OPCODE_F32_STORE:
+		return emit_store(f, &instruction->data.f32_store, VALTYPE_F32,
+				  "", "wasm_store_f32");
+	case OPCODE_F64_STORE:
+		return emit_store(f, &instruction->data.f64_store, VALTYPE_F64,
+				  "", "wasm_store_f64");
+	case OPCODE_I32_STORE8:
+		return emit_store(f, &instruction->data.i32_store8, VALTYPE_I32,
+				  "(uint8_t)", "wasm_store_u8");
+	case OPCODE_I32_STORE16:
+		return emit_store(f, &instruction->data.i32_store16, VALTYPE_I32,
+				  "(uint16_t)", "wasm_store_u16");
+	case OPCODE_I64_STORE8:
+		return emit_store(f, &instruction->data.i64_store8, VALTYPE_I64,
+				  "(uint8_t)", "wasm_store_u8");
+	case OPCODE_I64_STORE16:
+		return emit_store(f, &instruction->data.i64_store16, VALTYPE_I64,
+				  "(uint16_t)", "wasm_store_u16");
+	case OPCODE_I64_STORE32:
+		return emit_store(f, &instruction->data.i64_store32, VALTYPE_I64,
+				  "(uint32_t)", "wasm_store_u32");
+	case OPCODE_MEMORY_SIZE:
+		if (!push_value(f, VALTYPE_I32))
+			return 0;
+		OUTF("\tsi%zu = (uint32_t)(mem0->size / WASM_PAGE_SIZE);\n",
+		     TOP(0));
+		f->uses_memory = 1;
+		break;
+	case OPCODE_MEMORY_GROW:
+		f->uses_memory = 1;
+		return emit_unop(f, VALTYPE_I32, VALTYPE_I32,
+				 "wasm_memory_grow(mem0, ", ")");
+	case OPCODE_I32_CONST:
+		if (!push_value(f, VALTYPE_I32))
+			return 0;
+		OUTF("\tsi%zu = 0x%" PRIx32 "U;\n",
+		     TOP(0), instruction->data.i32_const.value);
+		break;
+	case OPCODE_I64_CONST:
+		if (!push_value(f, VALTYPE_I64))
+			return 0;
+		OUTF("\tsl%zu = UINT64_C(0x%" PRIx64 ");\n",
+		     TOP(0), instruction->data.i64_const.value);
+		break;
+	case OPCODE_F32_CONST: {
+		uint32_t bits;
+
+		memcpy(&bits, &instruction->data.f32_const.value, sizeof(bits));
+		if (!push_value(f, VALTYPE_F32))
+			return 0;
+		OUTF("\tsf%zu = wasm_f32_from_bits(0x%" PRIx32 "U);\n",
+		     TOP(0), bits);
+		break;
+	}
+	case OPCODE_F64_CONST: {
+		uint64_t bits;
+
+		memcpy(&bits, &instruction->data.f64_const.value, sizeof(bits));
+		if (!push_value(f, VALTYPE_F64))
+			return 0;
+		OUTF("\tsd%zu = wasm_f64_from_bits(UINT64_C(0x%" PRIx64 "));\n",
+		     TOP(0), bits);
+		break;
+	}
+
+#define UNOP(_in, _out, _prefix, _suffix) \
+	return emit_unop(f, VALTYPE_ ## _in, VALTYPE_ ## _out, _prefix, _suffix)
+#define BINOP(_in, _out, _prefix, _infix, _suffix) \
+	return emit_binop(f, VALTYPE_ ## _in, VALTYPE_ ## _out, _prefix, _infix, _suffix)
+
+	case OPCODE_I32_EQZ: UNOP(I32, I32, "!", "");
+	case OPCODE_I32_EQ: BINOP(I32, I32, "", " == ", "");
+	case OPCODE_I32_NE: BINOP(I32, I32, "", " != ", "");
+	case OPCODE_I32_LT_S: BINOP(I32, I32, "(int32_t)", " < (int32_t)", "");
+	case OPCODE_I32_LT_U: BINOP(I32, I32, "", " < ", "");
+	case OPCODE_I32_GT_S: BINOP(I32, I32, "(int32_t)", " > (int32_t)", "");
+	case OPCODE_I32_GT_U: BINOP(I32, I32, "", " > ", "");
+	case OPCODE_I32_LE_S: BINOP(I32, I32, "(int32_t)", " <= (int32_t)", "");
+	case OPCODE_I32_LE_U: BINOP(I32, I32, "", " <= ", "");
+	case OPCODE_I32_GE_S: BINOP(I32, I32, "(int32_t)", " >= (int32_t)", "");
+	case OPCODE_I32_GE_U: BINOP(I32, I32, "", " >= ", "");
+
+	case OPCODE_I64_EQZ: UNOP(I64, I32, "!", "");
+	case OPCODE_I64_EQ: BINOP(I64, I32, "", " == ", "");
+	case OPCODE_I64_NE: BINOP(I64, I32, "", " != ", "");
+	case OPCODE_I64_LT_S: BINOP(I64, I32, "(int64_t)", " < (int64_t)", "");
+	case OPCODE_I64_LT_U: BINOP(I64, I32, "", " < ", "");
+	case OPCODE_I64_GT_S: BINOP(I64, I32, "(int64_t)", " > (int64_t)", "");
+	case OPCODE_I64_GT_U: BINOP(I64, I32, "", " > ", "");
+	case OPCODE_I64_LE_S: BINOP(I64, I32, "(int64_t)", " <= (int64_t)", "");
+	case OPCODE_I64_LE_U: BINOP(I64, I32, "", " <= ", "");
+	case OPCODE_I64_GE_S: BINOP(I64, I32, "(int64_t)", " >= (int64_t)", "");
+	case OPCODE_I64_GE_U: BINOP(I64, I32, "", " >= ", "");
+
+	case OPCODE_F32_EQ: BINOP(F32, I32, "", " == ", "");
+	case OPCODE_F32_NE: BINOP(F32, I32, "", " != ", "");
+	case OPCODE_F32_LT: BINOP(F32, I32, "", " < ", "");
+	case OPCODE_F32_GT: BINOP(F32, I32, "", " > ", "");
+	case OPCODE_F32_LE: BINOP(F32, I32, "", " <= ", "");
+	case OPCODE_F32_GE: BINOP(F32, I32, "", " >= ", "");
+
+	case OPCODE_F64_EQ: BINOP(F64, I32, "", " == ", "");
+	case OPCODE_F64_NE: BINOP(F64, I32, "", " != ", "");
+	case OPCODE_F64_LT: BINOP(F64, I32, "", " < ", "");
+	case OPCODE_F64_GT: BINOP(F64, I32, "", " > ", "");
+	case OPCODE_F64_LE: BINOP(F64, I32, "", " <= ", "");
+	case OPCODE_F64_GE: BINOP(F64, I32, "", " >= ", "");
+
+	case OPCODE_I32_CLZ: UNOP(I32, I32, "wasm_i32_clz(", ")");
+	case OPCODE_I32_CTZ: UNOP(I32, I32, "wasm_i32_ctz(", ")");
+	case OPCODE_I32_POPCNT: UNOP(I32, I32, "wasm_i32_popcnt(", ")");
+	case OPCODE_I32_ADD: BINOP(I32, I32, "", " + ", "");
+	case OPCODE_I32_SUB: BINOP(I32, I32, "", " - ", "");
+	case OPCODE_I32_MUL: BINOP(I32, I32, "", " * ", "");
+	case OPCODE_I32_DIV_S: BINOP(I32, I32, "wasm_i32_div_s(", ", ", ")");
+	case OPCODE_I32_DIV_U: BINOP(I32, I32, "wasm_i32_div_u(", ", ", ")");
+	case OPCODE_I32_REM_S: BINOP(I32, I32, "wasm_i32_rem_s(", ", ", ")");
+	case OPCODE_I32_REM_U: BINOP(I32, I32, "wasm_i32_rem_u(", ", ", ")");
+	case OPCODE_I32_AND: BINOP(I32, I32, "", " & ", "");
+	case OPCODE_I32_OR: BINOP(I32, I32, "", " | ", "");
+	case OPCODE_I32_XOR: BINOP(I32, I32, "", " ^ ", "");
+	case OPCODE_I32_SHL: BINOP(I32, I32, "", " << (", " & 31)");
+	case OPCODE_I32_SHR_S: BINOP(I32, I32, "(uint32_t)((int32_t)", " >> (", " & 31))");
+	case OPCODE_I32_SHR_U: BINOP(I32, I32, "", " >> (", " & 31)");
+	case OPCODE_I32_ROTL: BINOP(I32, I32, "wasm_i32_rotl(", ", ", ")");
+	case OPCODE_I32_ROTR: BINOP(I32, I32, "wasm_i32_rotr(", ", ", ")");
+
+	case OPCODE_I64_CLZ: UNOP(I64, I64, "wasm_i64_clz(", ")");
+	case OPCODE_I64_CTZ: UNOP(I64, I64, "wasm_i64_ctz(", ")");
+	case OPCODE_I64_POPCNT: UNOP(I64, I64, "wasm_i64_popcnt(", ")");
+	case OPCODE_I64_ADD: BINOP(I64, I64, "", " + ", "");
+	case OPCODE_I64_SUB: BINOP(I64, I64, "", " - ", "");
+	case OPCODE_I64_MUL: BINOP(I64, I64, "", " * ", "");
+	case OPCODE_I64_DIV_S: BINOP(I64, I64, "wasm_i64_div_s(", ", ", ")");
+	case OPCODE_I64_DIV_U: BINOP(I64, I64, "wasm_i64_div_u(", ", ", ")");
+	case OPCODE_I64_REM_S: BINOP(I64, I64, "wasm_i64_rem_s(", ", ", ")");
+	case OPCODE_I64_REM_U: BINOP(I64, I64, "wasm_i64_rem_u(", ", ", ")");
+	case OPCODE_I64_AND: BINOP(I64, I64, "", " & ", "");
+	case OPCODE_I64_OR: BINOP(I64, I64, "", " | ", "");
+	case OPCODE_I64_XOR: BINOP(I64, I64, "", " ^ ", "");
+	case OPCODE_I64_SHL: BINOP(I64, I64, "", " << (", " & 63)");
+	case OPCODE_I64_SHR_S: BINOP(I64, I64, "(uint64_t)((int64_t)", " >> (", " & 63))");
+	case OPCODE_I64_SHR_U: BINOP(I64, I64, "", " >> (", " & 63)");
+	case OPCODE_I64_ROTL: BINOP(I64, I64, "wasm_i64_rotl(", ", ", ")");
+	case OPCODE_I64_ROTR: BINOP(I64, I64, "wasm_i64_rotr(", ", ", ")");
+
+	case OPCODE_F32_ABS: UNOP(F32, F32, "fabsf(", ")");
+	case OPCODE_F32_NEG: UNOP(F32, F32, "-", "");
+	case OPCODE_F32_CEIL: UNOP(F32, F32, "ceilf(", ")");
+	case OPCODE_F32_FLOOR: UNOP(F32, F32, "floorf(", ")");
+	case OPCODE_F32_TRUNC: UNOP(F32, F32, "truncf(", ")");
+	case OPCODE_F32_NEAREST: UNOP(F32, F32, "nearbyintf(", ")");
+	case OPCODE_F32_SQRT: UNOP(F32, F32, "sqrtf(", ")");
+	case OPCODE_F32_ADD: BINOP(F32, F32, "", " + ", "");
+	case OPCODE_F32_SUB: BINOP(F32, F32, "", " - ", "");
+	case OPCODE_F32_MUL: BINOP(F32, F32, "", " * ", "");
+	case OPCODE_F32_DIV: BINOP(F32, F32, "", " / ", "");
+	case OPCODE_F32_MIN: BINOP(F32, F32, "wasm_f32_min(", ", ", ")");
+	case OPCODE_F32_MAX: BINOP(F32, F32, "wasm_f32_max(", ", ", ")");
+	case OPCODE_F32_COPYSIGN: BINOP(F32, F32, "copysignf(", ", ", ")");
+
+	case OPCODE_F64_ABS: UNOP(F64, F64, "fabs(", ")");
+	case OPCODE_F64_NEG: UNOP(F64, F64, "-", "");
+	case OPCODE_F64_CEIL: UNOP(F64, F64, "ceil(", ")");
+	case OPCODE_F64_FLOOR: UNOP(F64, F64, "floor(", ")");
+	case OPCODE_F64_TRUNC: UNOP(F64, F64, "trunc(", ")");
+	case OPCODE_F64_NEAREST: UNOP(F64, F64, "nearbyint(", ")");
+	case OPCODE_F64_SQRT: UNOP(F64, F64, "sqrt(", ")");
+	case OPCODE_F64_ADD: BINOP(F64, F64, "", " + ", "");
+	case OPCODE_F64_SUB: BINOP(F64, F64, "", " - ", "");
+	case OPCODE_F64_MUL: BINOP(F64, F64, "", " * ", "");
+	case OPCODE_F64_DIV: BINOP(F64, F64, "", " / ", "");
+	case OPCODE_F64_MIN: BINOP(F64, F64, "wasm_f64_min(", ", ", ")");
+	case OPCODE_F64_MAX: BINOP(F64, F64, "wasm_f64_max(", ", ", ")");
+	case OPCODE_F64_COPYSIGN: BINOP(F64, F64, "copysign(", ", ", ")");
+
+	case OPCODE_I32_WRAP_I64: UNOP(I64, I32, "(uint32_t)", "");
+	case OPCODE_I32_TRUNC_S_F32: UNOP(F32, I32, "wasm_i32_trunc_s_f32(", ")");
+	case OPCODE_I32_TRUNC_U_F32: UNOP(F32, I32, "wasm_i32_trunc_u_f32(", ")");
+	case OPCODE_I32_TRUNC_S_F64: UNOP(F64, I32, "wasm_i32_trunc_s_f64(", ")");
+	case OPCODE_I32_TRUNC_U_F64: UNOP(F64, I32, "wasm_i32_trunc_u_f64(", ")");
+	case OPCODE_I64_EXTEND_S_I32: UNOP(I32, I64, "(uint64_t)(int64_t)(int32_t)", "");
+	case OPCODE_I64_EXTEND_U_I32: UNOP(I32, I64, "(uint64_t)", "");
+	case OPCODE_I64_TRUNC_S_F32: UNOP(F32, I64, "wasm_i64_trunc_s_f32(", ")");
+	case OPCODE_I64_TRUNC_U_F32: UNOP(F32, I64, "wasm_i64_trunc_u_f32(", ")");
+	case OPCODE_I64_TRUNC_S_F64: UNOP(F64, I64, "wasm_i64_trunc_s_f64(", ")");
+	case OPCODE_I64_TRUNC_U_F64: UNOP(F64, I64, "wasm_i64_trunc_u_f64(", ")");
+	case OPCODE_F32_CONVERT_S_I32: UNOP(I32, F32, "(float)(int32_t)", "");
+	case OPCODE_F32_CONVERT_U_I32: UNOP(I32, F32, "(float)", "");
+	case OPCODE_F32_CONVERT_S_I64: UNOP(I64, F32, "(float)(int64_t)", "");
+	case OPCODE_F32_CONVERT_U_I64: UNOP(I64, F32, "(float)", "");
+	case OPCODE_F32_DEMOTE_F64: UNOP(F64, F32, "(float)", "");
+	case OPCODE_F64_CONVERT_S_I32: UNOP(I32, F64, "(double)(int32_t)", "");
+	case OPCODE_F64_CONVERT_U_I32: UNOP(I32, F64, "(double)", "");
+	case OPCODE_F64_CONVERT_S_I64: UNOP(I64, F64, "(double)(int64_t)", "");
+	case OPCODE_F64_CONVERT_U_I64: UNOP(I64, F64, "(double)", "");
+	case OPCODE_F64_PROMOTE_F32: UNOP(F32, F64, "(double)", "");
+	case OPCODE_I32_REINTERPRET_F32: UNOP(F32, I32, "wasm_f32_to_bits(", ")");
+	case OPCODE_I64_REINTERPRET_F64: UNOP(F64, I64, "wasm_f64_to_bits(", ")");
+	case OPCODE_F32_REINTERPRET_I32: UNOP(I32, F32, "wasm_f32_from_bits(", ")");
+	case OPCODE_F64_REINTERPRET_I64: UNOP(I64, F64, "wasm_f64_from_bits(", ")");
+
+#undef UNOP
+#undef BINOP
+
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+static int emit_instructions(struct CFunction *f,
+			     size_t n_instructions,
+			     const struct Instr *instructions)
+{
+	size_t i;
+
+	/* everything after an unconditional branch is dead */
+	for (i = 0; i < n_instructions && f->reachable; ++i) {
+		if (!emit_instruction(f, &instructions[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+#undef OUTF
+#define OUTF(...)					\
+	do {						\
+		if (!outf(output, __VA_ARGS__))		\
+			goto error;			\
+	}						\
+	while (0)
+
+static int emit_function_prototype(struct SizedBuffer *output,
+				   const char *module_name,
+				   size_t i, const struct FuncType *ft,
+				   int with_names)
+{
+	size_t j;
+
+	OUTF("%s " WASMJIT_C_SOURCE_CODE_SYMBOL_FORMAT "(",
+	     c_type(ft->output_type), module_name, i);
+	if (!ft->n_inputs)
+		OUTF("void");
+	for (j = 0; j < ft->n_inputs; ++j) {
+		OUTF("%s%s", j ? ", " : "", c_type(ft->input_types[j]));
+		if (with_names)
+			OUTF(" loc%zu", j);
+	}
+	OUTF(")");
+
+	return 1;
+
+ error:
+	return 0;
+}
+
+static int emit_function(struct SizedBuffer *output,
+			 struct CFunction *f,
+			 size_t i,
+			 const struct FuncType *ft,
+			 struct CodeSectionCode *code)
+{
+	struct SizedBuffer bodyv = { 0, NULL };
+	wasmjit_valtype_t *local_types = NULL;
+	size_t n_locals, j, k;
+	int ret;
+
+	if (!read_code(code))
+		goto error;
+
+	n_locals = ft->n_inputs;
+	for (j = 0; j < code->n_locals; ++j) {
+		if (__builtin_add_overflow(n_locals, code->locals[j].count,
+					   &n_locals))
+			goto error;
+	}
+
+	local_types = wasmjit_alloc_vector(n_locals, sizeof(local_types[0]),
+					   NULL);
+	if (!local_types && n_locals)
+		goto error;
+
+	n_locals = ft->n_inputs;
+	if (n_locals)
+		memcpy(local_types, ft->input_types, n_locals);
+	for (j = 0; j < code->n_locals; ++j) {
+		for (k = 0; k < code->locals[j].count; ++k)
+			local_types[n_locals++] = code->locals[j].valtype;
+	}
+
+	f->output = &bodyv;
+	f->local_types = local_types;
+	f->n_locals = n_locals;
+	f->stack.n_elts = 0;
+	f->labels.n_elts = 0;
+	memset(f->max_depth, 0, sizeof(f->max_depth));
+	f->next_label = 0;
+	f->reachable = 1;
+	f->uses_memory = 0;
+
+	if (!push_label(f, C_LABEL_FUNCTION, ft->output_type))
+		goto error;
+
+	if (!emit_instructions(f, code->n_instructions, code->instructions))
+		goto error;
+
+	if (f->reachable && !emit_return(f, "\t"))
+		goto error;
+
+	/* header, now that the body's requirements are known */
+	if (!emit_function_prototype(output, f->module_name, i, ft, 1))
+		goto error;
+	OUTF("\n{\n");
+
+	for (j = ft->n_inputs; j < n_locals; ++j)
+		OUTF("\t%s loc%zu = 0;\n", c_type(local_types[j]), j);
+
+	for (j = 0; j < ARRAY_LEN(f->max_depth); ++j) {
+		static const wasmjit_valtype_t types[] = {
+			VALTYPE_I32, VALTYPE_I64, VALTYPE_F32, VALTYPE_F64,
+		};
+
+		if (!f->max_depth[j])
+			continue;
+
+		OUTF("\t%s ", c_type(types[j]));
+		for (k = 0; k < f->max_depth[j]; ++k)
+			OUTF("%s%s%zu", k ? ", " : "", c_stack_prefix[j], k);
+		OUTF(";\n");
+	}
+
+	if (f->uses_memory)
+		OUTF("\tstruct MemInst *const mem0 = MODULE_INST->mems.elts[0];\n");
+
+	OUTF("\n");
+	if (!output_buf(output, bodyv.elts, bodyv.n_elts))
+		goto error;
+	OUTF("}\n\n");
+
+	ret = 1;
+
+	if (0) {
+	error:
+		ret = 0;
+	}
+
+	free(bodyv.elts);
+	free(local_types);
+
+	return ret;
+}
+
+char *wasmjit_output_c_source(const char *module_name,
+			      struct Module *module,
+			      uint32_t flags,
+			      size_t *outsize)
+{
+	struct SizedBuffer outputv = { 0, NULL };
+	struct SizedBuffer *output = &outputv;
+	struct CFunction fv;
+	struct CFunction *f = &fv;
+	const struct FuncType **func_types = NULL;
+	const struct ImportSectionImport **func_imports = NULL;
+	char *direct_host_calls = NULL;
+	wasmjit_valtype_t *global_types = NULL;
+	size_t i, n_funcs = 0, n_globals = 0, n_imported_funcs = 0;
+	char nul = '\0';
+
+	memset(f, 0, sizeof(*f));
+
+	if (!is_c_identifier(module_name))
+		goto error;
+
+	func_types = wasmjit_alloc_vector(module->import_section.n_imports +
+					  module->function_section.n_typeidxs,
+					  sizeof(func_types[0]), NULL);
+	func_imports = wasmjit_alloc_vector(module->import_section.n_imports,
+					    sizeof(func_imports[0]), NULL);
+	direct_host_calls = wasmjit_alloc_vector(module->import_section.n_imports,
+						 sizeof(direct_host_calls[0]), NULL);
+	global_types = wasmjit_alloc_vector(module->import_section.n_imports +
+					    module->global_section.n_globals,
+					    sizeof(global_types[0]), NULL);
+	if (!func_types || !func_imports || !direct_host_calls || !global_types)
+		goto error;
+
+	OUTF("%s", c_source_prologue);
+	OUTF("extern struct StaticModuleInst WASM_MODULE_SYMBOL(%s);\n",
+	     module_name);
+	OUTF("#define MODULE_INST (&WASM_MODULE_SYMBOL(%s).module)\n\n",
+	     module_name);
+
+	/* imported functions are called through their FuncInst,
+	   except for host functions that may be called directly */
+	for (i = 0; i < module->import_section.n_imports; ++i) {
+		struct ImportSectionImport *import =
+			&module->import_section.imports[i];
+
+		switch (import->desc_type) {
+		case IMPORT_DESC_TYPE_FUNC:
+			if (import->desc.functypeidx >= module->type_section.n_types ||
+			    !is_c_identifier(import->module) ||
+			    !is_c_identifier(import->name))
+				goto error;
+			func_imports[n_funcs] = import;
+			func_types[n_funcs] =
+				&module->type_section.types[import->desc.functypeidx];
+			OUTF("extern struct FuncInst WASM_FUNC_SYMBOL(%s, %s);\n",
+			     import->module, import->name);
+			direct_host_calls[n_funcs] =
+				(flags & WASMJIT_OUTPUT_C_SOURCE_FLAGS_DIRECT_HOST_CALLS) &&
+				is_direct_host_function(import, func_types[n_funcs]);
+			if (direct_host_calls[n_funcs]) {
+				const struct FuncType *ft = func_types[n_funcs];
+				size_t j;
+
+				OUTF("extern %s wasmjit_emscripten_%s(",
+				     c_type(ft->output_type), import->name);
+				for (j = 0; j < ft->n_inputs; ++j)
+					OUTF("%s, ", c_type(ft->input_types[j]));
+				OUTF("struct FuncInst *);\n");
+			}
+			n_funcs++;
+			break;
+		case IMPORT_DESC_TYPE_GLOBAL:
+			global_types[n_globals++] =
+				import->desc.globaltype.valtype;
+			break;
+		default:
+			break;
+		}
+	}
+	n_imported_funcs = n_funcs;
+	OUTF("\n");
+
+	for (i = 0; i < module->function_section.n_typeidxs; ++i) {
+		uint32_t typeidx = module->function_section.typeidxs[i];
+		if (typeidx >= module->type_section.n_types)
+			goto error;
+		func_types[n_funcs++] = &module->type_section.types[typeidx];
+		if (!emit_function_prototype(output, module_name, i,
+					     func_types[n_funcs - 1], 0))
+			goto error;
+		OUTF(";\n");
+	}
+	OUTF("\n");
+
+	for (i = 0; i < module->global_section.n_globals; ++i)
+		global_types[n_globals++] =
+			module->global_section.globals[i].type.valtype;
+
+	if (module->code_section.n_codes != module->function_section.n_typeidxs)
+		goto error;
+
+	f->module_name = module_name;
+	f->module = module;
+	f->func_types = func_types;
+	f->func_imports = func_imports;
+	f->direct_host_calls = direct_host_calls;
+	f->global_types = global_types;
+	f->n_globals = n_globals;
+	f->n_imported_funcs = n_imported_funcs;
+
+	for (i = 0; i < module->code_section.n_codes; ++i) {
+		if (!emit_function(output, f, i,
+				   func_types[n_imported_funcs + i],
+				   &module->code_section.codes[i]))
+			goto error;
+	}
+
+	if (outsize)
+		*outsize = output->n_elts;
+
+	if (!output_buf(output, &nul, 1))
+		goto error;
+
+	if (0) {
+	error:
+		free(output->elts);
+		output->elts = NULL;
+	}
+
+	free(f->stack.elts);
+	free(f->labels.elts);
+	free(func_types);
+	free(func_imports);
+	free(direct_host_calls);
+	free(global_types);
+
+	return output->elts;
+}
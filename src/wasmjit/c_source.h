@@ -0,0 +1,43 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__C_SOURCE_H__
+#define __WASMJIT__C_SOURCE_H__
+
+#include <wasmjit/ast.h>
+
+/* name of the C function implementing each defined wasm function,
+   shared with the ELF writer so the two outputs link together */
+#define WASMJIT_C_SOURCE_CODE_SYMBOL_FORMAT "%s__function_%zu__code"
+
+/* call emscripten host functions by their C name instead of through
+   their FuncInst, requires linking against the static runtime */
+#define WASMJIT_OUTPUT_C_SOURCE_FLAGS_DIRECT_HOST_CALLS 1
+
+char *wasmjit_output_c_source(const char *module_name,
+			      struct Module *module,
+			      uint32_t flags,
+			      size_t *outsize);
+
+#endif
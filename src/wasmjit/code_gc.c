@@ -0,0 +1,548 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/code_gc.h>
+
+#include <wasmjit/instantiate.h>
+#include <wasmjit/compile.h>
+#include <wasmjit/runtime.h>
+
+#include <wasmjit/sys.h>
+
+/* a function is collected after this many epochs without a call */
+#define CODE_GC_IDLE_EPOCHS 4
+#define CODE_GC_SLOTS_PER_PAGE 64
+
+/*
+  collected functions point their compiled_code at a slot, slots stay
+  with their function until its module is released so code that read
+  compiled_code earlier never calls the wrong function
+*/
+struct CodeGCSlots {
+	char *code;
+	size_t code_size, stride;
+	size_t n_used;
+	/* the CodeGCFunc each slot restores, NULL when free */
+	void *cells[CODE_GC_SLOTS_PER_PAGE];
+	struct CodeGCSlots *next;
+};
+
+struct CodeGCFunc {
+	struct FuncInst *funcinst;
+	struct WasmJITCodeGC *gc;
+	size_t body_offset;
+	uint32_t body_size;
+	unsigned idle_epochs;
+	int collected;
+	struct CodeGCSlots *slots;
+	size_t slot;
+};
+
+struct WasmJITCodeGC {
+	struct ModuleInst *module_inst;
+	/* identifies the program, polls only see their own stack */
+	const struct MemInst *meminst;
+	struct ModuleTypes module_types;
+	unsigned flags;
+	char *bodies;
+	size_t n_funcs;
+	struct CodeGCFunc *funcs;
+	unsigned last_epoch;
+	struct WasmJITCodeGC *next;
+};
+
+static unsigned code_gc_idle_ms;
+
+/* protected by code_gc_lock() */
+static struct WasmJITCodeGC *code_gc_head;
+static struct CodeGCSlots *slots_head;
+static void *restore_stub;
+static size_t restore_stub_size;
+
+static void code_gc_lock(void);
+static void code_gc_unlock(void);
+static unsigned code_gc_now_ms(void);
+
+void wasmjit_code_gc_configure(unsigned idle_ms)
+{
+	code_gc_idle_ms = idle_ms;
+}
+
+int wasmjit_code_gc_enabled(void)
+{
+	return code_gc_idle_ms != 0;
+}
+
+static void free_module_types(struct ModuleTypes *module_types)
+{
+	if (module_types->functypes)
+		free(module_types->functypes);
+	if (module_types->tabletypes)
+		free(module_types->tabletypes);
+	if (module_types->memorytypes)
+		free(module_types->memorytypes);
+	if (module_types->globaltypes)
+		free(module_types->globaltypes);
+	if (module_types->direct_funcs)
+		free(module_types->direct_funcs);
+	if (module_types->intrinsics)
+		free(module_types->intrinsics);
+}
+
+static void *map_code(const char *unmapped, size_t size)
+{
+	void *mapped;
+
+	mapped = wasmjit_map_code_segment(size);
+	if (!mapped)
+		return NULL;
+
+	memcpy(mapped, unmapped, size);
+	if (!wasmjit_mark_code_segment_executable(mapped, size)) {
+		wasmjit_unmap_code_segment(mapped, size);
+		return NULL;
+	}
+
+	return mapped;
+}
+
+/* called by the stub in place of the function's code */
+static void *code_gc_restore(void *cell)
+{
+	struct CodeGCFunc *func = cell;
+	struct FuncInst *funcinst = func->funcinst;
+	struct WasmJITCodeGC *gc = func->gc;
+	void *code;
+	size_t code_size;
+
+	/* restored since the caller read compiled_code */
+	if (!func->collected)
+		return funcinst->compiled_code;
+
+	code = wasmjit_recompile_function(gc->module_inst,
+					  &gc->module_types,
+					  funcinst,
+					  gc->bodies + func->body_offset,
+					  func->body_size,
+					  &code_size,
+					  gc->flags);
+	if (!code)
+		wasmjit_trap(WASMJIT_TRAP_ABORT);
+
+	funcinst->compiled_code = code;
+	funcinst->compiled_code_size = code_size;
+	func->collected = 0;
+	func->idle_epochs = 0;
+
+	return code;
+}
+
+static int slot_alloc(struct CodeGCFunc *func)
+{
+	struct CodeGCSlots *slots;
+	char *unmapped = NULL;
+	size_t i, size;
+	unsigned flags;
+
+	for (slots = slots_head; slots; slots = slots->next) {
+		if (slots->n_used < CODE_GC_SLOTS_PER_PAGE)
+			break;
+	}
+
+	if (!slots) {
+		flags = wasmjit_detect_retpoline_flags();
+
+		if (!restore_stub) {
+			unmapped = wasmjit_compile_code_gc_stub((void *) &code_gc_restore,
+								&size, flags);
+			if (!unmapped)
+				goto error;
+			restore_stub = map_code(unmapped, size);
+			if (!restore_stub)
+				goto error;
+			restore_stub_size = size;
+			free(unmapped);
+			unmapped = NULL;
+		}
+
+		slots = calloc(1, sizeof(*slots));
+		if (!slots)
+			goto error;
+
+		unmapped = wasmjit_compile_code_gc_slots(slots->cells,
+							 CODE_GC_SLOTS_PER_PAGE,
+							 restore_stub,
+							 &slots->stride,
+							 &size, flags);
+		if (!unmapped)
+			goto error;
+		slots->code = map_code(unmapped, size);
+		if (!slots->code)
+			goto error;
+		slots->code_size = size;
+		free(unmapped);
+		unmapped = NULL;
+
+		slots->next = slots_head;
+		slots_head = slots;
+	}
+
+	for (i = 0; slots->cells[i]; ++i) {
+	}
+
+	slots->cells[i] = func;
+	slots->n_used += 1;
+	func->slots = slots;
+	func->slot = i;
+
+	return 1;
+
+ error:
+	if (unmapped)
+		free(unmapped);
+	if (slots)
+		free(slots);
+	return 0;
+}
+
+static void slot_free(struct CodeGCFunc *func)
+{
+	struct CodeGCSlots *slots = func->slots, **pslots;
+
+	slots->cells[func->slot] = NULL;
+	slots->n_used -= 1;
+	func->slots = NULL;
+
+	if (slots->n_used)
+		return;
+
+	for (pslots = &slots_head; *pslots != slots; pslots = &(*pslots)->next) {
+	}
+	*pslots = slots->next;
+
+	wasmjit_unmap_code_segment(slots->code, slots->code_size);
+	free(slots);
+}
+
+static int collect(struct CodeGCFunc *func)
+{
+	struct FuncInst *funcinst = func->funcinst;
+	void *code;
+	size_t code_size;
+
+	if (!func->slots && !slot_alloc(func))
+		return 0;
+
+	code = funcinst->compiled_code;
+	code_size = funcinst->compiled_code_size;
+
+	funcinst->compiled_code =
+		func->slots->code + func->slot * func->slots->stride;
+	funcinst->compiled_code_size = 0;
+	func->collected = 1;
+
+	wasmjit_unmap_code_segment(code, code_size);
+
+	return 1;
+}
+
+/*
+  conservatively treats every word between us and the outermost
+  invocation's frame as a return address, functions whose code it
+  points into are kept. whole frames are read, including any
+  sanitizer redzones
+*/
+__attribute__((no_sanitize_address))
+static int scan_stack(struct WasmJITCodeGC *gc)
+{
+	const uintptr_t *sp, *end;
+	uintptr_t lo = ~(uintptr_t) 0, hi = 0;
+	size_t i;
+
+	sp = __builtin_frame_address(0);
+	end = (const uintptr_t *) wasmjit_get_jmp_buf();
+	if (!end || end < sp)
+		return 0;
+
+	for (i = 0; i < gc->n_funcs; ++i) {
+		struct FuncInst *funcinst = gc->funcs[i].funcinst;
+		uintptr_t code = (uintptr_t) funcinst->compiled_code;
+
+		if (gc->funcs[i].collected)
+			continue;
+
+		if (code < lo)
+			lo = code;
+		if (code + funcinst->compiled_code_size > hi)
+			hi = code + funcinst->compiled_code_size;
+	}
+
+	for (; sp < end; ++sp) {
+		uintptr_t word = *sp;
+
+		if (word < lo || word >= hi)
+			continue;
+
+		for (i = 0; i < gc->n_funcs; ++i) {
+			struct FuncInst *funcinst = gc->funcs[i].funcinst;
+			uintptr_t code = (uintptr_t) funcinst->compiled_code;
+
+			if (!gc->funcs[i].collected &&
+			    word >= code &&
+			    word < code + funcinst->compiled_code_size) {
+				gc->funcs[i].idle_epochs = 0;
+				break;
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int is_cold(const struct CodeGCFunc *func)
+{
+	return !func->collected &&
+		!func->funcinst->code_pinned &&
+		func->idle_epochs >= CODE_GC_IDLE_EPOCHS;
+}
+
+static void code_gc_epoch(struct WasmJITCodeGC *gc)
+{
+	size_t i, n_cold = 0;
+
+	for (i = 0; i < gc->n_funcs; ++i) {
+		struct CodeGCFunc *func = &gc->funcs[i];
+
+		if (func->funcinst->code_used) {
+			func->funcinst->code_used = 0;
+			func->idle_epochs = 0;
+		} else if (func->idle_epochs < CODE_GC_IDLE_EPOCHS) {
+			func->idle_epochs += 1;
+		}
+
+		if (is_cold(func))
+			n_cold += 1;
+	}
+
+	if (!n_cold || !scan_stack(gc))
+		return;
+
+	for (i = 0; i < gc->n_funcs; ++i) {
+		if (is_cold(&gc->funcs[i]) && !collect(&gc->funcs[i]))
+			break;
+	}
+}
+
+void wasmjit_code_gc_poll(const struct MemInst *meminst)
+{
+	struct WasmJITCodeGC *gc;
+	unsigned now, epoch_ms;
+
+	if (!code_gc_idle_ms)
+		return;
+
+	now = code_gc_now_ms();
+	epoch_ms = code_gc_idle_ms / CODE_GC_IDLE_EPOCHS;
+	if (!epoch_ms)
+		epoch_ms = 1;
+
+	code_gc_lock();
+	for (gc = code_gc_head; gc; gc = gc->next) {
+		if (gc->meminst != meminst ||
+		    now - gc->last_epoch < epoch_ms)
+			continue;
+
+		gc->last_epoch = now;
+		code_gc_epoch(gc);
+	}
+	code_gc_unlock();
+}
+
+int wasmjit_code_gc_register(struct ModuleInst *module_inst,
+			     struct ModuleTypes *module_types,
+			     const struct CodeSection *code_section,
+			     unsigned flags)
+{
+	struct WasmJITCodeGC *gc = NULL;
+	size_t i, total = 0;
+
+	/* polls find the modules of a program by its memory */
+	if (!module_inst->mems.n_elts || !code_section->n_codes)
+		return 1;
+
+	gc = calloc(1, sizeof(*gc));
+	if (!gc)
+		goto error;
+
+	for (i = 0; i < code_section->n_codes; ++i)
+		total += code_section->codes[i].size;
+
+	gc->bodies = malloc(total ? total : 1);
+	if (!gc->bodies)
+		goto error;
+
+	gc->funcs = calloc(code_section->n_codes, sizeof(gc->funcs[0]));
+	if (!gc->funcs)
+		goto error;
+	gc->n_funcs = code_section->n_codes;
+
+	total = 0;
+	for (i = 0; i < code_section->n_codes; ++i) {
+		const struct CodeSectionCode *code = &code_section->codes[i];
+		struct CodeGCFunc *func = &gc->funcs[i];
+
+		memcpy(gc->bodies + total, code->body, code->size);
+		func->funcinst =
+			module_inst->funcs.elts[module_inst->n_imported_funcs + i];
+		func->gc = gc;
+		func->body_offset = total;
+		func->body_size = code->size;
+		total += code->size;
+	}
+
+	gc->module_inst = module_inst;
+	gc->meminst = module_inst->mems.elts[0];
+	gc->flags = flags;
+	gc->last_epoch = code_gc_now_ms();
+	gc->module_types = *module_types;
+	memset(module_types, 0, sizeof(*module_types));
+	module_inst->code_gc = gc;
+
+	code_gc_lock();
+	gc->next = code_gc_head;
+	code_gc_head = gc;
+	code_gc_unlock();
+
+	return 1;
+
+ error:
+	if (gc) {
+		if (gc->funcs)
+			free(gc->funcs);
+		if (gc->bodies)
+			free(gc->bodies);
+		free(gc);
+	}
+	return 0;
+}
+
+void wasmjit_code_gc_release(struct ModuleInst *module_inst)
+{
+	struct WasmJITCodeGC *gc = module_inst->code_gc, **pgc;
+	size_t i;
+
+	if (!gc)
+		return;
+
+	code_gc_lock();
+	for (pgc = &code_gc_head; *pgc != gc; pgc = &(*pgc)->next) {
+	}
+	*pgc = gc->next;
+
+	for (i = 0; i < gc->n_funcs; ++i) {
+		struct CodeGCFunc *func = &gc->funcs[i];
+
+		/* a slot isn't the funcinst's to unmap */
+		if (func->collected) {
+			func->funcinst->compiled_code = NULL;
+			func->funcinst->compiled_code_size = 0;
+		}
+
+		if (func->slots)
+			slot_free(func);
+	}
+	code_gc_unlock();
+
+	free_module_types(&gc->module_types);
+	free(gc->funcs);
+	free(gc->bodies);
+	free(gc);
+	module_inst->code_gc = NULL;
+}
+
+void wasmjit_code_gc_shutdown(void)
+{
+	code_gc_lock();
+	if (!slots_head && restore_stub) {
+		wasmjit_unmap_code_segment(restore_stub, restore_stub_size);
+		restore_stub = NULL;
+	}
+	code_gc_unlock();
+}
+
+/* platform specific */
+
+#ifdef __KERNEL__
+
+#include <linux/jiffies.h>
+#include <linux/mutex.h>
+
+static DEFINE_MUTEX(code_gc_mutex);
+
+static void code_gc_lock(void)
+{
+	mutex_lock(&code_gc_mutex);
+}
+
+static void code_gc_unlock(void)
+{
+	mutex_unlock(&code_gc_mutex);
+}
+
+static unsigned code_gc_now_ms(void)
+{
+	return jiffies_to_msecs(jiffies);
+}
+
+#else
+
+#include <pthread.h>
+#include <time.h>
+
+static pthread_mutex_t code_gc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void code_gc_lock(void)
+{
+	pthread_mutex_lock(&code_gc_mutex);
+}
+
+static void code_gc_unlock(void)
+{
+	pthread_mutex_unlock(&code_gc_mutex);
+}
+
+static unsigned code_gc_now_ms(void)
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts))
+#else
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+#endif
+		return 0;
+	return (unsigned) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__CODE_GC_H__
+#define __WASMJIT__CODE_GC_H__
+
+#include <wasmjit/sys.h>
+
+struct ModuleInst;
+struct ModuleTypes;
+struct CodeSection;
+struct MemInst;
+
+/*
+  code of functions not called for about idle_ms is unmapped and
+  compiled again on their next call, 0 (the default) disables it.
+  only affects modules instantiated afterwards
+*/
+void wasmjit_code_gc_configure(unsigned idle_ms);
+int wasmjit_code_gc_enabled(void);
+
+/*
+  makes the code of module_inst collectable, it keeps a copy of the
+  bodies in code_section and takes over the contents of module_types
+*/
+int wasmjit_code_gc_register(struct ModuleInst *module_inst,
+			     struct ModuleTypes *module_types,
+			     const struct CodeSection *code_section,
+			     unsigned flags);
+
+/*
+  collects cold functions of the modules using meminst as their
+  memory. must be called from a host function of that program, the
+  caller's stack is scanned for code still in use
+*/
+void wasmjit_code_gc_poll(const struct MemInst *meminst);
+
+/* undoes wasmjit_code_gc_register(), collected code pointers are cleared */
+void wasmjit_code_gc_release(struct ModuleInst *module_inst);
+
+/* frees the shared stubs once no module is registered */
+void wasmjit_code_gc_shutdown(void);
+
+/*
+  native stack the recompile of a collected function needs, on top of
+  WASMJIT_HOST_STACK_RESERVE, for each level of nested blocks in its
+  body. freeing the decoded body recurses once per level (about 96
+  bytes each unoptimized)
+*/
+#define WASMJIT_CODE_GC_STACK_PER_BLOCK ((size_t) 128)
+
+#endif
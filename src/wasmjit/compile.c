@@ -534,6 +534,157 @@ static int emit_trap(struct SizedBuffer *output,
 	return 0;
 }
 
+/* replaces a call to a host function of type ft */
+static int emit_intrinsic(struct SizedBuffer *output,
+			  struct MemoryReferences *memrefs,
+			  struct StaticStack *sstack,
+			  const struct FuncType *ft,
+			  const struct WasmJITIntrinsic *intrinsic,
+			  unsigned flags)
+{
+	char buf[sizeof(uint64_t)];
+	size_t i;
+
+	switch (intrinsic->kind) {
+	case WASMJIT_INTRINSIC_NOP:
+	case WASMJIT_INTRINSIC_CONST_I32:
+		for (i = 0; i < ft->n_inputs; ++i) {
+			if (!pop_stack(sstack))
+				goto error;
+			/* pop %rax */
+			OUTS("\x58");
+		}
+
+		if (intrinsic->kind == WASMJIT_INTRINSIC_NOP) {
+			assert(ft->output_type == VALTYPE_NULL);
+			break;
+		}
+
+		assert(ft->output_type == VALTYPE_I32);
+
+		/* mov $value, %eax */
+		OUTS("\xb8");
+		encode_le_uint32_t(intrinsic->value, buf);
+		if (!output_buf(output, buf, sizeof(uint32_t)))
+			goto error;
+
+		/* push %rax */
+		OUTS("\x50");
+		if (!push_stack(sstack, STACK_I32))
+			goto error;
+		break;
+	case WASMJIT_INTRINSIC_MEMCPY:
+		assert(ft->n_inputs == 3 && ft->output_type == VALTYPE_I32);
+		for (i = 0; i < 3; ++i) {
+			assert(peek_stack(sstack) == STACK_I32);
+			if (!pop_stack(sstack))
+				goto error;
+		}
+
+		/* pop %rcx; pop %rsi; pop %rdi */
+		OUTS("\x59\x5e\x5f");
+
+		/* mov %ecx, %ecx; mov %esi, %esi; mov %edi, %edi */
+		OUTS("\x89\xc9\x89\xf6\x89\xff");
+
+		/* movq $const, %rax */
+		OUTS("\x48\xb8");
+		OUTNULL(8);
+		{
+			size_t memref_idx;
+
+			memref_idx = memrefs->n_elts;
+			if (!memrefs_grow(memrefs, 1))
+				goto error;
+
+			memrefs->elts[memref_idx].type = MEMREF_MEM;
+			memrefs->elts[memref_idx].code_offset =
+				output->n_elts - 8;
+			memrefs->elts[memref_idx].idx = 0;
+		}
+
+		/* mov size_offset(%rax), %rdx */
+		OUTS("\x48\x8b\x50");
+		OUTB(offsetof(struct MemInst, size));
+
+		/* LOGIC: if src + n > size then trap() */
+
+		/* lea (%rsi,%rcx), %r8 */
+		OUTS("\x4c\x8d\x04\x0e");
+		/* cmp %rdx, %r8 */
+		OUTS("\x49\x39\xd0");
+		/* jbe AFTER_TRAP */
+		OUTS("\x76");
+		OUTB(TRAP_SIZE(flags));
+		if (!emit_trap(output, memrefs, flags, WASMJIT_TRAP_MEMORY_OVERFLOW))
+			goto error;
+
+		/* LOGIC: if dest + n > size then trap() */
+
+		/* lea (%rdi,%rcx), %r8 */
+		OUTS("\x4c\x8d\x04\x0f");
+		/* cmp %rdx, %r8 */
+		OUTS("\x49\x39\xd0");
+		/* jbe AFTER_TRAP */
+		OUTS("\x76");
+		OUTB(TRAP_SIZE(flags));
+		if (!emit_trap(output, memrefs, flags, WASMJIT_TRAP_MEMORY_OVERFLOW))
+			goto error;
+
+		/*
+		  LOGIC: src &= -(src + n <= size), same for dest, so a
+		  mispredicted check can't copy out of bounds (spectre v1)
+		*/
+
+		/* lea (%rsi,%rcx), %r8 */
+		OUTS("\x4c\x8d\x04\x0e");
+		/* cmp %r8, %rdx */
+		OUTS("\x4c\x39\xc2");
+		/* sbb %r9, %r9 */
+		OUTS("\x4d\x19\xc9");
+		/* not %r9 */
+		OUTS("\x49\xf7\xd1");
+		/* and %r9, %rsi */
+		OUTS("\x4c\x21\xce");
+
+		/* lea (%rdi,%rcx), %r8 */
+		OUTS("\x4c\x8d\x04\x0f");
+		/* cmp %r8, %rdx */
+		OUTS("\x4c\x39\xc2");
+		/* sbb %r9, %r9 */
+		OUTS("\x4d\x19\xc9");
+		/* not %r9 */
+		OUTS("\x49\xf7\xd1");
+		/* and %r9, %rdi */
+		OUTS("\x4c\x21\xcf");
+
+		/* the result is dest */
+		/* push %rdi */
+		OUTS("\x57");
+		if (!push_stack(sstack, STACK_I32))
+			goto error;
+
+		/* mov data_off(%rax), %rax */
+		OUTS("\x48\x8b\x40");
+		OUTB(offsetof(struct MemInst, data));
+
+		/* add %rax, %rsi; add %rax, %rdi */
+		OUTS("\x48\x01\xc6\x48\x01\xc7");
+
+		/* rep movsb */
+		OUTS("\xf3\xa4");
+		break;
+	default:
+		assert(0);
+		goto error;
+	}
+
+	return 1;
+
+ error:
+	return 0;
+}
+
 static int wasmjit_compile_instruction(const struct FuncType *func_types,
 				       const struct ModuleTypes *module_types,
 				       const struct FuncType *type,
@@ -762,10 +913,22 @@ static int wasmjit_compile_instruction(const struct FuncType *func_types,
 
 		break;
 	case OPCODE_CALL:
+		if (module_types->intrinsics &&
+		    module_types->intrinsics[instruction->data.call.funcidx]) {
+			uint32_t fidx = instruction->data.call.funcidx;
+
+			if (!emit_intrinsic(output, memrefs, sstack,
+					    &module_types->functypes[fidx],
+					    module_types->intrinsics[fidx],
+					    flags))
+				goto error;
+			break;
+		}
+		/* fall through */
 	case OPCODE_CALL_INDIRECT: {
 		size_t i;
 		size_t n_movs, n_xmm_movs, n_stack;
-		int aligned = 0;
+		int aligned = 0, direct = 0;
 		const struct FuncType *ft;
 		size_t cur_stack_depth = n_frame_locals;
 
@@ -847,22 +1010,27 @@ static int wasmjit_compile_instruction(const struct FuncType *func_types,
 			uint32_t fidx =
 				instruction->data.call.funcidx;
 			ft = &module_types->functypes[fidx];
+			direct = module_types->direct_funcs &&
+				module_types->direct_funcs[fidx];
+
+			/* direct calls only need the funcinst for the stack check */
+			if (!direct || check_stack) {
+				/* movq $const, %rax */
+				OUTS("\x48\xb8");
+				OUTNULL(8);
+				{
+					size_t memref_idx;
 
-			/* movq $const, %rax */
-			OUTS("\x48\xb8");
-			OUTNULL(8);
-			{
-				size_t memref_idx;
-
-				memref_idx = memrefs->n_elts;
-				if (!memrefs_grow(memrefs, 1))
-					goto error;
+					memref_idx = memrefs->n_elts;
+					if (!memrefs_grow(memrefs, 1))
+						goto error;
 
-				memrefs->elts[memref_idx].type =
-					MEMREF_FUNC;
-				memrefs->elts[memref_idx].code_offset =
-					output->n_elts - 8;
-				memrefs->elts[memref_idx].idx = fidx;
+					memrefs->elts[memref_idx].type =
+						MEMREF_FUNC;
+					memrefs->elts[memref_idx].code_offset =
+						output->n_elts - 8;
+					memrefs->elts[memref_idx].idx = fidx;
+				}
 			}
 		}
 
@@ -970,9 +1138,18 @@ static int wasmjit_compile_instruction(const struct FuncType *func_types,
 			OUTS("\x5b");
 		}
 
-		/* mov compiled_code_off(%rax), %rax */
-		OUTS("\x48\x8b\x40");
-		OUTB(offsetof(struct FuncInst, compiled_code));
+		if (!direct) {
+			if (flags & WASMJIT_COMPILE_FLAG_CODE_GC) {
+				/* movb $1, code_used_off(%rax) */
+				OUTS("\xc6\x40");
+				OUTB(offsetof(struct FuncInst, code_used));
+				OUTB(1);
+			}
+
+			/* mov compiled_code_off(%rax), %rax */
+			OUTS("\x48\x8b\x40");
+			OUTB(offsetof(struct FuncInst, compiled_code));
+		}
 
 		/* align stack to 16-byte boundary */
 		{
@@ -981,9 +1158,45 @@ static int wasmjit_compile_instruction(const struct FuncType *func_types,
 				OUTS("\x48\x83\xec\x08");
 		}
 
+		/*
+		  push stack arguments last to first, the callee
+		  expects the first one at the lowest address
+		*/
 		n_movs = 0;
 		n_xmm_movs = 0;
+		for (i = 0; i < ft->n_inputs; ++i) {
+			if (ft->input_types[i] == VALTYPE_I32 ||
+			    ft->input_types[i] == VALTYPE_I64)
+				n_movs += 1;
+			else
+				n_xmm_movs += 1;
+		}
+
 		n_stack = 0;
+		for (i = ft->n_inputs; i-- > 0;) {
+			int on_stack;
+
+			/* count only the arguments before this one */
+			if (ft->input_types[i] == VALTYPE_I32 ||
+			    ft->input_types[i] == VALTYPE_I64) {
+				n_movs -= 1;
+				on_stack = n_movs >= 6;
+			} else {
+				n_xmm_movs -= 1;
+				on_stack = n_xmm_movs >= 8;
+			}
+
+			if (!on_stack)
+				continue;
+
+			OUTS("\xff\xb4\x24");	/* push N(%rsp) */
+			encode_le_uint32_t((ft->n_inputs - i - 1 + n_stack + aligned) * 8,
+					   buf);
+			if (!output_buf(output, buf, sizeof(uint32_t)))
+				goto error;
+			n_stack += 1;
+		}
+
 		for (i = 0; i < ft->n_inputs; ++i) {
 			static const char *const movs[] = {
 				"\x48\x8b\xbc\x24",	/* mov N(%rsp), %rdi */
@@ -1042,10 +1255,8 @@ static int wasmjit_compile_instruction(const struct FuncType *func_types,
 				OUTS(f64_movs[n_xmm_movs]);
 				n_xmm_movs += 1;
 			} else {
-				stack_offset =
-					(i - (ft->n_inputs - 1) + n_stack + aligned) * 8;
-				OUTS("\xff\xb4\x24");	/* push N(%rsp) */
-				n_stack += 1;
+				/* already pushed */
+				continue;
 			}
 
 			encode_le_uint32_t(stack_offset, buf);
@@ -1053,8 +1264,31 @@ static int wasmjit_compile_instruction(const struct FuncType *func_types,
 				goto error;
 		}
 
-		if (!emit_indirect_call(output, flags))
+		if (direct) {
+			/*
+			  call rel32, initially targets a stub emitted
+			  after the epilogue, the linker points it
+			  directly at the callee when in range
+			*/
+			OUTS("\xe8");
+			OUTNULL(4);
+			{
+				size_t memref_idx;
+
+				memref_idx = memrefs->n_elts;
+				if (!memrefs_grow(memrefs, 1))
+					goto error;
+
+				memrefs->elts[memref_idx].type =
+					MEMREF_FUNC_CODE_REL32;
+				memrefs->elts[memref_idx].code_offset =
+					output->n_elts - 4;
+				memrefs->elts[memref_idx].idx =
+					instruction->data.call.funcidx;
+			}
+		} else if (!emit_indirect_call(output, flags)) {
 			goto error;
+		}
 
 		/* clean up stack */
 		/* add (n_stack + n_inputs + aligned) * 8, %rsp */
@@ -2582,7 +2816,7 @@ char *wasmjit_compile_function(const struct FuncType *func_types,
 			       size_t *stack_usage,
 			       unsigned flags)
 {
-	char buf[sizeof(uint32_t)];
+	char buf[sizeof(uint64_t)];
 	struct SizedBuffer outputv = { 0, NULL };
 	struct SizedBuffer *output = &outputv;
 	struct BranchPoints branches = { 0, NULL };
@@ -2853,6 +3087,59 @@ char *wasmjit_compile_function(const struct FuncType *func_types,
 	/* retq */
 	OUTS("\xc3");
 
+	/* output stubs for direct calls, one per callee */
+	{
+		size_t i, n_memrefs = memrefs->n_elts;
+		for (i = 0; i < n_memrefs; ++i) {
+			size_t j, code_offset, stub_offset;
+			uint32_t rel;
+
+			if (memrefs->elts[i].type != MEMREF_FUNC_CODE_REL32)
+				continue;
+
+			for (j = 0; j < i; ++j) {
+				if (memrefs->elts[j].type == MEMREF_FUNC_CODE_REL32 &&
+				    memrefs->elts[j].idx == memrefs->elts[i].idx)
+					break;
+			}
+
+			if (j < i) {
+				/* reuse stub of previous call site */
+				code_offset = memrefs->elts[j].code_offset;
+				memcpy(&rel, &output->elts[code_offset], sizeof(rel));
+				stub_offset = code_offset + sizeof(rel) +
+					(int32_t) uint32_t_swap_bytes(rel);
+			} else {
+				stub_offset = output->n_elts;
+
+				/* mov $const, %rax */
+				OUTS("\x48\xb8");
+				OUTNULL(8);
+				{
+					size_t memref_idx;
+
+					memref_idx = memrefs->n_elts;
+					if (!memrefs_grow(memrefs, 1))
+						goto error;
+
+					memrefs->elts[memref_idx].type =
+						MEMREF_FUNC_CODE;
+					memrefs->elts[memref_idx].code_offset =
+						output->n_elts - 8;
+					memrefs->elts[memref_idx].idx =
+						memrefs->elts[i].idx;
+				}
+
+				if (!emit_indirect_jump(output, flags))
+					goto error;
+			}
+
+			code_offset = memrefs->elts[i].code_offset;
+			encode_le_uint32_t(stub_offset - (code_offset + sizeof(rel)),
+					   &output->elts[code_offset]);
+		}
+	}
+
 	if (0) {
 	error:
 		free(output->elts);
@@ -3055,6 +3342,130 @@ char *wasmjit_compile_hostfunc(struct FuncType *type,
 	return out;
 }
 
+char *wasmjit_compile_hostfunc_values(struct FuncType *type,
+				      void *hostfunc,
+				      void *funcinst_ptr,
+				      size_t *out_size,
+				      unsigned flags)
+{
+	size_t i, frame_size;
+	size_t n_movs = 0, n_xmm_movs = 0, n_stack = 0;
+	struct SizedBuffer outputv = { 0, NULL };
+	struct SizedBuffer *output = &outputv;
+	char buf[sizeof(uint64_t)];
+	char *out;
+
+	/* one slot per input, %rsp must be 16-byte aligned at the call */
+	frame_size = 8 * type->n_inputs;
+	if (!(type->n_inputs % 2))
+		frame_size += 8;
+
+	/* sub $frame_size, %rsp */
+	OUTS("\x48\x81\xec");
+	encode_le_uint32_t(frame_size, buf);
+	if (!output_buf(output, buf, sizeof(uint32_t)))
+		goto error;
+
+	for (i = 0; i < type->n_inputs; ++i) {
+		static const char *const movs[] = {
+			"\x48\x89\xbc\x24", /* mov %rdi, N(%rsp) */
+			"\x48\x89\xb4\x24", /* mov %rsi, N(%rsp) */
+			"\x48\x89\x94\x24", /* mov %rdx, N(%rsp) */
+			"\x48\x89\x8c\x24", /* mov %rcx, N(%rsp) */
+			"\x4c\x89\x84\x24", /* mov %r8, N(%rsp) */
+			"\x4c\x89\x8c\x24", /* mov %r9, N(%rsp) */
+		};
+
+		/* preceded by \xf3 for movss or \xf2 for movsd */
+		static const char *const xmm_movs[] = {
+			"\x0f\x11\x84\x24", /* mov %xmm0, N(%rsp) */
+			"\x0f\x11\x8c\x24", /* mov %xmm1, N(%rsp) */
+			"\x0f\x11\x94\x24", /* mov %xmm2, N(%rsp) */
+			"\x0f\x11\x9c\x24", /* mov %xmm3, N(%rsp) */
+			"\x0f\x11\xa4\x24", /* mov %xmm4, N(%rsp) */
+			"\x0f\x11\xac\x24", /* mov %xmm5, N(%rsp) */
+			"\x0f\x11\xb4\x24", /* mov %xmm6, N(%rsp) */
+			"\x0f\x11\xbc\x24", /* mov %xmm7, N(%rsp) */
+		};
+
+		if ((type->input_types[i] == VALTYPE_I32 ||
+		     type->input_types[i] == VALTYPE_I64) &&
+		    n_movs < 6) {
+			OUTS(movs[n_movs]);
+			n_movs += 1;
+		} else if ((type->input_types[i] == VALTYPE_F32 ||
+			    type->input_types[i] == VALTYPE_F64) &&
+			   n_xmm_movs < 8) {
+			OUTS(type->input_types[i] == VALTYPE_F32
+			     ? "\xf3" : "\xf2");
+			OUTS(xmm_movs[n_xmm_movs]);
+			n_xmm_movs += 1;
+		} else {
+			/* mov (frame_size + 8 * (n_stack + 1))(%rsp), %rax */
+			OUTS("\x48\x8b\x84\x24");
+			encode_le_uint32_t(frame_size + 8 * (n_stack + 1), buf);
+			if (!output_buf(output, buf, sizeof(uint32_t)))
+				goto error;
+
+			/* mov %rax, N(%rsp) */
+			OUTS("\x48\x89\x84\x24");
+			n_stack += 1;
+		}
+
+		encode_le_uint32_t(i * 8, buf);
+		if (!output_buf(output, buf, sizeof(uint32_t)))
+			goto error;
+	}
+
+	/* mov %rsp, %rsi */
+	OUTS("\x48\x89\xe6");
+
+	/* movabs $funcinst_ptr, %rdi */
+	OUTS("\x48\xbf");
+	encode_le_uint64_t((uintptr_t) funcinst_ptr, buf);
+	if (!output_buf(output, buf, sizeof(uint64_t)))
+		goto error;
+
+	/* movabs $hostfunc, %rax */
+	OUTS("\x48\xb8");
+	encode_le_uint64_t((uintptr_t) hostfunc, buf);
+	if (!output_buf(output, buf, sizeof(uint64_t)))
+		goto error;
+
+	if (!emit_indirect_call(output, flags))
+		goto error;
+
+	/* the union comes back in %rax, wasm code expects floats in %xmm0 */
+	if (type->output_type == VALTYPE_F32) {
+		/* movd %eax, %xmm0 */
+		OUTS("\x66\x0f\x6e\xc0");
+	} else if (type->output_type == VALTYPE_F64) {
+		/* movq %rax, %xmm0 */
+		OUTS("\x66\x48\x0f\x6e\xc0");
+	}
+
+	/* add $frame_size, %rsp */
+	OUTS("\x48\x81\xc4");
+	encode_le_uint32_t(frame_size, buf);
+	if (!output_buf(output, buf, sizeof(uint32_t)))
+		goto error;
+
+	/* ret */
+	OUTS("\xc3");
+
+	if (0) {
+	error:
+		free(output->elts);
+		out = NULL;
+	}
+	else {
+		out = output->elts;
+		*out_size = output->n_elts;
+	}
+
+	return out;
+}
+
 char *wasmjit_compile_invoker_offset(struct FuncType *type,
 				     size_t *compiled_code_offset,
 				     size_t *out_size,
@@ -3165,9 +3576,9 @@ char *wasmjit_compile_invoker_offset(struct FuncType *type,
 			   n_xmm_movs < 8) {
 
 			if (type->input_types[i] == VALTYPE_F32) {
-				OUTS(f32_movs[n_movs]);
+				OUTS(f32_movs[n_xmm_movs]);
 			} else {
-				OUTS(f64_movs[n_movs]);
+				OUTS(f64_movs[n_xmm_movs]);
 			}
 
 			encode_le_uint32_t(i * 8, buf);
@@ -3197,9 +3608,30 @@ char *wasmjit_compile_invoker_offset(struct FuncType *type,
 	*compiled_code_offset = output->n_elts;
 	OUTNULL(8);
 
+	/* the constant is the FuncInst, its code may be replaced */
+	if (flags & WASMJIT_COMPILE_FLAG_CODE_GC) {
+		/* movb $1, code_used_off(%rax) */
+		OUTS("\xc6\x40");
+		OUTB(offsetof(struct FuncInst, code_used));
+		OUTB(1);
+
+		/* mov compiled_code_off(%rax), %rax */
+		OUTS("\x48\x8b\x40");
+		OUTB(offsetof(struct FuncInst, compiled_code));
+	}
+
 	if (!emit_indirect_call(output, flags))
 		goto error;
 
+	/* float results come back in %xmm0, callers expect them in %rax */
+	if (type->output_type == VALTYPE_F32) {
+		/* movd %xmm0, %eax */
+		OUTS("\x66\x0f\x7e\xc0");
+	} else if (type->output_type == VALTYPE_F64) {
+		/* movq %xmm0, %rax */
+		OUTS("\x66\x48\x0f\x7e\xc0");
+	}
+
 	/* mov (to_reserve - 1) *8(%rsp), %rbx */
 	OUTS("\x48\x8b\x9c\x24");
 	encode_le_uint32_t((to_reserve - 1) * 8, buf);
@@ -3246,6 +3678,133 @@ char *wasmjit_compile_invoker(struct FuncType *type,
 	return ret;
 }
 
+char *wasmjit_compile_code_gc_stub(void *restore,
+				   size_t *out_size,
+				   unsigned flags)
+{
+	struct SizedBuffer outputv = { 0, NULL };
+	struct SizedBuffer *output = &outputv;
+	char buf[sizeof(uint64_t)];
+	unsigned i;
+
+	/*
+	  the caller's arguments are still in registers (and on the
+	  stack above us), keep them for the real code
+	*/
+	OUTS("\x57"); /* push %rdi */
+	OUTS("\x56"); /* push %rsi */
+	OUTS("\x52"); /* push %rdx */
+	OUTS("\x51"); /* push %rcx */
+	OUTS("\x41\x50"); /* push %r8 */
+	OUTS("\x41\x51"); /* push %r9 */
+
+	/* 8 xmm arguments and realignment to 16 bytes */
+	/* sub $72, %rsp */
+	OUTS("\x48\x83\xec\x48");
+	for (i = 0; i < 8; ++i) {
+		/* movq %xmmI, (I * 8)(%rsp) */
+		OUTS("\x66\x0f\xd6");
+		OUTB(0x44 | (i << 3));
+		OUTB(0x24);
+		OUTB(i * 8);
+	}
+
+	/* mov %r10, %rdi */
+	OUTS("\x4c\x89\xd7");
+
+	/* movabs $restore, %rax */
+	OUTS("\x48\xb8");
+	encode_le_uint64_t((uintptr_t) restore, buf);
+	if (!output_buf(output, buf, sizeof(uint64_t)))
+		goto error;
+
+	if (!emit_indirect_call(output, flags))
+		goto error;
+
+	for (i = 0; i < 8; ++i) {
+		/* movq (I * 8)(%rsp), %xmmI */
+		OUTS("\xf3\x0f\x7e");
+		OUTB(0x44 | (i << 3));
+		OUTB(0x24);
+		OUTB(i * 8);
+	}
+	/* add $72, %rsp */
+	OUTS("\x48\x83\xc4\x48");
+
+	OUTS("\x41\x59"); /* pop %r9 */
+	OUTS("\x41\x58"); /* pop %r8 */
+	OUTS("\x59"); /* pop %rcx */
+	OUTS("\x5a"); /* pop %rdx */
+	OUTS("\x5e"); /* pop %rsi */
+	OUTS("\x5f"); /* pop %rdi */
+
+	/* jump to the restored code, %rax */
+	if (!emit_indirect_jump(output, flags))
+		goto error;
+
+	if (out_size)
+		*out_size = output->n_elts;
+	return output->elts;
+
+ error:
+	free(output->elts);
+	return NULL;
+}
+
+char *wasmjit_compile_code_gc_slots(void **cells,
+				    size_t n_slots,
+				    void *stub,
+				    size_t *stride,
+				    size_t *out_size,
+				    unsigned flags)
+{
+	struct SizedBuffer outputv = { 0, NULL };
+	struct SizedBuffer *output = &outputv;
+	char buf[sizeof(uint64_t)];
+	size_t i, slot_size = 0;
+
+	for (i = 0; i < n_slots; ++i) {
+		size_t start = output->n_elts;
+
+		/* movabs $&cells[i], %rax */
+		OUTS("\x48\xb8");
+		encode_le_uint64_t((uintptr_t) &cells[i], buf);
+		if (!output_buf(output, buf, sizeof(uint64_t)))
+			goto error;
+
+		/* mov (%rax), %r10 */
+		OUTS("\x4c\x8b\x10");
+
+		/* movabs $stub, %rax */
+		OUTS("\x48\xb8");
+		encode_le_uint64_t((uintptr_t) stub, buf);
+		if (!output_buf(output, buf, sizeof(uint64_t)))
+			goto error;
+
+		if (!emit_indirect_jump(output, flags))
+			goto error;
+
+		/* every slot is the same size, pad them to 16 bytes */
+		if (!i)
+			slot_size = (output->n_elts - start + 15) & ~(size_t) 15;
+
+		while (output->n_elts - start < slot_size) {
+			/* int3 */
+			OUTS("\xcc");
+		}
+	}
+
+	if (stride)
+		*stride = slot_size;
+	if (out_size)
+		*out_size = output->n_elts;
+	return output->elts;
+
+ error:
+	free(output->elts);
+	return NULL;
+}
+
 #undef INC_LABELS
 #undef OUTNULL
 #undef OUTB
@@ -29,11 +29,37 @@
 
 #include <wasmjit/sys.h>
 
+/*
+  an operation the compiler emits in place of a call to a host
+  function, registered by the host runtime that defines it
+*/
+struct WasmJITIntrinsic {
+	enum {
+		/* nothing, the arguments are dropped */
+		WASMJIT_INTRINSIC_NOP,
+		/* the arguments are dropped and value is returned */
+		WASMJIT_INTRINSIC_CONST_I32,
+		/*
+		  (dest, src, n) copies n bytes within memory 0 and
+		  returns dest, trapping if either range is out of bounds
+		*/
+		WASMJIT_INTRINSIC_MEMCPY,
+	} kind;
+	uint32_t value;
+};
+
 struct ModuleTypes {
 	struct FuncType *functypes;
 	struct TableType *tabletypes;
 	struct MemoryType *memorytypes;
 	struct GlobalType *globaltypes;
+	/*
+	  optional, non-zero entries mark imported functions whose
+	  compiled code is fixed and may be called directly
+	*/
+	char *direct_funcs;
+	/* optional, non-NULL entries are emitted inline for imports */
+	const struct WasmJITIntrinsic **intrinsics;
 };
 
 struct MemoryReferences {
@@ -48,6 +74,8 @@ struct MemoryReferences {
 			MEMREF_RESOLVE_INDIRECT_CALL,
 			MEMREF_TRAP,
 			MEMREF_STACK_TOP,
+			MEMREF_FUNC_CODE,
+			MEMREF_FUNC_CODE_REL32,
 		} type;
 		size_t code_offset;
 		size_t idx;
@@ -56,6 +84,11 @@ struct MemoryReferences {
 
 #define WASMJIT_COMPILE_FLAG_INTEL_RETPOLINE 1
 #define WASMJIT_COMPILE_FLAG_AMD_RETPOLINE 2
+/*
+  calls through a FuncInst set its code_used, invokers load the code
+  from the FuncInst so it may be replaced while the module runs
+*/
+#define WASMJIT_COMPILE_FLAG_CODE_GC 4
 
 unsigned wasmjit_detect_retpoline_flags(void);
 
@@ -74,6 +107,17 @@ char *wasmjit_compile_hostfunc(struct FuncType *type,
 			       size_t *out_size,
 			       unsigned flags);
 
+/*
+  like wasmjit_compile_hostfunc() but hostfunc is called as
+  union ValueUnion hostfunc(struct FuncInst *, union ValueUnion *args),
+  for host functions that serve many signatures
+*/
+char *wasmjit_compile_hostfunc_values(struct FuncType *type,
+				      void *hostfunc,
+				      void *funcinst_ptr,
+				      size_t *out_size,
+				      unsigned flags);
+
 char *wasmjit_compile_invoker(struct FuncType *type,
 			      void *compiled_code,
 			      size_t *out_size,
@@ -84,4 +128,24 @@ char *wasmjit_compile_invoker_offset(struct FuncType *type,
 				     size_t *out_size,
 				     unsigned flags);
 
+/*
+  common entry of code GC slots, called with the slot's cell value in
+  %r10 it preserves the argument registers around
+  void *restore(void *cell) and jumps to the code it returns
+*/
+char *wasmjit_compile_code_gc_stub(void *restore,
+				   size_t *out_size,
+				   unsigned flags);
+
+/*
+  n_slots entries stride bytes apart, entry k loads cells[k] into %r10
+  and jumps to stub
+*/
+char *wasmjit_compile_code_gc_slots(void **cells,
+				    size_t n_slots,
+				    void *stub,
+				    size_t *stride,
+				    size_t *out_size,
+				    unsigned flags);
+
 #endif
@@ -26,71 +26,159 @@
 #include <wasmjit/emscripten_runtime.h>
 #include <wasmjit/util.h>
 #include <wasmjit/compile.h>
+#include <wasmjit/instantiate.h>
 
 #include <wasmjit/sys.h>
 
-static struct FuncInst *alloc_func(struct ModuleInst *module, void *_fptr,
-				   wasmjit_valtype_t _output, size_t n_inputs,
-				   wasmjit_valtype_t *inputs)
+/*
+  host functions simple enough for the compiler to emit in place of
+  calls to them, keyed by module, name and signature.
+  abortOnCannotGrowMemory is left out, it never returns
+*/
+static const struct {
+	const char *module_name;
+	const char *name;
+	wasmjit_valtype_t output_type;
+	size_t n_inputs;
+	wasmjit_valtype_t input_types[3];
+	struct WasmJITIntrinsic intrinsic;
+} intrinsics[] = {
+	{"env", "___lock", VALTYPE_NULL, 1, {VALTYPE_I32},
+	 {WASMJIT_INTRINSIC_NOP, 0}},
+	{"env", "___unlock", VALTYPE_NULL, 1, {VALTYPE_I32},
+	 {WASMJIT_INTRINSIC_NOP, 0}},
+	{"env", "getTotalMemory", VALTYPE_I32, 0, {0},
+	 {WASMJIT_INTRINSIC_CONST_I32, WASMJIT_EMSCRIPTEN_TOTAL_MEMORY}},
+	/* memory can't grow */
+	{"env", "enlargeMemory", VALTYPE_I32, 0, {0},
+	 {WASMJIT_INTRINSIC_CONST_I32, 0}},
+	{"env", "_emscripten_memcpy_big", VALTYPE_I32, 3,
+	 {VALTYPE_I32, VALTYPE_I32, VALTYPE_I32},
+	 {WASMJIT_INTRINSIC_MEMCPY, 0}},
+};
+
+static const struct WasmJITIntrinsic *find_intrinsic(const char *module_name,
+						     const char *name,
+						     const struct FuncType *type)
 {
-	void *tmp_unmapped = NULL;
-	struct FuncInst *tmp_func = NULL;
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(intrinsics); ++i) {
+		if (!strcmp(intrinsics[i].module_name, module_name) &&
+		    !strcmp(intrinsics[i].name, name) &&
+		    intrinsics[i].output_type == type->output_type &&
+		    intrinsics[i].n_inputs == type->n_inputs &&
+		    !memcmp(intrinsics[i].input_types, type->input_types,
+			    type->n_inputs))
+			return &intrinsics[i].intrinsic;
+	}
+
+	return NULL;
+}
+
+/*
+  if takes_values, _fptr takes its arguments as an array,
+  see wasmjit_compile_hostfunc_values(). the trampoline isn't
+  compiled until the function is imported, most programs only
+  use a few of the runtime's functions
+*/
+static struct FuncInst *_alloc_func(struct ModuleInst *module, void *_fptr,
+				    wasmjit_valtype_t _output, size_t n_inputs,
+				    wasmjit_valtype_t *inputs, int takes_values)
+{
+	struct FuncInst *tmp_func;
 
 	tmp_func = calloc(1, sizeof(struct FuncInst));
 	if (!tmp_func)
-		goto error;
+		return NULL;
 	tmp_func->module_inst = module;
+	tmp_func->host_function = 1;
 	tmp_func->type.n_inputs = n_inputs;
 	memcpy(tmp_func->type.input_types, inputs, n_inputs);
 	tmp_func->type.output_type = _output;
-	tmp_unmapped =
-		wasmjit_compile_hostfunc(&tmp_func->type, _fptr,
-					 tmp_func,
-					 &tmp_func->compiled_code_size,
-					 wasmjit_detect_retpoline_flags());
-	if (!tmp_unmapped)
-		goto error;
-	tmp_func->compiled_code =
-		wasmjit_map_code_segment(tmp_func->compiled_code_size);
-	if (!tmp_func->compiled_code)
-		goto error;
-	memcpy(tmp_func->compiled_code, tmp_unmapped,
-	       tmp_func->compiled_code_size);
-	if (!wasmjit_mark_code_segment_executable(tmp_func->compiled_code,
-						  tmp_func->compiled_code_size))
-		goto error;
-	tmp_unmapped =
-		wasmjit_compile_invoker(&tmp_func->type,
-					tmp_func->compiled_code,
-					&tmp_func->invoker_size,
-					wasmjit_detect_retpoline_flags());
-	if (!tmp_unmapped)
-		goto error;
-	tmp_func->invoker =
-		wasmjit_map_code_segment(tmp_func->invoker_size);
-	memcpy(tmp_func->invoker, tmp_unmapped,
-	       tmp_func->invoker_size);
-	if (!wasmjit_mark_code_segment_executable(tmp_func->invoker,
-						  tmp_func->invoker_size))
-		goto error;
+	tmp_func->host_fptr = _fptr;
+	tmp_func->host_takes_values = takes_values;
+
+	return tmp_func;
+}
+
+static struct FuncInst *alloc_func(struct ModuleInst *module, void *_fptr,
+				   wasmjit_valtype_t _output, size_t n_inputs,
+				   wasmjit_valtype_t *inputs)
+{
+	return _alloc_func(module, _fptr, _output, n_inputs, inputs, 0);
+}
+
+int wasmjit_emscripten_add_invoke_imports(struct ModuleInst *env_module_inst,
+					  const struct Module *module)
+{
+	size_t i;
+	struct FuncInst *tmp_func = NULL;
+	char *tmp_name = NULL;
+
+	for (i = 0; i < module->import_section.n_imports; ++i) {
+		struct ImportSectionImport *import =
+			&module->import_section.imports[i];
+		struct FuncType *type;
+		struct Export *export;
+
+		if (import->desc_type != IMPORT_DESC_TYPE_FUNC ||
+		    strcmp(import->module, "env") ||
+		    strncmp(import->name, "invoke_", strlen("invoke_")))
+			continue;
+
+		if (wasmjit_get_export(env_module_inst, import->name,
+				       IMPORT_DESC_TYPE_FUNC).func)
+			continue;
+
+		/* anything else is left for linking to reject */
+		type = &module->type_section.types[import->desc.functypeidx];
+		if (!type->n_inputs || type->input_types[0] != VALTYPE_I32)
+			continue;
+
+		tmp_func = _alloc_func(env_module_inst,
+				       &wasmjit_emscripten_invoke,
+				       type->output_type,
+				       type->n_inputs, type->input_types, 1);
+		if (!tmp_func)
+			goto error;
+		tmp_func->host_calls_table = 1;
+
+		tmp_name = strdup(import->name);
+		if (!tmp_name)
+			goto error;
+
+		if (!VECTOR_GROW(&env_module_inst->funcs, 1))
+			goto error;
+		env_module_inst->funcs.elts[env_module_inst->funcs.n_elts - 1] = tmp_func;
+		tmp_func = NULL;
+
+		if (!VECTOR_GROW(&env_module_inst->exports, 1))
+			goto error;
+		export = &env_module_inst->exports.elts[env_module_inst->exports.n_elts - 1];
+		export->name = tmp_name;
+		export->type = IMPORT_DESC_TYPE_FUNC;
+		export->value.func = env_module_inst->funcs.elts[env_module_inst->funcs.n_elts - 1];
+		tmp_name = NULL;
+	}
 
 	if (0) {
 	error:
 		if (tmp_func)
 			wasmjit_free_func_inst(tmp_func);
-		tmp_func = NULL;
+		if (tmp_name)
+			free(tmp_name);
+		return -1;
 	}
 
-	if (tmp_unmapped)
-		free(tmp_unmapped);
-
-	return tmp_func;
+	return 0;
 }
 
 struct NamedModule *wasmjit_instantiate_emscripten_runtime(uint32_t static_bump,
 							   int has_table,
 							   size_t tablemin,
 							   size_t tablemax,
+							   int shared_memory,
 							   size_t *amt)
 {
 	struct {
@@ -101,7 +189,6 @@ struct NamedModule *wasmjit_instantiate_emscripten_runtime(uint32_t static_bump,
 	struct FuncInst *start_func = NULL;
 	struct FuncInst **tmp_table_buf = NULL;
 	struct TableInst *tmp_table = NULL;
-	char *tmp_mem_buf = NULL;
 	struct MemInst *tmp_mem = NULL;
 	struct GlobalInst *tmp_global = NULL;
 	struct ModuleInst *module = NULL;
@@ -165,6 +252,8 @@ struct NamedModule *wasmjit_instantiate_emscripten_runtime(uint32_t static_bump,
 		tmp_func = alloc_func(module, _fptr, _output, n, inputs); \
 		if (!tmp_func)						\
 			goto error;					\
+		tmp_func->intrinsic = find_intrinsic(XSTR(CURRENT_MODULE), \
+						     #_name, &tmp_func->type); \
 		LVECTOR_GROW(&module->funcs, 1);			\
 		module->funcs.elts[module->funcs.n_elts - 1] = tmp_func; \
 		tmp_func = NULL;					\
@@ -178,7 +267,8 @@ struct NamedModule *wasmjit_instantiate_emscripten_runtime(uint32_t static_bump,
 #define DEFINE_WASM_START_FUNCTION(fptr)				\
 	do {								\
 		start_func = alloc_func(module, fptr, VALTYPE_NULL, 0, NULL); \
-		if (!start_func)					\
+		if (!start_func ||					\
+		    wasmjit_bind_host_function(start_func))		\
 			goto error;					\
 	} while (0);
 
@@ -213,12 +303,14 @@ struct NamedModule *wasmjit_instantiate_emscripten_runtime(uint32_t static_bump,
 
 #define DEFINE_WASM_MEMORY(_name, _min, _max)	\
 	{						\
-		tmp_mem_buf = calloc((_min) * WASM_PAGE_SIZE, 1);	\
-		if ((_min) && !tmp_mem_buf)				\
-			goto error;				\
 		tmp_mem = calloc(1, sizeof(struct MemInst));	\
-		tmp_mem->data = tmp_mem_buf;			\
-		tmp_mem_buf = NULL;				\
+		if (!tmp_mem)					\
+			goto error;				\
+		tmp_mem->data = shared_memory			\
+			? wasmjit_map_shared_memory((_min) * WASM_PAGE_SIZE) \
+			: wasmjit_map_memory((_min) * WASM_PAGE_SIZE);	\
+		if ((_min) && !tmp_mem->data)			\
+			goto error;				\
 		tmp_mem->size = (_min) * WASM_PAGE_SIZE;	\
 		tmp_mem->max = (_max) * WASM_PAGE_SIZE;		\
 		LVECTOR_GROW(&module->mems, 1);			\
@@ -290,10 +382,8 @@ struct NamedModule *wasmjit_instantiate_emscripten_runtime(uint32_t static_bump,
 		free(tmp_table->data);
 		free(tmp_table);
 	}
-	if (tmp_mem_buf)
-		free(tmp_mem_buf);
 	if (tmp_mem) {
-		free(tmp_mem->data);
+		wasmjit_unmap_memory(tmp_mem->data, tmp_mem->size);
 		free(tmp_mem);
 	}
 	if (tmp_global)
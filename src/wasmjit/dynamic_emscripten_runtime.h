@@ -25,12 +25,21 @@
 #ifndef __WASMJIT__DYNAMIC_EMSCRIPTEN_RUNTIME_H__
 #define __WASMJIT__DYNAMIC_EMSCRIPTEN_RUNTIME_H__
 
+#include <wasmjit/ast.h>
 #include <wasmjit/runtime.h>
 
 struct NamedModule *wasmjit_instantiate_emscripten_runtime(uint32_t static_bump,
 							   int has_table,
 							   size_t tablemin,
 							   size_t tablemax,
+							   int shared_memory,
 							   size_t *amt);
 
+/*
+  adds an invoke_* function to env_module_inst for each one module
+  imports, before it is instantiated
+*/
+int wasmjit_emscripten_add_invoke_imports(struct ModuleInst *env_module_inst,
+					  const struct Module *module);
+
 #endif
@@ -22,8 +22,17 @@
   SOFTWARE.
  */
 
+/* For memfd_create() and fallocate() */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <wasmjit/runtime.h>
 
+#include <wasmjit/perf_counters.h>
+#include <wasmjit/reclaim.h>
+#include <wasmjit/util.h>
+
 #include <wasmjit/sys.h>
 
 /* platform specific */
@@ -33,6 +42,7 @@
 #include <wasmjit/ktls.h>
 
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <linux/sched/task_stack.h>
 
 void *wasmjit_map_code_segment(size_t code_size)
@@ -55,6 +65,181 @@ int wasmjit_unmap_code_segment(void *code, size_t code_size)
 	return 1;
 }
 
+struct WasmJITSharedCode {
+	size_t n_pages;
+	struct page **pages;
+};
+
+struct WasmJITSharedCodeMapping {
+	void *data;
+	/* the code's pages followed by the table's */
+	size_t n_pages;
+	struct page **pages;
+};
+
+size_t wasmjit_shared_code_refs_offset(size_t code_size)
+{
+	return PAGE_ALIGN(code_size);
+}
+
+/* a zeroed page holding the size bytes at buf */
+static struct page *alloc_filled_page(const char *buf, size_t size)
+{
+	struct page *page;
+
+	page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (page)
+		memcpy(page_address(page), buf, MMIN(size, PAGE_SIZE));
+	return page;
+}
+
+struct WasmJITSharedCode *wasmjit_create_shared_code(const void *code,
+						     size_t code_size)
+{
+	struct WasmJITSharedCode *shared;
+	size_t i;
+
+	shared = calloc(1, sizeof(*shared));
+	if (!shared)
+		return NULL;
+
+	shared->n_pages = DIV_ROUND_UP(code_size, PAGE_SIZE);
+	shared->pages = calloc(shared->n_pages, sizeof(shared->pages[0]));
+	if (!shared->pages)
+		goto error;
+
+	for (i = 0; i < shared->n_pages; ++i) {
+		shared->pages[i] =
+			alloc_filled_page((const char *) code + i * PAGE_SIZE,
+					  code_size - i * PAGE_SIZE);
+		if (!shared->pages[i])
+			goto error;
+	}
+
+	return shared;
+
+ error:
+	wasmjit_free_shared_code(shared);
+	return NULL;
+}
+
+void wasmjit_free_shared_code(struct WasmJITSharedCode *shared)
+{
+	size_t i;
+
+	/* mappings hold their own references to the pages */
+	if (shared->pages) {
+		for (i = 0; i < shared->n_pages; ++i) {
+			if (shared->pages[i])
+				put_page(shared->pages[i]);
+		}
+		free(shared->pages);
+	}
+	free(shared);
+}
+
+void *wasmjit_map_shared_code(const struct WasmJITSharedCode *shared,
+			      const void *refs, size_t refs_size,
+			      struct WasmJITSharedCodeMapping **out)
+{
+	struct WasmJITSharedCodeMapping *mapping;
+	size_t i;
+
+	mapping = calloc(1, sizeof(*mapping));
+	if (!mapping)
+		return NULL;
+
+	mapping->n_pages = shared->n_pages + DIV_ROUND_UP(refs_size, PAGE_SIZE);
+	mapping->pages = calloc(mapping->n_pages, sizeof(mapping->pages[0]));
+	if (!mapping->pages)
+		goto error;
+
+	for (i = 0; i < shared->n_pages; ++i) {
+		get_page(shared->pages[i]);
+		mapping->pages[i] = shared->pages[i];
+	}
+
+	for (; i < mapping->n_pages; ++i) {
+		size_t offset = (i - shared->n_pages) * PAGE_SIZE;
+
+		mapping->pages[i] = alloc_filled_page((const char *) refs + offset,
+						      refs_size - offset);
+		if (!mapping->pages[i])
+			goto error;
+	}
+
+	mapping->data = vmap(mapping->pages, mapping->n_pages, VM_MAP,
+			     PAGE_KERNEL_ROX);
+	if (!mapping->data)
+		goto error;
+
+	*out = mapping;
+	return mapping->data;
+
+ error:
+	wasmjit_unmap_shared_code(mapping);
+	return NULL;
+}
+
+void wasmjit_unmap_shared_code(struct WasmJITSharedCodeMapping *mapping)
+{
+	size_t i;
+
+	if (mapping->data)
+		vunmap(mapping->data);
+	if (mapping->pages) {
+		for (i = 0; i < mapping->n_pages; ++i) {
+			if (mapping->pages[i])
+				put_page(mapping->pages[i]);
+		}
+		free(mapping->pages);
+	}
+	free(mapping);
+}
+
+void *wasmjit_map_memory(size_t size)
+{
+	void *data;
+
+	if (!size)
+		return NULL;
+
+	data = wasmjit_reclaim_memory(size);
+	if (data)
+		return data;
+
+	/* zeroed and VM_USERMAP, so /dev/wasm can map it */
+	return vmalloc_user(size);
+}
+
+int wasmjit_unmap_memory(void *data, size_t size)
+{
+	(void)size;
+	vfree(data);
+	return 1;
+}
+
+int wasmjit_discard_memory(void *data, size_t size)
+{
+	/* vmalloc areas can't have their pages swapped for the zero
+	   page with exported interfaces */
+	(void)data;
+	(void)size;
+	return 0;
+}
+
+void *wasmjit_map_shared_memory(size_t size)
+{
+	/* there's no memfd but /dev/wasm can map any linear memory */
+	return wasmjit_map_memory(size);
+}
+
+int wasmjit_shared_memory_fd(const void *data)
+{
+	(void)data;
+	return -1;
+}
+
 jmp_buf *wasmjit_get_jmp_buf(void)
 {
 	return wasmjit_get_ktls()->jmp_buf;
@@ -81,7 +266,35 @@ int wasmjit_set_stack_top(void *stack_top)
 
 #include <wasmjit/tls.h>
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <unistd.h>
+
+struct SharedMemory {
+	char *data;
+	size_t size;
+	int fd;
+	struct SharedMemory *next;
+};
+
+/* instances may be freed by the reclaim worker */
+static pthread_mutex_t shared_memories_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct SharedMemory *shared_memories;
+
+/* must be called with shared_memories_mutex held */
+static struct SharedMemory **find_shared_memory(const void *data)
+{
+	struct SharedMemory **entry;
+
+	for (entry = &shared_memories; *entry; entry = &(*entry)->next) {
+		if ((const char *) data >= (*entry)->data &&
+		    (const char *) data < (*entry)->data + (*entry)->size)
+			break;
+	}
+
+	return entry;
+}
 
 void *wasmjit_map_code_segment(size_t code_size)
 {
@@ -104,6 +317,274 @@ int wasmjit_unmap_code_segment(void *code, size_t code_size)
 	return !munmap(code, code_size);
 }
 
+struct WasmJITSharedCode {
+	/* memfd holding the code, -1 where there's none */
+	int fd;
+	/* otherwise each instance maps a private copy of this */
+	char *copy;
+	size_t size;
+};
+
+struct WasmJITSharedCodeMapping {
+	char *data;
+	size_t size;
+};
+
+static size_t page_align(size_t size)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+
+	return (size + page_size - 1) & ~(page_size - 1);
+}
+
+size_t wasmjit_shared_code_refs_offset(size_t code_size)
+{
+	return page_align(code_size);
+}
+
+struct WasmJITSharedCode *wasmjit_create_shared_code(const void *code,
+						     size_t code_size)
+{
+	struct WasmJITSharedCode *shared;
+
+	shared = calloc(1, sizeof(*shared));
+	if (!shared)
+		return NULL;
+	shared->fd = -1;
+	shared->size = code_size;
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	shared->fd = memfd_create("wasmjit-code", MFD_CLOEXEC);
+	if (shared->fd >= 0) {
+		void *data;
+
+		if (ftruncate(shared->fd, code_size))
+			goto error;
+
+		data = mmap(NULL, code_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, shared->fd, 0);
+		if (data == MAP_FAILED)
+			goto error;
+		memcpy(data, code, code_size);
+		(void)munmap(data, code_size);
+
+		return shared;
+	}
+#endif
+
+	shared->copy = malloc(code_size);
+	if (!shared->copy)
+		goto error;
+	memcpy(shared->copy, code, code_size);
+
+	return shared;
+
+ error:
+	wasmjit_free_shared_code(shared);
+	return NULL;
+}
+
+void wasmjit_free_shared_code(struct WasmJITSharedCode *shared)
+{
+	if (shared->fd >= 0)
+		(void)close(shared->fd);
+	if (shared->copy)
+		free(shared->copy);
+	free(shared);
+}
+
+void *wasmjit_map_shared_code(const struct WasmJITSharedCode *shared,
+			      const void *refs, size_t refs_size,
+			      struct WasmJITSharedCodeMapping **out)
+{
+	struct WasmJITSharedCodeMapping *mapping;
+	size_t refs_offset;
+	void *data;
+
+	mapping = malloc(sizeof(*mapping));
+	if (!mapping)
+		return NULL;
+
+	refs_offset = page_align(shared->size);
+	mapping->size = refs_offset + page_align(refs_size);
+	data = mmap(NULL, mapping->size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED) {
+		free(mapping);
+		return NULL;
+	}
+	mapping->data = data;
+
+	if (shared->fd >= 0) {
+		if (mmap(data, refs_offset, PROT_READ | PROT_EXEC,
+			 MAP_SHARED | MAP_FIXED, shared->fd, 0) == MAP_FAILED)
+			goto error;
+	} else {
+		memcpy(data, shared->copy, shared->size);
+		if (mprotect(data, refs_offset, PROT_READ | PROT_EXEC))
+			goto error;
+	}
+
+	if (refs_size) {
+		memcpy(mapping->data + refs_offset, refs, refs_size);
+		if (mprotect(mapping->data + refs_offset,
+			     mapping->size - refs_offset, PROT_READ))
+			goto error;
+	}
+
+	*out = mapping;
+	return data;
+
+ error:
+	wasmjit_unmap_shared_code(mapping);
+	return NULL;
+}
+
+void wasmjit_unmap_shared_code(struct WasmJITSharedCodeMapping *mapping)
+{
+	(void)munmap(mapping->data, mapping->size);
+	free(mapping);
+}
+
+/* page alignment lets aligned guest buffers be used with O_DIRECT */
+void *wasmjit_map_memory(size_t size)
+{
+	void *data;
+
+	if (!size)
+		return NULL;
+
+	data = wasmjit_reclaim_memory(size);
+	if (data)
+		return data;
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		return NULL;
+	return data;
+}
+
+int wasmjit_unmap_memory(void *data, size_t size)
+{
+	struct SharedMemory **entry, *shared = NULL;
+
+	if (!data)
+		return 1;
+
+	pthread_mutex_lock(&shared_memories_mutex);
+	entry = find_shared_memory(data);
+	if (*entry) {
+		shared = *entry;
+		*entry = shared->next;
+	}
+	pthread_mutex_unlock(&shared_memories_mutex);
+
+	if (shared) {
+		(void)close(shared->fd);
+		free(shared);
+	}
+
+	return !munmap(data, size);
+}
+
+void *wasmjit_map_shared_memory(size_t size)
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	struct SharedMemory *shared;
+	void *data = MAP_FAILED;
+	int fd = -1;
+
+	if (!size)
+		return NULL;
+
+	shared = malloc(sizeof(*shared));
+	if (!shared)
+		goto error;
+
+	/* holders that should inherit it across exec clear FD_CLOEXEC */
+	fd = memfd_create("wasmjit-memory", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, size))
+		goto error;
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+		goto error;
+
+	shared->data = data;
+	shared->size = size;
+	shared->fd = fd;
+
+	pthread_mutex_lock(&shared_memories_mutex);
+	shared->next = shared_memories;
+	shared_memories = shared;
+	pthread_mutex_unlock(&shared_memories_mutex);
+
+	return data;
+
+ error:
+	if (fd >= 0)
+		(void)close(fd);
+	if (shared)
+		free(shared);
+	return NULL;
+#else
+	(void)size;
+	return NULL;
+#endif
+}
+
+int wasmjit_shared_memory_fd(const void *data)
+{
+	struct SharedMemory *shared;
+	int fd;
+
+	pthread_mutex_lock(&shared_memories_mutex);
+	shared = *find_shared_memory(data);
+	fd = shared ? shared->fd : -1;
+	pthread_mutex_unlock(&shared_memories_mutex);
+
+	return fd;
+}
+
+int wasmjit_discard_memory(void *data, size_t size)
+{
+	uintptr_t page_size, start, end;
+	void *ret;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	start = ((uintptr_t) data + page_size - 1) & ~(page_size - 1);
+	end = ((uintptr_t) data + size) & ~(page_size - 1);
+	if (start >= end)
+		return 1;
+
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+	{
+		struct SharedMemory *shared;
+		int punched = -1;
+
+		/* a private mapping would cut other processes off */
+		pthread_mutex_lock(&shared_memories_mutex);
+		shared = *find_shared_memory((void *) start);
+		if (shared)
+			punched = fallocate(shared->fd,
+					    FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+					    start - (uintptr_t) shared->data,
+					    end - start);
+		pthread_mutex_unlock(&shared_memories_mutex);
+
+		if (shared)
+			return !punched;
+	}
+#endif
+
+	/* MADV_DONTNEED would bring back the file's contents if memory
+	   was mapped from a checkpoint, a fresh mapping is always zero */
+	ret = mmap((void *) start, end - start, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	return ret != MAP_FAILED;
+}
+
 wasmjit_tls_key_t jmp_buf_key;
 
 __attribute__((constructor))
@@ -157,9 +638,9 @@ void wasmjit_trap(int reason)
 	longjmp(*wasmjit_get_jmp_buf(), reason);
 }
 
-int wasmjit_invoke_function(struct FuncInst *funcinst,
-			    union ValueUnion *values,
-			    union ValueUnion *out)
+static int invoke_function(struct FuncInst *funcinst,
+			   union ValueUnion *values,
+			   union ValueUnion *out)
 {
 	union ValueUnion lout;
 	int ret;
@@ -183,3 +664,35 @@ int wasmjit_invoke_function(struct FuncInst *funcinst,
 
 	return ret;
 }
+
+static int invoke_function_counted(struct FuncInst *funcinst,
+				   union ValueUnion *values,
+				   union ValueUnion *out)
+{
+	uint64_t before[WASMJIT_PERF_N_COUNTERS], after[WASMJIT_PERF_N_COUNTERS];
+	uint32_t valid;
+	int ret;
+
+	if (!funcinst->perf_stats) {
+		funcinst->perf_stats = calloc(1, sizeof(*funcinst->perf_stats));
+		if (!funcinst->perf_stats)
+			return invoke_function(funcinst, values, out);
+	}
+
+	valid = wasmjit_perf_counters_read(before);
+	ret = invoke_function(funcinst, values, out);
+	valid &= wasmjit_perf_counters_read(after);
+
+	wasmjit_perf_stats_add(funcinst->perf_stats, valid, before, after);
+
+	return ret;
+}
+
+int wasmjit_invoke_function(struct FuncInst *funcinst,
+			    union ValueUnion *values,
+			    union ValueUnion *out)
+{
+	if (wasmjit_perf_counters_enabled())
+		return invoke_function_counted(funcinst, values, out);
+	return invoke_function(funcinst, values, out);
+}
@@ -22,7 +22,10 @@
   SOFTWARE.
  */
 
+#include <wasmjit/c_source.h>
 #include <wasmjit/compile.h>
+#include <wasmjit/elf_relocatable.h>
+#include <wasmjit/parse.h>
 #include <wasmjit/vector.h>
 #include <wasmjit/util.h>
 #include <wasmjit/runtime.h>
@@ -116,7 +119,8 @@ static void read_constant_expression(struct Value *value,
 
 
 void *wasmjit_output_elf_relocatable(const char *module_name,
-				     const struct Module *module,
+				     struct Module *module,
+				     uint32_t flags,
 				     size_t *outsize)
 {
 	enum {
@@ -222,12 +226,14 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 		resolve_indirect_call_symbol,
 		trap_symbol,
 		func_code_start,
+		external_code_start = 0,
 		n_imported_funcs, n_imported_tables,
 		n_imported_mems, n_imported_globals,
 		funcs_offset, tables_offset,
 		mems_offset, globals_offset,
 		types_symbol_start;
 	size_t bss_size = 0;
+	int external_code = flags & WASMJIT_OUTPUT_ELF_RELOCATABLE_FLAGS_EXTERNAL_CODE;
 	struct ModuleTypes module_types;
 	struct _ObjectIter {
 		size_t *inst_start;
@@ -834,6 +840,15 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 		module_types.globaltypes[i] = module_globals.elts[i].type;
 	}
 
+	if (!external_code && !read_codes(&module->code_section))
+		goto error;
+
+	/* external code is only defined by global symbols added later */
+#define CODE_SYMBOL(i)							\
+	(external_code ? external_code_start + (i) : func_code_start + (i) * 2)
+#define INVOKER_SYMBOL(i)						\
+	(external_code ? func_code_start + (i) : func_code_start + (i) * 2 + 1)
+
 	func_code_start = symbols->n_elts;
 	for (i = 0; i < module->function_section.n_typeidxs; ++i) {
 		struct FuncType *ft = &module->type_section.types[module->function_section.typeidxs[i]];
@@ -851,6 +866,9 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 		   the invoker */
 		LVECTOR_GROW(memrefs, 1);
 
+		if (external_code)
+			goto invoker;
+
 		code = wasmjit_compile_function(module->type_section.types,
 						&module_types,
 						ft,
@@ -875,6 +893,7 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 
 		OUT(code, code_size);
 
+	invoker:
 		code = wasmjit_compile_invoker_offset(ft,
 						      &memrefs->elts[0].code_offset,
 						      &code_size,
@@ -896,23 +915,6 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 		OUT(code, code_size);
 	}
 
-	/* add code references */
-	for (i = n_imported_funcs; i < module_funcs.n_elts; ++i) {
-		size_t off = module_funcs.elts[i].offset;
-
-		ADD_DATA_PTR_RELOCATION_RAW(off +
-					    offsetof(struct FuncInst, module_inst),
-					    module_symbol);
-
-		ADD_DATA_PTR_RELOCATION_RAW(off +
-					    offsetof(struct FuncInst, compiled_code),
-					    func_code_start + (i - n_imported_funcs) * 2);
-
-		ADD_DATA_PTR_RELOCATION_RAW(off +
-					    offsetof(struct FuncInst, invoker),
-					    func_code_start + (i - n_imported_funcs) * 2 + 1);
-	}
-
 	text_section_end = output->n_elts;
 
 	/* add bss references */
@@ -1003,6 +1005,24 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 			goto error;
 	}
 
+	if (external_code) {
+		external_code_start = symbols->n_elts;
+		for (i = 0; i < module->function_section.n_typeidxs; ++i) {
+			size_t string_offset;
+			int ret;
+
+			string_offset = strtab->n_elts;
+			ret = snprintf(buf, sizeof(buf),
+				       WASMJIT_C_SOURCE_CODE_SYMBOL_FORMAT,
+				       module_name, i);
+			if (!output_buf(strtab, buf, ret + 1))
+				goto error;
+			if (!add_symbol(symbols, string_offset, 0, STB_GLOBAL,
+					0, 0, 0, 0))
+				goto error;
+		}
+	}
+
 	/* add imported symbols */
 #define ADD_IMPORTED_SYMBOLS(_name)		\
 	do {							\
@@ -1053,6 +1073,24 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 
 	/* we now have all module symbols, add back relocations */
 
+	/* add code references */
+	for (i = n_imported_funcs; i < module_funcs.n_elts; ++i) {
+		size_t off = module_funcs.elts[i].offset;
+
+		ADD_DATA_PTR_RELOCATION_RAW(off +
+					    offsetof(struct FuncInst, module_inst),
+					    module_symbol);
+
+		ADD_DATA_PTR_RELOCATION_RAW(off +
+					    offsetof(struct FuncInst, compiled_code),
+					    CODE_SYMBOL(i - n_imported_funcs));
+
+		ADD_DATA_PTR_RELOCATION_RAW(off +
+					    offsetof(struct FuncInst, invoker),
+					    INVOKER_SYMBOL(i - n_imported_funcs));
+	}
+
+
 #define ADD_REF_ARRAY_RELOCATIONS(_name, _type)			\
 	do {								\
 		size_t ref_offset = (_name ## _offset);\
@@ -1144,10 +1182,11 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 	/* add code relocations */
 	for (i = 0; i < module->function_section.n_typeidxs; ++i) {
 		size_t j;
-		size_t offset = symbols->elts[func_code_start + i * 2].st_value + text_section_start;
+		size_t offset = symbols->elts[CODE_SYMBOL(i)].st_value + text_section_start;
 		struct MemoryReferences *memrefs = &code_memrefs.elts[i];
 
-		/* NB: j = 1 to skip memref used for invoker */
+		/* NB: j = 1 to skip memref used for invoker,
+		   external code has no other memrefs */
 		for (j = 1; j < memrefs->n_elts; ++j) {
 			struct MemoryReferenceElt *elt =
 				&memrefs->elts[j];
@@ -1186,9 +1225,9 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 
 		/* add invoker relocation */
 		{
-			offset = symbols->elts[func_code_start + i * 2 + 1].st_value + text_section_start;
+			offset = symbols->elts[INVOKER_SYMBOL(i)].st_value + text_section_start;
 			struct MemoryReferenceElt *elt = &memrefs->elts[0];
-			size_t symidx = func_code_start + i * 2;
+			size_t symidx = CODE_SYMBOL(i);
 			ADD_FUNC_PTR_RELOCATION_RAW(offset + elt->code_offset,
 						    symidx, 0);
 		}
@@ -1552,10 +1591,12 @@ void *wasmjit_output_elf_relocatable(const char *module_name,
 #else
 
 void *wasmjit_output_elf_relocatable(const char *module_name,
-                                     const struct Module *module,
+                                     struct Module *module,
+                                     uint32_t flags,
                                      size_t *outsize) {
 	(void)module_name;
 	(void)module;
+	(void)flags;
 	(void)outsize;
 	return NULL;
 }
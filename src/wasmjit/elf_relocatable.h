@@ -27,8 +27,13 @@
 
 #include <wasmjit/ast.h>
 
+/* function bodies are left undefined, to be provided by
+   the output of wasmjit_output_c_source() */
+#define WASMJIT_OUTPUT_ELF_RELOCATABLE_FLAGS_EXTERNAL_CODE 1
+
 void *wasmjit_output_elf_relocatable(const char *module_name,
-                                     const struct Module *module,
+                                     struct Module *module,
+                                     uint32_t flags,
                                      size_t *outsize);
 
 #endif
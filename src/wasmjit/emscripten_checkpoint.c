@@ -0,0 +1,584 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/emscripten_checkpoint.h>
+
+#include <wasmjit/runtime.h>
+#include <wasmjit/emscripten_runtime.h>
+#include <wasmjit/emscripten_memfs.h>
+#include <wasmjit/util.h>
+#include <wasmjit/sys.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+/*
+  The file holds a header, the instance's own globals, the table as
+  function indices, the regular files and directories the guest had
+  open (on the host or in a mounted archive), then linear memory at an aligned offset so it can be mapped
+  privately. It is only meant to be restored on the same host by the
+  same module, so everything is stored in host byte order.
+ */
+
+#define CHECKPOINT_MAGIC "WJCKPT\0\0"
+#define CHECKPOINT_VERSION 3
+/* covers any host page size */
+#define CHECKPOINT_MEMORY_ALIGN 65536
+
+/* ___buildEnvironment() had allocated the environment */
+#define CHECKPOINT_FLAGS_ENVIRONMENT_BUILT 1
+
+#define CHECKPOINT_TABLE_NULL (-1)
+/* host functions are stored as -2 - index into the env module */
+#define CHECKPOINT_TABLE_HOST(idx) (-2 - (int64_t) (idx))
+
+struct CheckpointHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_globals;
+	uint64_t table_length;
+	uint32_t n_files;
+	uint32_t flags;
+	uint64_t memory_size;
+	uint64_t memory_offset;
+	char resume_export[256];
+};
+
+struct CheckpointGlobal {
+	uint32_t type;
+	uint32_t reserved;
+	union ValueUnion value;
+};
+
+struct CheckpointFile {
+	int32_t fd;
+	int32_t flags;
+	int64_t offset;
+	char path[PATH_MAX];
+};
+
+static const char *checkpoint_path;
+
+void wasmjit_emscripten_set_checkpoint_path(const char *path)
+{
+	checkpoint_path = path;
+}
+
+static struct TableInst *module_table(struct ModuleInst *module_inst)
+{
+	if (!module_inst->tables.n_elts)
+		return NULL;
+	return module_inst->tables.elts[0];
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const char *p = buf;
+
+	while (size) {
+		ssize_t ret = write(fd, p, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		p += ret;
+		size -= ret;
+	}
+
+	return 1;
+}
+
+static int read_all(int fd, void *buf, size_t size)
+{
+	char *p = buf;
+
+	while (size) {
+		ssize_t ret = read(fd, p, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		if (!ret) {
+			errno = EINVAL;
+			return 0;
+		}
+		p += ret;
+		size -= ret;
+	}
+
+	return 1;
+}
+
+static int64_t table_entry_index(struct FuncInst *funcinst,
+				 struct ModuleInst *module_inst,
+				 struct ModuleInst *env_module_inst)
+{
+	size_t i;
+
+	if (!funcinst)
+		return CHECKPOINT_TABLE_NULL;
+
+	for (i = 0; i < module_inst->funcs.n_elts; ++i) {
+		if (module_inst->funcs.elts[i] == funcinst)
+			return i;
+	}
+
+	for (i = 0; i < env_module_inst->funcs.n_elts; ++i) {
+		if (env_module_inst->funcs.elts[i] == funcinst)
+			return CHECKPOINT_TABLE_HOST(i);
+	}
+
+	return CHECKPOINT_TABLE_NULL;
+}
+
+#ifdef __linux__
+
+static int fd_path(int fd, char *path, size_t size)
+{
+	char link[64];
+	ssize_t len;
+
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	len = readlink(link, path, size - 1);
+	if (len < 0)
+		return 0;
+	path[len] = '\0';
+
+	return 1;
+}
+
+#else
+
+static int fd_path(int fd, char *path, size_t size)
+{
+	(void)fd;
+	(void)path;
+	(void)size;
+	return 0;
+}
+
+#endif
+
+/*
+  the regular files and directories the guest opened, files of the
+  runtime itself (traces, shared memory) aren't the guest's to restore.
+  archive files are saved by their guest path
+*/
+static int collect_files(struct EmscriptenContext *ctx,
+			 struct CheckpointFile **files, uint32_t *n_files)
+{
+	struct CheckpointFile *new_files;
+	size_t fd;
+
+	*files = NULL;
+	*n_files = 0;
+
+	for (fd = 0; fd < ctx->opened_fds_size * 8; ++fd) {
+		struct CheckpointFile *file;
+		struct stat st;
+
+		if (!wasmjit_emscripten_fd_is_tracked(ctx, fd))
+			continue;
+
+		if (fstat(fd, &st) || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)))
+			continue;
+
+		new_files = realloc(*files, (*n_files + 1) * sizeof(**files));
+		if (!new_files)
+			goto error;
+		*files = new_files;
+
+		file = &(*files)[*n_files];
+		memset(file, 0, sizeof(*file));
+		file->fd = fd;
+		file->flags = fcntl(fd, F_GETFL);
+		file->offset = lseek(fd, 0, SEEK_CUR);
+
+		if (file->flags < 0 ||
+		    !fd_path(fd, file->path, sizeof(file->path)))
+			continue;
+
+		*n_files += 1;
+	}
+
+	if (ctx->memfs) {
+		const char *path;
+		uint64_t pos;
+		long mfd;
+
+		for (mfd = WASMJIT_MEMFS_FD_BASE;
+		     (mfd = wasmjit_memfs_next_file(ctx->memfs, mfd,
+						    &path, &pos)) >= 0;
+		     ++mfd) {
+			struct CheckpointFile *file;
+
+			if (strlen(path) >= sizeof(file->path))
+				continue;
+
+			new_files = realloc(*files, (*n_files + 1) * sizeof(**files));
+			if (!new_files)
+				goto error;
+			*files = new_files;
+
+			file = &(*files)[*n_files];
+			memset(file, 0, sizeof(*file));
+			file->fd = mfd;
+			file->flags = O_RDONLY;
+			file->offset = pos;
+			strcpy(file->path, path);
+
+			*n_files += 1;
+		}
+	}
+
+	return 1;
+
+ error:
+	free(*files);
+	*files = NULL;
+	*n_files = 0;
+	return 0;
+}
+
+long wasmjit_emscripten_checkpoint(struct EmscriptenContext *ctx,
+				   struct ModuleInst *module_inst,
+				   struct ModuleInst *env_module_inst,
+				   struct MemInst *meminst,
+				   const char *resume_export)
+{
+	struct CheckpointHeader header;
+	struct CheckpointFile *files = NULL;
+	struct TableInst *table;
+	char tmp_path[PATH_MAX];
+	size_t i;
+	int fd = -1, saved_errno;
+	long ret;
+
+	if (!checkpoint_path)
+		return -ENOSYS;
+
+	if (ctx->side_modules_loaded)
+		return -EOPNOTSUPP;
+
+	if (strlen(resume_export) >= sizeof(header.resume_export))
+		return -ENAMETOOLONG;
+
+	if ((size_t) snprintf(tmp_path, sizeof(tmp_path), "%s.tmp",
+			      checkpoint_path) >= sizeof(tmp_path))
+		return -ENAMETOOLONG;
+
+	table = module_table(module_inst);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.n_globals = module_inst->globals.n_elts - module_inst->n_imported_globals;
+	header.table_length = table ? table->length : 0;
+	header.memory_size = meminst->size;
+	strcpy(header.resume_export, resume_export);
+	if (ctx->buildEnvironmentCalled)
+		header.flags |= CHECKPOINT_FLAGS_ENVIRONMENT_BUILT;
+
+	if (!collect_files(ctx, &files, &header.n_files))
+		return -ENOMEM;
+
+	header.memory_offset = sizeof(header) +
+		header.n_globals * sizeof(struct CheckpointGlobal) +
+		header.table_length * sizeof(int64_t) +
+		header.n_files * sizeof(struct CheckpointFile);
+	header.memory_offset = (header.memory_offset + CHECKPOINT_MEMORY_ALIGN - 1) &
+		~((uint64_t) CHECKPOINT_MEMORY_ALIGN - 1);
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto error;
+
+	if (!write_all(fd, &header, sizeof(header)))
+		goto error;
+
+	for (i = module_inst->n_imported_globals; i < module_inst->globals.n_elts; ++i) {
+		struct GlobalInst *global = module_inst->globals.elts[i];
+		struct CheckpointGlobal cglobal;
+
+		memset(&cglobal, 0, sizeof(cglobal));
+		cglobal.type = global->value.type;
+		cglobal.value = global->value.data;
+
+		if (!write_all(fd, &cglobal, sizeof(cglobal)))
+			goto error;
+	}
+
+	for (i = 0; i < header.table_length; ++i) {
+		int64_t idx = table_entry_index(table->data[i], module_inst,
+						env_module_inst);
+		if (!write_all(fd, &idx, sizeof(idx)))
+			goto error;
+	}
+
+	if (header.n_files &&
+	    !write_all(fd, files, header.n_files * sizeof(files[0])))
+		goto error;
+
+	if (lseek(fd, header.memory_offset, SEEK_SET) < 0 ||
+	    !write_all(fd, meminst->data, meminst->size))
+		goto error;
+
+	if (close(fd)) {
+		fd = -1;
+		goto error;
+	}
+	fd = -1;
+
+	if (rename(tmp_path, checkpoint_path))
+		goto error;
+
+	ret = 0;
+
+	if (0) {
+	error:
+		saved_errno = errno;
+		if (fd >= 0)
+			(void)close(fd);
+		(void)unlink(tmp_path);
+		ret = -saved_errno;
+	}
+
+	free(files);
+
+	return ret;
+}
+
+/* file->fd must be free, the guest has its number in memory */
+static int restore_file(struct EmscriptenContext *ctx,
+			struct CheckpointFile *file)
+{
+	int fd;
+
+	/* the resumed run has to mount the same archive */
+	if (WASMJIT_MEMFS_IS_FD(file->fd)) {
+		long ret;
+
+		if (!ctx->memfs || file->offset < 0) {
+			errno = ENOENT;
+			return 0;
+		}
+
+		ret = wasmjit_memfs_reopen(ctx->memfs, file->fd, file->path,
+					   file->offset);
+		if (ret) {
+			errno = -ret;
+			return 0;
+		}
+
+		return 1;
+	}
+
+	if (fcntl(file->fd, F_GETFD) != -1) {
+		errno = EBUSY;
+		return 0;
+	}
+
+	fd = open(file->path, file->flags & ~(O_CREAT | O_EXCL | O_TRUNC));
+	if (fd < 0)
+		return 0;
+
+	if (fd != file->fd) {
+		if (dup2(fd, file->fd) < 0) {
+			(void)close(fd);
+			return 0;
+		}
+		(void)close(fd);
+	}
+
+	if ((!(file->flags & O_APPEND) && file->offset >= 0 &&
+	     lseek(file->fd, file->offset, SEEK_SET) < 0) ||
+	    wasmjit_emscripten_track_fd(ctx, file->fd)) {
+		(void)close(file->fd);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void close_restored_file(struct EmscriptenContext *ctx,
+				struct CheckpointFile *file)
+{
+	if (WASMJIT_MEMFS_IS_FD(file->fd))
+		(void)wasmjit_memfs_close(ctx->memfs, file->fd);
+	else
+		(void)close(file->fd);
+}
+
+int wasmjit_emscripten_checkpoint_restore(const char *path,
+					  struct EmscriptenContext *ctx,
+					  struct ModuleInst *module_inst,
+					  struct ModuleInst *env_module_inst,
+					  struct MemInst *meminst,
+					  struct FuncInst **resume_inst)
+{
+	struct CheckpointHeader header;
+	struct CheckpointFile *files = NULL;
+	struct TableInst *table;
+	struct FuncInst *resume;
+	size_t i, n_restored = 0;
+	int fd, ret, max_fd;
+	void *mapped;
+
+	/* the table would lose the side modules' entries */
+	if (ctx->side_modules_loaded)
+		return -1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (!read_all(fd, &header, sizeof(header)))
+		goto error;
+
+	table = module_table(module_inst);
+
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) ||
+	    header.version != CHECKPOINT_VERSION ||
+	    header.n_globals != module_inst->globals.n_elts - module_inst->n_imported_globals ||
+	    header.table_length != (table ? table->length : 0) ||
+	    header.memory_size != meminst->size ||
+	    header.memory_offset % CHECKPOINT_MEMORY_ALIGN ||
+	    memchr(header.resume_export, '\0', sizeof(header.resume_export)) == NULL)
+		goto error;
+
+	resume = wasmjit_get_export(module_inst, header.resume_export,
+				    IMPORT_DESC_TYPE_FUNC).func;
+	if (!resume || resume->type.n_inputs)
+		goto error;
+
+	for (i = module_inst->n_imported_globals; i < module_inst->globals.n_elts; ++i) {
+		struct GlobalInst *global = module_inst->globals.elts[i];
+		struct CheckpointGlobal cglobal;
+
+		if (!read_all(fd, &cglobal, sizeof(cglobal)) ||
+		    cglobal.type != global->value.type)
+			goto error;
+
+		global->value.data = cglobal.value;
+	}
+
+	for (i = 0; i < header.table_length; ++i) {
+		int64_t idx;
+		struct FuncInst *funcinst;
+
+		if (!read_all(fd, &idx, sizeof(idx)))
+			goto error;
+
+		if (idx == CHECKPOINT_TABLE_NULL) {
+			funcinst = NULL;
+		} else if (idx >= 0) {
+			if ((uint64_t) idx >= module_inst->funcs.n_elts)
+				goto error;
+			funcinst = module_inst->funcs.elts[idx];
+		} else {
+			idx = -2 - idx;
+			if ((uint64_t) idx >= env_module_inst->funcs.n_elts)
+				goto error;
+			funcinst = env_module_inst->funcs.elts[idx];
+		}
+
+		table->data[i] = funcinst;
+	}
+
+	if (header.n_files) {
+		files = calloc(header.n_files, sizeof(files[0]));
+		if (!files ||
+		    !read_all(fd, files, header.n_files * sizeof(files[0])))
+			goto error;
+	}
+
+	max_fd = -1;
+	for (i = 0; i < header.n_files; ++i) {
+		if (files[i].fd < 0 ||
+		    memchr(files[i].path, '\0', sizeof(files[i].path)) == NULL)
+			goto error;
+		if (!WASMJIT_MEMFS_IS_FD(files[i].fd))
+			max_fd = MMAX(max_fd, files[i].fd);
+	}
+
+	/* our own fd mustn't take a number the guest is using */
+	if (fd <= max_fd) {
+		int new_fd = fcntl(fd, F_DUPFD_CLOEXEC, max_fd + 1);
+		if (new_fd < 0)
+			goto error;
+		(void)close(fd);
+		fd = new_fd;
+	}
+
+	for (i = 0; i < header.n_files; ++i) {
+		if (!restore_file(ctx, &files[i]))
+			goto error;
+		n_restored++;
+	}
+
+	ctx->buildEnvironmentCalled =
+		!!(header.flags & CHECKPOINT_FLAGS_ENVIRONMENT_BUILT);
+
+	/*
+	  pages are only copied once the guest writes to them. shared
+	  memory must stay on its memfd, so it's read in instead
+	*/
+	mapped = MAP_FAILED;
+	if (wasmjit_shared_memory_fd(meminst->data) < 0)
+		mapped = mmap(meminst->data, meminst->size,
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_FIXED, fd, header.memory_offset);
+	if (mapped == MAP_FAILED &&
+	    (lseek(fd, header.memory_offset, SEEK_SET) < 0 ||
+	     !read_all(fd, meminst->data, meminst->size)))
+		goto error;
+
+	*resume_inst = resume;
+	ret = 0;
+
+	if (0) {
+	error:
+		ret = -1;
+
+		for (i = 0; i < n_restored; ++i)
+			close_restored_file(ctx, &files[i]);
+	}
+
+	free(files);
+	(void)close(fd);
+
+	return ret;
+}
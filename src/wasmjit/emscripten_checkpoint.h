@@ -0,0 +1,64 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__EMSCRIPTEN_CHECKPOINT_H__
+#define __WASMJIT__EMSCRIPTEN_CHECKPOINT_H__
+
+#include <wasmjit/sys.h>
+
+/*
+  warm checkpoints: the guest calls wasmjit_checkpoint(resume_export)
+  once it is warmed up, later instances map the saved linear memory
+  copy-on-write, restore globals, the table and open files, then call
+  resume_export instead of main. only available in user mode.
+*/
+
+#ifndef __KERNEL__
+
+struct ModuleInst;
+struct MemInst;
+struct FuncInst;
+struct EmscriptenContext;
+
+/* where wasmjit_checkpoint() writes to, NULL makes it fail with ENOSYS */
+void wasmjit_emscripten_set_checkpoint_path(const char *path);
+
+/* returns 0 or a negative errno value */
+long wasmjit_emscripten_checkpoint(struct EmscriptenContext *ctx,
+				   struct ModuleInst *module_inst,
+				   struct ModuleInst *env_module_inst,
+				   struct MemInst *meminst,
+				   const char *resume_export);
+
+/* returns 0 on success and the export to resume at */
+int wasmjit_emscripten_checkpoint_restore(const char *path,
+					  struct EmscriptenContext *ctx,
+					  struct ModuleInst *module_inst,
+					  struct ModuleInst *env_module_inst,
+					  struct MemInst *meminst,
+					  struct FuncInst **resume_inst);
+
+#endif
+
+#endif
@@ -0,0 +1,768 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/emscripten_dylink.h>
+
+#include <wasmjit/parse.h>
+#include <wasmjit/instantiate.h>
+#include <wasmjit/dynamic_emscripten_runtime.h>
+#include <wasmjit/util.h>
+
+#include <wasmjit/sys.h>
+
+/*
+  parsed and compiled side modules kept around, beyond this they
+  aren't cached. instances of a cached module map the same code,
+  see wasmjit_instantiate_compiled()
+*/
+#define DYLINK_CACHE_MAX_ENTRIES 16
+
+#define DYLINK_MEM_INFO 1
+
+struct DylinkInfo {
+	uint32_t memory_size;
+	uint32_t memory_align;
+	uint32_t table_size;
+	uint32_t table_align;
+};
+
+struct DylinkCacheEntry {
+	char *buf;
+	size_t size;
+	struct Module module;
+	struct CompiledModule compiled;
+};
+
+static struct DylinkCacheEntry cache[DYLINK_CACHE_MAX_ENTRIES];
+static size_t cache_n_entries;
+
+static void dylink_lock(void);
+static void dylink_unlock(void);
+
+static int read_mem_info(struct ParseState *pstate, struct DylinkInfo *info)
+{
+	return read_uleb_uint32_t(pstate, &info->memory_size) &&
+		read_uleb_uint32_t(pstate, &info->memory_align) &&
+		read_uleb_uint32_t(pstate, &info->table_size) &&
+		read_uleb_uint32_t(pstate, &info->table_align);
+}
+
+/* reads the legacy "dylink" section or the mem info of "dylink.0" */
+static int read_dylink_info(const struct Module *module,
+			    struct DylinkInfo *info)
+{
+	uint32_t i;
+
+	for (i = 0; i < module->custom_section.n_customs; ++i) {
+		struct CustomSectionCustom *custom =
+			&module->custom_section.customs[i];
+		struct ParseState pstate;
+
+		if (!init_pstate(&pstate, custom->payload,
+				 custom->payload_size))
+			continue;
+
+		if (!strcmp(custom->name, "dylink"))
+			return read_mem_info(&pstate, info);
+
+		if (strcmp(custom->name, "dylink.0"))
+			continue;
+
+		while (pstate.amt_left) {
+			uint8_t type;
+			uint32_t size;
+
+			type = *pstate.input;
+			pstate.input += 1;
+			pstate.amt_left -= 1;
+
+			if (!read_uleb_uint32_t(&pstate, &size) ||
+			    size > pstate.amt_left)
+				return 0;
+
+			if (type == DYLINK_MEM_INFO)
+				return read_mem_info(&pstate, info);
+
+			pstate.input += size;
+			pstate.amt_left -= size;
+		}
+
+		/* no mem info means nothing to place */
+		memset(info, 0, sizeof(*info));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* carves memory_size bytes off the heap, like getMemory() before main */
+static int alloc_memory_base(struct ModuleInst *env_module_inst,
+			     const struct DylinkInfo *info,
+			     uint32_t *memory_base, uint32_t *old_top)
+{
+	struct MemInst *meminst;
+	struct GlobalInst *dynamictop_ptr;
+	uint32_t ptr, top, align, end;
+
+	meminst = wasmjit_get_export(env_module_inst, "memory",
+				     IMPORT_DESC_TYPE_MEM).mem;
+	dynamictop_ptr = wasmjit_get_export(env_module_inst, "DYNAMICTOP_PTR",
+					    IMPORT_DESC_TYPE_GLOBAL).global;
+	if (!meminst || !dynamictop_ptr || info->memory_align > 16)
+		return 0;
+
+	ptr = dynamictop_ptr->value.data.i32;
+	if (meminst->size < sizeof(top) || ptr > meminst->size - sizeof(top))
+		return 0;
+
+	memcpy(&top, meminst->data + ptr, sizeof(top));
+	top = uint32_t_swap_bytes(top);
+	*old_top = top;
+
+	align = MMAX(1U << info->memory_align, 16);
+	if (__builtin_add_overflow(top, align - 1, &top))
+		return 0;
+	top &= ~(align - 1);
+
+	if (__builtin_add_overflow(top, info->memory_size, &end) ||
+	    __builtin_add_overflow(end, 15, &end))
+		return 0;
+	end &= ~(uint32_t) 15;
+	if (end > meminst->size)
+		return 0;
+
+	*memory_base = top;
+
+	end = uint32_t_swap_bytes(end);
+	memcpy(meminst->data + ptr, &end, sizeof(end));
+
+	return 1;
+}
+
+/* gives the heap back if nothing was allocated after the side module */
+static void free_memory_base(struct ModuleInst *env_module_inst,
+			     const struct DylinkInfo *info,
+			     uint32_t memory_base, uint32_t old_top)
+{
+	struct MemInst *meminst;
+	struct GlobalInst *dynamictop_ptr;
+	uint32_t ptr, top, end;
+
+	meminst = wasmjit_get_export(env_module_inst, "memory",
+				     IMPORT_DESC_TYPE_MEM).mem;
+	dynamictop_ptr = wasmjit_get_export(env_module_inst, "DYNAMICTOP_PTR",
+					    IMPORT_DESC_TYPE_GLOBAL).global;
+	ptr = dynamictop_ptr->value.data.i32;
+
+	memcpy(&top, meminst->data + ptr, sizeof(top));
+	top = uint32_t_swap_bytes(top);
+
+	end = (memory_base + info->memory_size + 15) & ~(uint32_t) 15;
+	if (top != end)
+		return;
+
+	old_top = uint32_t_swap_bytes(old_top);
+	memcpy(meminst->data + ptr, &old_top, sizeof(old_top));
+}
+
+static int grow_table(struct TableInst *tableinst, size_t n_elts)
+{
+	struct FuncInst **data;
+	size_t length, size;
+
+	if (__builtin_add_overflow(tableinst->length, n_elts, &length) ||
+	    (tableinst->max && length > tableinst->max) ||
+	    __builtin_mul_overflow(length, sizeof(data[0]), &size))
+		return 0;
+
+	if (!n_elts)
+		return 1;
+
+	data = realloc(tableinst->data, size);
+	if (!data)
+		return 0;
+
+	memset(data + tableinst->length, 0, n_elts * sizeof(data[0]));
+	tableinst->data = data;
+	tableinst->length = length;
+
+	return 1;
+}
+
+/* drops the entries added since the table was old_length long */
+static void shrink_table(struct TableInst *tableinst, size_t old_length)
+{
+	if (tableinst->length <= old_length)
+		return;
+
+	memset(tableinst->data + old_length, 0,
+	       (tableinst->length - old_length) * sizeof(tableinst->data[0]));
+	tableinst->length = old_length;
+}
+
+static int alloc_table_base(struct TableInst *tableinst,
+			    const struct DylinkInfo *info,
+			    uint32_t *table_base)
+{
+	size_t align, base;
+
+	if (info->table_align > 16)
+		return 0;
+
+	align = (size_t) 1 << info->table_align;
+	base = (tableinst->length + align - 1) & ~(align - 1);
+	if (base > UINT32_MAX ||
+	    !grow_table(tableinst, base - tableinst->length + info->table_size))
+		return 0;
+
+	*table_base = base;
+
+	return 1;
+}
+
+static struct GlobalInst *add_global(struct ModuleInst *module_inst,
+				     unsigned mut, uint32_t value)
+{
+	struct GlobalInst *global;
+
+	global = calloc(1, sizeof(*global));
+	if (!global)
+		return NULL;
+
+	global->value.type = VALTYPE_I32;
+	global->value.data.i32 = value;
+	global->mut = mut;
+	module_inst->globals.elts[module_inst->globals.n_elts++] = global;
+
+	return global;
+}
+
+static int add_export(struct ModuleInst *module_inst, const char *name,
+		      struct GlobalInst *global)
+{
+	struct Export *export =
+		&module_inst->exports.elts[module_inst->exports.n_elts];
+
+	export->name = strdup(name);
+	if (!export->name)
+		return 0;
+	export->type = IMPORT_DESC_TYPE_GLOBAL;
+	export->value.global = global;
+	module_inst->exports.n_elts++;
+
+	return 1;
+}
+
+/* non-owning view used to resolve one namespace of imports */
+static int append_exports(struct ModuleInst *view,
+			  const struct ModuleInst *module_inst)
+{
+	if (module_inst->exports.n_elts) {
+		memcpy(&view->exports.elts[view->exports.n_elts],
+		       module_inst->exports.elts,
+		       module_inst->exports.n_elts * sizeof(view->exports.elts[0]));
+		view->exports.n_elts += module_inst->exports.n_elts;
+	}
+	return 1;
+}
+
+static uint32_t main_memory_base(struct ModuleInst *env_module_inst,
+				 const struct ModuleInst *main_module_inst)
+{
+	static const char *const names[] = {"__memory_base", "memoryBase"};
+	size_t i, j;
+
+	/* exports of a relocatable main module are relative too */
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		struct GlobalInst *global =
+			wasmjit_get_export(env_module_inst, names[i],
+					   IMPORT_DESC_TYPE_GLOBAL).global;
+
+		for (j = 0; global && j < main_module_inst->n_imported_globals; ++j) {
+			if (main_module_inst->globals.elts[j] == global)
+				return global->value.data.i32;
+		}
+	}
+
+	return 0;
+}
+
+static int resolve_data_symbol(const struct ModuleInst *module_inst,
+			       uint32_t memory_base, const char *name,
+			       uint32_t *addr)
+{
+	struct GlobalInst *global;
+
+	global = wasmjit_get_export(module_inst, name,
+				    IMPORT_DESC_TYPE_GLOBAL).global;
+	if (!global || global->value.type != VALTYPE_I32)
+		return 0;
+
+	*addr = memory_base + global->value.data.i32;
+	return 1;
+}
+
+/* returns the table index of funcinst, adding it if it isn't there */
+static int function_table_index(struct TableInst *tableinst,
+				struct FuncInst *funcinst,
+				uint32_t *idx)
+{
+	size_t i;
+
+	for (i = 0; i < tableinst->length; ++i) {
+		if (tableinst->data[i] == funcinst) {
+			*idx = i;
+			return 1;
+		}
+	}
+
+	if (tableinst->length >= UINT32_MAX || !grow_table(tableinst, 1))
+		return 0;
+
+	tableinst->data[tableinst->length - 1] = funcinst;
+	*idx = tableinst->length - 1;
+	return 1;
+}
+
+static struct DylinkCacheEntry *cache_lookup(const char *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < cache_n_entries; ++i) {
+		if (cache[i].size == size && !memcmp(cache[i].buf, buf, size))
+			return &cache[i];
+	}
+
+	return NULL;
+}
+
+static void free_cache_entry(struct DylinkCacheEntry *entry)
+{
+	wasmjit_free_compiled_module(&entry->compiled);
+	wasmjit_free_module(&entry->module);
+	if (entry->buf)
+		free(entry->buf);
+	memset(entry, 0, sizeof(*entry));
+}
+
+/* parsed modules point into their buffer, so the entry keeps a copy */
+static int init_cache_entry(struct DylinkCacheEntry *entry,
+			    const char *buf, size_t size,
+			    char *why, size_t why_size)
+{
+	struct ParseState pstate;
+
+	memset(entry, 0, sizeof(*entry));
+	wasmjit_init_module(&entry->module);
+
+	entry->buf = malloc(size);
+	if (!entry->buf)
+		goto error;
+	memcpy(entry->buf, buf, size);
+	entry->size = size;
+
+	if (!init_pstate(&pstate, entry->buf, size) ||
+	    !read_module(&pstate, &entry->module, why, why_size))
+		goto error;
+
+	return 1;
+
+ error:
+	free_cache_entry(entry);
+	return 0;
+}
+
+int wasmjit_emscripten_dylink_load(const char *buf, size_t size,
+				   struct ModuleInst *env_module_inst,
+				   struct ModuleInst *main_module_inst,
+				   size_t n_modules,
+				   const struct NamedModule *modules,
+				   size_t n_side_modules,
+				   const struct EmscriptenSideModule *side_modules,
+				   struct EmscriptenSideModule *out,
+				   char *why, size_t why_size)
+{
+	struct DylinkCacheEntry uncached, *entry;
+	struct Module *module;
+	struct DylinkInfo info;
+	struct TableInst *tableinst;
+	struct ModuleInst *imports_inst = NULL, *module_inst = NULL;
+	struct ModuleInst env_view, got_mem_view, got_func_view;
+	struct NamedModule *all_modules = NULL;
+	struct GlobalInst *memory_base, *table_base;
+	size_t i, j, n_got, n_env_exports, old_table_length = 0;
+	uint32_t old_top = 0;
+	int ret, locked = 0, memory_allocated = 0, table_allocated = 0;
+	static const char *const linked_env_names[] = {
+		"__memory_base", "memoryBase", "__table_base", "tableBase",
+	};
+
+	memset(&uncached, 0, sizeof(uncached));
+	memset(&env_view, 0, sizeof(env_view));
+	memset(&got_mem_view, 0, sizeof(got_mem_view));
+	memset(&got_func_view, 0, sizeof(got_func_view));
+
+	tableinst = wasmjit_get_export(env_module_inst, "table",
+				       IMPORT_DESC_TYPE_TABLE).table;
+	if (!tableinst) {
+		snprintf(why, why_size, "side modules need a table in env");
+		goto error;
+	}
+
+	dylink_lock();
+	locked = 1;
+
+	entry = cache_lookup(buf, size);
+	if (!entry) {
+		entry = cache_n_entries < DYLINK_CACHE_MAX_ENTRIES
+			? &cache[cache_n_entries]
+			: &uncached;
+		if (!init_cache_entry(entry, buf, size, why, why_size))
+			goto error;
+		if (entry != &uncached)
+			cache_n_entries++;
+	}
+	module = &entry->module;
+
+	if (!read_dylink_info(module, &info)) {
+		snprintf(why, why_size, "not a side module, no dylink section");
+		goto error;
+	}
+
+	/* the base and GOT globals are ours, they outlive this call */
+	n_got = 0;
+	for (i = 0; i < module->import_section.n_imports; ++i) {
+		struct ImportSectionImport *import =
+			&module->import_section.imports[i];
+		if (import->desc_type == IMPORT_DESC_TYPE_GLOBAL &&
+		    (!strcmp(import->module, "GOT.mem") ||
+		     !strcmp(import->module, "GOT.func")))
+			n_got++;
+	}
+
+	imports_inst = calloc(1, sizeof(*imports_inst));
+	if (!imports_inst)
+		goto error;
+	imports_inst->globals.elts = calloc(2 + n_got,
+					    sizeof(imports_inst->globals.elts[0]));
+	imports_inst->exports.elts =
+		calloc(sizeof(linked_env_names) / sizeof(linked_env_names[0]),
+		       sizeof(imports_inst->exports.elts[0]));
+	got_mem_view.exports.elts = calloc(n_got + 1, sizeof(struct Export));
+	got_func_view.exports.elts = calloc(n_got + 1, sizeof(struct Export));
+	if (!imports_inst->globals.elts || !imports_inst->exports.elts ||
+	    !got_mem_view.exports.elts || !got_func_view.exports.elts)
+		goto error;
+
+	if (!alloc_memory_base(env_module_inst, &info, &out->memory_base,
+			       &old_top)) {
+		snprintf(why, why_size,
+			 "couldn't allocate %" PRIu32 " bytes for side module",
+			 info.memory_size);
+		goto error;
+	}
+	memory_allocated = 1;
+
+	old_table_length = tableinst->length;
+	if (!alloc_table_base(tableinst, &info, &out->table_base)) {
+		snprintf(why, why_size,
+			 "couldn't grow table by %" PRIu32 " for side module",
+			 info.table_size);
+		goto error;
+	}
+	table_allocated = 1;
+
+	memory_base = add_global(imports_inst, 0, out->memory_base);
+	table_base = add_global(imports_inst, 0, out->table_base);
+	if (!memory_base || !table_base)
+		goto error;
+
+	for (i = 0; i < sizeof(linked_env_names) / sizeof(linked_env_names[0]); ++i) {
+		if (!add_export(imports_inst, linked_env_names[i],
+				i < 2 ? memory_base : table_base))
+			goto error;
+	}
+
+	for (i = 0; i < module->import_section.n_imports; ++i) {
+		struct ImportSectionImport *import =
+			&module->import_section.imports[i];
+		struct ModuleInst *view;
+		struct Export *export;
+		struct GlobalInst *global;
+
+		if (import->desc_type != IMPORT_DESC_TYPE_GLOBAL)
+			continue;
+
+		if (!strcmp(import->module, "GOT.mem"))
+			view = &got_mem_view;
+		else if (!strcmp(import->module, "GOT.func"))
+			view = &got_func_view;
+		else
+			continue;
+
+		/* filled in once the module's own exports exist */
+		global = add_global(imports_inst, 1, 0);
+		if (!global)
+			goto error;
+
+		/* the module may be freed before the GOT is filled in */
+		export = &view->exports.elts[view->exports.n_elts];
+		export->name = strdup(import->name);
+		if (!export->name)
+			goto error;
+		view->exports.n_elts++;
+		export->type = IMPORT_DESC_TYPE_GLOBAL;
+		export->value.global = global;
+	}
+
+	/*
+	  "env" imports resolve to our bases first, then to what the main
+	  module and earlier side modules export, then to the runtime
+	*/
+	if (wasmjit_emscripten_add_invoke_imports(env_module_inst, module))
+		goto error;
+
+	n_env_exports = imports_inst->exports.n_elts +
+		env_module_inst->exports.n_elts;
+	if (main_module_inst)
+		n_env_exports += main_module_inst->exports.n_elts;
+	for (i = 0; i < n_side_modules; ++i)
+		n_env_exports += side_modules[i].module->exports.n_elts;
+
+	env_view.exports.elts = calloc(n_env_exports + 1, sizeof(struct Export));
+	if (!env_view.exports.elts)
+		goto error;
+
+	append_exports(&env_view, imports_inst);
+	if (main_module_inst)
+		append_exports(&env_view, main_module_inst);
+	for (i = 0; i < n_side_modules; ++i)
+		append_exports(&env_view, side_modules[i].module);
+	append_exports(&env_view, env_module_inst);
+
+	all_modules = calloc(n_modules + 3, sizeof(all_modules[0]));
+	if (!all_modules)
+		goto error;
+	memcpy(all_modules, modules, n_modules * sizeof(all_modules[0]));
+	/* later entries win when names repeat */
+	all_modules[n_modules].name = "env";
+	all_modules[n_modules].module = &env_view;
+	all_modules[n_modules + 1].name = "GOT.mem";
+	all_modules[n_modules + 1].module = &got_mem_view;
+	all_modules[n_modules + 2].name = "GOT.func";
+	all_modules[n_modules + 2].module = &got_func_view;
+
+	module_inst = wasmjit_instantiate_compiled(module, n_modules + 3,
+						   all_modules,
+						   &entry->compiled,
+						   why, why_size);
+	if (!module_inst)
+		goto error;
+
+	free_cache_entry(&uncached);
+	dylink_unlock();
+	locked = 0;
+
+	/* symbols resolve to the first module that defines them */
+	for (i = 0; i < got_mem_view.exports.n_elts; ++i) {
+		struct Export *export = &got_mem_view.exports.elts[i];
+		uint32_t addr;
+		int found;
+
+		found = main_module_inst &&
+			resolve_data_symbol(main_module_inst,
+					    main_memory_base(env_module_inst,
+							     main_module_inst),
+					    export->name, &addr);
+		for (j = 0; !found && j < n_side_modules; ++j)
+			found = resolve_data_symbol(side_modules[j].module,
+						    side_modules[j].memory_base,
+						    export->name, &addr);
+		if (!found)
+			found = resolve_data_symbol(module_inst, out->memory_base,
+						    export->name, &addr);
+		if (!found) {
+			snprintf(why, why_size, "undefined symbol: %s",
+				 export->name);
+			goto error;
+		}
+
+		export->value.global->value.data.i32 = addr;
+	}
+
+	for (i = 0; i < got_func_view.exports.n_elts; ++i) {
+		struct Export *export = &got_func_view.exports.elts[i];
+		struct FuncInst *funcinst = NULL;
+		uint32_t idx;
+
+		if (main_module_inst)
+			funcinst = wasmjit_get_export(main_module_inst, export->name,
+						      IMPORT_DESC_TYPE_FUNC).func;
+		for (j = 0; !funcinst && j < n_side_modules; ++j)
+			funcinst = wasmjit_get_export(side_modules[j].module,
+						      export->name,
+						      IMPORT_DESC_TYPE_FUNC).func;
+		if (!funcinst)
+			funcinst = wasmjit_get_export(module_inst, export->name,
+						      IMPORT_DESC_TYPE_FUNC).func;
+		if (!funcinst)
+			funcinst = wasmjit_get_export(env_module_inst, export->name,
+						      IMPORT_DESC_TYPE_FUNC).func;
+		if (!funcinst) {
+			snprintf(why, why_size, "undefined symbol: %s",
+				 export->name);
+			goto error;
+		}
+
+		if ((IS_HOST(funcinst) &&
+		     wasmjit_bind_host_function(funcinst)) ||
+		    !function_table_index(tableinst, funcinst, &idx)) {
+			snprintf(why, why_size, "couldn't add %s to the table",
+				 export->name);
+			goto error;
+		}
+
+		export->value.global->value.data.i32 = idx;
+	}
+
+	/* apply data relocations and run static constructors */
+	{
+		static const char *const init_names[] = {
+			"__post_instantiate",
+			"__wasm_apply_relocs",
+			"__wasm_call_ctors",
+		};
+
+		for (i = 0; i < sizeof(init_names) / sizeof(init_names[0]); ++i) {
+			struct FuncInst *init_inst =
+				wasmjit_get_export(module_inst, init_names[i],
+						   IMPORT_DESC_TYPE_FUNC).func;
+
+			if (!init_inst || init_inst->type.n_inputs)
+				continue;
+
+			if (wasmjit_invoke_function(init_inst, NULL, NULL)) {
+				snprintf(why, why_size, "%s trapped",
+					 init_names[i]);
+				goto error;
+			}
+
+			/* it does the other two itself */
+			if (!i)
+				break;
+		}
+	}
+
+	out->module = module_inst;
+	out->imports = imports_inst;
+	module_inst = NULL;
+	imports_inst = NULL;
+
+	ret = 0;
+
+	if (0) {
+	error:
+		ret = -1;
+
+		/* nothing can reference what was placed for the module */
+		if (table_allocated)
+			shrink_table(tableinst, old_table_length);
+		if (memory_allocated)
+			free_memory_base(env_module_inst, &info,
+					 out->memory_base, old_top);
+	}
+
+	if (locked) {
+		free_cache_entry(&uncached);
+		dylink_unlock();
+	}
+
+	if (module_inst)
+		wasmjit_free_module_inst(module_inst);
+	if (imports_inst)
+		wasmjit_free_module_inst(imports_inst);
+	if (all_modules)
+		free(all_modules);
+	if (env_view.exports.elts)
+		free(env_view.exports.elts);
+	if (got_mem_view.exports.elts) {
+		for (i = 0; i < got_mem_view.exports.n_elts; ++i)
+			free(got_mem_view.exports.elts[i].name);
+		free(got_mem_view.exports.elts);
+	}
+	if (got_func_view.exports.elts) {
+		for (i = 0; i < got_func_view.exports.n_elts; ++i)
+			free(got_func_view.exports.elts[i].name);
+		free(got_func_view.exports.elts);
+	}
+
+	return ret;
+}
+
+void wasmjit_emscripten_dylink_clear_cache(void)
+{
+	size_t i;
+
+	dylink_lock();
+	for (i = 0; i < cache_n_entries; ++i)
+		free_cache_entry(&cache[i]);
+	cache_n_entries = 0;
+	dylink_unlock();
+}
+
+/* platform specific */
+
+#ifdef __KERNEL__
+
+#include <linux/mutex.h>
+
+static DEFINE_MUTEX(dylink_mutex);
+
+static void dylink_lock(void)
+{
+	mutex_lock(&dylink_mutex);
+}
+
+static void dylink_unlock(void)
+{
+	mutex_unlock(&dylink_mutex);
+}
+
+#else
+
+#include <pthread.h>
+
+static pthread_mutex_t dylink_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void dylink_lock(void)
+{
+	pthread_mutex_lock(&dylink_mutex);
+}
+
+static void dylink_unlock(void)
+{
+	pthread_mutex_unlock(&dylink_mutex);
+}
+
+#endif
@@ -0,0 +1,68 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__EMSCRIPTEN_DYLINK_H__
+#define __WASMJIT__EMSCRIPTEN_DYLINK_H__
+
+#include <wasmjit/runtime.h>
+
+#include <wasmjit/sys.h>
+
+/*
+  Emscripten SIDE_MODULE dynamic linking. side modules are relocatable,
+  they get their data and table entries placed at the __memory_base and
+  __table_base they import and reach symbols of other modules through
+  GOT.mem and GOT.func global imports.
+*/
+
+struct EmscriptenSideModule {
+	struct ModuleInst *module;
+	/* owns the base and GOT globals imported by module */
+	struct ModuleInst *imports;
+	uint32_t memory_base;
+	uint32_t table_base;
+};
+
+/*
+  instantiates the side module in buf against env, the main module
+  (may be NULL) and the already loaded side modules, then runs its
+  constructors. imports from other namespaces resolve through modules.
+  compilation output is cached process-wide, keyed on the contents of
+  buf, so loading the same side module again only relocates it.
+  returns 0 on success and fills out.
+*/
+int wasmjit_emscripten_dylink_load(const char *buf, size_t size,
+				   struct ModuleInst *env_module_inst,
+				   struct ModuleInst *main_module_inst,
+				   size_t n_modules,
+				   const struct NamedModule *modules,
+				   size_t n_side_modules,
+				   const struct EmscriptenSideModule *side_modules,
+				   struct EmscriptenSideModule *out,
+				   char *why, size_t why_size);
+
+/* drops all cached side module code */
+void wasmjit_emscripten_dylink_clear_cache(void);
+
+#endif
@@ -0,0 +1,490 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+/* For REG_ERR */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <wasmjit/emscripten_heatmap.h>
+
+#include <wasmjit/emscripten_runtime.h>
+#include <wasmjit/runtime.h>
+#include <wasmjit/vector.h>
+#include <wasmjit/util.h>
+#include <wasmjit/sys.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <ucontext.h>
+#endif
+
+/*
+  Pages are made inaccessible at the start of every epoch. The first
+  fault on a page records a read (or a write, when the fault error code
+  says so) and opens the page up just enough for that access, so a
+  later write in the same epoch faults once more. Heat is the number of
+  epochs a page was read or written in.
+
+  The kernel doesn't fault on our protection, it returns EFAULT. Host
+  functions validate guest buffers before passing them to syscalls,
+  so the runtime opens those ranges up through
+  wasmjit_emscripten_heatmap_touch() and counts them as host accesses.
+  Retrying after EFAULT would lose data a read or accept had already
+  consumed, so instead no epoch starts while a syscall is in flight,
+  and one that started between the touch and the syscall is undone by
+  opening up all of memory for the rest of that epoch.
+ */
+
+enum {
+	REGION_RESERVED,
+	REGION_STATIC,
+	REGION_STACK,
+	REGION_HEAP,
+	REGION_UNUSED,
+	N_REGIONS,
+};
+
+static const char *const region_names[N_REGIONS] = {
+	"reserved",
+	"static",
+	"stack",
+	"heap",
+	"unused",
+};
+
+struct PageHeat {
+	uint32_t reads, writes, host;
+	uint32_t read_epoch, write_epoch, host_epoch;
+};
+
+struct EpochHeat {
+	uint32_t pages_read[N_REGIONS];
+	uint32_t pages_written[N_REGIONS];
+	uint32_t pages_host[N_REGIONS];
+};
+
+volatile int wasmjit_emscripten_heatmap_active;
+
+static struct {
+	char *base;
+	size_t size, page_size, n_pages;
+	struct WasmJITEmscriptenMemoryGlobals globals;
+	struct PageHeat *pages;
+	/* 0 means never touched */
+	volatile uint32_t epoch;
+	DEFINE_ANON_VECTOR(struct EpochHeat) epochs;
+	unsigned interval_ms;
+	struct sigaction old_segv;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stopping;
+	/* guarded by lock, see wasmjit_emscripten_heatmap_enter_host() */
+	int in_host;
+	/* epoch of the last touch, 0 after every syscall */
+	uint32_t touch_epoch;
+} heatmap = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned page_region(size_t page, uint32_t heap_end)
+{
+	size_t offset = page * heatmap.page_size;
+
+	if (offset < heatmap.globals.memoryBase)
+		return REGION_RESERVED;
+	if (offset < heatmap.globals.STACKTOP)
+		return REGION_STATIC;
+	if (offset < heatmap.globals.STACK_MAX)
+		return REGION_STACK;
+	if (offset < heap_end)
+		return REGION_HEAP;
+	return REGION_UNUSED;
+}
+
+static void set_protection(size_t page, size_t n_pages, int prot)
+{
+	(void)mprotect(heatmap.base + page * heatmap.page_size,
+		       n_pages * heatmap.page_size, prot);
+}
+
+static void heatmap_segv(int sig, siginfo_t *info, void *ctx)
+{
+	char *addr = info->si_addr;
+	struct PageHeat *heat;
+	uint32_t epoch = heatmap.epoch;
+	size_t page;
+	int write = 0, prot = PROT_READ | PROT_WRITE;
+
+	if (!wasmjit_emscripten_heatmap_active ||
+	    addr < heatmap.base || addr >= heatmap.base + heatmap.size) {
+		/* not ours */
+		if (heatmap.old_segv.sa_flags & SA_SIGINFO) {
+			heatmap.old_segv.sa_sigaction(sig, info, ctx);
+		} else if (heatmap.old_segv.sa_handler == SIG_DFL) {
+			/* the access faults again and kills us */
+			(void)sigaction(SIGSEGV, &heatmap.old_segv, NULL);
+		} else if (heatmap.old_segv.sa_handler != SIG_IGN) {
+			heatmap.old_segv.sa_handler(sig);
+		}
+		return;
+	}
+
+#if defined(__linux__) && defined(__x86_64__)
+	write = (((ucontext_t *) ctx)->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+	if (!write)
+		prot = PROT_READ;
+#else
+	(void)ctx;
+#endif
+
+	page = (addr - heatmap.base) / heatmap.page_size;
+	heat = &heatmap.pages[page];
+
+	if (write) {
+		if (heat->write_epoch != epoch) {
+			heat->write_epoch = epoch;
+			heat->writes += 1;
+		}
+	} else {
+		if (heat->read_epoch != epoch) {
+			heat->read_epoch = epoch;
+			heat->reads += 1;
+		}
+	}
+
+	set_protection(page, 1, prot);
+}
+
+static int summarize_epoch(void)
+{
+	struct EpochHeat *summary;
+	uint32_t epoch = heatmap.epoch;
+	size_t i;
+
+	if (!VECTOR_GROW(&heatmap.epochs, 1))
+		return 0;
+
+	summary = &heatmap.epochs.elts[heatmap.epochs.n_elts - 1];
+	memset(summary, 0, sizeof(*summary));
+
+	for (i = 0; i < heatmap.n_pages; ++i) {
+		struct PageHeat *heat = &heatmap.pages[i];
+		/* the heap end moves, report the space it may grow into */
+		unsigned region = page_region(i, heatmap.size);
+
+		if (heat->read_epoch == epoch)
+			summary->pages_read[region] += 1;
+		if (heat->write_epoch == epoch)
+			summary->pages_written[region] += 1;
+		if (heat->host_epoch == epoch)
+			summary->pages_host[region] += 1;
+	}
+
+	return 1;
+}
+
+static void *heatmap_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&heatmap.lock);
+	while (!heatmap.stopping) {
+		struct timespec deadline;
+		int ret;
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += heatmap.interval_ms / 1000;
+		deadline.tv_nsec += (long) (heatmap.interval_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		do {
+			ret = pthread_cond_timedwait(&heatmap.cond, &heatmap.lock,
+						     &deadline);
+		} while (!heatmap.stopping && ret != ETIMEDOUT);
+
+		if (heatmap.stopping)
+			break;
+
+		/* the syscall's buffers must stay open until it returns */
+		if (heatmap.in_host)
+			continue;
+
+		if (!summarize_epoch())
+			break;
+
+		heatmap.epoch += 1;
+		set_protection(0, heatmap.n_pages, PROT_NONE);
+	}
+	pthread_mutex_unlock(&heatmap.lock);
+
+	return NULL;
+}
+
+int wasmjit_emscripten_heatmap_start(struct MemInst *meminst,
+				     const struct WasmJITEmscriptenMemoryGlobals *globals,
+				     unsigned interval_ms)
+{
+	struct sigaction sa;
+	long page_size;
+
+	if (wasmjit_emscripten_heatmap_active)
+		return -1;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0 ||
+	    (uintptr_t) meminst->data % page_size ||
+	    meminst->size % page_size)
+		return -1;
+
+	memset(&heatmap.epochs, 0, sizeof(heatmap.epochs));
+	heatmap.base = meminst->data;
+	heatmap.size = meminst->size;
+	heatmap.page_size = page_size;
+	heatmap.n_pages = meminst->size / page_size;
+	heatmap.globals = *globals;
+	heatmap.interval_ms = interval_ms ? interval_ms : 1;
+	heatmap.epoch = 1;
+	heatmap.stopping = 0;
+	heatmap.in_host = 0;
+	heatmap.touch_epoch = 0;
+
+	heatmap.pages = calloc(heatmap.n_pages, sizeof(heatmap.pages[0]));
+	if (heatmap.n_pages && !heatmap.pages)
+		return -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = &heatmap_segv;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGSEGV, &sa, &heatmap.old_segv))
+		goto error;
+
+	wasmjit_emscripten_heatmap_active = 1;
+	set_protection(0, heatmap.n_pages, PROT_NONE);
+
+	if (pthread_create(&heatmap.thread, NULL, &heatmap_thread, NULL)) {
+		wasmjit_emscripten_heatmap_active = 0;
+		set_protection(0, heatmap.n_pages, PROT_READ | PROT_WRITE);
+		(void)sigaction(SIGSEGV, &heatmap.old_segv, NULL);
+		goto error;
+	}
+
+	return 0;
+
+ error:
+	free(heatmap.pages);
+	heatmap.pages = NULL;
+	return -1;
+}
+
+void wasmjit_emscripten_heatmap_touch(char *addr, size_t len)
+{
+	uint32_t epoch = heatmap.epoch;
+	size_t first, last, i;
+	int open = 0;
+
+	if (!len || addr < heatmap.base ||
+	    addr >= heatmap.base + heatmap.size)
+		return;
+
+	heatmap.touch_epoch = epoch;
+
+	first = (addr - heatmap.base) / heatmap.page_size;
+	last = (MMIN(addr - heatmap.base + len, heatmap.size) - 1) /
+		heatmap.page_size;
+
+	for (i = first; i <= last; ++i) {
+		struct PageHeat *heat = &heatmap.pages[i];
+		if (heat->host_epoch != epoch) {
+			heat->host_epoch = epoch;
+			heat->host += 1;
+			open = 1;
+		}
+	}
+
+	if (open)
+		set_protection(first, last - first + 1, PROT_READ | PROT_WRITE);
+}
+
+void wasmjit_emscripten_heatmap_enter_host(void)
+{
+	pthread_mutex_lock(&heatmap.lock);
+	heatmap.in_host = 1;
+	if (heatmap.touch_epoch && heatmap.touch_epoch != heatmap.epoch)
+		set_protection(0, heatmap.n_pages, PROT_READ | PROT_WRITE);
+	heatmap.touch_epoch = 0;
+	pthread_mutex_unlock(&heatmap.lock);
+}
+
+void wasmjit_emscripten_heatmap_leave_host(void)
+{
+	pthread_mutex_lock(&heatmap.lock);
+	heatmap.in_host = 0;
+	pthread_mutex_unlock(&heatmap.lock);
+}
+
+static void write_report(FILE *f, uint32_t heap_end)
+{
+	size_t i, j;
+	uint32_t region_pages[N_REGIONS], region_touched[N_REGIONS];
+	uint32_t region_reads[N_REGIONS], region_writes[N_REGIONS],
+		region_host[N_REGIONS];
+	size_t region_start[N_REGIONS], region_end[N_REGIONS];
+
+	memset(region_pages, 0, sizeof(region_pages));
+	memset(region_touched, 0, sizeof(region_touched));
+	memset(region_reads, 0, sizeof(region_reads));
+	memset(region_writes, 0, sizeof(region_writes));
+	memset(region_host, 0, sizeof(region_host));
+
+	region_start[REGION_RESERVED] = 0;
+	region_end[REGION_RESERVED] = heatmap.globals.memoryBase;
+	region_start[REGION_STATIC] = heatmap.globals.memoryBase;
+	region_end[REGION_STATIC] = heatmap.globals.STACKTOP;
+	region_start[REGION_STACK] = heatmap.globals.STACKTOP;
+	region_end[REGION_STACK] = heatmap.globals.STACK_MAX;
+	region_start[REGION_HEAP] = heatmap.globals.STACK_MAX;
+	region_end[REGION_HEAP] = heap_end;
+	region_start[REGION_UNUSED] = heap_end;
+	region_end[REGION_UNUSED] = heatmap.size;
+
+	for (i = 0; i < heatmap.n_pages; ++i) {
+		struct PageHeat *heat = &heatmap.pages[i];
+		unsigned region = page_region(i, heap_end);
+
+		region_pages[region] += 1;
+		if (heat->reads || heat->writes || heat->host)
+			region_touched[region] += 1;
+		region_reads[region] += heat->reads;
+		region_writes[region] += heat->writes;
+		region_host[region] += heat->host;
+	}
+
+	fprintf(f, "# wasmjit linear memory heatmap\n");
+	fprintf(f, "# page_size %zu pages %zu epochs %zu interval_ms %u\n",
+		heatmap.page_size, heatmap.n_pages,
+		heatmap.epochs.n_elts, heatmap.interval_ms);
+	fprintf(f, "# heat is the number of epochs a page was accessed in\n");
+
+	fprintf(f, "# region name start end pages touched reads writes host\n");
+	for (i = 0; i < N_REGIONS; ++i) {
+		fprintf(f, "region %s 0x%08zx 0x%08zx %" PRIu32 " %" PRIu32
+			" %" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+			region_names[i], region_start[i], region_end[i],
+			region_pages[i], region_touched[i],
+			region_reads[i], region_writes[i], region_host[i]);
+	}
+
+	/* the heap end at the time of each epoch isn't known,
+	   so epochs count everything above the stack as heap */
+	fprintf(f, "# epoch index region pages_read pages_written pages_host\n");
+	for (i = 0; i < heatmap.epochs.n_elts; ++i) {
+		struct EpochHeat *summary = &heatmap.epochs.elts[i];
+		for (j = 0; j < N_REGIONS; ++j) {
+			if (!summary->pages_read[j] &&
+			    !summary->pages_written[j] &&
+			    !summary->pages_host[j])
+				continue;
+			fprintf(f, "epoch %zu %s %" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+				i, region_names[j],
+				summary->pages_read[j],
+				summary->pages_written[j],
+				summary->pages_host[j]);
+		}
+	}
+
+	fprintf(f, "# page start region reads writes host\n");
+	for (i = 0; i < heatmap.n_pages; ++i) {
+		struct PageHeat *heat = &heatmap.pages[i];
+
+		if (!heat->reads && !heat->writes && !heat->host)
+			continue;
+
+		fprintf(f, "page 0x%08zx %s %" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+			i * heatmap.page_size,
+			region_names[page_region(i, heap_end)],
+			heat->reads, heat->writes, heat->host);
+	}
+}
+
+int wasmjit_emscripten_heatmap_stop(const char *path)
+{
+	uint32_t heap_end;
+	FILE *f;
+	int ret;
+
+	if (!wasmjit_emscripten_heatmap_active)
+		return -1;
+
+	pthread_mutex_lock(&heatmap.lock);
+	heatmap.stopping = 1;
+	pthread_cond_signal(&heatmap.cond);
+	pthread_mutex_unlock(&heatmap.lock);
+	pthread_join(heatmap.thread, NULL);
+
+	(void)summarize_epoch();
+
+	wasmjit_emscripten_heatmap_active = 0;
+	set_protection(0, heatmap.n_pages, PROT_READ | PROT_WRITE);
+	(void)sigaction(SIGSEGV, &heatmap.old_segv, NULL);
+
+	heap_end = heatmap.size;
+	if (heatmap.globals.DYNAMICTOP_PTR <= heatmap.size - sizeof(heap_end)) {
+		memcpy(&heap_end, heatmap.base + heatmap.globals.DYNAMICTOP_PTR,
+		       sizeof(heap_end));
+		heap_end = uint32_t_swap_bytes(heap_end);
+		if (heap_end < heatmap.globals.STACK_MAX || heap_end > heatmap.size)
+			heap_end = heatmap.size;
+	}
+
+	f = fopen(path, "w");
+	if (f) {
+		write_report(f, heap_end);
+		ret = fclose(f) ? -1 : 0;
+	} else {
+		ret = -1;
+	}
+
+	free(heatmap.pages);
+	heatmap.pages = NULL;
+	free(heatmap.epochs.elts);
+	heatmap.epochs.elts = NULL;
+	heatmap.epochs.n_elts = 0;
+
+	return ret;
+}
@@ -0,0 +1,85 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__EMSCRIPTEN_HEATMAP_H__
+#define __WASMJIT__EMSCRIPTEN_HEATMAP_H__
+
+#include <wasmjit/sys.h>
+
+/*
+  linear memory access profiler, pages are protected at the start of
+  every epoch and the first read and write fault on each page in an
+  epoch is counted. only available in user mode, static executables
+  build with WASMJIT_NO_HEATMAP since they never start it.
+*/
+
+#if defined(__KERNEL__) || defined(WASMJIT_NO_HEATMAP)
+
+#define WASMJIT_EMSCRIPTEN_HEATMAP_TOUCH(addr, len) do { } while (0)
+#define WASMJIT_EMSCRIPTEN_HEATMAP_ENTER_HOST() do { } while (0)
+#define WASMJIT_EMSCRIPTEN_HEATMAP_LEAVE_HOST() do { } while (0)
+
+#else
+
+struct MemInst;
+struct WasmJITEmscriptenMemoryGlobals;
+
+extern volatile int wasmjit_emscripten_heatmap_active;
+
+int wasmjit_emscripten_heatmap_start(struct MemInst *meminst,
+				     const struct WasmJITEmscriptenMemoryGlobals *globals,
+				     unsigned interval_ms);
+/* writes the report to path, returns 0 on success */
+int wasmjit_emscripten_heatmap_stop(const char *path);
+
+/* host access to guest memory, e.g. a buffer about to be passed to the kernel */
+void wasmjit_emscripten_heatmap_touch(char *addr, size_t len);
+/* around syscalls, no epoch starts in between */
+void wasmjit_emscripten_heatmap_enter_host(void);
+void wasmjit_emscripten_heatmap_leave_host(void);
+
+#define WASMJIT_EMSCRIPTEN_HEATMAP_TOUCH(addr, len)			\
+	do {								\
+		if (wasmjit_emscripten_heatmap_active)			\
+			wasmjit_emscripten_heatmap_touch((addr), (len)); \
+	}								\
+	while (0)
+
+#define WASMJIT_EMSCRIPTEN_HEATMAP_ENTER_HOST()				\
+	do {								\
+		if (wasmjit_emscripten_heatmap_active)			\
+			wasmjit_emscripten_heatmap_enter_host();	\
+	}								\
+	while (0)
+
+#define WASMJIT_EMSCRIPTEN_HEATMAP_LEAVE_HOST()				\
+	do {								\
+		if (wasmjit_emscripten_heatmap_active)			\
+			wasmjit_emscripten_heatmap_leave_host();	\
+	}								\
+	while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,1146 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/emscripten_memfs.h>
+
+#include <wasmjit/emscripten_runtime_sys.h>
+#include <wasmjit/util.h>
+#include <wasmjit/vector.h>
+
+#include <wasmjit/sys.h>
+
+#define MEMFS_MAGIC "WJMEMFS"
+#define MEMFS_HEADER_SIZE 16
+#define MEMFS_ENTRY_SIZE 24
+
+/* access() modes, the same everywhere */
+#define MEMFS_X_OK 1
+#define MEMFS_W_OK 2
+
+/* open() fails with EMFILE beyond this many archive files per mount */
+#define MEMFS_MAX_FILES 65536
+
+enum {
+	MEMFS_NOT_FOUND,
+	MEMFS_FILE,
+	MEMFS_DIR,
+};
+
+/* what archives are shared by, a changed file is loaded again */
+struct MemFSFileId {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	long mtime_nsec;
+};
+
+struct WasmJITMemFS {
+	struct MemFSFileId id;
+	int listed;
+	size_t refcount;
+	char *data;
+	size_t size;
+	/* private copy of the entries and names, data may change under us */
+	char *index;
+	uint32_t n_entries;
+	const char *entries;
+	const char *names;
+	uint32_t names_size;
+	struct WasmJITMemFS *next;
+};
+
+struct MemFSFile {
+	int used;
+	uint32_t entry;
+	uint64_t pos;
+};
+
+struct WasmJITMemFSMount {
+	struct WasmJITMemFS *fs;
+	size_t n_files;
+	struct MemFSFile *files;
+};
+
+/* archives currently mounted somewhere, under memfs_lock() */
+static struct WasmJITMemFS *loaded;
+
+struct MemFSArchiveFile;
+
+static void memfs_lock(void);
+static void memfs_unlock(void);
+static struct MemFSArchiveFile *open_archive(const char *path,
+					     struct MemFSFileId *id);
+static void close_archive(struct MemFSArchiveFile *file);
+static char *map_archive(struct MemFSArchiveFile *file, size_t size);
+static void unmap_archive(char *data, size_t size);
+
+static uint32_t read_le32(const char *p)
+{
+	const unsigned char *u = (const unsigned char *) p;
+	return (uint32_t) u[0] | ((uint32_t) u[1] << 8) |
+		((uint32_t) u[2] << 16) | ((uint32_t) u[3] << 24);
+}
+
+static uint64_t read_le64(const char *p)
+{
+	return (uint64_t) read_le32(p) | ((uint64_t) read_le32(p + 4) << 32);
+}
+
+static const char *entry_name(const struct WasmJITMemFS *fs, uint32_t idx)
+{
+	return fs->names + read_le32(fs->entries + idx * MEMFS_ENTRY_SIZE);
+}
+
+static uint64_t entry_data_offset(const struct WasmJITMemFS *fs, uint32_t idx)
+{
+	return read_le64(fs->entries + idx * MEMFS_ENTRY_SIZE + 8);
+}
+
+static uint64_t entry_size(const struct WasmJITMemFS *fs, uint32_t idx)
+{
+	return read_le64(fs->entries + idx * MEMFS_ENTRY_SIZE + 16);
+}
+
+static int validate_archive(struct WasmJITMemFS *fs)
+{
+	uint32_t i;
+	size_t names_start;
+
+	if (fs->size < MEMFS_HEADER_SIZE ||
+	    memcmp(fs->data, MEMFS_MAGIC, sizeof(MEMFS_MAGIC)))
+		return 0;
+
+	fs->n_entries = read_le32(fs->data + 8);
+	fs->names_size = read_le32(fs->data + 12);
+
+	if (fs->n_entries > (fs->size - MEMFS_HEADER_SIZE) / MEMFS_ENTRY_SIZE)
+		return 0;
+	names_start = MEMFS_HEADER_SIZE +
+		(size_t) fs->n_entries * MEMFS_ENTRY_SIZE;
+	if (fs->names_size > fs->size - names_start)
+		return 0;
+
+	fs->index = malloc(names_start - MEMFS_HEADER_SIZE + fs->names_size);
+	if (!fs->index)
+		return 0;
+	memcpy(fs->index, fs->data + MEMFS_HEADER_SIZE,
+	       names_start - MEMFS_HEADER_SIZE + fs->names_size);
+
+	fs->entries = fs->index;
+	fs->names = fs->index + (names_start - MEMFS_HEADER_SIZE);
+
+	for (i = 0; i < fs->n_entries; ++i) {
+		const char *entry = fs->entries + i * MEMFS_ENTRY_SIZE;
+		uint32_t name_offset = read_le32(entry);
+		uint32_t name_len = read_le32(entry + 4);
+		uint64_t data_offset = entry_data_offset(fs, i);
+		uint64_t size = entry_size(fs, i);
+
+		if (name_offset >= fs->names_size ||
+		    name_len >= fs->names_size - name_offset ||
+		    fs->names[name_offset + name_len] != '\0' ||
+		    memchr(fs->names + name_offset, '\0', name_len) ||
+		    fs->names[name_offset] != '/')
+			return 0;
+
+		if (data_offset > fs->size || size > fs->size - data_offset)
+			return 0;
+
+		/* lookups are binary searches */
+		if (i && strcmp(entry_name(fs, i - 1), entry_name(fs, i)) >= 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* under memfs_lock(), later mounts won't find fs */
+static void unlist_archive(struct WasmJITMemFS *fs)
+{
+	struct WasmJITMemFS **pos;
+
+	for (pos = &loaded; *pos != fs; pos = &(*pos)->next)
+		;
+	*pos = fs->next;
+	fs->listed = 0;
+}
+
+static void put_archive(struct WasmJITMemFS *fs)
+{
+	memfs_lock();
+	if (--fs->refcount) {
+		memfs_unlock();
+		return;
+	}
+	if (fs->listed)
+		unlist_archive(fs);
+	memfs_unlock();
+
+	unmap_archive(fs->data, fs->size);
+	free(fs->index);
+	free(fs);
+}
+
+/*
+  the file is opened on every mount so the caller's permissions apply,
+  the loaded archive is only reused if it's still the same file
+*/
+static struct WasmJITMemFS *get_archive(const char *path)
+{
+	struct MemFSArchiveFile *file;
+	struct MemFSFileId id;
+	struct WasmJITMemFS *fs, *next;
+
+	file = open_archive(path, &id);
+	if (!file)
+		return NULL;
+
+	memfs_lock();
+
+	for (fs = loaded; fs; fs = next) {
+		next = fs->next;
+
+		if (fs->id.dev != id.dev || fs->id.ino != id.ino)
+			continue;
+
+		if (fs->id.size == id.size &&
+		    fs->id.mtime_sec == id.mtime_sec &&
+		    fs->id.mtime_nsec == id.mtime_nsec) {
+			fs->refcount += 1;
+			goto out;
+		}
+
+		/* rewritten since, current mounts keep the old contents */
+		unlist_archive(fs);
+	}
+
+	if (id.size > SIZE_MAX)
+		goto out;
+
+	fs = calloc(1, sizeof(*fs));
+	if (!fs)
+		goto out;
+
+	fs->id = id;
+	fs->size = id.size;
+	fs->data = map_archive(file, fs->size);
+	if (!fs->data)
+		goto error;
+
+	if (!validate_archive(fs))
+		goto error;
+
+	fs->refcount = 1;
+	fs->listed = 1;
+	fs->next = loaded;
+	loaded = fs;
+
+	if (0) {
+	error:
+		if (fs->data)
+			unmap_archive(fs->data, fs->size);
+		free(fs->index);
+		free(fs);
+		fs = NULL;
+	}
+
+ out:
+	memfs_unlock();
+	close_archive(file);
+	return fs;
+}
+
+struct WasmJITMemFSMount *wasmjit_memfs_mount(const char *archive_path)
+{
+	struct WasmJITMemFSMount *mount;
+
+	mount = calloc(1, sizeof(*mount));
+	if (!mount)
+		return NULL;
+
+	mount->fs = get_archive(archive_path);
+	if (!mount->fs) {
+		free(mount);
+		return NULL;
+	}
+
+	return mount;
+}
+
+void wasmjit_memfs_unmount(struct WasmJITMemFSMount *mount)
+{
+	put_archive(mount->fs);
+	free(mount->files);
+	free(mount);
+}
+
+/*
+  absolute form of path with empty, "." and ".." components resolved,
+  relative paths start at "/", with room for one more character.
+  NULL if out of memory
+*/
+static char *normalize_path(const char *path)
+{
+	size_t o = 1;
+	char *out;
+
+	out = malloc(strlen(path) + 3);
+	if (!out)
+		return NULL;
+	out[0] = '/';
+
+	while (*path) {
+		const char *seg;
+		size_t seg_len;
+
+		while (*path == '/')
+			path++;
+		if (!*path)
+			break;
+
+		seg = path;
+		while (*path && *path != '/')
+			path++;
+		seg_len = path - seg;
+
+		if (seg_len == 1 && seg[0] == '.')
+			continue;
+
+		if (seg_len == 2 && seg[0] == '.' && seg[1] == '.') {
+			while (o > 1 && out[o - 1] != '/')
+				o--;
+			if (o > 1)
+				o--;
+			continue;
+		}
+
+		if (o > 1)
+			out[o++] = '/';
+		memcpy(out + o, seg, seg_len);
+		o += seg_len;
+	}
+
+	out[o] = '\0';
+
+	return out;
+}
+
+/* first entry not sorting before name */
+static uint32_t lower_bound(const struct WasmJITMemFS *fs, const char *name)
+{
+	uint32_t lo = 0, hi = fs->n_entries;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (strcmp(entry_name(fs, mid), name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+  directories exist implicitly as prefixes of file paths, idx is
+  then the first file below it. returns -ENOMEM on failure
+*/
+static long lookup(const struct WasmJITMemFS *fs, const char *path,
+		   uint32_t *idx)
+{
+	char *name;
+	size_t len;
+	long ret = MEMFS_NOT_FOUND;
+
+	name = normalize_path(path);
+	if (!name)
+		return -ENOMEM;
+
+	*idx = lower_bound(fs, name);
+	if (*idx < fs->n_entries && !strcmp(entry_name(fs, *idx), name)) {
+		ret = MEMFS_FILE;
+		goto out;
+	}
+
+	/*
+	  "/a" is a directory if there's a "/a/...", which can sort
+	  after siblings like "/a.txt" so search for "/a/" itself
+	*/
+	len = strlen(name);
+	if (len > 1) {
+		/* normalize_path() leaves room for this */
+		name[len++] = '/';
+		name[len] = '\0';
+	}
+	*idx = lower_bound(fs, name);
+	if (*idx < fs->n_entries &&
+	    !strncmp(entry_name(fs, *idx), name, len))
+		ret = MEMFS_DIR;
+
+ out:
+	free(name);
+	return ret;
+}
+
+static void fill_stat(const struct WasmJITMemFS *fs, int is_dir,
+		      uint32_t idx, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	if (is_dir) {
+		/* inode numbers of files are idx + 1 */
+		st->st_ino = fs->n_entries + 1 + idx;
+		st->st_mode = S_IFDIR | 0555;
+		st->st_nlink = 2;
+		st->st_size = 4096;
+	} else {
+		st->st_ino = idx + 1;
+		st->st_mode = S_IFREG | 0444;
+		st->st_nlink = 1;
+		st->st_size = entry_size(fs, idx);
+	}
+	st->st_blksize = 4096;
+	st->st_blocks = (st->st_size + 511) / 512;
+}
+
+static struct MemFSFile *get_file(struct WasmJITMemFSMount *mount, int fd)
+{
+	size_t i;
+
+	if (!WASMJIT_MEMFS_IS_FD(fd))
+		return NULL;
+
+	i = fd - WASMJIT_MEMFS_FD_BASE;
+	if (i >= mount->n_files || !mount->files[i].used)
+		return NULL;
+
+	return &mount->files[i];
+}
+
+/* makes room for at least n_files files */
+static long grow_files(struct WasmJITMemFSMount *mount, size_t n_files)
+{
+	size_t new_n_files = mount->n_files ? mount->n_files : 8;
+	struct MemFSFile *files;
+
+	if (n_files <= mount->n_files)
+		return 0;
+	if (n_files > MEMFS_MAX_FILES)
+		return -EMFILE;
+
+	while (new_n_files < n_files)
+		new_n_files *= 2;
+	new_n_files = MMIN(new_n_files, MEMFS_MAX_FILES);
+
+	files = realloc(mount->files, new_n_files * sizeof(files[0]));
+	if (!files)
+		return -ENOMEM;
+	memset(files + mount->n_files, 0,
+	       (new_n_files - mount->n_files) * sizeof(files[0]));
+	mount->files = files;
+	mount->n_files = new_n_files;
+
+	return 0;
+}
+
+long wasmjit_memfs_open(struct WasmJITMemFSMount *mount,
+			const char *path, int flags)
+{
+	uint32_t idx;
+	size_t i;
+	long ret;
+
+	ret = lookup(mount->fs, path, &idx);
+	/* directories can't be listed, leave them to the host */
+	if (ret != MEMFS_FILE)
+		return ret < 0 ? ret : -ENOENT;
+
+	if ((flags & O_CREAT) && (flags & O_EXCL))
+		return -EEXIST;
+	if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC))
+		return -EROFS;
+	if (flags & O_DIRECTORY)
+		return -ENOTDIR;
+
+	for (i = 0; i < mount->n_files; ++i) {
+		if (!mount->files[i].used)
+			break;
+	}
+
+	ret = grow_files(mount, i + 1);
+	if (ret)
+		return ret;
+
+	mount->files[i].used = 1;
+	mount->files[i].entry = idx;
+	mount->files[i].pos = 0;
+
+	return WASMJIT_MEMFS_FD_BASE + i;
+}
+
+long wasmjit_memfs_next_file(struct WasmJITMemFSMount *mount, int fd,
+			     const char **path, uint64_t *pos)
+{
+	size_t i;
+
+	i = WASMJIT_MEMFS_IS_FD(fd) ? (size_t) fd - WASMJIT_MEMFS_FD_BASE : 0;
+	for (; i < mount->n_files; ++i) {
+		if (!mount->files[i].used)
+			continue;
+
+		*path = entry_name(mount->fs, mount->files[i].entry);
+		*pos = mount->files[i].pos;
+		return WASMJIT_MEMFS_FD_BASE + i;
+	}
+
+	return -EBADF;
+}
+
+long wasmjit_memfs_reopen(struct WasmJITMemFSMount *mount, int fd,
+			  const char *path, uint64_t pos)
+{
+	uint32_t idx;
+	size_t i;
+	long ret;
+
+	if (!WASMJIT_MEMFS_IS_FD(fd))
+		return -EBADF;
+	i = fd - WASMJIT_MEMFS_FD_BASE;
+
+	ret = lookup(mount->fs, path, &idx);
+	if (ret < 0)
+		return ret;
+	if (ret != MEMFS_FILE)
+		return -ENOENT;
+
+	ret = grow_files(mount, i + 1);
+	if (ret)
+		return ret;
+	if (mount->files[i].used)
+		return -EBUSY;
+
+	mount->files[i].used = 1;
+	mount->files[i].entry = idx;
+	mount->files[i].pos = pos;
+
+	return 0;
+}
+
+long wasmjit_memfs_stat(struct WasmJITMemFSMount *mount,
+			const char *path, struct stat *st)
+{
+	uint32_t idx;
+	long ret;
+
+	ret = lookup(mount->fs, path, &idx);
+	if (ret < 0)
+		return ret;
+	if (ret == MEMFS_NOT_FOUND)
+		return -ENOENT;
+
+	fill_stat(mount->fs, ret == MEMFS_DIR, idx, st);
+	return 0;
+}
+
+long wasmjit_memfs_access(struct WasmJITMemFSMount *mount,
+			  const char *path, int mode)
+{
+	uint32_t idx;
+	long ret;
+
+	ret = lookup(mount->fs, path, &idx);
+	if (ret < 0)
+		return ret;
+	if (ret == MEMFS_NOT_FOUND)
+		return -ENOENT;
+
+	if (mode & MEMFS_W_OK)
+		return -EROFS;
+	if ((mode & MEMFS_X_OK) && ret == MEMFS_FILE)
+		return -EACCES;
+
+	return 0;
+}
+
+long wasmjit_memfs_fstat(struct WasmJITMemFSMount *mount,
+			 int fd, struct stat *st)
+{
+	struct MemFSFile *file = get_file(mount, fd);
+
+	if (!file)
+		return -EBADF;
+
+	fill_stat(mount->fs, 0, file->entry, st);
+	return 0;
+}
+
+/* copies what's left of the file from offset, up to count bytes */
+static size_t copy_out(const struct WasmJITMemFS *fs, uint32_t idx,
+		       uint64_t offset, void *buf, size_t count)
+{
+	uint64_t size = entry_size(fs, idx);
+
+	if (offset >= size)
+		return 0;
+	if (count > size - offset)
+		count = size - offset;
+
+	memcpy(buf, fs->data + entry_data_offset(fs, idx) + offset, count);
+	return count;
+}
+
+long wasmjit_memfs_read(struct WasmJITMemFSMount *mount,
+			int fd, void *buf, size_t count)
+{
+	struct MemFSFile *file = get_file(mount, fd);
+	size_t n;
+
+	if (!file)
+		return -EBADF;
+
+	if (count > LONG_MAX)
+		count = LONG_MAX;
+
+	n = copy_out(mount->fs, file->entry, file->pos, buf, count);
+	file->pos += n;
+
+	return n;
+}
+
+long wasmjit_memfs_readv(struct WasmJITMemFSMount *mount,
+			 int fd, const struct iovec *iov, size_t iovcnt)
+{
+	struct MemFSFile *file = get_file(mount, fd);
+	size_t i, total = 0;
+
+	if (!file)
+		return -EBADF;
+
+	for (i = 0; i < iovcnt; ++i) {
+		size_t n;
+
+		if (iov[i].iov_len > LONG_MAX - total)
+			return -EINVAL;
+
+		n = copy_out(mount->fs, file->entry, file->pos,
+			     iov[i].iov_base, iov[i].iov_len);
+		file->pos += n;
+		total += n;
+		if (n < iov[i].iov_len)
+			break;
+	}
+
+	return total;
+}
+
+long wasmjit_memfs_pread(struct WasmJITMemFSMount *mount,
+			 int fd, void *buf, size_t count, int64_t offset)
+{
+	struct MemFSFile *file = get_file(mount, fd);
+
+	if (!file)
+		return -EBADF;
+
+	if (offset < 0)
+		return -EINVAL;
+
+	if (count > LONG_MAX)
+		count = LONG_MAX;
+
+	return copy_out(mount->fs, file->entry, offset, buf, count);
+}
+
+long wasmjit_memfs_lseek(struct WasmJITMemFSMount *mount,
+			 int fd, int64_t offset, int whence)
+{
+	struct MemFSFile *file = get_file(mount, fd);
+	int64_t pos;
+
+	if (!file)
+		return -EBADF;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = 0;
+		break;
+	case SEEK_CUR:
+		pos = file->pos;
+		break;
+	case SEEK_END:
+		pos = entry_size(mount->fs, file->entry);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (__builtin_add_overflow(pos, offset, &pos))
+		return -EOVERFLOW;
+	if (pos < 0)
+		return -EINVAL;
+
+	file->pos = pos;
+
+	return pos;
+}
+
+long wasmjit_memfs_close(struct WasmJITMemFSMount *mount, int fd)
+{
+	struct MemFSFile *file = get_file(mount, fd);
+
+	if (!file)
+		return -EBADF;
+
+	file->used = 0;
+
+	return 0;
+}
+
+#ifndef __KERNEL__
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct PackFile {
+	char *guest_path;
+	char *host_path;
+	uint64_t size;
+};
+
+struct PackFiles {
+	size_t n_elts;
+	struct PackFile *elts;
+};
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const char *p = buf;
+
+	while (size) {
+		ssize_t ret = write(fd, p, size);
+		if (ret < 0)
+			return -1;
+		p += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int compare_pack_files(const void *a, const void *b)
+{
+	return strcmp(((const struct PackFile *) a)->guest_path,
+		      ((const struct PackFile *) b)->guest_path);
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+	char *ret = malloc(strlen(dir) + strlen(name) + 2);
+
+	if (ret)
+		sprintf(ret, "%s/%s", dir, name);
+	return ret;
+}
+
+/* adds host_path (recursively if it's a directory) as guest_path */
+static int add_pack_path(struct PackFiles *files, const char *host_path,
+			 const char *guest_path, char *why, size_t why_size)
+{
+	struct stat st;
+	DIR *dir = NULL;
+	struct dirent *dirent;
+	char *host_child = NULL, *guest_child = NULL;
+	struct PackFile *file;
+	int ret = -1;
+
+	if (stat(host_path, &st)) {
+		snprintf(why, why_size, "couldn't stat %s", host_path);
+		goto error;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		if (!VECTOR_GROW(files, 1))
+			goto error;
+		file = &files->elts[files->n_elts - 1];
+		file->guest_path = normalize_path(guest_path);
+		file->host_path = strdup(host_path);
+		file->size = st.st_size;
+		if (!file->guest_path || !file->host_path)
+			goto error;
+		return 0;
+	}
+
+	if (!S_ISDIR(st.st_mode))
+		return 0;
+
+	dir = opendir(host_path);
+	if (!dir) {
+		snprintf(why, why_size, "couldn't open %s", host_path);
+		goto error;
+	}
+
+	while ((dirent = readdir(dir))) {
+		if (!strcmp(dirent->d_name, ".") ||
+		    !strcmp(dirent->d_name, ".."))
+			continue;
+
+		host_child = join_path(host_path, dirent->d_name);
+		guest_child = join_path(guest_path, dirent->d_name);
+		if (!host_child || !guest_child ||
+		    add_pack_path(files, host_child, guest_child,
+				  why, why_size))
+			goto error;
+		free(host_child);
+		free(guest_child);
+		host_child = guest_child = NULL;
+	}
+
+	ret = 0;
+
+ error:
+	if (ret && !why[0])
+		snprintf(why, why_size, "out of memory");
+	free(host_child);
+	free(guest_child);
+	if (dir)
+		closedir(dir);
+	return ret;
+}
+
+static int copy_file(int out_fd, const struct PackFile *file,
+		     char *why, size_t why_size)
+{
+	char buf[65536];
+	uint64_t left = file->size;
+	int fd;
+
+	fd = open(file->host_path, O_RDONLY);
+	if (fd < 0) {
+		snprintf(why, why_size, "couldn't open %s", file->host_path);
+		return -1;
+	}
+
+	while (left) {
+		ssize_t n = read(fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+		if (n <= 0) {
+			snprintf(why, why_size, "couldn't read all of %s",
+				 file->host_path);
+			goto error;
+		}
+		if (write_all(out_fd, buf, n)) {
+			snprintf(why, why_size, "couldn't write the archive");
+			goto error;
+		}
+		left -= n;
+	}
+
+	close(fd);
+	return 0;
+
+ error:
+	close(fd);
+	return -1;
+}
+
+static void put_le32(char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void put_le64(char *p, uint64_t v)
+{
+	put_le32(p, v);
+	put_le32(p + 4, v >> 32);
+}
+
+int wasmjit_memfs_pack(int out_fd, size_t n_specs, char *const *specs,
+		       char *why, size_t why_size)
+{
+	struct PackFiles files = {0, NULL};
+	char *index = NULL, *host_path = NULL;
+	size_t i, names_size = 0, index_size;
+	uint64_t data_offset;
+	int ret = -1;
+
+	why[0] = '\0';
+
+	for (i = 0; i < n_specs; ++i) {
+		const char *at = strchr(specs[i], '@');
+
+		host_path = strdup(specs[i]);
+		if (!host_path) {
+			snprintf(why, why_size, "out of memory");
+			goto error;
+		}
+
+		if (at)
+			host_path[at - specs[i]] = '\0';
+
+		if (add_pack_path(&files, host_path, at ? at + 1 : host_path,
+				  why, why_size))
+			goto error;
+
+		free(host_path);
+		host_path = NULL;
+	}
+
+	qsort(files.elts, files.n_elts, sizeof(files.elts[0]),
+	      compare_pack_files);
+
+	for (i = 0; i < files.n_elts; ++i) {
+		if (i && !strcmp(files.elts[i - 1].guest_path,
+				 files.elts[i].guest_path)) {
+			snprintf(why, why_size, "%s added twice",
+				 files.elts[i].guest_path);
+			goto error;
+		}
+		names_size += strlen(files.elts[i].guest_path) + 1;
+	}
+
+	if (files.n_elts > UINT32_MAX / MEMFS_ENTRY_SIZE ||
+	    names_size > UINT32_MAX) {
+		snprintf(why, why_size, "too many files");
+		goto error;
+	}
+
+	index_size = MEMFS_HEADER_SIZE + files.n_elts * MEMFS_ENTRY_SIZE +
+		names_size;
+	index = calloc(1, index_size);
+	if (!index) {
+		snprintf(why, why_size, "out of memory");
+		goto error;
+	}
+
+	memcpy(index, MEMFS_MAGIC, sizeof(MEMFS_MAGIC));
+	put_le32(index + 8, files.n_elts);
+	put_le32(index + 12, names_size);
+
+	names_size = 0;
+	data_offset = index_size;
+	for (i = 0; i < files.n_elts; ++i) {
+		char *entry = index + MEMFS_HEADER_SIZE + i * MEMFS_ENTRY_SIZE;
+		char *names = index + MEMFS_HEADER_SIZE +
+			files.n_elts * MEMFS_ENTRY_SIZE;
+		size_t len = strlen(files.elts[i].guest_path);
+
+		put_le32(entry, names_size);
+		put_le32(entry + 4, len);
+		put_le64(entry + 8, data_offset);
+		put_le64(entry + 16, files.elts[i].size);
+		memcpy(names + names_size, files.elts[i].guest_path, len + 1);
+
+		names_size += len + 1;
+		data_offset += files.elts[i].size;
+	}
+
+	if (write_all(out_fd, index, index_size)) {
+		snprintf(why, why_size, "couldn't write the archive");
+		goto error;
+	}
+
+	for (i = 0; i < files.n_elts; ++i) {
+		if (copy_file(out_fd, &files.elts[i], why, why_size))
+			goto error;
+	}
+
+	ret = 0;
+
+ error:
+	for (i = 0; i < files.n_elts; ++i) {
+		free(files.elts[i].guest_path);
+		free(files.elts[i].host_path);
+	}
+	free(files.elts);
+	free(index);
+	free(host_path);
+	return ret;
+}
+
+#endif
+
+/* platform specific */
+
+#ifdef __KERNEL__
+
+#include <linux/mutex.h>
+
+static DEFINE_MUTEX(memfs_mutex);
+
+static void memfs_lock(void)
+{
+	mutex_lock(&memfs_mutex);
+}
+
+static void memfs_unlock(void)
+{
+	mutex_unlock(&memfs_mutex);
+}
+
+struct MemFSArchiveFile {
+	struct file *filp;
+};
+
+static struct MemFSArchiveFile *open_archive(const char *path,
+					     struct MemFSFileId *id)
+{
+	struct MemFSArchiveFile *file;
+	struct kstat stat;
+
+	file = kmalloc(sizeof(*file), GFP_KERNEL);
+	if (!file)
+		return NULL;
+
+	file->filp = filp_open(path, O_RDONLY, 0);
+	if (IS_ERR(file->filp))
+		goto error;
+
+	if (vfs_getattr(&file->filp->f_path, &stat,
+			STATX_BASIC_STATS, AT_STATX_SYNC_AS_STAT) ||
+	    !S_ISREG(stat.mode) || stat.size <= 0) {
+		filp_close(file->filp, NULL);
+		goto error;
+	}
+
+	id->dev = stat.dev;
+	id->ino = stat.ino;
+	id->size = stat.size;
+	id->mtime_sec = stat.mtime.tv_sec;
+	id->mtime_nsec = stat.mtime.tv_nsec;
+
+	return file;
+
+ error:
+	kfree(file);
+	return NULL;
+}
+
+static void close_archive(struct MemFSArchiveFile *file)
+{
+	filp_close(file->filp, NULL);
+	kfree(file);
+}
+
+/* the kernel can't map files into its own address space, read it */
+static char *map_archive(struct MemFSArchiveFile *file, size_t size)
+{
+	void *buf;
+	loff_t offsize;
+
+	if (kernel_read_file(file->filp, &buf, &offsize, INT_MAX,
+			     READING_UNKNOWN) < 0)
+		return NULL;
+
+	if ((size_t) offsize != size) {
+		vfree(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void unmap_archive(char *data, size_t size)
+{
+	wasmjit_unload_file(data, size);
+}
+
+#else
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+static pthread_mutex_t memfs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void memfs_lock(void)
+{
+	pthread_mutex_lock(&memfs_mutex);
+}
+
+static void memfs_unlock(void)
+{
+	pthread_mutex_unlock(&memfs_mutex);
+}
+
+struct MemFSArchiveFile {
+	int fd;
+};
+
+static struct MemFSArchiveFile *open_archive(const char *path,
+					     struct MemFSFileId *id)
+{
+	struct MemFSArchiveFile *file;
+	struct stat st;
+
+	file = malloc(sizeof(*file));
+	if (!file)
+		return NULL;
+
+	file->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (file->fd < 0)
+		goto error;
+
+	if (fstat(file->fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(file->fd);
+		goto error;
+	}
+
+	id->dev = st.st_dev;
+	id->ino = st.st_ino;
+	id->size = st.st_size;
+	id->mtime_sec = st.st_mtime;
+	id->mtime_nsec = SYS_STAT_NSEC(&st, m);
+
+	return file;
+
+ error:
+	free(file);
+	return NULL;
+}
+
+static void close_archive(struct MemFSArchiveFile *file)
+{
+	close(file->fd);
+	free(file);
+}
+
+static char *map_archive(struct MemFSArchiveFile *file, size_t size)
+{
+	void *data;
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	return data;
+}
+
+static void unmap_archive(char *data, size_t size)
+{
+	munmap(data, size);
+}
+
+#endif
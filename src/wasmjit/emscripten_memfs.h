@@ -0,0 +1,108 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__EMSCRIPTEN_MEMFS_H__
+#define __WASMJIT__EMSCRIPTEN_MEMFS_H__
+
+#include <wasmjit/sys.h>
+
+/*
+  read-only files preloaded from an archive, served to the guest ahead
+  of the host's file system without system calls. the archive is
+  opened by every mount, as whoever mounts it, and its contents are
+  shared by all mounts of the same unchanged file (device, inode, size
+  and mtime). guest paths are looked up normalized, relative ones from
+  "/" (Emscripten's initial directory), and anything not in the archive
+  is left to the host.
+
+  the archive is little-endian:
+    header   "WJMEMFS\0", u32 n_entries, u32 names_size
+    entries  n_entries x {u32 name_offset, u32 name_len,
+                          u64 data_offset, u64 size}
+    names    names_size bytes of NUL-terminated absolute paths,
+             entries are sorted by them
+    data     file contents at data_offset from the start
+*/
+
+struct stat;
+struct iovec;
+
+struct WasmJITMemFSMount;
+
+/* fds of archive files, no host fd gets this high (see fs.nr_open) */
+#define WASMJIT_MEMFS_FD_BASE 0x40000000
+#define WASMJIT_MEMFS_IS_FD(fd) ((fd) >= WASMJIT_MEMFS_FD_BASE)
+
+/* NULL on failure */
+struct WasmJITMemFSMount *wasmjit_memfs_mount(const char *archive_path);
+/* closes the mount's files and drops its reference to the archive */
+void wasmjit_memfs_unmount(struct WasmJITMemFSMount *mount);
+
+/*
+  these return what the system call would, -ENOENT from the path
+  based ones means the path isn't in the archive. flags are the
+  host's open flags
+*/
+long wasmjit_memfs_open(struct WasmJITMemFSMount *mount,
+			const char *path, int flags);
+long wasmjit_memfs_stat(struct WasmJITMemFSMount *mount,
+			const char *path, struct stat *st);
+long wasmjit_memfs_access(struct WasmJITMemFSMount *mount,
+			  const char *path, int mode);
+long wasmjit_memfs_fstat(struct WasmJITMemFSMount *mount,
+			 int fd, struct stat *st);
+long wasmjit_memfs_read(struct WasmJITMemFSMount *mount,
+			int fd, void *buf, size_t count);
+long wasmjit_memfs_readv(struct WasmJITMemFSMount *mount,
+			 int fd, const struct iovec *iov, size_t iovcnt);
+long wasmjit_memfs_pread(struct WasmJITMemFSMount *mount,
+			 int fd, void *buf, size_t count, int64_t offset);
+long wasmjit_memfs_lseek(struct WasmJITMemFSMount *mount,
+			 int fd, int64_t offset, int whence);
+long wasmjit_memfs_close(struct WasmJITMemFSMount *mount, int fd);
+
+/*
+  for checkpoints: the first open fd from fd on, with its guest path
+  and position, or -EBADF if there are no more
+*/
+long wasmjit_memfs_next_file(struct WasmJITMemFSMount *mount, int fd,
+			     const char **path, uint64_t *pos);
+/* opens path as fd, which must be free, at pos. returns 0 or -errno */
+long wasmjit_memfs_reopen(struct WasmJITMemFSMount *mount, int fd,
+			  const char *path, uint64_t pos);
+
+#ifndef __KERNEL__
+
+/*
+  writes an archive of host files to out_fd, specs are
+  "host_path[@guest_path]" like emcc's --preload-file, directories are
+  added recursively. the guest path defaults to the host path under "/".
+  returns 0 or -1 with why filled in
+*/
+int wasmjit_memfs_pack(int out_fd, size_t n_specs, char *const *specs,
+		       char *why, size_t why_size);
+
+#endif
+
+#endif
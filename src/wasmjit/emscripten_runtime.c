@@ -30,6 +30,11 @@
 #include <wasmjit/emscripten_runtime.h>
 
 #include <wasmjit/emscripten_runtime_sys.h>
+#include <wasmjit/emscripten_heatmap.h>
+#include <wasmjit/emscripten_checkpoint.h>
+#include <wasmjit/log_ring.h>
+#include <wasmjit/emscripten_memfs.h>
+#include <wasmjit/code_gc.h>
 #include <wasmjit/util.h>
 #include <wasmjit/runtime.h>
 #include <wasmjit/sys.h>
@@ -76,7 +81,8 @@ static int32_t int32_t_swap_bytes(int32_t a)
 					       &args, varargs,		\
 					       sizeof(args)))		\
 		return -EM_EFAULT;					\
-	__MMAP(args, n, __SWAP, __VA_ARGS__)
+	__MMAP(args, n, __SWAP, __VA_ARGS__)				\
+	wasmjit_code_gc_poll(wasmjit_emscripten_get_mem_inst(funcinst))
 
 #define LOAD_ARGS(...)				\
 	LOAD_ARGS_CUSTOM(args, __VA_ARGS__)
@@ -156,7 +162,10 @@ static int wasmjit_emscripten_check_range(struct MemInst *meminst,
 	size_t ret;
 	if (__builtin_add_overflow(user_ptr, extent, &ret))
 		return 0;
-	return ret <= meminst->size;
+	if (ret > meminst->size)
+		return 0;
+	WASMJIT_EMSCRIPTEN_HEATMAP_TOUCH(meminst->data + user_ptr, extent);
+	return 1;
 }
 
 /* use this whenever going to read from an address controlled by user input,
@@ -193,6 +202,8 @@ static int wasmjit_emscripten_check_range_sanitize(struct MemInst *meminst,
 #endif
 
 	*user_ptr &= mask;
+	if (toret)
+		WASMJIT_EMSCRIPTEN_HEATMAP_TOUCH(meminst->data + *user_ptr, extent);
 	return toret;
 
 }
@@ -229,19 +240,16 @@ static int _wasmjit_emscripten_check_string(struct FuncInst *funcinst,
 					    size_t max)
 {
 	struct MemInst *meminst = wasmjit_emscripten_get_mem_inst(funcinst);
-	size_t len = 0;
+	size_t avail;
 
-	while (wasmjit_emscripten_check_range_sanitize(meminst,
-						       &user_ptr,
-						       1) &&
-	       len < max) {
-		if (!*(meminst->data + user_ptr))
-			return 1;
-		user_ptr += 1;
-		len += 1;
-	}
+	if (!wasmjit_emscripten_check_range_sanitize(meminst, &user_ptr, 1))
+		return 0;
 
-	return 0;
+	avail = meminst->size - user_ptr;
+	if (avail > max)
+		avail = max;
+
+	return memchr(meminst->data + user_ptr, '\0', avail) != NULL;
 }
 
 /* shortcut functions */
@@ -438,6 +446,148 @@ static struct EmscriptenContext *_wasmjit_emscripten_get_context(struct FuncInst
 	return wasmjit_emscripten_get_context(funcinst->module_inst);
 }
 
+#define WASMJIT_EMSCRIPTEN_LOG_RING_SIZE (256 * 1024)
+
+/*
+  keeps direct writes, seeks, syncs, truncates and closes ordered after
+  queued log records
+*/
+static void sync_log_fd(struct FuncInst *funcinst, int32_t fd, int forget)
+{
+	struct EmscriptenContext *ctx =
+		_wasmjit_emscripten_get_context(funcinst);
+
+	if (ctx->log_ring)
+		wasmjit_log_ring_sync_fd(ctx->log_ring, fd, forget);
+}
+
+/* the preloaded files, NULL if none are mounted */
+static struct WasmJITMemFSMount *get_memfs(struct FuncInst *funcinst)
+{
+	return _wasmjit_emscripten_get_context(funcinst)->memfs;
+}
+
+/* the preloaded files if fd is one of them */
+static struct WasmJITMemFSMount *get_memfs_for_fd(struct FuncInst *funcinst,
+						  int32_t fd)
+{
+	return WASMJIT_MEMFS_IS_FD(fd) ? get_memfs(funcinst) : NULL;
+}
+
+int wasmjit_emscripten_init_invoke(struct EmscriptenContext *ctx,
+				   struct FuncInst *set_threw_inst,
+				   struct FuncInst *stack_save_inst,
+				   struct FuncInst *stack_restore_inst)
+{
+	struct FuncType type;
+	wasmjit_valtype_t i32_types[] = {VALTYPE_I32, VALTYPE_I32};
+
+	_wasmjit_create_func_type(&type, 2, i32_types, 0, NULL);
+	if (set_threw_inst && !wasmjit_typecheck_func(&type, set_threw_inst))
+		return -1;
+
+	_wasmjit_create_func_type(&type, 0, NULL, 1, i32_types);
+	if (stack_save_inst && !wasmjit_typecheck_func(&type, stack_save_inst))
+		return -1;
+
+	_wasmjit_create_func_type(&type, 1, i32_types, 0, NULL);
+	if (stack_restore_inst &&
+	    !wasmjit_typecheck_func(&type, stack_restore_inst))
+		return -1;
+
+	ctx->set_threw_inst = set_threw_inst;
+	ctx->stack_save_inst = stack_save_inst;
+	ctx->stack_restore_inst = stack_restore_inst;
+	ctx->stack_global = stack_save_inst &&
+		stack_save_inst->returns_global &&
+		stack_save_inst->returns_global->value.type == VALTYPE_I32
+		? stack_save_inst->returns_global
+		: NULL;
+
+	return 0;
+}
+
+union ValueUnion wasmjit_emscripten_invoke(struct FuncInst *funcinst,
+					   union ValueUnion *args)
+{
+	struct EmscriptenContext *ctx =
+		_wasmjit_emscripten_get_context(funcinst);
+	struct EmscriptenInvokeFrame frame;
+	struct FuncType callee_type;
+	struct FuncInst *callee;
+	union ValueUnion out;
+
+	if (!funcinst->module_inst->tables.n_elts)
+		wasmjit_trap(WASMJIT_TRAP_TABLE_OVERFLOW);
+
+	/* the callee's type is ours without the leading table index */
+	callee_type.n_inputs = funcinst->type.n_inputs - 1;
+	memcpy(callee_type.input_types, funcinst->type.input_types + 1,
+	       callee_type.n_inputs);
+	callee_type.output_type = funcinst->type.output_type;
+
+	callee = wasmjit_resolve_indirect_call(funcinst->module_inst->tables.elts[0],
+					       &callee_type,
+					       args[0].i32);
+
+	/*
+	  arming the frame only stores the frame and stack pointers, the
+	  registers our caller expects preserved are restored by our own
+	  epilogue after a throw. the guest stack pointer is read straight
+	  from its global unless stackSave() does more than return it
+	*/
+	frame.prev = ctx->invoke_frame;
+	if (ctx->stack_global)
+		frame.stack_top = ctx->stack_global->value.data.i32;
+	else if (ctx->stack_save_inst)
+		frame.stack_top =
+			wasmjit_invoke_function_raw(ctx->stack_save_inst, NULL).i32;
+	else
+		frame.stack_top = 0;
+	ctx->invoke_frame = &frame;
+
+	if (!__builtin_setjmp(frame.jmpbuf)) {
+		out = wasmjit_invoke_function_raw(callee, args + 1);
+		ctx->invoke_frame = frame.prev;
+		return out;
+	}
+
+	/* the thrower already set __THREW__ through setThrew() */
+	ctx->invoke_frame = frame.prev;
+
+	if (ctx->stack_restore_inst) {
+		union ValueUnion stack_top;
+		stack_top.i32 = frame.stack_top;
+		wasmjit_invoke_function_raw(ctx->stack_restore_inst, &stack_top);
+	}
+
+	memset(&out, 0, sizeof(out));
+	return out;
+}
+
+void wasmjit_emscripten_reset_invoke(struct EmscriptenContext *ctx)
+{
+	ctx->invoke_frame = NULL;
+}
+
+__attribute__((noreturn))
+static void wasmjit_emscripten_throw(struct FuncInst *funcinst,
+				     uint32_t threw, uint32_t value)
+{
+	struct EmscriptenContext *ctx =
+		_wasmjit_emscripten_get_context(funcinst);
+	union ValueUnion args[2];
+
+	if (!ctx->invoke_frame || !ctx->set_threw_inst)
+		wasmjit_emscripten_internal_abort("Uncaught longjmp or exception");
+
+	args[0].i32 = threw;
+	args[1].i32 = value;
+	wasmjit_invoke_function_raw(ctx->set_threw_inst, args);
+
+	__builtin_longjmp(ctx->invoke_frame->jmpbuf, 1);
+}
+
 void wasmjit_emscripten_abortStackOverflow(uint32_t allocSize, struct FuncInst *funcinst)
 {
 	(void)funcinst;
@@ -502,6 +652,7 @@ void wasmjit_emscripten____setErrNo(uint32_t value, struct FuncInst *funcinst)
 uint32_t wasmjit_emscripten____syscall3(uint32_t which, uint32_t varargs, struct FuncInst *funcinst)
 {
 	char *base;
+	struct WasmJITMemFSMount *memfs;
 
 	LOAD_ARGS(funcinst, varargs, 3,
 		  int32_t, fd,
@@ -515,6 +666,12 @@ uint32_t wasmjit_emscripten____syscall3(uint32_t which, uint32_t varargs, struct
 
 	base = wasmjit_emscripten_get_base_address(funcinst);
 
+	memfs = get_memfs_for_fd(funcinst, args.fd);
+	if (memfs)
+		return check_ret(wasmjit_memfs_read(memfs, args.fd,
+						    base + args.buf,
+						    args.count));
+
 	return check_ret(sys_read(args.fd, base + args.buf, args.count));
 }
 
@@ -557,12 +714,15 @@ uint32_t wasmjit_emscripten____syscall42(uint32_t which, uint32_t varargs, struc
 uint32_t wasmjit_emscripten____syscall140(uint32_t which, uint32_t varargs, struct FuncInst *funcinst)
 {
 	char *base;
-	int32_t ret;
+	int64_t offset;
+	uint64_t result;
+	long ret;
+	struct WasmJITMemFSMount *memfs;
 
 	LOAD_ARGS(funcinst, varargs, 5,
 		  int32_t, fd,
 		  uint32_t, offset_high,
-		  int32_t, offset_low,
+		  uint32_t, offset_low,
 		  uint32_t, result,
 		  int32_t, whence);
 
@@ -570,21 +730,28 @@ uint32_t wasmjit_emscripten____syscall140(uint32_t which, uint32_t varargs, stru
 
 	base = wasmjit_emscripten_get_base_address(funcinst);
 
-	if (!_wasmjit_emscripten_check_range(funcinst, args.result, 4))
+	if (!_wasmjit_emscripten_check_range(funcinst, args.result, 8))
 		return -EM_EFAULT;
 
-	// emscripten off_t is 32-bits, offset_high is useless
-	if (args.offset_high)
-		return -EM_EINVAL;
-
-	ret = check_ret(sys_lseek(args.fd, args.offset_low, args.whence));
+	offset = (int64_t) (((uint64_t) args.offset_high << 32) |
+			    args.offset_low);
 
-	if (ret) {
-		return ret;
+	memfs = get_memfs_for_fd(funcinst, args.fd);
+	if (memfs) {
+		ret = wasmjit_memfs_lseek(memfs, args.fd, offset, args.whence);
 	} else {
-		memcpy(base + args.result, &ret, sizeof(ret));
-		return 0;
+		sync_log_fd(funcinst, args.fd, 0);
+		ret = sys_lseek(args.fd, offset, args.whence);
 	}
+
+	if (ret < 0)
+		return check_ret(ret);
+
+	/* the new offset is returned through result, as an i64 */
+	result = uint64_t_swap_bytes(ret);
+	memcpy(base + args.result, &result, sizeof(result));
+
+	return 0;
 }
 
 struct em_iovec {
@@ -648,6 +815,36 @@ static long copy_iov(struct FuncInst *funcinst,
 	return ret;
 }
 
+/* readv */
+uint32_t wasmjit_emscripten____syscall145(uint32_t which, uint32_t varargs, struct FuncInst *funcinst)
+{
+	long rret;
+	struct iovec *liov;
+	struct WasmJITMemFSMount *memfs;
+
+	LOAD_ARGS(funcinst, varargs, 3,
+		  int32_t, fd,
+		  uint32_t, iov,
+		  uint32_t, iovcnt);
+
+	(void)which;
+
+	rret = copy_iov(funcinst, args.iov, args.iovcnt, &liov);
+	if (rret)
+		goto error;
+
+	memfs = get_memfs_for_fd(funcinst, args.fd);
+	if (memfs)
+		rret = wasmjit_memfs_readv(memfs, args.fd, liov, args.iovcnt);
+	else
+		rret = sys_readv(args.fd, liov, args.iovcnt);
+
+	free(liov);
+
+ error:
+	return check_ret(rret);
+}
+
 /* writev */
 uint32_t wasmjit_emscripten____syscall146(uint32_t which, uint32_t varargs, struct FuncInst *funcinst)
 {
@@ -665,7 +862,9 @@ uint32_t wasmjit_emscripten____syscall146(uint32_t which, uint32_t varargs, stru
 	if (rret)
 		goto error;
 
-	rret = sys_writev(args.fd, liov, args.iovcnt);
+	sync_log_fd(funcinst, args.fd, 0);
+
+	rret = sys_writev_zerocopy(args.fd, liov, args.iovcnt);
 
 	free(liov);
 
@@ -690,6 +889,8 @@ uint32_t wasmjit_emscripten____syscall4(uint32_t which, uint32_t varargs, struct
 
 	base = wasmjit_emscripten_get_base_address(funcinst);
 
+	sync_log_fd(funcinst, args.fd, 0);
+
 	return check_ret(sys_write(args.fd, base + args.buf, args.count));
 }
 
@@ -703,14 +904,78 @@ uint32_t wasmjit_emscripten____syscall54(uint32_t which, uint32_t varargs, struc
 	return 0;
 }
 
+int wasmjit_emscripten_track_fd(struct EmscriptenContext *ctx, int fd)
+{
+	size_t byte = (size_t) fd / 8;
+
+	if (byte >= ctx->opened_fds_size) {
+		size_t new_size = MMAX(byte + 1, ctx->opened_fds_size * 2);
+		unsigned char *new_fds;
+
+		new_fds = realloc(ctx->opened_fds, new_size);
+		if (!new_fds)
+			return -1;
+		memset(new_fds + ctx->opened_fds_size, 0,
+		       new_size - ctx->opened_fds_size);
+		ctx->opened_fds = new_fds;
+		ctx->opened_fds_size = new_size;
+	}
+
+	ctx->opened_fds[byte] |= 1 << (fd % 8);
+	return 0;
+}
+
+int wasmjit_emscripten_fd_is_tracked(const struct EmscriptenContext *ctx,
+				     int fd)
+{
+	size_t byte = (size_t) fd / 8;
+
+	return fd >= 0 && byte < ctx->opened_fds_size &&
+		(ctx->opened_fds[byte] & (1 << (fd % 8)));
+}
+
+static void untrack_fd(struct EmscriptenContext *ctx, int fd)
+{
+	if (wasmjit_emscripten_fd_is_tracked(ctx, fd))
+		ctx->opened_fds[fd / 8] &= ~(1 << (fd % 8));
+}
+
+/* a new fd from open() or openat(), or a negative errno value */
+static long track_opened(struct FuncInst *funcinst, long fd)
+{
+	if (fd < 0)
+		return fd;
+
+	if (wasmjit_emscripten_track_fd(_wasmjit_emscripten_get_context(funcinst),
+					fd)) {
+		(void)sys_close(fd);
+		return -ENOMEM;
+	}
+
+	return fd;
+}
+
 /* close */
 uint32_t wasmjit_emscripten____syscall6(uint32_t which, uint32_t varargs, struct FuncInst *funcinst)
 {
+	struct WasmJITMemFSMount *memfs;
+
 	/* TODO: need to define non-no filesystem case */
 	LOAD_ARGS(funcinst, varargs, 1,
 		  int32_t, fd);
 
 	(void)which;
+
+	memfs = get_memfs_for_fd(funcinst, args.fd);
+	if (memfs)
+		return check_ret(wasmjit_memfs_close(memfs, args.fd));
+
+	sync_log_fd(funcinst, args.fd, 1);
+
+	/* the fd is released even when close() fails */
+	untrack_fd(_wasmjit_emscripten_get_context(funcinst), args.fd);
+	wasmjit_emscripten_zerocopy_forget(args.fd);
+
 	return check_ret(sys_close(args.fd));
 }
 
@@ -1494,7 +1759,7 @@ static long finish_sendto(struct FuncInst *funcinst,
 		real_dest_addr = NULL;
 	}
 
-	return sys_sendto(fd, buf, len, flags, real_dest_addr, addrlen);
+	return sys_sendto_zerocopy(fd, buf, len, flags, real_dest_addr, addrlen);
 }
 
 #else
@@ -1526,7 +1791,7 @@ static long finish_sendto(struct FuncInst *funcinst,
 		ptr_size = 0;
 	}
 
-	return sys_sendto(fd, buf, len, flags2, saddr, ptr_size);
+	return sys_sendto_zerocopy(fd, buf, len, flags2, saddr, ptr_size);
 }
 
 #endif
@@ -1719,6 +1984,8 @@ static long finish_setsockopt(int32_t fd,
 	default: assert(0); __builtin_unreachable();
 	}
 
+	wasmjit_emscripten_zerocopy_sockopt(fd, level2, optname2);
+
 	return sys_setsockopt(fd, level2, optname2, real_optval_p, real_optlen);
 }
 
@@ -2257,7 +2524,7 @@ static long finish_sendmsg(struct FuncInst *funcinst,
 
 	msg->msg_name = wasmjit_emscripten_get_base_address(funcinst) + msg_name;
 
-	return sys_sendmsg(fd, msg, flags);
+	return sys_sendmsg_zerocopy(fd, msg, flags);
 }
 
 #else
@@ -2288,7 +2555,7 @@ static long finish_sendmsg(struct FuncInst *funcinst,
 		msg->msg_namelen = ptr_size;
 	}
 
-	return sys_sendmsg(fd, msg, flags);
+	return sys_sendmsg_zerocopy(fd, msg, flags);
 }
 
 #endif
@@ -2854,9 +3121,821 @@ uint32_t wasmjit_emscripten____syscall122(uint32_t which, uint32_t varargs,
 	return 0;
 }
 
-void wasmjit_emscripten_cleanup(struct ModuleInst *moduleinst) {
-	(void)moduleinst;
-	/* TODO: implement */
+/* file system */
+
+#define EM_AT_FDCWD (-100)
+
+static int convert_dirfd(int32_t dirfd)
+{
+	return dirfd == EM_AT_FDCWD ? AT_FDCWD : dirfd;
+}
+
+/* emscripten uses the generic linux open flags */
+#if (defined(__linux__) || defined(__KERNEL__)) && (defined(__x86_64__) || defined(__i386__))
+
+static int convert_open_flags(int32_t flags, int *out)
+{
+	*out = flags;
+	return 1;
+}
+
+#else
+
+#define EM_O_ACCMODE 03
+#define EM_O_CREAT 0100
+#define EM_O_EXCL 0200
+#define EM_O_NOCTTY 0400
+#define EM_O_TRUNC 01000
+#define EM_O_APPEND 02000
+#define EM_O_NONBLOCK 04000
+#define EM_O_DSYNC 010000
+#define EM_O_ASYNC 020000
+#define EM_O_DIRECT 040000
+#define EM_O_LARGEFILE 0100000
+#define EM_O_DIRECTORY 0200000
+#define EM_O_NOFOLLOW 0400000
+#define EM_O_NOATIME 01000000
+#define EM_O_CLOEXEC 02000000
+#define EM_O_SYNC 04010000
+
+static int convert_open_flags(int32_t flags, int *out)
+{
+	int oflags = flags & EM_O_ACCMODE;
+
+	flags &= ~EM_O_ACCMODE;
+	/* off_t is always 64-bit here */
+	flags &= ~EM_O_LARGEFILE;
+
+	if ((flags & EM_O_SYNC) == EM_O_SYNC) {
+		oflags |= O_SYNC;
+		flags &= ~EM_O_SYNC;
+	}
+
+#define SETF(n)					\
+	if (flags & EM_O_ ## n) {		\
+		oflags |= O_ ## n;		\
+		flags &= ~EM_O_ ## n;		\
+	}
+
+	SETF(CREAT);
+	SETF(EXCL);
+	SETF(NOCTTY);
+	SETF(TRUNC);
+	SETF(APPEND);
+	SETF(NONBLOCK);
+	SETF(DIRECTORY);
+	SETF(NOFOLLOW);
+	SETF(CLOEXEC);
+#ifdef O_DSYNC
+	SETF(DSYNC);
+#endif
+#ifdef O_ASYNC
+	SETF(ASYNC);
+#endif
+#ifdef O_DIRECT
+	SETF(DIRECT);
+#endif
+#ifdef O_NOATIME
+	SETF(NOATIME);
+#endif
+
+#undef SETF
+
+	/* there are flags we don't understand */
+	if (flags)
+		return 0;
+
+	*out = oflags;
+	return 1;
+}
+
+#endif
+
+/* struct stat as laid out by emscripten, st_size is a 32-bit off_t */
+struct em_stat64 {
+	uint32_t st_dev;
+	uint32_t __st_dev_padding;
+	uint32_t __st_ino_truncated;
+	uint32_t st_mode;
+	uint32_t st_nlink;
+	uint32_t st_uid;
+	uint32_t st_gid;
+	uint32_t st_rdev;
+	uint32_t __st_rdev_padding;
+	uint32_t st_size;
+	uint32_t st_blksize;
+	uint32_t st_blocks;
+	uint32_t st_atim_sec;
+	uint32_t st_atim_nsec;
+	uint32_t st_mtim_sec;
+	uint32_t st_mtim_nsec;
+	uint32_t st_ctim_sec;
+	uint32_t st_ctim_nsec;
+	uint32_t st_ino;
+};
+
+COMPILE_TIME_ASSERT(sizeof(struct em_stat64) == 76);
+
+static long write_stat(struct FuncInst *funcinst, uint32_t buf,
+		       const struct stat *st)
+{
+	struct em_stat64 emst;
+
+	if (st->st_size > INT32_MAX)
+		return -EOVERFLOW;
+
+	emst.st_dev = uint32_t_swap_bytes(st->st_dev);
+	emst.__st_dev_padding = 0;
+	emst.__st_ino_truncated = uint32_t_swap_bytes(st->st_ino);
+	emst.st_mode = uint32_t_swap_bytes(st->st_mode);
+	emst.st_nlink = uint32_t_swap_bytes(st->st_nlink);
+	emst.st_uid = uint32_t_swap_bytes(st->st_uid);
+	emst.st_gid = uint32_t_swap_bytes(st->st_gid);
+	emst.st_rdev = uint32_t_swap_bytes(st->st_rdev);
+	emst.__st_rdev_padding = 0;
+	emst.st_size = uint32_t_swap_bytes(st->st_size);
+	emst.st_blksize = uint32_t_swap_bytes(st->st_blksize);
+	emst.st_blocks = uint32_t_swap_bytes(st->st_blocks);
+	emst.st_atim_sec = uint32_t_swap_bytes(st->st_atime);
+	emst.st_atim_nsec = uint32_t_swap_bytes(SYS_STAT_NSEC(st, a));
+	emst.st_mtim_sec = uint32_t_swap_bytes(st->st_mtime);
+	emst.st_mtim_nsec = uint32_t_swap_bytes(SYS_STAT_NSEC(st, m));
+	emst.st_ctim_sec = uint32_t_swap_bytes(st->st_ctime);
+	emst.st_ctim_nsec = uint32_t_swap_bytes(SYS_STAT_NSEC(st, c));
+	emst.st_ino = uint32_t_swap_bytes(st->st_ino);
+
+	if (_wasmjit_emscripten_copy_to_user(funcinst, buf, &emst, sizeof(emst)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/* emscripten splits 64-bit syscall arguments into two words */
+static int64_t make_off64(uint32_t low, uint32_t high)
+{
+	return (int64_t) (((uint64_t) high << 32) | low);
+}
+
+/* open */
+uint32_t wasmjit_emscripten____syscall5(uint32_t which, uint32_t varargs,
+					struct FuncInst *funcinst)
+{
+	char *base;
+	int flags;
+	struct WasmJITMemFSMount *memfs;
+
+	LOAD_ARGS(funcinst, varargs, 3,
+		  uint32_t, pathname,
+		  int32_t, flags,
+		  int32_t, mode);
+
+	(void) which;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!_wasmjit_emscripten_check_string(funcinst, args.pathname, PATH_MAX))
+		return -EM_EFAULT;
+
+	if (!convert_open_flags(args.flags, &flags))
+		return -EM_EINVAL;
+
+	memfs = get_memfs(funcinst);
+	if (memfs) {
+		long ret = wasmjit_memfs_open(memfs, base + args.pathname,
+					      flags);
+		if (ret != -ENOENT)
+			return check_ret(ret);
+	}
+
+	return check_ret(track_opened(funcinst,
+				      sys_open(base + args.pathname, flags,
+					       args.mode)));
+}
+
+/* openat */
+uint32_t wasmjit_emscripten____syscall295(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	char *base;
+	int flags;
+	struct WasmJITMemFSMount *memfs;
+
+	LOAD_ARGS(funcinst, varargs, 4,
+		  int32_t, dirfd,
+		  uint32_t, pathname,
+		  int32_t, flags,
+		  int32_t, mode);
+
+	(void) which;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!_wasmjit_emscripten_check_string(funcinst, args.pathname, PATH_MAX))
+		return -EM_EFAULT;
+
+	if (!convert_open_flags(args.flags, &flags))
+		return -EM_EINVAL;
+
+	memfs = get_memfs(funcinst);
+	if (memfs &&
+	    (args.dirfd == EM_AT_FDCWD || base[args.pathname] == '/')) {
+		long ret = wasmjit_memfs_open(memfs, base + args.pathname,
+					      flags);
+		if (ret != -ENOENT)
+			return check_ret(ret);
+	}
+
+	return check_ret(track_opened(funcinst,
+				      sys_openat(convert_dirfd(args.dirfd),
+						 base + args.pathname, flags,
+						 args.mode)));
+}
+
+/* stat64 */
+uint32_t wasmjit_emscripten____syscall195(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	char *base;
+	struct stat st;
+	long ret;
+	struct WasmJITMemFSMount *memfs;
+
+	LOAD_ARGS(funcinst, varargs, 2,
+		  uint32_t, pathname,
+		  uint32_t, buf);
+
+	(void) which;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!_wasmjit_emscripten_check_string(funcinst, args.pathname, PATH_MAX))
+		return -EM_EFAULT;
+
+	ret = -ENOENT;
+	memfs = get_memfs(funcinst);
+	if (memfs)
+		ret = wasmjit_memfs_stat(memfs, base + args.pathname, &st);
+	if (ret == -ENOENT)
+		ret = sys_newstat(base + args.pathname, &st);
+	if (!ret)
+		ret = write_stat(funcinst, args.buf, &st);
+
+	return check_ret(ret);
+}
+
+/* lstat64 */
+uint32_t wasmjit_emscripten____syscall196(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	char *base;
+	struct stat st;
+	long ret;
+	struct WasmJITMemFSMount *memfs;
+
+	LOAD_ARGS(funcinst, varargs, 2,
+		  uint32_t, pathname,
+		  uint32_t, buf);
+
+	(void) which;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!_wasmjit_emscripten_check_string(funcinst, args.pathname, PATH_MAX))
+		return -EM_EFAULT;
+
+	ret = -ENOENT;
+	memfs = get_memfs(funcinst);
+	if (memfs)
+		ret = wasmjit_memfs_stat(memfs, base + args.pathname, &st);
+	if (ret == -ENOENT)
+		ret = sys_newlstat(base + args.pathname, &st);
+	if (!ret)
+		ret = write_stat(funcinst, args.buf, &st);
+
+	return check_ret(ret);
+}
+
+/* fstat64 */
+uint32_t wasmjit_emscripten____syscall197(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	struct stat st;
+	long ret;
+	struct WasmJITMemFSMount *memfs;
+
+	LOAD_ARGS(funcinst, varargs, 2,
+		  int32_t, fd,
+		  uint32_t, buf);
+
+	(void) which;
+
+	memfs = get_memfs_for_fd(funcinst, args.fd);
+	if (memfs)
+		ret = wasmjit_memfs_fstat(memfs, args.fd, &st);
+	else
+		ret = sys_newfstat(args.fd, &st);
+	if (!ret)
+		ret = write_stat(funcinst, args.buf, &st);
+
+	return check_ret(ret);
+}
+
+#if defined(__linux__) || defined(__KERNEL__)
+
+/* the kernel's struct linux_dirent64 */
+struct host_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+/* emscripten's struct dirent, every record is the same size */
+struct em_dirent {
+	uint64_t d_ino;
+	int64_t d_off;
+	uint16_t d_reclen;
+	uint8_t d_type;
+	char d_name[256];
+};
+
+COMPILE_TIME_ASSERT(sizeof(struct em_dirent) == 280);
+
+#endif
+
+/* getdents64 */
+uint32_t wasmjit_emscripten____syscall220(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+#if defined(__linux__) || defined(__KERNEL__)
+	/* small enough for the kernel stack, big enough for any record */
+	char hostbuf[1024] __attribute__((aligned(8)));
+	char *base;
+	uint32_t pos = 0;
+	int64_t last_off = 0;
+	long ret = 0;
+
+	LOAD_ARGS(funcinst, varargs, 3,
+		  int32_t, fd,
+		  uint32_t, dirp,
+		  uint32_t, count);
+
+	(void) which;
+
+	if (!_wasmjit_emscripten_check_range(funcinst, args.dirp, args.count))
+		return -EM_EFAULT;
+
+	if (args.count < sizeof(struct em_dirent))
+		return -EM_EINVAL;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	while (args.count - pos >= sizeof(struct em_dirent)) {
+		long n, off;
+
+		n = sys_getdents64(args.fd, hostbuf, sizeof(hostbuf));
+		if (n <= 0) {
+			if (!pos)
+				ret = n;
+			break;
+		}
+
+		for (off = 0; off < n;) {
+			struct host_dirent64 *d = (void *) (hostbuf + off);
+			struct em_dirent emd;
+			size_t namelen;
+
+			if (args.count - pos < sizeof(struct em_dirent)) {
+				/* rewind so the rest is returned next time */
+				ret = sys_lseek(args.fd, last_off, SEEK_SET);
+				if (ret < 0)
+					return check_ret(ret);
+				goto done;
+			}
+
+			namelen = strnlen(d->d_name, sizeof(emd.d_name) - 1);
+
+			memset(&emd, 0, offsetof(struct em_dirent, d_name));
+			emd.d_ino = uint64_t_swap_bytes(d->d_ino);
+			emd.d_off = uint64_t_swap_bytes(d->d_off);
+			emd.d_reclen = uint16_t_swap_bytes(sizeof(struct em_dirent));
+			emd.d_type = d->d_type;
+			memcpy(emd.d_name, d->d_name, namelen);
+			memset(emd.d_name + namelen, 0, sizeof(emd.d_name) - namelen);
+
+			memcpy(base + args.dirp + pos, &emd, sizeof(emd));
+			pos += sizeof(emd);
+
+			last_off = d->d_off;
+			off += d->d_reclen;
+		}
+	}
+
+ done:
+	if (ret < 0)
+		return check_ret(ret);
+	return pos;
+#else
+	(void) which;
+	(void) varargs;
+	(void) funcinst;
+	return -EM_ENOSYS;
+#endif
+}
+
+/* fsync */
+uint32_t wasmjit_emscripten____syscall118(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	LOAD_ARGS(funcinst, varargs, 1,
+		  int32_t, fd);
+
+	(void) which;
+
+	sync_log_fd(funcinst, args.fd, 0);
+
+	return check_ret(sys_fsync(args.fd));
+}
+
+/* fdatasync */
+uint32_t wasmjit_emscripten____syscall148(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	LOAD_ARGS(funcinst, varargs, 1,
+		  int32_t, fd);
+
+	(void) which;
+
+	sync_log_fd(funcinst, args.fd, 0);
+
+#if defined(__linux__) || defined(__KERNEL__)
+	return check_ret(sys_fdatasync(args.fd));
+#else
+	return check_ret(sys_fsync(args.fd));
+#endif
+}
+
+/* fallocate */
+uint32_t wasmjit_emscripten____syscall324(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	LOAD_ARGS(funcinst, varargs, 6,
+		  int32_t, fd,
+		  int32_t, mode,
+		  uint32_t, offset_low,
+		  uint32_t, offset_high,
+		  uint32_t, len_low,
+		  uint32_t, len_high);
+
+	(void) which;
+
+#if defined(__linux__) || defined(__KERNEL__)
+	/* mode flags are the same as linux */
+	return check_ret(sys_fallocate(args.fd, args.mode,
+				       make_off64(args.offset_low,
+						  args.offset_high),
+				       make_off64(args.len_low,
+						  args.len_high)));
+#else
+	(void) args;
+	return -EM_ENOSYS;
+#endif
+}
+
+/* ftruncate64 */
+uint32_t wasmjit_emscripten____syscall194(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	LOAD_ARGS(funcinst, varargs, 4,
+		  int32_t, fd,
+		  uint32_t, zero,
+		  uint32_t, length_low,
+		  uint32_t, length_high);
+
+	(void) which;
+
+	sync_log_fd(funcinst, args.fd, 0);
+
+	return check_ret(sys_ftruncate(args.fd,
+				       make_off64(args.length_low,
+						  args.length_high)));
+}
+
+/* pread64 */
+uint32_t wasmjit_emscripten____syscall180(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	char *base;
+	struct WasmJITMemFSMount *memfs;
+
+	LOAD_ARGS(funcinst, varargs, 6,
+		  int32_t, fd,
+		  uint32_t, buf,
+		  uint32_t, count,
+		  uint32_t, zero,
+		  uint32_t, offset_low,
+		  uint32_t, offset_high);
+
+	(void) which;
+
+	if (!_wasmjit_emscripten_check_range(funcinst, args.buf, args.count))
+		return -EM_EFAULT;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	memfs = get_memfs_for_fd(funcinst, args.fd);
+	if (memfs)
+		return check_ret(wasmjit_memfs_pread(memfs, args.fd,
+						     base + args.buf,
+						     args.count,
+						     make_off64(args.offset_low,
+								args.offset_high)));
+
+	return check_ret(sys_pread64(args.fd, base + args.buf, args.count,
+				     make_off64(args.offset_low,
+						args.offset_high)));
+}
+
+/* pwrite64 */
+uint32_t wasmjit_emscripten____syscall181(uint32_t which, uint32_t varargs,
+					  struct FuncInst *funcinst)
+{
+	char *base;
+
+	LOAD_ARGS(funcinst, varargs, 6,
+		  int32_t, fd,
+		  uint32_t, buf,
+		  uint32_t, count,
+		  uint32_t, zero,
+		  uint32_t, offset_low,
+		  uint32_t, offset_high);
+
+	(void) which;
+
+	if (!_wasmjit_emscripten_check_range(funcinst, args.buf, args.count))
+		return -EM_EFAULT;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	sync_log_fd(funcinst, args.fd, 0);
+
+	return check_ret(sys_pwrite64(args.fd, base + args.buf, args.count,
+				      make_off64(args.offset_low,
+						 args.offset_high)));
+}
+
+/* mkdir */
+uint32_t wasmjit_emscripten____syscall39(uint32_t which, uint32_t varargs,
+					 struct FuncInst *funcinst)
+{
+	char *base;
+
+	LOAD_ARGS(funcinst, varargs, 2,
+		  uint32_t, pathname,
+		  int32_t, mode);
+
+	(void) which;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!_wasmjit_emscripten_check_string(funcinst, args.pathname, PATH_MAX))
+		return -EM_EFAULT;
+
+	return check_ret(sys_mkdir(base + args.pathname, args.mode));
+}
+
+/* rmdir */
+uint32_t wasmjit_emscripten____syscall40(uint32_t which, uint32_t varargs,
+					 struct FuncInst *funcinst)
+{
+	char *base;
+
+	LOAD_ARGS(funcinst, varargs, 1,
+		  uint32_t, pathname);
+
+	(void) which;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!_wasmjit_emscripten_check_string(funcinst, args.pathname, PATH_MAX))
+		return -EM_EFAULT;
+
+	return check_ret(sys_rmdir(base + args.pathname));
+}
+
+/* rename */
+uint32_t wasmjit_emscripten____syscall38(uint32_t which, uint32_t varargs,
+					 struct FuncInst *funcinst)
+{
+	char *base;
+
+	LOAD_ARGS(funcinst, varargs, 2,
+		  uint32_t, oldpath,
+		  uint32_t, newpath);
+
+	(void) which;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!_wasmjit_emscripten_check_string(funcinst, args.oldpath, PATH_MAX) ||
+	    !_wasmjit_emscripten_check_string(funcinst, args.newpath, PATH_MAX))
+		return -EM_EFAULT;
+
+	return check_ret(sys_rename(base + args.oldpath, base + args.newpath));
+}
+
+/* access */
+uint32_t wasmjit_emscripten____syscall33(uint32_t which, uint32_t varargs,
+					 struct FuncInst *funcinst)
+{
+	char *base;
+	struct WasmJITMemFSMount *memfs;
+
+	LOAD_ARGS(funcinst, varargs, 2,
+		  uint32_t, pathname,
+		  int32_t, mode);
+
+	(void) which;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!_wasmjit_emscripten_check_string(funcinst, args.pathname, PATH_MAX))
+		return -EM_EFAULT;
+
+	memfs = get_memfs(funcinst);
+	if (memfs) {
+		long ret = wasmjit_memfs_access(memfs, base + args.pathname,
+						args.mode);
+		if (ret != -ENOENT)
+			return check_ret(ret);
+	}
+
+	/* F_OK, R_OK, W_OK and X_OK are the same everywhere */
+	return check_ret(sys_access(base + args.pathname, args.mode));
+}
+
+/* int wasmjit_checkpoint(const char *resume_export) */
+uint32_t wasmjit_emscripten__wasmjit_checkpoint(uint32_t resume_export,
+						struct FuncInst *funcinst)
+{
+#ifdef __KERNEL__
+	(void)resume_export;
+	(void)funcinst;
+	return -EM_ENOSYS;
+#else
+	struct EmscriptenContext *ctx =
+		_wasmjit_emscripten_get_context(funcinst);
+	char *base;
+
+	if (!_wasmjit_emscripten_check_string(funcinst, resume_export, 256))
+		return -EM_EFAULT;
+
+	if (!ctx->malloc_inst)
+		return -EM_EINVAL;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	return check_ret(wasmjit_emscripten_checkpoint(ctx,
+							 ctx->malloc_inst->module_inst,
+							 funcinst->module_inst,
+							 wasmjit_emscripten_get_mem_inst(funcinst),
+							 base + resume_export));
+#endif
+}
+
+uint32_t wasmjit_emscripten__wasmjit_discard(uint32_t ptr, uint32_t len,
+					     struct FuncInst *funcinst)
+{
+#ifdef __KERNEL__
+	(void)ptr;
+	(void)len;
+	(void)funcinst;
+	return -EM_ENOSYS;
+#else
+	char *base;
+
+	if (!_wasmjit_emscripten_check_range(funcinst, ptr, len))
+		return -EM_EFAULT;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	/* pages only partially in range are kept */
+	if (!wasmjit_discard_memory(base + ptr, len))
+		return -EM_ENOMEM;
+
+	return 0;
+#endif
+}
+
+void wasmjit_emscripten__longjmp(uint32_t env, uint32_t value,
+				 struct FuncInst *funcinst)
+{
+	wasmjit_emscripten_throw(funcinst, env, value ? value : 1);
+}
+
+void wasmjit_emscripten__emscripten_longjmp(uint32_t env, uint32_t value,
+					    struct FuncInst *funcinst)
+{
+	wasmjit_emscripten__longjmp(env, value, funcinst);
+}
+
+/* int wasmjit_log(int fd, const void *buf, size_t len) */
+uint32_t wasmjit_emscripten__wasmjit_log(uint32_t fd, uint32_t buf, uint32_t len,
+					 struct FuncInst *funcinst)
+{
+	struct EmscriptenContext *ctx =
+		_wasmjit_emscripten_get_context(funcinst);
+	char *base;
+
+	if (!_wasmjit_emscripten_check_range(funcinst, buf, len))
+		return -EM_EFAULT;
+
+	base = wasmjit_emscripten_get_base_address(funcinst);
+
+	if (!ctx->log_ring)
+		ctx->log_ring = wasmjit_log_ring_create(WASMJIT_EMSCRIPTEN_LOG_RING_SIZE);
+
+	if (ctx->log_ring) {
+		if (!wasmjit_log_ring_append(ctx->log_ring, (int32_t) fd,
+					     base + buf, len))
+			return len;
+		wasmjit_log_ring_sync_fd(ctx->log_ring, (int32_t) fd, 0);
+	}
+
+	/* no ring or it can't take this one, write it ourselves */
+	return check_ret(sys_write((int32_t) fd, base + buf, len));
+}
+
+/* int wasmjit_memory_fd(void) */
+uint32_t wasmjit_emscripten__wasmjit_memory_fd(struct FuncInst *funcinst)
+{
+	int fd;
+
+	fd = wasmjit_shared_memory_fd(wasmjit_emscripten_get_base_address(funcinst));
+	if (fd < 0)
+		return -EM_ENOSYS;
+
+	/* the guest may close its copy, the mapping keeps the original */
+	return check_ret(sys_dup(fd));
+}
+
+#define EM_EFD_SEMAPHORE 1
+#define EM_EFD_NONBLOCK 04000
+#define EM_EFD_CLOEXEC 02000000
+
+/* int wasmjit_eventfd(unsigned int initval, int flags) */
+uint32_t wasmjit_emscripten__wasmjit_eventfd(uint32_t initval, uint32_t flags,
+					     struct FuncInst *funcinst)
+{
+	(void)funcinst;
+#if defined(__linux__) || defined(__KERNEL__)
+	/* the guest's EFD_ flags are linux's */
+	if (flags & ~(uint32_t) (EM_EFD_SEMAPHORE | EM_EFD_NONBLOCK | EM_EFD_CLOEXEC))
+		return -EM_EINVAL;
+	return check_ret(sys_eventfd2(initval, flags));
+#else
+	(void)initval;
+	(void)flags;
+	return -EM_ENOSYS;
+#endif
+}
+
+void wasmjit_emscripten_flush_log(struct EmscriptenContext *ctx)
+{
+	if (ctx->log_ring)
+		wasmjit_log_ring_flush(ctx->log_ring);
+}
+
+void wasmjit_emscripten_cleanup(struct ModuleInst *moduleinst) {
+	struct EmscriptenContext *ctx =
+		wasmjit_emscripten_get_context(moduleinst);
+
+	if (ctx && ctx->log_ring) {
+		wasmjit_log_ring_free(ctx->log_ring);
+		ctx->log_ring = NULL;
+	}
+
+	if (ctx && ctx->memfs) {
+		wasmjit_memfs_unmount(ctx->memfs);
+		ctx->memfs = NULL;
+	}
+
+	if (ctx && ctx->opened_fds) {
+		free(ctx->opened_fds);
+		ctx->opened_fds = NULL;
+		ctx->opened_fds_size = 0;
+	}
+}
+
+int wasmjit_emscripten_mount_memfs(struct EmscriptenContext *ctx,
+				   const char *archive_path)
+{
+	if (ctx->memfs)
+		return -1;
+
+	ctx->memfs = wasmjit_memfs_mount(archive_path);
+	return ctx->memfs ? 0 : -1;
 }
 
 struct EmscriptenContext *wasmjit_emscripten_get_context(struct ModuleInst *module_inst)
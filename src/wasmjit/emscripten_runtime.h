@@ -29,16 +29,42 @@
 #include <wasmjit/util.h>
 #include <wasmjit/sys.h>
 
+struct WasmJITLogRing;
+struct WasmJITMemFSMount;
+
 enum {
 	WASMJIT_EMSCRIPTEN_TOTAL_MEMORY = 16777216,
 };
 
+/* armed by an invoke_*() call, longjmp() and throws unwind to it */
+struct EmscriptenInvokeFrame {
+	/* for __builtin_setjmp(), only the frame and stack pointers */
+	void *jmpbuf[5];
+	struct EmscriptenInvokeFrame *prev;
+	uint32_t stack_top;
+};
+
 struct EmscriptenContext {
 	struct FuncInst *errno_location_inst;
 	char **environ;
 	int buildEnvironmentCalled;
 	struct FuncInst *malloc_inst;
 	struct FuncInst *free_inst;
+	struct FuncInst *set_threw_inst;
+	struct FuncInst *stack_save_inst;
+	struct FuncInst *stack_restore_inst;
+	/* read directly when stackSave() only returns it */
+	struct GlobalInst *stack_global;
+	struct EmscriptenInvokeFrame *invoke_frame;
+	/* created by the first wasmjit_log() */
+	struct WasmJITLogRing *log_ring;
+	/* bitmap of the fds the guest opened by path, checkpoints save them */
+	unsigned char *opened_fds;
+	size_t opened_fds_size;
+	/* preloaded files, see wasmjit_emscripten_mount_memfs() */
+	struct WasmJITMemFSMount *memfs;
+	/* checkpoints don't save side modules' table entries and globals */
+	int side_modules_loaded;
 };
 
 #define CTYPE_VALTYPE_I32 uint32_t
@@ -107,6 +133,19 @@ struct EmscriptenContext {
 
 struct EmscriptenContext *wasmjit_emscripten_get_context(struct ModuleInst *);
 void wasmjit_emscripten_cleanup(struct ModuleInst *);
+/* writes out what the guest queued with wasmjit_log() */
+void wasmjit_emscripten_flush_log(struct EmscriptenContext *ctx);
+/*
+  serves the files of a memfs archive (see emscripten_memfs.h) ahead of
+  the host's, at most one per instance
+*/
+int wasmjit_emscripten_mount_memfs(struct EmscriptenContext *ctx,
+				   const char *archive_path);
+
+/* marks fd as opened by the guest, returns 0 or -1 if out of memory */
+int wasmjit_emscripten_track_fd(struct EmscriptenContext *ctx, int fd);
+int wasmjit_emscripten_fd_is_tracked(const struct EmscriptenContext *ctx,
+				     int fd);
 
 void wasmjit_emscripten_internal_abort(const char *msg) __attribute__((noreturn));
 struct MemInst *wasmjit_emscripten_get_mem_inst(struct FuncInst *funcinst);
@@ -125,6 +164,24 @@ int wasmjit_emscripten_init(struct EmscriptenContext *ctx,
 
 int wasmjit_emscripten_build_environment(struct FuncInst *environ_constructor);
 
+/* all optional, modules without exceptions or setjmp lack them */
+int wasmjit_emscripten_init_invoke(struct EmscriptenContext *ctx,
+				   struct FuncInst *set_threw_inst,
+				   struct FuncInst *stack_save_inst,
+				   struct FuncInst *stack_restore_inst);
+
+/*
+  backs every invoke_*(index, args...) import: calls table[index]
+  with args under an EmscriptenInvokeFrame
+*/
+union ValueUnion wasmjit_emscripten_invoke(struct FuncInst *funcinst,
+					   union ValueUnion *args);
+/*
+  a trap unwinds straight to wasmjit_invoke_function(), past any armed
+  frames. whoever called into the guest forgets them afterwards
+*/
+void wasmjit_emscripten_reset_invoke(struct EmscriptenContext *ctx);
+
 int wasmjit_emscripten_invoke_main(struct MemInst *meminst,
 				   struct FuncInst *stack_alloc_inst,
 				   struct FuncInst *main_inst,
@@ -139,6 +196,11 @@ struct WasmJITEmscriptenMemoryGlobals {
 	uint32_t STACK_MAX;
 };
 
+#ifndef __KERNEL__
+/* sends of at least this many bytes use MSG_ZEROCOPY, 0 disables */
+void wasmjit_emscripten_set_zerocopy_threshold(size_t threshold);
+#endif
+
 void wasmjit_emscripten_derive_memory_globals(uint32_t static_bump,
 					      struct WasmJITEmscriptenMemoryGlobals *out);
 
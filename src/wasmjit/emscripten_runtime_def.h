@@ -86,6 +86,7 @@ DEFINE_EMSCRIPTEN_FUNCTION(___setErrNo, VALTYPE_NULL, 1, VALTYPE_I32)
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall3, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall42, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall140, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall145, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall146, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall4, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall54, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
@@ -99,6 +100,29 @@ DEFINE_EMSCRIPTEN_FUNCTION(___syscall102, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall221, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall12, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
 DEFINE_EMSCRIPTEN_FUNCTION(___syscall122, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall5, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall295, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall195, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall196, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall197, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall220, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall118, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall148, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall324, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall194, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall180, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall181, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall39, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall40, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall38, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(___syscall33, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(_wasmjit_checkpoint, VALTYPE_I32, 1, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(_wasmjit_discard, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(_wasmjit_log, VALTYPE_I32, 3, VALTYPE_I32, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(_wasmjit_memory_fd, VALTYPE_I32, 0)
+DEFINE_EMSCRIPTEN_FUNCTION(_wasmjit_eventfd, VALTYPE_I32, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(_longjmp, VALTYPE_NULL, 2, VALTYPE_I32, VALTYPE_I32)
+DEFINE_EMSCRIPTEN_FUNCTION(_emscripten_longjmp, VALTYPE_NULL, 2, VALTYPE_I32, VALTYPE_I32)
 END_FUNCTION_DEFS()
 
 DEFINE_WASM_START_FUNCTION(wasmjit_emscripten_start_func)
@@ -32,12 +32,18 @@
 #include <linux/kallsyms.h>
 #include <linux/limits.h>
 #include <linux/socket.h>
+#include <linux/stat.h>
+#include <linux/fcntl.h>
+#include <linux/fs.h>
 
 typedef int socklen_t;
 typedef struct user_msghdr user_msghdr_t;
 
 #define SYS_CMSG_NXTHDR(msg, cmsg) __CMSG_NXTHDR((msg)->msg_control, (msg)->msg_controllen, (cmsg))
 
+/* nanoseconds of st_atime, st_mtime or st_ctime */
+#define SYS_STAT_NSEC(st, t) ((st)->st_ ## t ## time_nsec)
+
 #else
 
 #include <errno.h>
@@ -47,6 +53,8 @@ typedef struct user_msghdr user_msghdr_t;
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/un.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <net/if.h>
 
 #ifndef PATH_MAX
@@ -57,6 +65,12 @@ typedef struct msghdr user_msghdr_t;
 
 #define SYS_CMSG_NXTHDR(msg, cmsg) CMSG_NXTHDR((msg), (cmsg))
 
+#ifdef __APPLE__
+#define SYS_STAT_NSEC(st, t) ((st)->st_ ## t ## timespec.tv_nsec)
+#else
+#define SYS_STAT_NSEC(st, t) ((st)->st_ ## t ## tim.tv_nsec)
+#endif
+
 #endif
 
 #include <wasmjit/util.h>
@@ -78,6 +92,7 @@ typedef struct msghdr user_msghdr_t;
 #define KWSC1(name, ...) KWSCx(1, name, __VA_ARGS__)
 #define KWSC2(name, ...) KWSCx(2, name, __VA_ARGS__)
 #define KWSC3(name, ...) KWSCx(3, name, __VA_ARGS__)
+#define KWSC4(name, ...) KWSCx(4, name, __VA_ARGS__)
 #define KWSC5(name, ...) KWSCx(5, name, __VA_ARGS__)
 #define KWSC6(name, ...) KWSCx(6, name, __VA_ARGS__)
 
@@ -86,9 +101,38 @@ typedef struct msghdr user_msghdr_t;
 #undef KWSC1
 #undef KWSC2
 #undef KWSC3
+#undef KWSC4
 #undef KWSC5
 #undef KWSC6
 #undef KWSCx
 #undef __KDECL
 
+/*
+  Sends from linear memory. In user mode these may use MSG_ZEROCOPY for
+  large payloads on blocking sockets, see
+  wasmjit_emscripten_set_zerocopy_threshold().
+ */
+
+#ifdef __KERNEL__
+
+#define sys_writev_zerocopy sys_writev
+#define sys_sendto_zerocopy sys_sendto
+#define sys_sendmsg_zerocopy sys_sendmsg
+#define wasmjit_emscripten_zerocopy_forget(fd) ((void)(fd))
+#define wasmjit_emscripten_zerocopy_sockopt(fd, level, optname) ((void)(fd))
+
+#else
+
+long sys_writev_zerocopy(unsigned long fd, const struct iovec *iov,
+			 unsigned long iovcnt);
+long sys_sendto_zerocopy(int fd, const void *buf, size_t len, int flags,
+			 const struct sockaddr *addr, socklen_t addrlen);
+long sys_sendmsg_zerocopy(int fd, const user_msghdr_t *msg, int flags);
+/* fd was closed, its number may now be another file */
+void wasmjit_emscripten_zerocopy_forget(int fd);
+/* the guest sets a socket option on fd */
+void wasmjit_emscripten_zerocopy_sockopt(int fd, int level, int optname);
+
+#endif
+
 #endif
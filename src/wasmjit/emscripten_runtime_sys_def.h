@@ -21,9 +21,11 @@
  */
 
 KWSC3(lseek, unsigned int, off_t, unsigned int)
+KWSC3(readv, unsigned long, const struct iovec *, unsigned long)
 KWSC3(writev, unsigned long, const struct iovec *, unsigned long)
 KWSC3(write, unsigned int, void *, size_t)
 KWSC1(close, unsigned int)
+KWSC1(dup, unsigned int)
 KWSC1(unlink, const char *)
 KWSC3(socket, int, int, int)
 KWSC3(bind, int, const struct sockaddr *, socklen_t)
@@ -41,3 +43,22 @@ KWSC3(recvmsg, int, user_msghdr_t *, int)
 KWSC1(chdir, const char *)
 KWSC3(read, int, void *, size_t)
 KWSC1(pipe, int *)
+KWSC3(open, const char *, int, int)
+KWSC4(openat, int, const char *, int, int)
+KWSC2(newstat, const char *, struct stat *)
+KWSC2(newlstat, const char *, struct stat *)
+KWSC2(newfstat, int, struct stat *)
+KWSC1(fsync, int)
+KWSC2(ftruncate, int, off_t)
+KWSC4(pread64, int, void *, size_t, off_t)
+KWSC4(pwrite64, int, const void *, size_t, off_t)
+KWSC2(mkdir, const char *, int)
+KWSC1(rmdir, const char *)
+KWSC2(rename, const char *, const char *)
+KWSC2(access, const char *, int)
+#if defined(__linux__) || defined(__KERNEL__)
+KWSC3(getdents64, int, void *, unsigned int)
+KWSC1(fdatasync, int)
+KWSC4(fallocate, int, int, off_t, off_t)
+KWSC2(eventfd2, unsigned int, int)
+#endif
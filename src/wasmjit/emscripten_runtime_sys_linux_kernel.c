@@ -39,6 +39,7 @@
 #define KWSC1(name, ...) KWSCx(1, name, __VA_ARGS__)
 #define KWSC2(name, ...) KWSCx(2, name, __VA_ARGS__)
 #define KWSC3(name, ...) KWSCx(3, name, __VA_ARGS__)
+#define KWSC4(name, ...) KWSCx(4, name, __VA_ARGS__)
 #define KWSC5(name, ...) KWSCx(5, name, __VA_ARGS__)
 #define KWSC6(name, ...) KWSCx(6, name, __VA_ARGS__)
 
@@ -61,7 +62,7 @@ static struct {
 	long sys_ ## name ## _regs(__KMAP(x, __KDECL, __VA_ARGS__))	\
 	{								\
 		struct pt_regs *vals = &wasmjit_get_ktls()->regs;	\
-		__KMAP(x, __KSET, di, si, dx, cx, r8, r9);		\
+		__KMAP(x, __KSET, di, si, dx, r10, r8, r9);		\
 		return sctable_regs. name (vals);			\
 	}
 
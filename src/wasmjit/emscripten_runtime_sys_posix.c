@@ -22,39 +22,391 @@
   SOFTWARE.
  */
 
+/* For fallocate() */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <wasmjit/emscripten_runtime_sys.h>
 
+#include <wasmjit/emscripten_runtime.h>
+#include <wasmjit/emscripten_heatmap.h>
+#include <wasmjit/log_ring.h>
 #include <wasmjit/ast.h>
 #include <wasmjit/runtime.h>
 #include <wasmjit/util.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+  the sys_ names follow the kernel's syscall names, these must be
+  function-like so KWSCx() still sees the kernel name
+ */
+#undef pread64
+#undef pwrite64
+#define newstat(...) stat(__VA_ARGS__)
+#define newlstat(...) lstat(__VA_ARGS__)
+#define newfstat(...) fstat(__VA_ARGS__)
+#define pread64(...) pread(__VA_ARGS__)
+#define pwrite64(...) pwrite(__VA_ARGS__)
+#ifdef __linux__
+#define getdents64(...) syscall(SYS_getdents64, __VA_ARGS__)
+#define eventfd2(...) eventfd(__VA_ARGS__)
+#endif
 
 #define __KDECL(to,n,t) t _##n
 #define __KA(to,n,t) _##n
 
+/* the heatmap profiler mustn't protect guest buffers mid-syscall */
 #define KWSCx(x, name, ...)					\
 	long sys_ ## name(__KMAP(x, __KDECL, __VA_ARGS__))	\
 	{							\
 		long ret;					\
+		WASMJIT_EMSCRIPTEN_HEATMAP_ENTER_HOST();	\
 		ret = name(__KMAP(x, __KA, __VA_ARGS__));	\
 		if (ret == -1) {				\
 			ret = -errno;				\
 		}						\
+		WASMJIT_EMSCRIPTEN_HEATMAP_LEAVE_HOST();	\
 		return ret;					\
 	}
 
 #define KWSC1(name, ...) KWSCx(1, name, __VA_ARGS__)
 #define KWSC2(name, ...) KWSCx(2, name, __VA_ARGS__)
 #define KWSC3(name, ...) KWSCx(3, name, __VA_ARGS__)
+#define KWSC4(name, ...) KWSCx(4, name, __VA_ARGS__)
 #define KWSC5(name, ...) KWSCx(5, name, __VA_ARGS__)
 #define KWSC6(name, ...) KWSCx(6, name, __VA_ARGS__)
 
 #include <wasmjit/emscripten_runtime_sys_def.h>
 
+/*
+  MSG_ZEROCOPY lets the kernel transmit straight from linear memory
+  instead of copying into socket buffers, but the pages must stay
+  untouched until the kernel reports completion on the socket's error
+  queue. The guest may reuse its buffer as soon as the syscall
+  returns, so we wait for that completion before returning. This
+  trades latency (TCP completes on ACK) for copy bandwidth, which is
+  why it's opt-in and only used above a size threshold. Non-blocking
+  sends never wait and always copy.
+ */
+
+static size_t zerocopy_threshold;
+
+void wasmjit_emscripten_set_zerocopy_threshold(size_t threshold)
+{
+	zerocopy_threshold = threshold;
+}
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+
+/*
+  whether a socket can take zerocopy sends is only worked out once, the
+  guest can't change what it depends on without closing it or going
+  through wasmjit_emscripten_zerocopy_sockopt(). the kernel numbers
+  zerocopy sends per socket, so entries remember which socket (device
+  and inode) they describe and start over when an fd number is reused
+  for another. fds past the table always copy
+ */
+#define ZEROCOPY_MAX_FDS 4096
+
+enum {
+	ZEROCOPY_UNKNOWN,
+	ZEROCOPY_ON,
+	ZEROCOPY_OFF,
+};
+
+struct ZerocopyFd {
+	unsigned char state;
+	dev_t dev;
+	ino_t ino;
+	/* the kernel numbers each zerocopy send on a socket from 0 */
+	uint32_t next_id;
+};
+
+static struct ZerocopyFd zerocopy_fds[ZEROCOPY_MAX_FDS];
+
+static struct ZerocopyFd *zerocopy_fd(int fd)
+{
+	if (fd < 0 || fd >= ZEROCOPY_MAX_FDS)
+		return NULL;
+	return &zerocopy_fds[fd];
+}
+
+void wasmjit_emscripten_zerocopy_forget(int fd)
+{
+	struct ZerocopyFd *zfd = zerocopy_fd(fd);
+
+	if (zfd)
+		memset(zfd, 0, sizeof(*zfd));
+}
+
+/* the guest's own notifications would mix with our completions */
+void wasmjit_emscripten_zerocopy_sockopt(int fd, int level, int optname)
+{
+	struct ZerocopyFd *zfd = zerocopy_fd(fd);
+
+	if (!zfd || level != SOL_SOCKET)
+		return;
+
+	if (optname == SO_ZEROCOPY
+#ifdef SO_TIMESTAMPING
+	    || optname == SO_TIMESTAMPING
+#endif
+		)
+		zfd->state = ZEROCOPY_OFF;
+}
+
+/*
+  the completions share the error queue with anything else queued
+  there, so only stream sockets nothing else reports on qualify. a
+  socket that already has SO_ZEROCOPY on is either the guest's or
+  reached through another fd, whose count of sends we don't know
+ */
+static int zerocopy_probe(int fd)
+{
+	int one = 1, type, val, fl;
+	socklen_t len;
+
+	len = sizeof(type);
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) ||
+	    type != SOCK_STREAM)
+		return ZEROCOPY_OFF;
+
+	len = sizeof(val);
+	if (getsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, &len) || val)
+		return ZEROCOPY_OFF;
+
+#ifdef SO_TIMESTAMPING
+	len = sizeof(val);
+	if (getsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &val, &len) || val)
+		return ZEROCOPY_OFF;
+#endif
+
+	/* fails on AF_UNIX */
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+		return ZEROCOPY_OFF;
+
+	fl = fcntl(fd, F_GETFL);
+	if (fl == -1 || (fl & O_NONBLOCK))
+		return ZEROCOPY_OFF;
+
+	return ZEROCOPY_ON;
+}
+
+/* the fd's entry if this send should be zerocopy, otherwise NULL */
+static struct ZerocopyFd *zerocopy_get(int fd, int flags, size_t len)
+{
+	struct ZerocopyFd *zfd;
+	struct stat st;
+
+	if (!zerocopy_threshold || len < zerocopy_threshold ||
+	    (flags & MSG_DONTWAIT))
+		return NULL;
+
+	zfd = zerocopy_fd(fd);
+	if (!zfd || fstat(fd, &st))
+		return NULL;
+
+	if (zfd->state == ZEROCOPY_UNKNOWN ||
+	    zfd->dev != st.st_dev || zfd->ino != st.st_ino) {
+		zfd->state = zerocopy_probe(fd);
+		zfd->dev = st.st_dev;
+		zfd->ino = st.st_ino;
+		zfd->next_id = 0;
+	}
+
+	return zfd->state == ZEROCOPY_ON ? zfd : NULL;
+}
+
+/*
+  waits for the completion of send id for as long as the peer takes to
+  ACK it, until then the kernel may still read the guest's pages. a
+  dead peer ends in a reset, which frees the pages and completes the
+  send too. returns 1 if entries other than completions were found,
+  the fd should stop using zerocopy then
+ */
+static int wait_zerocopy(int fd, uint32_t id)
+{
+	int foreign = 0, spurious = 0;
+
+	for (;;) {
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+			     CMSG_SPACE(sizeof(struct sockaddr_storage))];
+		struct msghdr msg;
+		struct cmsghdr *cm;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1) {
+			struct pollfd pfd;
+
+			if (errno == EINTR)
+				continue;
+
+			/*
+			  POLLERR also stays up for a pending socket
+			  error, which isn't ours to clear
+			 */
+			if (spurious) {
+				struct timespec ts = {0, 1000000};
+				nanosleep(&ts, NULL);
+			}
+
+			/* POLLERR is always reported, so no events needed */
+			pfd.fd = fd;
+			pfd.events = 0;
+			spurious = poll(&pfd, 1, -1) > 0;
+			continue;
+		}
+
+		spurious = 0;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err serr;
+
+			if (!((cm->cmsg_level == SOL_IP &&
+			       cm->cmsg_type == IP_RECVERR) ||
+			      (cm->cmsg_level == SOL_IPV6 &&
+			       cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+
+			memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+			if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				foreign = 1;
+				continue;
+			}
+
+			/* a completion covers sends ee_info to ee_data */
+			if ((int32_t) (serr.ee_data - id) >= 0)
+				return foreign;
+		}
+	}
+}
+
+/* only returns once the kernel is done with the guest's pages */
+static long send_zerocopy(struct ZerocopyFd *zfd, int fd,
+			  const struct msghdr *msg, int flags)
+{
+	long ret;
+
+	ret = sys_sendmsg(fd, msg, flags | MSG_ZEROCOPY);
+	if (ret == -ENOBUFS) {
+		/* out of optmem for pinned pages, just copy */
+		return sys_sendmsg(fd, msg, flags);
+	}
+
+	if (ret > 0 && wait_zerocopy(fd, zfd->next_id++))
+		zfd->state = ZEROCOPY_OFF;
+
+	return ret;
+}
+
+long sys_sendmsg_zerocopy(int fd, const user_msghdr_t *msg, int flags)
+{
+	struct ZerocopyFd *zfd;
+	size_t i, len = 0;
+
+	for (i = 0; i < (size_t) msg->msg_iovlen; ++i)
+		len += msg->msg_iov[i].iov_len;
+
+	zfd = zerocopy_get(fd, flags, len);
+	if (!zfd)
+		return sys_sendmsg(fd, msg, flags);
+
+	return send_zerocopy(zfd, fd, msg, flags);
+}
+
+long sys_sendto_zerocopy(int fd, const void *buf, size_t len, int flags,
+			 const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct msghdr msg;
+	struct iovec iov;
+
+	if (!zerocopy_threshold || len < zerocopy_threshold)
+		return sys_sendto(fd, buf, len, flags, addr, addrlen);
+
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void *) addr;
+	msg.msg_namelen = addrlen;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	return sys_sendmsg_zerocopy(fd, &msg, flags);
+}
+
+long sys_writev_zerocopy(unsigned long fd, const struct iovec *iov,
+			 unsigned long iovcnt)
+{
+	struct ZerocopyFd *zfd;
+	struct msghdr msg;
+	size_t i, len = 0;
+
+	for (i = 0; i < iovcnt; ++i)
+		len += iov[i].iov_len;
+
+	zfd = zerocopy_get(fd, 0, len);
+	if (!zfd)
+		return sys_writev(fd, iov, iovcnt);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec *) iov;
+	msg.msg_iovlen = iovcnt;
+
+	return send_zerocopy(zfd, fd, &msg, 0);
+}
+
+#else
+
+void wasmjit_emscripten_zerocopy_forget(int fd)
+{
+	(void)fd;
+}
+
+void wasmjit_emscripten_zerocopy_sockopt(int fd, int level, int optname)
+{
+	(void)fd;
+	(void)level;
+	(void)optname;
+}
+
+long sys_sendmsg_zerocopy(int fd, const user_msghdr_t *msg, int flags)
+{
+	return sys_sendmsg(fd, msg, flags);
+}
+
+long sys_sendto_zerocopy(int fd, const void *buf, size_t len, int flags,
+			 const struct sockaddr *addr, socklen_t addrlen)
+{
+	return sys_sendto(fd, buf, len, flags, addr, addrlen);
+}
+
+long sys_writev_zerocopy(unsigned long fd, const struct iovec *iov,
+			 unsigned long iovcnt)
+{
+	return sys_writev(fd, iov, iovcnt);
+}
+
+#endif
+
 struct MemInst *wasmjit_emscripten_get_mem_inst(struct FuncInst *funcinst) {
 	return funcinst->module_inst->mems.elts[0];
 }
@@ -62,6 +414,8 @@ struct MemInst *wasmjit_emscripten_get_mem_inst(struct FuncInst *funcinst) {
 __attribute__((noreturn))
 void wasmjit_emscripten_internal_abort(const char *msg)
 {
+	/* the guest's queued output came first */
+	wasmjit_log_ring_flush_all();
 	fprintf(stderr, "%s\n", msg);
 	wasmjit_trap(WASMJIT_TRAP_ABORT);
 }
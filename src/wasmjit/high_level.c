@@ -28,8 +28,12 @@
 #include <wasmjit/instantiate.h>
 #include <wasmjit/dynamic_emscripten_runtime.h>
 #include <wasmjit/emscripten_runtime.h>
+#include <wasmjit/emscripten_checkpoint.h>
+#include <wasmjit/emscripten_dylink.h>
+#include <wasmjit/reclaim.h>
 #include <wasmjit/sys.h>
 #include <wasmjit/util.h>
+#include <wasmjit/trace.h>
 
 #ifdef WASMJIT_CAN_USE_DEVICE
 #include <wasmjit/kwasmjit.h>
@@ -101,18 +105,21 @@ int wasmjit_high_init(struct WasmJITHigh *self)
 	self->modules = NULL;
 	self->emscripten_asm_module = NULL;
 	self->emscripten_env_module = NULL;
+	self->main_module = NULL;
+	self->n_side_modules = 0;
+	self->side_modules = NULL;
 	memset(self->error_buffer, 0, sizeof(self->error_buffer));
 	return 0;
 }
 
-static int wasmjit_high_instantiate_buf(struct WasmJITHigh *self,
-					const char *buf, size_t size,
-					const char *module_name, uint32_t flags)
+static int wasmjit_high_instantiate_module(struct WasmJITHigh *self,
+					   struct Module *module,
+					   const char *module_name,
+					   uint32_t flags)
 {
 	int ret;
-	struct ParseState pstate;
-	struct Module module;
 	struct ModuleInst *module_inst = NULL;
+	uint64_t trace_start;
 
 #ifdef WASMJIT_CAN_USE_DEVICE
 	/* should not be using this if we are backending to kernel */
@@ -121,27 +128,25 @@ static int wasmjit_high_instantiate_buf(struct WasmJITHigh *self,
 
 	(void)flags;
 
-	wasmjit_init_module(&module);
-
-	if (!init_pstate(&pstate, buf, size)) {
-		goto error;
-	}
+	/* TODO: validate module */
 
-	if (!read_module(&pstate, &module, NULL, 0)) {
+	if (self->emscripten_env_module &&
+	    wasmjit_emscripten_add_invoke_imports(self->emscripten_env_module,
+						  module))
 		goto error;
-	}
-
-	/* TODO: validate module */
 
-	module_inst = wasmjit_instantiate(&module, self->n_modules, self->modules,
+	WASMJIT_TRACE_BEGIN(trace_start);
+	module_inst = wasmjit_instantiate(module, self->n_modules, self->modules,
 					  self->error_buffer, sizeof(self->error_buffer));
 	if (!module_inst) {
 		goto error;
 	}
+	WASMJIT_TRACE_END(trace_start, "instantiate", module_name, -1);
 
 	if (!add_named_module(self, module_name, module_inst)) {
 		goto error;
 	}
+	self->main_module = module_inst;
 	module_inst = NULL;
 
 	if (0) {
@@ -151,8 +156,6 @@ static int wasmjit_high_instantiate_buf(struct WasmJITHigh *self,
 		ret = 0;
 	}
 
-	wasmjit_free_module(&module);
-
 	if (module_inst) {
 		wasmjit_free_module_inst(module_inst);
 	}
@@ -160,6 +163,105 @@ static int wasmjit_high_instantiate_buf(struct WasmJITHigh *self,
 	return ret;
 }
 
+static int wasmjit_high_instantiate_side_module(struct WasmJITHigh *self,
+						const char *buf, size_t size,
+						const char *module_name)
+{
+	int ret;
+	struct EmscriptenSideModule side_module, *new_side_modules;
+	uint64_t trace_start;
+
+	side_module.module = NULL;
+	side_module.imports = NULL;
+
+	if (!self->emscripten_env_module) {
+		snprintf(self->error_buffer, sizeof(self->error_buffer),
+			 "side modules need the emscripten runtime");
+		goto error;
+	}
+
+	new_side_modules = realloc(self->side_modules,
+				   (self->n_side_modules + 1) *
+				   sizeof(self->side_modules[0]));
+	if (!new_side_modules)
+		goto error;
+	self->side_modules = new_side_modules;
+
+	WASMJIT_TRACE_BEGIN(trace_start);
+	if (wasmjit_emscripten_dylink_load(buf, size,
+					   self->emscripten_env_module,
+					   self->main_module,
+					   self->n_modules, self->modules,
+					   self->n_side_modules,
+					   self->side_modules,
+					   &side_module,
+					   self->error_buffer,
+					   sizeof(self->error_buffer)))
+		goto error;
+	WASMJIT_TRACE_END(trace_start, "dylink", module_name, (long) size);
+
+	if (!add_named_module(self, module_name, side_module.module))
+		goto error;
+
+	wasmjit_emscripten_get_context(self->emscripten_env_module)->side_modules_loaded = 1;
+
+	/* the module is now freed along with the named modules */
+	self->side_modules[self->n_side_modules++] = side_module;
+	side_module.module = NULL;
+	side_module.imports = NULL;
+
+	if (0) {
+ error:
+		ret = -1;
+	} else {
+		ret = 0;
+	}
+
+	if (side_module.module)
+		wasmjit_free_module_inst(side_module.module);
+	if (side_module.imports)
+		wasmjit_free_module_inst(side_module.imports);
+
+	return ret;
+}
+
+static int wasmjit_high_instantiate_buf(struct WasmJITHigh *self,
+					const char *buf, size_t size,
+					const char *module_name, uint32_t flags)
+{
+	int ret;
+	struct ParseState pstate;
+	struct Module module;
+	uint64_t trace_start;
+
+	if (flags & WASMJIT_HIGH_INSTANTIATE_FLAGS_SIDE_MODULE)
+		return wasmjit_high_instantiate_side_module(self, buf, size,
+							    module_name);
+
+	wasmjit_init_module(&module);
+
+	if (!init_pstate(&pstate, buf, size)) {
+		goto error;
+	}
+
+	WASMJIT_TRACE_BEGIN(trace_start);
+	if (!read_module(&pstate, &module, NULL, 0)) {
+		goto error;
+	}
+	WASMJIT_TRACE_END(trace_start, "read_module", module_name, (long) size);
+
+	ret = wasmjit_high_instantiate_module(self, &module, module_name, flags);
+
+	if (0) {
+ error:
+		ret = -1;
+	}
+
+	wasmjit_free_module(&module);
+
+	return ret;
+}
+
 int wasmjit_high_instantiate(struct WasmJITHigh *self, const char *filename, const char *module_name, uint32_t flags)
 {
 	int ret;
@@ -199,6 +301,29 @@ int wasmjit_high_instantiate(struct WasmJITHigh *self, const char *filename, con
 	return ret;
 }
 
+int wasmjit_high_instantiate_parsed(struct WasmJITHigh *self,
+				    const char *filename,
+				    struct Module *module,
+				    const char *module_name,
+				    uint32_t flags)
+{
+#ifdef WASMJIT_CAN_USE_DEVICE
+	/* the kernel does its own parsing */
+	if (self->fd >= 0)
+		return wasmjit_high_instantiate(self, filename, module_name, flags);
+#else
+	(void)filename;
+#endif
+
+	self->error_buffer[0] = '\0';
+
+	/* side modules are cached by their contents */
+	if (flags & WASMJIT_HIGH_INSTANTIATE_FLAGS_SIDE_MODULE)
+		return -1;
+
+	return wasmjit_high_instantiate_module(self, module, module_name, flags);
+}
+
 int wasmjit_high_instantiate_emscripten_runtime(struct WasmJITHigh *self,
 						uint32_t static_bump,
 						size_t tablemin,
@@ -208,6 +333,7 @@ int wasmjit_high_instantiate_emscripten_runtime(struct WasmJITHigh *self,
 	int ret, has_table;
 	size_t n_modules, i;
 	struct NamedModule *modules = NULL;
+	uint64_t trace_start;
 
 #ifdef WASMJIT_CAN_USE_DEVICE
 	if (self->fd >= 0) {
@@ -230,14 +356,17 @@ int wasmjit_high_instantiate_emscripten_runtime(struct WasmJITHigh *self,
 
 	has_table = !(flags & WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_NO_TABLE);
 
+	WASMJIT_TRACE_BEGIN(trace_start);
 	modules = wasmjit_instantiate_emscripten_runtime(static_bump,
 							 has_table,
 							 tablemin,
 							 tablemax,
+							 !!(flags & WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_SHARED_MEMORY),
 							 &n_modules);
 	if (!modules) {
 		goto error;
 	}
+	WASMJIT_TRACE_END(trace_start, "instantiate", "env", -1);
 
 	for (i = 0; i < n_modules; ++i)  {
 		if (!add_named_module(self, modules[i].name, modules[i].module)) {
@@ -275,36 +404,17 @@ int wasmjit_high_instantiate_emscripten_runtime(struct WasmJITHigh *self,
 	return ret;
 }
 
-int wasmjit_high_emscripten_invoke_main(struct WasmJITHigh *self,
-					const char *module_name,
-					int argc, char **argv, char **envp,
-					uint32_t flags)
+/* finds the module and runs the emscripten runtime's one-time init */
+static int emscripten_setup(struct WasmJITHigh *self,
+			    const char *module_name,
+			    char **envp,
+			    struct ModuleInst **module_inst_out,
+			    struct MemInst **meminst_out)
 {
 	size_t i;
 	struct ModuleInst *env_module_inst;
-	struct FuncInst *main_inst,
-		*stack_alloc_inst,
-		*environ_constructor;
 	struct MemInst *meminst;
 	struct ModuleInst *module_inst;
-	int ret;
-
-#ifdef WASMJIT_CAN_USE_DEVICE
-	if (self->fd >= 0) {
-		struct kwasmjit_emscripten_invoke_main_args arg;
-
-		arg.version = 0;
-		arg.module_name = module_name;
-		arg.argc = argc;
-		arg.argv = argv;
-		arg.envp = envp;
-		arg.flags = flags;
-
-		return ioctl(self->fd, KWASMJIT_EMSCRIPTEN_INVOKE_MAIN, &arg);
-	}
-#endif
-
-	self->error_buffer[0] = '\0';
 
 	module_inst = NULL;
 	for (i = 0; i < self->n_modules; ++i) {
@@ -327,16 +437,6 @@ int wasmjit_high_emscripten_invoke_main(struct WasmJITHigh *self,
 	if (!env_module_inst)
 		return -1;
 
-	main_inst = wasmjit_get_export(module_inst, "_main",
-				       IMPORT_DESC_TYPE_FUNC).func;
-	if (!main_inst)
-		return -1;
-
-	stack_alloc_inst = wasmjit_get_export(module_inst, "stackAlloc",
-					      IMPORT_DESC_TYPE_FUNC).func;
-	if (!stack_alloc_inst)
-		return -1;
-
 	meminst = wasmjit_get_export(env_module_inst, "memory",
 				     IMPORT_DESC_TYPE_MEM).mem;
 	if (!meminst)
@@ -371,14 +471,72 @@ int wasmjit_high_emscripten_invoke_main(struct WasmJITHigh *self,
 						    envp))
 				return -1;
 
+			if (wasmjit_emscripten_init_invoke(wasmjit_emscripten_get_context(env_module_inst),
+							   wasmjit_get_export(module_inst, "setThrew",
+									      IMPORT_DESC_TYPE_FUNC).func,
+							   wasmjit_get_export(module_inst, "stackSave",
+									      IMPORT_DESC_TYPE_FUNC).func,
+							   wasmjit_get_export(module_inst, "stackRestore",
+									      IMPORT_DESC_TYPE_FUNC).func))
+				return -1;
+
 			self->emscripten_asm_module = module_inst;
 		}
 
-		if (self->emscripten_asm_module != module_inst) {
-			ret = -1;
-			goto error;
-		}
+		if (self->emscripten_asm_module != module_inst)
+			return -1;
+	}
+
+	*module_inst_out = module_inst;
+	*meminst_out = meminst;
+
+	return 0;
+}
+
+int wasmjit_high_emscripten_invoke_main(struct WasmJITHigh *self,
+					const char *module_name,
+					int argc, char **argv, char **envp,
+					uint32_t flags)
+{
+	struct FuncInst *main_inst,
+		*stack_alloc_inst,
+		*environ_constructor;
+	struct MemInst *meminst;
+	struct ModuleInst *module_inst;
+	int ret;
+	uint64_t trace_start;
+
+#ifdef WASMJIT_CAN_USE_DEVICE
+	if (self->fd >= 0) {
+		struct kwasmjit_emscripten_invoke_main_args arg;
+
+		arg.version = 0;
+		arg.module_name = module_name;
+		arg.argc = argc;
+		arg.argv = argv;
+		arg.envp = envp;
+		arg.flags = flags;
+
+		return ioctl(self->fd, KWASMJIT_EMSCRIPTEN_INVOKE_MAIN, &arg);
 	}
+#endif
+
+	self->error_buffer[0] = '\0';
+
+	WASMJIT_TRACE_BEGIN(trace_start);
+
+	if (emscripten_setup(self, module_name, envp, &module_inst, &meminst))
+		return -1;
+
+	main_inst = wasmjit_get_export(module_inst, "_main",
+				       IMPORT_DESC_TYPE_FUNC).func;
+	if (!main_inst)
+		return -1;
+
+	stack_alloc_inst = wasmjit_get_export(module_inst, "stackAlloc",
+					      IMPORT_DESC_TYPE_FUNC).func;
+	if (!stack_alloc_inst)
+		return -1;
 
 	environ_constructor = wasmjit_get_export(module_inst,
 						 "___emscripten_environ_constructor",
@@ -389,15 +547,272 @@ int wasmjit_high_emscripten_invoke_main(struct WasmJITHigh *self,
 		goto error;
 	}
 
+	WASMJIT_TRACE_END(trace_start, "emscripten_init", module_name, -1);
+
+	if (flags & WASMJIT_HIGH_EMSCRIPTEN_INVOKE_MAIN_FLAGS_PERF_COUNTERS)
+		(void)wasmjit_perf_counters_open();
+
+	WASMJIT_TRACE_BEGIN(trace_start);
 	ret = wasmjit_emscripten_invoke_main(meminst,
 					     stack_alloc_inst,
 					     main_inst,
 					     argc, argv);
+	WASMJIT_TRACE_END(trace_start, "main", module_name, -1);
+
+	if (self->emscripten_env_module) {
+		struct EmscriptenContext *ctx =
+			wasmjit_emscripten_get_context(self->emscripten_env_module);
+		wasmjit_emscripten_flush_log(ctx);
+		wasmjit_emscripten_reset_invoke(ctx);
+	}
+
+	if (flags & WASMJIT_HIGH_EMSCRIPTEN_INVOKE_MAIN_FLAGS_PERF_COUNTERS)
+		wasmjit_perf_counters_close();
  error:
 	return ret;
 }
 
-void wasmjit_high_close(struct WasmJITHigh *self)
+int wasmjit_high_emscripten_resume(struct WasmJITHigh *self,
+				   const char *module_name,
+				   const char *checkpoint_path,
+				   char **envp,
+				   uint32_t flags)
+{
+	struct FuncInst *resume_inst;
+	struct MemInst *meminst;
+	struct ModuleInst *module_inst;
+	union ValueUnion out;
+	int ret;
+	uint64_t trace_start;
+
+#ifdef WASMJIT_CAN_USE_DEVICE
+	/* the kernel module has no checkpoint support */
+	if (self->fd >= 0)
+		return -1;
+#endif
+
+	self->error_buffer[0] = '\0';
+
+	if (emscripten_setup(self, module_name, envp, &module_inst, &meminst))
+		return -1;
+
+	/* the environment was built before the checkpoint was taken */
+	WASMJIT_TRACE_BEGIN(trace_start);
+	if (!self->emscripten_env_module ||
+	    wasmjit_emscripten_checkpoint_restore(checkpoint_path,
+						  wasmjit_emscripten_get_context(self->emscripten_env_module),
+						  module_inst,
+						  self->emscripten_env_module,
+						  meminst,
+						  &resume_inst)) {
+		snprintf(self->error_buffer, sizeof(self->error_buffer),
+			 "couldn't restore checkpoint %s", checkpoint_path);
+		return -1;
+	}
+	WASMJIT_TRACE_END(trace_start, "checkpoint_restore", module_name, -1);
+
+	if (flags & WASMJIT_HIGH_EMSCRIPTEN_INVOKE_MAIN_FLAGS_PERF_COUNTERS)
+		(void)wasmjit_perf_counters_open();
+
+	WASMJIT_TRACE_BEGIN(trace_start);
+	ret = wasmjit_invoke_function(resume_inst, NULL, &out);
+	WASMJIT_TRACE_END(trace_start, "resume", module_name, -1);
+
+	if (self->emscripten_env_module) {
+		struct EmscriptenContext *ctx =
+			wasmjit_emscripten_get_context(self->emscripten_env_module);
+		wasmjit_emscripten_flush_log(ctx);
+		wasmjit_emscripten_reset_invoke(ctx);
+	}
+
+	if (flags & WASMJIT_HIGH_EMSCRIPTEN_INVOKE_MAIN_FLAGS_PERF_COUNTERS)
+		wasmjit_perf_counters_close();
+
+	if (ret)
+		return ret > 0 ? WASMJIT_ENCODE_TRAP_ERROR(ret) : ret;
+
+	return resume_inst->type.output_type == VALTYPE_I32 ? 0xff & out.i32 : 0;
+}
+
+int wasmjit_high_emscripten_memory_fd(struct WasmJITHigh *self)
+{
+	struct MemInst *meminst;
+
+#ifdef WASMJIT_CAN_USE_DEVICE
+	/* the device maps linear memory the same way */
+	if (self->fd >= 0)
+		return self->fd;
+#endif
+
+	if (!self->emscripten_env_module)
+		return -1;
+
+	meminst = wasmjit_get_export(self->emscripten_env_module, "memory",
+				     IMPORT_DESC_TYPE_MEM).mem;
+	if (!meminst)
+		return -1;
+
+	return wasmjit_shared_memory_fd(meminst->data);
+}
+
+int wasmjit_high_emscripten_mount(struct WasmJITHigh *self,
+				  const char *archive_path)
+{
+#ifdef WASMJIT_CAN_USE_DEVICE
+	if (self->fd >= 0) {
+		struct kwasmjit_emscripten_mount_args arg;
+
+		arg.version = 0;
+		arg.file_name = archive_path;
+
+		return ioctl(self->fd, KWASMJIT_EMSCRIPTEN_MOUNT, &arg);
+	}
+#endif
+
+	self->error_buffer[0] = '\0';
+
+	if (!self->emscripten_env_module) {
+		snprintf(self->error_buffer, sizeof(self->error_buffer),
+			 "mounting needs the emscripten runtime");
+		return -1;
+	}
+
+	if (wasmjit_emscripten_mount_memfs(wasmjit_emscripten_get_context(self->emscripten_env_module),
+					   archive_path)) {
+		snprintf(self->error_buffer, sizeof(self->error_buffer),
+			 "couldn't mount %s", archive_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+size_t wasmjit_high_emscripten_stack_usage(struct WasmJITHigh *self,
+					   const char *module_name)
+{
+	struct ModuleInst *module_inst;
+	struct FuncInst *main_inst, *environ_constructor,
+		*malloc_inst, *free_inst;
+	size_t i, guest, runtime, ret;
+
+#ifdef WASMJIT_CAN_USE_DEVICE
+	if (self->fd >= 0)
+		return 0;
+#endif
+
+	/*
+	  the bounds were computed without the side modules' functions
+	  and GOT.func entries the table now holds
+	*/
+	if (self->n_side_modules)
+		return 0;
+
+	module_inst = NULL;
+	for (i = 0; i < self->n_modules; ++i) {
+		if (!strcmp(self->modules[i].name, module_name)) {
+			module_inst = self->modules[i].module;
+		}
+	}
+
+	if (!module_inst)
+		return 0;
+
+	main_inst = wasmjit_get_export(module_inst, "_main",
+				       IMPORT_DESC_TYPE_FUNC).func;
+	malloc_inst = wasmjit_get_export(module_inst, "_malloc",
+					 IMPORT_DESC_TYPE_FUNC).func;
+	if (!main_inst || !main_inst->max_stack_usage ||
+	    !malloc_inst || !malloc_inst->max_stack_usage)
+		return 0;
+
+	guest = main_inst->max_stack_usage;
+	environ_constructor = wasmjit_get_export(module_inst,
+						 "___emscripten_environ_constructor",
+						 IMPORT_DESC_TYPE_FUNC).func;
+	if (environ_constructor) {
+		if (!environ_constructor->max_stack_usage)
+			return 0;
+		guest = MMAX(guest, environ_constructor->max_stack_usage);
+	}
+
+	/* host functions call back into malloc() and free() */
+	runtime = malloc_inst->max_stack_usage;
+	free_inst = wasmjit_get_export(module_inst, "_free",
+				       IMPORT_DESC_TYPE_FUNC).func;
+	if (free_inst) {
+		if (!free_inst->max_stack_usage)
+			return 0;
+		runtime = MMAX(runtime, free_inst->max_stack_usage);
+	}
+
+	if (__builtin_add_overflow(guest, runtime, &ret) ||
+	    __builtin_add_overflow(ret, WASMJIT_HOST_STACK_RESERVE, &ret))
+		return 0;
+
+	return ret;
+}
+
+int wasmjit_high_perf_stats(struct WasmJITHigh *self,
+			    const char *module_name,
+			    struct WasmJITPerfExportStats *stats,
+			    size_t n_stats,
+			    size_t *n_total)
+{
+	size_t i, n;
+	struct ModuleInst *module_inst;
+
+#ifdef WASMJIT_CAN_USE_DEVICE
+	if (self->fd >= 0) {
+		struct kwasmjit_perf_stats_args arg;
+
+		arg.version = 0;
+		arg.module_name = module_name;
+		arg.stats = stats;
+		arg.n_stats = n_stats;
+		arg.n_total = n_total;
+
+		return ioctl(self->fd, KWASMJIT_PERF_STATS, &arg);
+	}
+#endif
+
+	module_inst = NULL;
+	for (i = 0; i < self->n_modules; ++i) {
+		if (!strcmp(self->modules[i].name, module_name)) {
+			module_inst = self->modules[i].module;
+			break;
+		}
+	}
+
+	if (!module_inst)
+		return -1;
+
+	n = 0;
+	for (i = 0; i < module_inst->exports.n_elts; ++i) {
+		struct Export *export = &module_inst->exports.elts[i];
+		struct FuncInst *funcinst;
+
+		if (export->type != IMPORT_DESC_TYPE_FUNC)
+			continue;
+
+		funcinst = export->value.func;
+		if (!funcinst->perf_stats)
+			continue;
+
+		if (n < n_stats) {
+			strncpy(stats[n].name, export->name,
+				sizeof(stats[n].name));
+			stats[n].name[sizeof(stats[n].name) - 1] = '\0';
+			stats[n].stats = *funcinst->perf_stats;
+		}
+		n += 1;
+	}
+
+	*n_total = n;
+
+	return 0;
+}
+
+static void high_close(struct WasmJITHigh *self, int deferred)
 {
 	size_t i;
 
@@ -415,11 +830,32 @@ void wasmjit_high_close(struct WasmJITHigh *self)
 
 	for (i = 0; i < self->n_modules; ++i) {
 		free(self->modules[i].name);
-		wasmjit_free_module_inst(self->modules[i].module);
+		if (deferred)
+			wasmjit_free_module_inst_deferred(self->modules[i].module);
+		else
+			wasmjit_free_module_inst(self->modules[i].module);
 	}
 	if (self->modules)
 		free(self->modules);
 
+	for (i = 0; i < self->n_side_modules; ++i) {
+		if (deferred)
+			wasmjit_free_module_inst_deferred(self->side_modules[i].imports);
+		else
+			wasmjit_free_module_inst(self->side_modules[i].imports);
+	}
+	if (self->side_modules)
+		free(self->side_modules);
+}
+
+void wasmjit_high_close(struct WasmJITHigh *self)
+{
+	high_close(self, 0);
+}
+
+void wasmjit_high_close_deferred(struct WasmJITHigh *self)
+{
+	high_close(self, 1);
 }
 
 int wasmjit_high_error_message(struct WasmJITHigh *self,
@@ -26,6 +26,10 @@
 #define __WASMJIT__HIGH_LEVEL_H
 
 #include <wasmjit/sys.h>
+#include <wasmjit/perf_counters.h>
+
+struct Module;
+struct EmscriptenSideModule;
 
 /* this interface mimics the kernel interface and thus lacks power
    since we can't pass in abitrary objects for import, like host functions */
@@ -43,25 +47,96 @@ struct WasmJITHigh {
 	char error_buffer[256];
 	struct ModuleInst *emscripten_asm_module;
 	struct ModuleInst *emscripten_env_module;
+	/* last module instantiated without the side module flag */
+	struct ModuleInst *main_module;
+	size_t n_side_modules;
+	struct EmscriptenSideModule *side_modules;
 };
 
+/* link the module as an Emscripten SIDE_MODULE, see emscripten_dylink.h */
+#define WASMJIT_HIGH_INSTANTIATE_FLAGS_SIDE_MODULE 1
+
 #define WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_NO_TABLE 1
+/*
+  back linear memory with a memfd so other processes can map it, see
+  wasmjit_high_emscripten_memory_fd(). the kernel module's memory is
+  always mappable by the opener
+*/
+#define WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_SHARED_MEMORY 2
 
 int wasmjit_high_init(struct WasmJITHigh *self);
 int wasmjit_high_instantiate(struct WasmJITHigh *self,
 			     const char *filename,
 			     const char *module_name,
 			     uint32_t flags);
+/*
+  same as wasmjit_high_instantiate() but reuses an already parsed module,
+  filename is only read when backed by the kernel device
+*/
+int wasmjit_high_instantiate_parsed(struct WasmJITHigh *self,
+				    const char *filename,
+				    struct Module *module,
+				    const char *module_name,
+				    uint32_t flags);
 int wasmjit_high_instantiate_emscripten_runtime(struct WasmJITHigh *self,
 						uint32_t static_bump,
 						size_t tablemin,
 						size_t tablemax,
 						uint32_t flags);
+/* count invocations and hardware events of exported functions */
+#define WASMJIT_HIGH_EMSCRIPTEN_INVOKE_MAIN_FLAGS_PERF_COUNTERS 1
+
 int wasmjit_high_emscripten_invoke_main(struct WasmJITHigh *self,
 					const char *module_name,
 					int argc, char **argv, char **envp,
 					uint32_t flags);
+/*
+  instead of main(), restores a checkpoint taken by the guest through
+  wasmjit_checkpoint() and calls the export it named. not supported
+  with the kernel module
+*/
+int wasmjit_high_emscripten_resume(struct WasmJITHigh *self,
+				   const char *module_name,
+				   const char *checkpoint_path,
+				   char **envp,
+				   uint32_t flags);
+/*
+  an fd to mmap(MAP_SHARED) the Emscripten linear memory from, offsets
+  being guest addresses: the memfd when the runtime was instantiated
+  with WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_SHARED_MEMORY,
+  the /dev/wasm fd with the kernel module (only mappable by this
+  process), -1 otherwise. it stays owned by the instance
+*/
+int wasmjit_high_emscripten_memory_fd(struct WasmJITHigh *self);
+/*
+  serves the files of a memfs archive (see emscripten_memfs.h) to the
+  guest ahead of the host's, call after
+  wasmjit_high_instantiate_emscripten_runtime()
+*/
+int wasmjit_high_emscripten_mount(struct WasmJITHigh *self,
+				  const char *archive_path);
+/*
+  bound on the native stack needed to run main() of module_name,
+  0 if it can't be bounded (e.g. the program is recursive or side
+  modules are loaded)
+*/
+size_t wasmjit_high_emscripten_stack_usage(struct WasmJITHigh *self,
+					   const char *module_name);
+/*
+  fills up to n_stats entries for the function exports of module_name
+  that have been invoked, *n_total receives the number of such exports
+*/
+int wasmjit_high_perf_stats(struct WasmJITHigh *self,
+			    const char *module_name,
+			    struct WasmJITPerfExportStats *stats,
+			    size_t n_stats,
+			    size_t *n_total);
 void wasmjit_high_close(struct WasmJITHigh *self);
+/*
+  same as wasmjit_high_close() but the instances are torn down later
+  by a background worker, see wasmjit_free_module_inst_deferred()
+*/
+void wasmjit_high_close_deferred(struct WasmJITHigh *self);
 int wasmjit_high_error_message(struct WasmJITHigh *self, char *buf, size_t buf_size);
 
 
@@ -28,6 +28,8 @@
 #include <wasmjit/runtime.h>
 #include <wasmjit/compile.h>
 #include <wasmjit/util.h>
+#include <wasmjit/trace.h>
+#include <wasmjit/code_gc.h>
 
 #include <wasmjit/sys.h>
 
@@ -51,6 +53,71 @@ static int func_sig_repr(char *why, size_t why_size, struct FuncType *type)
 	return ret;
 }
 
+int wasmjit_bind_host_function(struct FuncInst *funcinst)
+{
+	void *unmapped = NULL;
+	void *compiled_code = NULL;
+	size_t compiled_code_size;
+	void *invoker = NULL;
+	size_t invoker_size = 0;
+	unsigned flags = wasmjit_detect_retpoline_flags();
+
+	if (funcinst->compiled_code)
+		return 0;
+
+	assert(IS_HOST(funcinst) && funcinst->host_fptr);
+
+	unmapped = funcinst->host_takes_values
+		? wasmjit_compile_hostfunc_values(&funcinst->type,
+						  funcinst->host_fptr,
+						  funcinst,
+						  &compiled_code_size,
+						  flags)
+		: wasmjit_compile_hostfunc(&funcinst->type,
+					   funcinst->host_fptr,
+					   funcinst,
+					   &compiled_code_size,
+					   flags);
+	if (!unmapped)
+		goto error;
+	compiled_code = wasmjit_map_code_segment(compiled_code_size);
+	if (!compiled_code)
+		goto error;
+	memcpy(compiled_code, unmapped, compiled_code_size);
+	if (!wasmjit_mark_code_segment_executable(compiled_code,
+						  compiled_code_size))
+		goto error;
+	free(unmapped);
+
+	unmapped = wasmjit_compile_invoker(&funcinst->type, compiled_code,
+					   &invoker_size, flags);
+	if (!unmapped)
+		goto error;
+	invoker = wasmjit_map_code_segment(invoker_size);
+	if (!invoker)
+		goto error;
+	memcpy(invoker, unmapped, invoker_size);
+	if (!wasmjit_mark_code_segment_executable(invoker, invoker_size))
+		goto error;
+	free(unmapped);
+
+	funcinst->compiled_code = compiled_code;
+	funcinst->compiled_code_size = compiled_code_size;
+	funcinst->invoker = invoker;
+	funcinst->invoker_size = invoker_size;
+
+	return 0;
+
+ error:
+	if (unmapped)
+		free(unmapped);
+	if (compiled_code)
+		wasmjit_unmap_code_segment(compiled_code, compiled_code_size);
+	if (invoker)
+		wasmjit_unmap_code_segment(invoker, invoker_size);
+	return -1;
+}
+
 static int read_constant_expression(struct ModuleInst *module_inst,
 				    unsigned valtype, struct Value *value,
 				    size_t n_instructions, struct Instr *instructions)
@@ -106,6 +173,24 @@ static int read_constant_expression(struct ModuleInst *module_inst,
 	return 0;
 }
 
+/*
+  inlined memory intrinsics use the importing module's memory, the
+  host function they replace uses its own module's
+*/
+static const struct WasmJITIntrinsic *
+usable_intrinsic(struct ModuleInst *module_inst, struct FuncInst *funcinst)
+{
+	const struct WasmJITIntrinsic *intrinsic = funcinst->intrinsic;
+
+	if (intrinsic && intrinsic->kind == WASMJIT_INTRINSIC_MEMCPY &&
+	    (!module_inst->mems.n_elts ||
+	     !funcinst->module_inst->mems.n_elts ||
+	     module_inst->mems.elts[0] != funcinst->module_inst->mems.elts[0]))
+		return NULL;
+
+	return intrinsic;
+}
+
 static int fill_module_types(struct ModuleInst *module_inst,
 			     struct ModuleTypes *module_types)
 {
@@ -136,10 +221,36 @@ static int fill_module_types(struct ModuleInst *module_inst,
 		goto error;
 
 
+	module_types->direct_funcs =
+		calloc(module_inst->funcs.n_elts,
+		       sizeof(module_types->direct_funcs[0]));
+	if (module_inst->funcs.n_elts && !module_types->direct_funcs)
+		goto error;
+
+	module_types->intrinsics =
+		calloc(module_inst->funcs.n_elts,
+		       sizeof(module_types->intrinsics[0]));
+	if (module_inst->funcs.n_elts && !module_types->intrinsics)
+		goto error;
+
 	for (i = 0; i < module_inst->funcs.n_elts; ++i) {
 		module_types->functypes[i] = module_inst->funcs.elts[i]->type;
 	}
 
+	/*
+	  imports exported by other wasm modules are already compiled,
+	  their code embeds its own memory and global references
+	  so we can call it directly without going through the FuncInst
+	*/
+	for (i = 0; i < module_inst->n_imported_funcs; ++i) {
+		struct FuncInst *funcinst = module_inst->funcs.elts[i];
+		module_types->direct_funcs[i] = !IS_HOST(funcinst) &&
+			funcinst->compiled_code;
+		if (IS_HOST(funcinst))
+			module_types->intrinsics[i] =
+				usable_intrinsic(module_inst, funcinst);
+	}
+
 	for (i = 0; i < module_inst->tables.n_elts; ++i) {
 		module_types->tabletypes[i].elemtype =
 			module_inst->tables.elts[i]->elemtype;
@@ -169,10 +280,748 @@ static int fill_module_types(struct ModuleInst *module_inst,
 	return 0;
 }
 
-struct ModuleInst *wasmjit_instantiate(const struct Module *module,
+static int func_types_equal(const struct FuncType *a,
+			    const struct FuncType *b)
+{
+	return a->n_inputs == b->n_inputs &&
+		!memcmp(a->input_types, b->input_types, a->n_inputs) &&
+		a->output_type == b->output_type;
+}
+
+/*
+  call graph used to bound native stack usage, there is a node per
+  function and one per type. indirect calls are edges to the node
+  of their type, which has edges to every function of that type.
+ */
+struct StackGraph {
+	size_t *edge_start;
+	size_t *edges;
+	size_t n_edges;
+	size_t *last_caller;
+};
+
+static void stack_graph_add_edge(struct StackGraph *graph,
+				 size_t caller, size_t callee)
+{
+	/* edges of a caller are added together, so this dedupes them */
+	if (graph->last_caller[callee] == caller)
+		return;
+	graph->last_caller[callee] = caller;
+	if (graph->edges)
+		graph->edges[graph->n_edges] = callee;
+	graph->n_edges++;
+}
+
+static void stack_graph_add_calls(struct StackGraph *graph, size_t caller,
+				  size_t n_funcs, const size_t *canon_types,
+				  size_t n_instructions,
+				  const struct Instr *instructions)
+{
+	size_t i;
+
+	for (i = 0; i < n_instructions; ++i) {
+		const struct Instr *instr = &instructions[i];
+
+		switch (instr->opcode) {
+		case OPCODE_BLOCK:
+			stack_graph_add_calls(graph, caller, n_funcs, canon_types,
+					      instr->data.block.n_instructions,
+					      instr->data.block.instructions);
+			break;
+		case OPCODE_LOOP:
+			stack_graph_add_calls(graph, caller, n_funcs, canon_types,
+					      instr->data.loop.n_instructions,
+					      instr->data.loop.instructions);
+			break;
+		case OPCODE_IF:
+			stack_graph_add_calls(graph, caller, n_funcs, canon_types,
+					      instr->data.if_.n_instructions_then,
+					      instr->data.if_.instructions_then);
+			stack_graph_add_calls(graph, caller, n_funcs, canon_types,
+					      instr->data.if_.n_instructions_else,
+					      instr->data.if_.instructions_else);
+			break;
+		case OPCODE_CALL:
+			stack_graph_add_edge(graph, caller,
+					     instr->data.call.funcidx);
+			break;
+		case OPCODE_CALL_INDIRECT:
+			stack_graph_add_edge(graph, caller,
+					     n_funcs +
+					     canon_types[instr->data.call_indirect.typeidx]);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* deepest nesting of blocks, loops and ifs in instructions */
+static size_t max_block_depth(size_t n_instructions,
+			      const struct Instr *instructions)
+{
+	size_t i, depth = 0, sub;
+
+	for (i = 0; i < n_instructions; ++i) {
+		const struct Instr *instr = &instructions[i];
+
+		switch (instr->opcode) {
+		case OPCODE_BLOCK:
+			sub = max_block_depth(instr->data.block.n_instructions,
+					      instr->data.block.instructions);
+			depth = MMAX(depth, sub + 1);
+			break;
+		case OPCODE_LOOP:
+			sub = max_block_depth(instr->data.loop.n_instructions,
+					      instr->data.loop.instructions);
+			depth = MMAX(depth, sub + 1);
+			break;
+		case OPCODE_IF:
+			sub = max_block_depth(instr->data.if_.n_instructions_then,
+					      instr->data.if_.instructions_then);
+			depth = MMAX(depth, sub + 1);
+			sub = max_block_depth(instr->data.if_.n_instructions_else,
+					      instr->data.if_.instructions_else);
+			depth = MMAX(depth, sub + 1);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return depth;
+}
+
+/*
+  sets max_stack_usage of the module's functions from the stack
+  usage of each function and its callees. SIZE_MAX stands for
+  unbounded while computing.
+ */
+static int compute_max_stack_usage(const struct Module *module,
+				   struct ModuleInst *module_inst)
+{
+	size_t n_funcs = module_inst->funcs.n_elts;
+	size_t n_types = module_inst->types.n_elts;
+	size_t n_nodes = n_funcs + n_types;
+	size_t i, j, pass;
+	size_t *func_types = NULL, *canon_types = NULL,
+		*first_func = NULL, *next_func = NULL,
+		*costs = NULL, *bounds = NULL, *cursors = NULL, *dfs = NULL;
+	unsigned char *states = NULL;
+	struct StackGraph graph = {NULL, NULL, 0, NULL};
+	int ret = 0;
+
+	func_types = calloc(n_funcs + 1, sizeof(func_types[0]));
+	next_func = calloc(n_funcs + 1, sizeof(next_func[0]));
+	canon_types = calloc(n_types + 1, sizeof(canon_types[0]));
+	first_func = calloc(n_types + 1, sizeof(first_func[0]));
+	costs = calloc(n_nodes, sizeof(costs[0]));
+	bounds = calloc(n_nodes, sizeof(bounds[0]));
+	cursors = calloc(n_nodes, sizeof(cursors[0]));
+	dfs = calloc(n_nodes, sizeof(dfs[0]));
+	states = calloc(n_nodes, sizeof(states[0]));
+	graph.edge_start = calloc(n_nodes + 1, sizeof(graph.edge_start[0]));
+	graph.last_caller = calloc(n_nodes, sizeof(graph.last_caller[0]));
+	if (!func_types || !next_func || !canon_types || !first_func ||
+	    (n_nodes && (!costs || !bounds || !cursors || !dfs || !states ||
+			 !graph.last_caller)) ||
+	    !graph.edge_start)
+		goto error;
+
+	/* functions of structurally equal types share a type node */
+	for (i = 0; i < n_types; ++i) {
+		canon_types[i] = i;
+		for (j = 0; j < i; ++j) {
+			if (func_types_equal(&module_inst->types.elts[j],
+					     &module_inst->types.elts[i])) {
+				canon_types[i] = canon_types[j];
+				break;
+			}
+		}
+		first_func[i] = SIZE_MAX;
+	}
+
+	j = 0;
+	for (i = 0; i < module->import_section.n_imports; ++i) {
+		if (module->import_section.imports[i].desc_type !=
+		    IMPORT_DESC_TYPE_FUNC)
+			continue;
+		func_types[j++] =
+			module->import_section.imports[i].desc.functypeidx;
+	}
+	assert(j == module_inst->n_imported_funcs);
+	for (i = 0; i < module->function_section.n_typeidxs; ++i)
+		func_types[j++] = module->function_section.typeidxs[i];
+	assert(j == n_funcs);
+
+	for (i = n_funcs; i-- > 0;) {
+		size_t canon = canon_types[func_types[i]];
+		next_func[i] = first_func[canon];
+		first_func[canon] = i;
+	}
+
+	for (i = 0; i < n_funcs; ++i) {
+		struct FuncInst *funcinst = module_inst->funcs.elts[i];
+		size_t args = 8 * (funcinst->type.n_inputs + 1);
+
+		if (i >= module_inst->n_imported_funcs)
+			costs[i] = funcinst->stack_usage + args;
+		else if (IS_HOST(funcinst))
+			costs[i] = WASMJIT_HOST_STACK_RESERVE + args;
+		else if (funcinst->max_stack_usage)
+			costs[i] = funcinst->max_stack_usage + args;
+		else
+			costs[i] = SIZE_MAX;
+	}
+
+	/* count the edges, then fill them in */
+	for (pass = 0; pass < 2; ++pass) {
+		graph.n_edges = 0;
+		for (i = 0; i < n_nodes; ++i)
+			graph.last_caller[i] = SIZE_MAX;
+
+		for (i = 0; i < n_nodes; ++i) {
+			graph.edge_start[i] = graph.n_edges;
+
+			if (i < module_inst->n_imported_funcs) {
+				struct FuncInst *funcinst = module_inst->funcs.elts[i];
+				struct FuncType callee_type;
+
+				if (!IS_HOST(funcinst) ||
+				    !funcinst->host_calls_table ||
+				    !funcinst->type.n_inputs)
+					continue;
+
+				callee_type.n_inputs = funcinst->type.n_inputs - 1;
+				memcpy(callee_type.input_types,
+				       funcinst->type.input_types + 1,
+				       callee_type.n_inputs);
+				callee_type.output_type = funcinst->type.output_type;
+
+				for (j = 0; j < n_types; ++j) {
+					if (func_types_equal(&module_inst->types.elts[j],
+							     &callee_type)) {
+						stack_graph_add_edge(&graph, i,
+								     n_funcs + canon_types[j]);
+						break;
+					}
+				}
+			} else if (i < n_funcs) {
+				struct CodeSectionCode *code =
+					&module->code_section.codes[i - module_inst->n_imported_funcs];
+
+				stack_graph_add_calls(&graph, i, n_funcs, canon_types,
+						      code->n_instructions,
+						      code->instructions);
+			} else {
+				for (j = first_func[i - n_funcs]; j != SIZE_MAX;
+				     j = next_func[j])
+					stack_graph_add_edge(&graph, i, j);
+			}
+		}
+		graph.edge_start[n_nodes] = graph.n_edges;
+
+		if (!pass) {
+			graph.edges = calloc(graph.n_edges + 1,
+					     sizeof(graph.edges[0]));
+			if (!graph.edges)
+				goto error;
+		}
+	}
+
+	/* iterative depth-first search, a call back into the path is recursion */
+	for (i = 0; i < n_nodes; ++i) {
+		size_t depth = 0;
+
+		if (states[i])
+			continue;
+
+		states[i] = 1;
+		cursors[i] = graph.edge_start[i];
+		dfs[depth++] = i;
+
+		while (depth) {
+			size_t node = dfs[depth - 1];
+
+			if (cursors[node] < graph.edge_start[node + 1]) {
+				size_t callee = graph.edges[cursors[node]++];
+
+				switch (states[callee]) {
+				case 0:
+					states[callee] = 1;
+					cursors[callee] = graph.edge_start[callee];
+					dfs[depth++] = callee;
+					break;
+				case 1:
+					bounds[node] = SIZE_MAX;
+					break;
+				default:
+					bounds[node] = MMAX(bounds[node], bounds[callee]);
+					break;
+				}
+				continue;
+			}
+
+			if (bounds[node] == SIZE_MAX || costs[node] == SIZE_MAX ||
+			    __builtin_add_overflow(bounds[node], costs[node],
+						   &bounds[node]))
+				bounds[node] = SIZE_MAX;
+			states[node] = 2;
+
+			if (--depth) {
+				size_t caller = dfs[depth - 1];
+				bounds[caller] = MMAX(bounds[caller], bounds[node]);
+			}
+		}
+	}
+
+	for (i = module_inst->n_imported_funcs; i < n_funcs; ++i) {
+		module_inst->funcs.elts[i]->max_stack_usage =
+			bounds[i] == SIZE_MAX ? 0 : bounds[i];
+	}
+
+	ret = 1;
+
+ error:
+	if (func_types)
+		free(func_types);
+	if (next_func)
+		free(next_func);
+	if (canon_types)
+		free(canon_types);
+	if (first_func)
+		free(first_func);
+	if (costs)
+		free(costs);
+	if (bounds)
+		free(bounds);
+	if (cursors)
+		free(cursors);
+	if (dfs)
+		free(dfs);
+	if (states)
+		free(states);
+	if (graph.edge_start)
+		free(graph.edge_start);
+	if (graph.edges)
+		free(graph.edges);
+	if (graph.last_caller)
+		free(graph.last_caller);
+
+	return ret;
+}
+
+/* patches the references recorded while compiling into mapped code */
+/* the address ref stands for in module_inst */
+static uintptr_t ref_value(const struct ModuleInst *module_inst,
+			   const struct MemoryReferenceElt *ref)
+{
+	switch (ref->type) {
+	case MEMREF_TYPE:
+		return (uintptr_t) &module_inst->types.elts[ref->idx];
+	case MEMREF_FUNC:
+		return (uintptr_t) module_inst->funcs.elts[ref->idx];
+	case MEMREF_TABLE:
+		return (uintptr_t) module_inst->tables.elts[ref->idx];
+	case MEMREF_MEM:
+		return (uintptr_t) module_inst->mems.elts[ref->idx];
+	case MEMREF_GLOBAL:
+		return (uintptr_t) module_inst->globals.elts[ref->idx];
+	case MEMREF_RESOLVE_INDIRECT_CALL:
+		return (uintptr_t) &wasmjit_resolve_indirect_call;
+	case MEMREF_TRAP:
+		return (uintptr_t) &wasmjit_trap;
+	case MEMREF_STACK_TOP:
+		return (uintptr_t) &wasmjit_stack_top;
+	case MEMREF_FUNC_CODE:
+		return (uintptr_t) module_inst->funcs.elts[ref->idx]->compiled_code;
+	default:
+		assert(0);
+		return 0;
+	}
+}
+
+static void relocate_code(struct ModuleInst *module_inst,
+			  void *mapped,
+			  const struct MemoryReferences *refs)
+{
+	size_t j;
+
+	for (j = 0; j < refs->n_elts; ++j) {
+		if (refs->elts[j].type == MEMREF_FUNC_CODE_REL32) {
+			intptr_t rel;
+			char *site = &((char *) mapped)[refs->elts[j].code_offset];
+
+			rel = (intptr_t) module_inst->funcs.elts[refs->elts[j].idx]->compiled_code -
+				(intptr_t) (site + sizeof(uint32_t));
+
+			/* otherwise leave it pointing to its stub */
+			if (rel >= INT32_MIN && rel <= INT32_MAX) {
+				uint32_t le_rel = uint32_t_swap_bytes((uint32_t) rel);
+				memcpy(site, &le_rel, sizeof(le_rel));
+			}
+			continue;
+		}
+
+		encode_le_uint64_t(ref_value(module_inst, &refs->elts[j]),
+				   &((char *) mapped)[refs->elts[j].code_offset]);
+	}
+}
+
+/* distinct for every reference code of module_inst can make */
+static size_t ref_key(const struct ModuleInst *module_inst,
+		      const struct MemoryReferenceElt *ref)
+{
+	size_t key = 0;
+
+	switch (ref->type) {
+	case MEMREF_RESOLVE_INDIRECT_CALL:
+		return 0;
+	case MEMREF_TRAP:
+		return 1;
+	case MEMREF_STACK_TOP:
+		return 2;
+	default:
+		break;
+	}
+
+	key += 3;
+	if (ref->type == MEMREF_FUNC_CODE)
+		return key + ref->idx;
+	key += module_inst->funcs.n_elts;
+	if (ref->type == MEMREF_FUNC)
+		return key + ref->idx;
+	key += module_inst->funcs.n_elts;
+	if (ref->type == MEMREF_TYPE)
+		return key + ref->idx;
+	key += module_inst->types.n_elts;
+	if (ref->type == MEMREF_TABLE)
+		return key + ref->idx;
+	key += module_inst->tables.n_elts;
+	if (ref->type == MEMREF_MEM)
+		return key + ref->idx;
+	key += module_inst->mems.n_elts;
+	assert(ref->type == MEMREF_GLOBAL);
+	return key + ref->idx;
+}
+
+static size_t n_ref_keys(const struct ModuleInst *module_inst)
+{
+	return 3 + 2 * module_inst->funcs.n_elts + module_inst->types.n_elts +
+		module_inst->tables.n_elts + module_inst->mems.n_elts +
+		module_inst->globals.n_elts;
+}
+
+/*
+  turns the movabs $imm64, %reg whose immediate is at offset into
+  mov target(%rip), %reg (or lea when lea is set) of the same length
+*/
+static int rewrite_movabs(char *image, size_t offset, size_t target, int lea)
+{
+	unsigned char *insn = (unsigned char *) &image[offset - 2];
+	unsigned reg;
+	int64_t disp;
+	uint32_t le_disp;
+
+	if ((insn[0] != 0x48 && insn[0] != 0x49) ||
+	    insn[1] < 0xb8 || insn[1] > 0xbf)
+		return 0;
+	reg = (insn[1] - 0xb8) | ((insn[0] & 1) << 3);
+
+	/* relative to the end of the 7 byte mov */
+	disp = (int64_t) target - (int64_t) (offset - 2 + 7);
+	if (disp < INT32_MIN || disp > INT32_MAX)
+		return 0;
+
+	insn[0] = 0x48 | ((reg & 8) >> 1);
+	insn[1] = lea ? 0x8d : 0x8b;
+	insn[2] = 0x05 | ((reg & 7) << 3);
+	le_disp = uint32_t_swap_bytes((uint32_t) disp);
+	memcpy(&insn[3], &le_disp, sizeof(le_disp));
+
+	/* nopl (%rax) */
+	insn[7] = 0x0f;
+	insn[8] = 0x1f;
+	insn[9] = 0x00;
+
+	return 1;
+}
+
+#define SHARED_CODE_ALIGN 16
+
+/*
+  lays out the functions of compiled, then their invokers, as one
+  image with every absolute reference loaded from the table each
+  instance maps after it. direct calls into other modules stay on
+  their stubs since the distance differs between instances.
+*/
+static int build_shared_code(struct CompiledModule *compiled,
+			     struct ModuleInst *module_inst,
+			     unsigned flags)
+{
+	size_t i, j, size = 0, refs_offset, n_keys;
+	char *image = NULL, *invoker = NULL;
+	size_t *slots = NULL;
+	struct MemoryReferences refs = {0, NULL};
+	int ret = 0;
+
+	for (i = 0; i < compiled->n_funcs; ++i) {
+		size = (size + SHARED_CODE_ALIGN - 1) & ~(size_t) (SHARED_CODE_ALIGN - 1);
+		compiled->funcs[i].code_offset = size;
+		size += compiled->funcs[i].code_size;
+	}
+
+	image = malloc(size);
+	if (!image)
+		goto error;
+	/* int3 between functions */
+	memset(image, 0xcc, size);
+	for (i = 0; i < compiled->n_funcs; ++i)
+		memcpy(&image[compiled->funcs[i].code_offset],
+		       compiled->funcs[i].code, compiled->funcs[i].code_size);
+
+	for (i = 0; i < compiled->n_funcs; ++i) {
+		struct CompiledFunction *cfunc = &compiled->funcs[i];
+		struct FuncInst *funcinst =
+			module_inst->funcs.elts[module_inst->n_imported_funcs + i];
+		size_t offset, invoker_size, start;
+		char *new_image;
+
+		invoker = wasmjit_compile_invoker_offset(&funcinst->type,
+							 &offset,
+							 &invoker_size,
+							 flags);
+		if (!invoker)
+			goto error;
+
+		start = (size + SHARED_CODE_ALIGN - 1) & ~(size_t) (SHARED_CODE_ALIGN - 1);
+		new_image = realloc(image, start + invoker_size);
+		if (!new_image)
+			goto error;
+		image = new_image;
+		memset(&image[size], 0xcc, start - size);
+		memcpy(&image[start], invoker, invoker_size);
+		size = start + invoker_size;
+
+		free(invoker);
+		invoker = NULL;
+
+		if (!rewrite_movabs(image, start + offset, cfunc->code_offset, 1))
+			goto error;
+
+		cfunc->invoker_offset = start;
+		cfunc->invoker_size = invoker_size;
+	}
+
+	refs_offset = wasmjit_shared_code_refs_offset(size);
+
+	/* each distinct reference gets one entry */
+	n_keys = n_ref_keys(module_inst);
+	slots = malloc(n_keys * sizeof(slots[0]));
+	refs.elts = malloc(n_keys * sizeof(refs.elts[0]));
+	if (!slots || !refs.elts)
+		goto error;
+	for (i = 0; i < n_keys; ++i)
+		slots[i] = SIZE_MAX;
+
+	for (i = 0; i < compiled->n_funcs; ++i) {
+		struct CompiledFunction *cfunc = &compiled->funcs[i];
+
+		for (j = 0; j < cfunc->memrefs.n_elts; ++j) {
+			struct MemoryReferenceElt *ref = &cfunc->memrefs.elts[j];
+			size_t key;
+
+			if (ref->type == MEMREF_FUNC_CODE_REL32)
+				continue;
+
+			key = ref_key(module_inst, ref);
+			assert(key < n_keys);
+			if (slots[key] == SIZE_MAX) {
+				slots[key] = refs.n_elts;
+				refs.elts[refs.n_elts++] = *ref;
+			}
+
+			if (!rewrite_movabs(image, cfunc->code_offset + ref->code_offset,
+					    refs_offset + slots[key] * sizeof(uint64_t),
+					    0))
+				goto error;
+		}
+	}
+
+	compiled->shared_code = wasmjit_create_shared_code(image, size);
+	if (!compiled->shared_code)
+		goto error;
+	compiled->shared_refs = refs;
+	refs.elts = NULL;
+
+	for (i = 0; i < compiled->n_funcs; ++i) {
+		free(compiled->funcs[i].code);
+		compiled->funcs[i].code = NULL;
+		if (compiled->funcs[i].memrefs.elts)
+			free(compiled->funcs[i].memrefs.elts);
+		compiled->funcs[i].memrefs.n_elts = 0;
+		compiled->funcs[i].memrefs.elts = NULL;
+	}
+
+	ret = 1;
+
+ error:
+	if (image)
+		free(image);
+	if (invoker)
+		free(invoker);
+	if (slots)
+		free(slots);
+	if (refs.elts)
+		free(refs.elts);
+
+	return ret;
+}
+
+/* maps compiled's shared code with a table for module_inst */
+static int map_shared_code(const struct CompiledModule *compiled,
+			   struct ModuleInst *module_inst)
+{
+	const struct MemoryReferences *refs = &compiled->shared_refs;
+	char *values = NULL, *code;
+	size_t i;
+	int ret = 0;
+
+	if (refs->n_elts) {
+		values = malloc(refs->n_elts * sizeof(uint64_t));
+		if (!values)
+			goto error;
+	}
+
+	for (i = 0; i < refs->n_elts; ++i)
+		encode_le_uint64_t(ref_value(module_inst, &refs->elts[i]),
+				   &values[i * sizeof(uint64_t)]);
+
+	code = wasmjit_map_shared_code(compiled->shared_code, values,
+				       refs->n_elts * sizeof(uint64_t),
+				       &module_inst->shared_code);
+	if (!code)
+		goto error;
+
+	for (i = 0; i < compiled->n_funcs; ++i) {
+		const struct CompiledFunction *cfunc = &compiled->funcs[i];
+		struct FuncInst *funcinst =
+			module_inst->funcs.elts[module_inst->n_imported_funcs + i];
+
+		funcinst->compiled_code = &code[cfunc->code_offset];
+		funcinst->compiled_code_size = cfunc->code_size;
+		funcinst->invoker = (void *) &code[cfunc->invoker_offset];
+		funcinst->invoker_size = cfunc->invoker_size;
+		funcinst->code_shared = 1;
+	}
+
+	ret = 1;
+
+ error:
+	if (values)
+		free(values);
+
+	return ret;
+}
+
+void *wasmjit_recompile_function(struct ModuleInst *module_inst,
+				 const struct ModuleTypes *module_types,
+				 struct FuncInst *funcinst,
+				 const char *body,
+				 size_t body_size,
+				 size_t *out_size,
+				 unsigned flags)
+{
+	struct CodeSectionCode code;
+	struct MemoryReferences memrefs = {0, NULL};
+	void *unmapped = NULL, *mapped = NULL;
+	size_t code_size = 0, stack_usage;
+
+	memset(&code, 0, sizeof(code));
+	code.size = body_size;
+	code.body = body;
+	if (!read_code(&code))
+		goto error;
+
+	unmapped = wasmjit_compile_function(module_inst->types.elts,
+					    module_types,
+					    &funcinst->type,
+					    &code,
+					    &memrefs,
+					    &code_size,
+					    &stack_usage,
+					    flags);
+	if (!unmapped)
+		goto error;
+
+	mapped = wasmjit_map_code_segment(code_size);
+	if (!mapped)
+		goto error;
+
+	memcpy(mapped, unmapped, code_size);
+	relocate_code(module_inst, mapped, &memrefs);
+
+	if (!wasmjit_mark_code_segment_executable(mapped, code_size))
+		goto error;
+
+	*out_size = code_size;
+
+	if (0) {
+	error:
+		if (mapped)
+			wasmjit_unmap_code_segment(mapped, code_size);
+		mapped = NULL;
+	}
+
+	if (unmapped)
+		free(unmapped);
+	if (memrefs.elts)
+		free(memrefs.elts);
+	if (code.locals)
+		free(code.locals);
+	if (code.instructions)
+		free_instructions(code.instructions, code.n_instructions);
+
+	return mapped;
+}
+
+void wasmjit_free_compiled_module(struct CompiledModule *compiled)
+{
+	size_t i;
+
+	for (i = 0; i < compiled->n_funcs; ++i) {
+		if (compiled->funcs[i].code)
+			free(compiled->funcs[i].code);
+		if (compiled->funcs[i].memrefs.elts)
+			free(compiled->funcs[i].memrefs.elts);
+	}
+	if (compiled->funcs)
+		free(compiled->funcs);
+	if (compiled->shared_code)
+		wasmjit_free_shared_code(compiled->shared_code);
+	if (compiled->shared_refs.elts)
+		free(compiled->shared_refs.elts);
+	if (compiled->direct_funcs)
+		free(compiled->direct_funcs);
+	if (compiled->intrinsics)
+		free(compiled->intrinsics);
+	memset(compiled, 0, sizeof(*compiled));
+}
+
+struct ModuleInst *wasmjit_instantiate(struct Module *module,
 				       size_t n_imports,
 				       const struct NamedModule *imports,
 				       char *why, size_t why_size)
+{
+	return wasmjit_instantiate_compiled(module, n_imports, imports,
+					    NULL, why, why_size);
+}
+
+struct ModuleInst *wasmjit_instantiate_compiled(struct Module *module,
+						size_t n_imports,
+						const struct NamedModule *imports,
+						struct CompiledModule *compiled,
+						char *why, size_t why_size)
 {
 	uint32_t i;
 	struct ModuleInst *module_inst = NULL;
@@ -185,8 +1034,15 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 	struct MemoryReferences memrefs = {0, NULL};
 	size_t code_size;
 	unsigned global_compile_flags;
+	uint64_t trace_start;
+	struct CompiledModule fill = {0, NULL, 0, 0, NULL, NULL, NULL, {0, NULL}};
+	const void *code_buf;
+	const struct MemoryReferences *refs;
+	int share;
 
 	global_compile_flags = wasmjit_detect_retpoline_flags();
+	if (wasmjit_code_gc_enabled())
+		global_compile_flags |= WASMJIT_COMPILE_FLAG_CODE_GC;
 
 	memset(&module_types, 0, sizeof(module_types));
 	module_inst = calloc(1, sizeof(*module_inst));
@@ -208,6 +1064,7 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 	}
 
 	/* load imports */
+	WASMJIT_TRACE_BEGIN(trace_start);
 	for (i = 0; i < module->import_section.n_imports; ++i) {
 		size_t j;
 		struct ImportSectionImport *import =
@@ -261,6 +1118,16 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 					goto error;
 				}
 
+				if (IS_HOST(funcinst) &&
+				    wasmjit_bind_host_function(funcinst)) {
+					if (why)
+						snprintf(why, why_size,
+							 "Couldn't compile trampoline for %s.%s",
+							 import->module,
+							 import->name);
+					goto error;
+				}
+
 				/* add funcinst to func table */
 				LVECTOR_GROW(&module_inst->funcs, 1);
 				module_inst->funcs.elts[module_inst->funcs.n_elts - 1] = funcinst;
@@ -398,6 +1265,8 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 			goto error;
 		}
 	}
+	WASMJIT_TRACE_END(trace_start, "link_imports", NULL,
+			  (long) module->import_section.n_imports);
 
 	for (i = 0; i < module->function_section.n_typeidxs; ++i) {
 		assert(tmp_func == NULL);
@@ -470,7 +1339,7 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 			goto error;
 
 		if (size) {
-			tmp_mem->data = calloc(size, 1);
+			tmp_mem->data = wasmjit_map_memory(size);
 			if (!tmp_mem->data) {
 				free(tmp_mem);
 				goto error;
@@ -578,10 +1447,47 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 	if (!fill_module_types(module_inst, &module_types))
 		goto error;
 
+	/*
+	  code embeds whether imports are called directly, so earlier
+	  output is only valid if that hasn't changed
+	*/
+	if (compiled && compiled->n_funcs &&
+	    (compiled->flags != global_compile_flags ||
+	     compiled->n_imported_funcs != module_inst->n_imported_funcs ||
+	     (module_inst->n_imported_funcs &&
+	      (memcmp(compiled->direct_funcs, module_types.direct_funcs,
+		      module_inst->n_imported_funcs) ||
+	       memcmp(compiled->intrinsics, module_types.intrinsics,
+		      module_inst->n_imported_funcs *
+		      sizeof(module_types.intrinsics[0]))))))
+		compiled = NULL;
+
+	/* instances of cached modules map the same code */
+	share = compiled && module->code_section.n_codes &&
+		!(global_compile_flags & WASMJIT_COMPILE_FLAG_CODE_GC);
+
+	if (compiled && !compiled->n_funcs && module->code_section.n_codes) {
+		fill.funcs = calloc(module->code_section.n_codes,
+				    sizeof(fill.funcs[0]));
+		if (!fill.funcs)
+			goto error;
+		fill.n_funcs = module->code_section.n_codes;
+	}
+
+	/* we compile everything, so decode all bodies up front */
+	WASMJIT_TRACE_BEGIN(trace_start);
+	if (!read_codes(&module->code_section)) {
+		if (why)
+			snprintf(why, why_size, "Error reading code section");
+		goto error;
+	}
+	WASMJIT_TRACE_END(trace_start, "decode_code", NULL,
+			  (long) module->code_section.n_codes);
+
 	for (i = 0; i < module->code_section.n_codes; ++i) {
 		struct CodeSectionCode *code = &module->code_section.codes[i];
 		struct FuncInst *funcinst;
-		size_t j;
+		long funcidx = i + module_inst->n_imported_funcs;
 
 		funcinst = module_inst->funcs.elts[i + module_inst->n_imported_funcs];
 
@@ -591,89 +1497,121 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 			memrefs.elts = NULL;
 		}
 
-		if (unmapped)
+		if (unmapped) {
 			free(unmapped);
+			unmapped = NULL;
+		}
 
 		assert(mapped == NULL);
-		unmapped = wasmjit_compile_function(module_inst->types.elts,
-						    &module_types,
-						    &funcinst->type,
-						    code,
-						    &memrefs,
-						    &code_size,
-						    &funcinst->stack_usage,
-						    global_compile_flags);
-		if (!unmapped)
-			goto error;
+		if (compiled && compiled->n_funcs) {
+			struct CompiledFunction *cfunc = &compiled->funcs[i];
+
+			code_buf = cfunc->code;
+			code_size = cfunc->code_size;
+			funcinst->stack_usage = cfunc->stack_usage;
+			refs = &cfunc->memrefs;
+		} else {
+			WASMJIT_TRACE_BEGIN(trace_start);
+			unmapped = wasmjit_compile_function(module_inst->types.elts,
+							    &module_types,
+							    &funcinst->type,
+							    code,
+							    &memrefs,
+							    &code_size,
+							    &funcinst->stack_usage,
+							    global_compile_flags);
+			if (!unmapped)
+				goto error;
+			WASMJIT_TRACE_END(trace_start, "compile", NULL, funcidx);
+
+			code_buf = unmapped;
+			refs = &memrefs;
+
+			if (fill.funcs) {
+				struct CompiledFunction *cfunc = &fill.funcs[i];
+
+				cfunc->code = unmapped;
+				cfunc->code_size = code_size;
+				cfunc->stack_usage = funcinst->stack_usage;
+				cfunc->memrefs = memrefs;
+				unmapped = NULL;
+				memrefs.n_elts = 0;
+				memrefs.elts = NULL;
+				refs = &cfunc->memrefs;
+			}
+		}
+
+		/* lets the host read it instead of calling the function */
+		if (code->n_instructions == 1 &&
+		    code->instructions[0].opcode == OPCODE_GET_GLOBAL &&
+		    code->instructions[0].data.get_global.globalidx <
+		    module_inst->globals.n_elts)
+			funcinst->returns_global =
+				module_inst->globals.elts[code->instructions[0].data.get_global.globalidx];
+
+		/* the stub restoring collected code runs on our stack */
+		if (global_compile_flags & WASMJIT_COMPILE_FLAG_CODE_GC) {
+			size_t depth = max_block_depth(code->n_instructions,
+						       code->instructions);
+
+			if (depth > (SIZE_MAX - funcinst->stack_usage -
+				     WASMJIT_HOST_STACK_RESERVE) /
+			    WASMJIT_CODE_GC_STACK_PER_BLOCK)
+				goto error;
+			funcinst->stack_usage += WASMJIT_HOST_STACK_RESERVE +
+				depth * WASMJIT_CODE_GC_STACK_PER_BLOCK;
+		}
 
+		/* mapped once every function is compiled */
+		if (share)
+			continue;
+
+		WASMJIT_TRACE_BEGIN(trace_start);
 		mapped = wasmjit_map_code_segment(code_size);
 		if (!mapped)
 			goto error;
 
-		memcpy(mapped, unmapped, code_size);
+		memcpy(mapped, code_buf, code_size);
+		WASMJIT_TRACE_END(trace_start, "map_code", NULL, funcidx);
 
 		/* resolve code references */
-		for (j = 0; j < memrefs.n_elts; ++j) {
-			uint64_t val;
-
-			switch (memrefs.elts[j].type) {
-			case MEMREF_TYPE:
-				val = (uintptr_t) &module_inst->types.elts[memrefs.elts[j].idx];
-				break;
-			case MEMREF_FUNC:
-				val = (uintptr_t) module_inst->funcs.elts[memrefs.elts[j].idx];
-				break;
-			case MEMREF_TABLE:
-				val = (uintptr_t) module_inst->tables.elts[memrefs.elts[j].idx];
-				break;
-			case MEMREF_MEM:
-				val = (uintptr_t) module_inst->mems.elts[memrefs.elts[j].idx];
-				break;
-			case MEMREF_GLOBAL:
-				val = (uintptr_t) module_inst->globals.elts[memrefs.elts[j].idx];
-				break;
-			case MEMREF_RESOLVE_INDIRECT_CALL:
-				val = (uintptr_t) &wasmjit_resolve_indirect_call;
-				break;
-			case MEMREF_TRAP:
-				val = (uintptr_t) &wasmjit_trap;
-				break;
-			case MEMREF_STACK_TOP:
-				val = (uintptr_t) &wasmjit_stack_top;
-				break;
-			default:
-				assert(0);
-				val = 0;
-				break;
-			}
-
-			encode_le_uint64_t(val, &((char *) mapped)[memrefs.elts[j].code_offset]);
-		}
-
+		WASMJIT_TRACE_BEGIN(trace_start);
+		relocate_code(module_inst, mapped, refs);
+		WASMJIT_TRACE_END(trace_start, "relocate", NULL, funcidx);
 
+		WASMJIT_TRACE_BEGIN(trace_start);
 		if (!wasmjit_mark_code_segment_executable(mapped, code_size)) {
 			goto error;
 		}
+		WASMJIT_TRACE_END(trace_start, "protect_code", NULL, funcidx);
 
 		funcinst->compiled_code = mapped;
 		funcinst->compiled_code_size = code_size;
 		mapped = NULL;
 
 		/* also need an invoker */
+		WASMJIT_TRACE_BEGIN(trace_start);
 		{
-			size_t invoker_size;
+			size_t invoker_size, offset;
+			uintptr_t target;
 
 			if (unmapped)
 				free(unmapped);
 
 			assert(mapped == NULL);
-			unmapped = wasmjit_compile_invoker(&funcinst->type,
-							   funcinst->compiled_code,
-							   &invoker_size,
-							   global_compile_flags);
+			unmapped = wasmjit_compile_invoker_offset(&funcinst->type,
+								  &offset,
+								  &invoker_size,
+								  global_compile_flags);
 			if (!unmapped)
 				goto error;
 
+			/* collectable code is looked up through the funcinst */
+			target = (global_compile_flags & WASMJIT_COMPILE_FLAG_CODE_GC)
+				? (uintptr_t) funcinst
+				: (uintptr_t) funcinst->compiled_code;
+			encode_le_uint64_t(target, &((char *) unmapped)[offset]);
+
 			mapped = wasmjit_map_code_segment(code_size);
 			if (!mapped)
 				goto error;
@@ -687,8 +1625,30 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 			funcinst->invoker_size = invoker_size;
 			mapped = NULL;
 		}
+		WASMJIT_TRACE_END(trace_start, "invoker", NULL, funcidx);
 	}
 
+	if (share) {
+		struct CompiledModule *image = fill.funcs ? &fill : compiled;
+
+		WASMJIT_TRACE_BEGIN(trace_start);
+		if (!image->shared_code &&
+		    !build_shared_code(image, module_inst, global_compile_flags))
+			goto error;
+		if (!map_shared_code(image, module_inst))
+			goto error;
+		WASMJIT_TRACE_END(trace_start, "shared_code", NULL,
+				  (long) image->n_funcs);
+	}
+
+	WASMJIT_TRACE_BEGIN(trace_start);
+	if (!compute_max_stack_usage(module, module_inst))
+		goto error;
+	WASMJIT_TRACE_END(trace_start, "stack_analysis", NULL,
+			  (long) module_inst->funcs.n_elts);
+
+	WASMJIT_TRACE_BEGIN(trace_start);
+
 	for (i = 0; i < module->data_section.n_datas; ++i) {
 		struct DataSectionData *data = &module->data_section.datas[i];
 		struct MemInst *meminst =
@@ -713,11 +1673,50 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 		       value.data.i32, data->buf,
 		       data->buf_size);
 	}
+	WASMJIT_TRACE_END(trace_start, "data_segments", NULL,
+			  (long) module->data_section.n_datas);
 
 	/* add start function */
 	if (module->start_section.has_start) {
+		WASMJIT_TRACE_BEGIN(trace_start);
 		wasmjit_invoke_function(module_inst->funcs.elts[module->start_section.funcidx],
 					NULL, NULL);
+		WASMJIT_TRACE_END(trace_start, "start", NULL,
+				  (long) module->start_section.funcidx);
+	}
+
+	if (fill.funcs) {
+		fill.flags = global_compile_flags;
+		fill.n_imported_funcs = module_inst->n_imported_funcs;
+		if (fill.n_imported_funcs) {
+			fill.direct_funcs = malloc(fill.n_imported_funcs);
+			if (!fill.direct_funcs)
+				goto error;
+			memcpy(fill.direct_funcs, module_types.direct_funcs,
+			       fill.n_imported_funcs);
+			fill.intrinsics = malloc(fill.n_imported_funcs *
+						 sizeof(fill.intrinsics[0]));
+			if (!fill.intrinsics)
+				goto error;
+			memcpy(fill.intrinsics, module_types.intrinsics,
+			       fill.n_imported_funcs *
+			       sizeof(fill.intrinsics[0]));
+		}
+		*compiled = fill;
+		memset(&fill, 0, sizeof(fill));
+	}
+
+	if (global_compile_flags & WASMJIT_COMPILE_FLAG_CODE_GC) {
+		/* our code embeds the code of directly called imports */
+		for (i = 0; i < module_inst->n_imported_funcs; ++i) {
+			if (module_types.direct_funcs[i])
+				module_inst->funcs.elts[i]->code_pinned = 1;
+		}
+
+		if (!wasmjit_code_gc_register(module_inst, &module_types,
+					      &module->code_section,
+					      global_compile_flags))
+			goto error;
 	}
 
 	if (0) {
@@ -727,6 +1726,8 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 		module_inst = NULL;
 	}
 
+	wasmjit_free_compiled_module(&fill);
+
 	if (tmp_func)
 		free(tmp_func);
 	if (tmp_table) {
@@ -735,8 +1736,7 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 		free(tmp_table);
 	}
 	if (tmp_mem) {
-		if (tmp_mem->data)
-			free(tmp_mem->data);
+		wasmjit_unmap_memory(tmp_mem->data, tmp_mem->size);
 		free(tmp_mem);
 	}
 	if (tmp_global)
@@ -755,6 +1755,10 @@ struct ModuleInst *wasmjit_instantiate(const struct Module *module,
 		free(module_types.memorytypes);
 	if (module_types.globaltypes)
 		free(module_types.globaltypes);
+	if (module_types.direct_funcs)
+		free(module_types.direct_funcs);
+	if (module_types.intrinsics)
+		free(module_types.intrinsics);
 
 
 	return module_inst;
@@ -27,10 +27,72 @@
 
 #include <wasmjit/ast.h>
 #include <wasmjit/runtime.h>
+#include <wasmjit/compile.h>
 
-struct ModuleInst *wasmjit_instantiate(const struct Module *module,
+/*
+  compiler output for a module before relocation, kept by the caller
+  so later instantiations of the same module skip compilation
+*/
+struct CompiledModule {
+	size_t n_funcs;
+	struct CompiledFunction {
+		void *code;
+		size_t code_size;
+		size_t stack_usage;
+		struct MemoryReferences memrefs;
+		/* where the code and its invoker are in shared_code */
+		size_t code_offset;
+		size_t invoker_offset;
+		size_t invoker_size;
+	} *funcs;
+	/* what the code was compiled against */
+	unsigned flags;
+	size_t n_imported_funcs;
+	char *direct_funcs;
+	const struct WasmJITIntrinsic **intrinsics;
+	/*
+	  all functions and invokers, their references loaded from a table
+	  each instance maps after the code, see wasmjit_map_shared_code().
+	  once this is built the functions' code and memrefs are freed
+	*/
+	struct WasmJITSharedCode *shared_code;
+	/* what each 8 byte entry of that table refers to */
+	struct MemoryReferences shared_refs;
+};
+
+struct ModuleInst *wasmjit_instantiate(struct Module *module,
 				       size_t n_imports,
 				       const struct NamedModule *imports,
 				       char *why, size_t why_size);
+/*
+  same as wasmjit_instantiate() but reuses compiled if it was filled
+  by an earlier call with compatible imports, an empty compiled is
+  filled in. unless code may be collected, instances made from the
+  same compiled map the same read-only code
+*/
+struct ModuleInst *wasmjit_instantiate_compiled(struct Module *module,
+						size_t n_imports,
+						const struct NamedModule *imports,
+						struct CompiledModule *compiled,
+						char *why, size_t why_size);
+void wasmjit_free_compiled_module(struct CompiledModule *compiled);
+
+/*
+  compiles and maps the trampoline of a host function created with only
+  host_fptr set, does nothing if it already has one
+*/
+int wasmjit_bind_host_function(struct FuncInst *funcinst);
+
+/*
+  compiles body (a code section entry) for funcinst of module_inst again,
+  returns the relocated executable code or NULL
+*/
+void *wasmjit_recompile_function(struct ModuleInst *module_inst,
+				 const struct ModuleTypes *module_types,
+				 struct FuncInst *funcinst,
+				 const char *body,
+				 size_t body_size,
+				 size_t *out_size,
+				 unsigned flags);
 
 #endif
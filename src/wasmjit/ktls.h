@@ -29,13 +29,19 @@
 #error Only for kernel
 #endif
 
+#include <wasmjit/perf_counters.h>
+
 #include <linux/sched/task_stack.h>
 
+struct perf_event;
+
 struct KernelThreadLocal {
 	jmp_buf *jmp_buf;
 	void *stack_top;
 	struct pt_regs regs;
 	struct MemInst *mem_inst;
+	int perf_enabled;
+	struct perf_event *perf_events[WASMJIT_PERF_N_COUNTERS];
 };
 
 static inline char *ptrptr(void) {
@@ -31,6 +31,8 @@
 #include <stddef.h>
 #endif
 
+#include <wasmjit/perf_counters.h>
+
 #if defined(__linux__)
 #include <linux/ioctl.h>
 #elif defined(__APPLE__)
@@ -48,6 +50,8 @@ struct kwasmjit_instantiate_args {
 	uint32_t flags;
 };
 
+#define KWASMJIT_INSTANTIATE_FLAGS_SIDE_MODULE 1
+
 #define KWASMJIT_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_NO_TABLE 1
 
 struct kwasmjit_instantiate_emscripten_runtime_args {
@@ -57,6 +61,8 @@ struct kwasmjit_instantiate_emscripten_runtime_args {
 	uint32_t flags;
 };
 
+#define KWASMJIT_EMSCRIPTEN_INVOKE_MAIN_FLAGS_PERF_COUNTERS 1
+
 struct kwasmjit_emscripten_invoke_main_args {
 	uint32_t version;
 	const char *module_name;
@@ -72,9 +78,30 @@ struct kwasmjit_error_message_args {
 	size_t size;
 };
 
+struct kwasmjit_perf_stats_args {
+	uint32_t version;
+	const char *module_name;
+	struct WasmJITPerfExportStats *stats;
+	size_t n_stats;
+	size_t *n_total;
+};
+
+struct kwasmjit_emscripten_mount_args {
+	uint32_t version;
+	const char *file_name;
+};
+
+/*
+  mmap(MAP_SHARED) of the device maps the Emscripten linear memory,
+  the offset being the guest address of the window. only the process
+  that opened it, or one with CAP_SYS_ADMIN, may do so
+*/
+
 #define KWASMJIT_INSTANTIATE _IOW(KWASMJIT_MAGIC, 0, struct kwasmjit_instantiate_args)
 #define KWASMJIT_INSTANTIATE_EMSCRIPTEN_RUNTIME _IOW(KWASMJIT_MAGIC, 1, struct kwasmjit_instantiate_emscripten_runtime_args)
 #define KWASMJIT_EMSCRIPTEN_INVOKE_MAIN _IOW(KWASMJIT_MAGIC, 2, struct kwasmjit_emscripten_invoke_main_args)
 #define KWASMJIT_ERROR_MESSAGE _IOW(KWASMJIT_MAGIC, 3, struct kwasmjit_error_message_args)
+#define KWASMJIT_PERF_STATS _IOW(KWASMJIT_MAGIC, 4, struct kwasmjit_perf_stats_args)
+#define KWASMJIT_EMSCRIPTEN_MOUNT _IOW(KWASMJIT_MAGIC, 5, struct kwasmjit_emscripten_mount_args)
 
 #endif
@@ -29,7 +29,11 @@
 #include <wasmjit/sys.h>
 #include <wasmjit/ktls.h>
 #include <wasmjit/util.h>
+#include <wasmjit/reclaim.h>
+#include <wasmjit/emscripten_dylink.h>
+#include <wasmjit/code_gc.h>
 
+#include <linux/capability.h>
 #include <linux/sched/signal.h>
 #include <linux/sched/mm.h>
 #include <linux/uaccess.h>
@@ -47,6 +51,11 @@ MODULE_AUTHOR("Rian Hunter");
 MODULE_DESCRIPTION("Executes WASM files natively.");
 MODULE_VERSION("0.01");
 
+static unsigned int code_gc_idle_ms;
+module_param(code_gc_idle_ms, uint, 0444);
+MODULE_PARM_DESC(code_gc_idle_ms,
+		 "Unmap code of functions idle this long, 0 disables");
+
 static void set_current_stack(void)
 {
 	void *addr = end_of_stack(current);
@@ -100,6 +109,8 @@ static char *kvstrndup_user(const char __user *s, long n, gfp_t flags)
 
 struct kwasmjit_private {
 	struct WasmJITHigh high;
+	/* the opener, the only one trusted to map linear memory */
+	struct mm_struct *mm;
 };
 
 static int kwasmjit_instantiate(struct kwasmjit_private *self,
@@ -167,6 +178,26 @@ static int kwasmjit_instantiate_emscripten_runtime(struct kwasmjit_private *self
 	return retval;
 }
 
+static int kwasmjit_emscripten_mount(struct kwasmjit_private *self,
+				     struct kwasmjit_emscripten_mount_args *arg)
+{
+	int retval;
+	char *file_name;
+
+	file_name = kvstrndup_user(arg->file_name, 1024, GFP_KERNEL);
+	if (IS_ERR(file_name))
+		return PTR_ERR(file_name);
+
+	if (wasmjit_high_emscripten_mount(&self->high, file_name))
+		retval = -EINVAL;
+	else
+		retval = 0;
+
+	kvfree(file_name);
+
+	return retval;
+}
+
 static void wasmjit_set_ktls(struct KernelThreadLocal *ktls)
 {
 	memcpy(ptrptr(), &ktls, sizeof(ktls));
@@ -212,6 +243,9 @@ static void free_stack(void *ptr, size_t size)
 
 #define MAX_STACK (8 * 1024 * 1024)
 
+/* slack on top of the bound computed for the module */
+#define STACK_MARGIN (64 * 1024)
+
 struct InvokeMainArgs {
 	struct WasmJITHigh *high;
 	const char *module_name;
@@ -313,7 +347,7 @@ static int kwasmjit_emscripten_invoke_main(struct kwasmjit_private *self,
 
 	{
 		mm_segment_t old_fs = get_fs();
-		size_t real_size;
+		size_t real_size, stack_size, bound;
 		void *stack;
 		struct mm_struct *saved_mm;
 
@@ -333,7 +367,17 @@ static int kwasmjit_emscripten_invoke_main(struct kwasmjit_private *self,
 			}
 		}
 
-		stack = alloc_stack(MMAX(rlimit(RLIMIT_STACK), MAX_STACK), &real_size);
+		/*
+		  non-recursive programs get a stack sized from their
+		  call graph, vmalloc() areas are separated by guard pages
+		*/
+		stack_size = MMAX(rlimit(RLIMIT_STACK), MAX_STACK);
+		bound = wasmjit_high_emscripten_stack_usage(&self->high,
+							    module_name);
+		if (bound && bound <= stack_size - STACK_MARGIN)
+			stack_size = bound + STACK_MARGIN;
+
+		stack = alloc_stack(stack_size, &real_size);
 		if (stack) {
 #ifdef CONFIG_STACK_GROWSUP
 			wasmjit_set_stack_top(stack + real_size);
@@ -427,6 +471,64 @@ static int kwasmjit_error_message(struct kwasmjit_private *self,
 	return 0;
 }
 
+static int kwasmjit_perf_stats(struct kwasmjit_private *self,
+			      struct kwasmjit_perf_stats_args *arg)
+{
+	int retval;
+	char *module_name = NULL;
+	struct WasmJITPerfExportStats *stats = NULL;
+	size_t n_total, n_stats;
+
+	module_name = kvstrndup_user(arg->module_name, 1024, GFP_USER);
+	if (IS_ERR(module_name)) {
+		retval = PTR_ERR(module_name);
+		module_name = NULL;
+		goto error;
+	}
+
+	if (wasmjit_high_perf_stats(&self->high, module_name,
+				    NULL, 0, &n_total)) {
+		retval = -EINVAL;
+		goto error;
+	}
+
+	n_stats = MMIN(n_total, arg->n_stats);
+	if (n_stats) {
+		stats = kvzalloc(n_stats * sizeof(stats[0]), GFP_KERNEL);
+		if (!stats) {
+			retval = -ENOMEM;
+			goto error;
+		}
+
+		if (wasmjit_high_perf_stats(&self->high, module_name,
+					    stats, n_stats, &n_total)) {
+			retval = -EINVAL;
+			goto error;
+		}
+
+		if (copy_to_user(arg->stats, stats, n_stats * sizeof(stats[0]))) {
+			retval = -EFAULT;
+			goto error;
+		}
+	}
+
+	if (put_user(n_total, arg->n_total)) {
+		retval = -EFAULT;
+		goto error;
+	}
+
+	retval = 0;
+
+ error:
+	if (stats)
+		kvfree(stats);
+
+	if (module_name)
+		kvfree(module_name);
+
+	return retval;
+}
+
 static int kwasmjit_open(struct inode *inode, struct file *filp)
 {
 	/* allocate kwasmjit_private */
@@ -440,9 +542,50 @@ static int kwasmjit_open(struct inode *inode, struct file *filp)
 		return -EINVAL;
 	}
 
+	((struct kwasmjit_private *)filp->private_data)->mm = current->mm;
+	mmgrab(current->mm);
+
 	return 0;
 }
 
+/*
+  maps a window of the Emscripten linear memory, vm_pgoff being its
+  guest address in pages. the vma holds a reference to filp so the
+  instance outlives the mapping, and linear memory never grows or
+  moves, so the window stays valid until munmap()
+*/
+static int kwasmjit_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct kwasmjit_private *self = filp->private_data;
+	struct MemInst *meminst;
+	unsigned long size;
+
+	/* the fd may have been passed on to a less trusted process */
+	if (current->mm != self->mm && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	/* copy-on-write would cut the caller off from the guest */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	if (!self->high.emscripten_env_module)
+		return -ENODEV;
+
+	meminst = wasmjit_get_export(self->high.emscripten_env_module,
+				     "memory", IMPORT_DESC_TYPE_MEM).mem;
+	if (!meminst || !meminst->data)
+		return -ENODEV;
+
+	size = vma->vm_end - vma->vm_start;
+	if (vma->vm_pgoff > (meminst->size >> PAGE_SHIFT) ||
+	    size > meminst->size - (vma->vm_pgoff << PAGE_SHIFT))
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTCOPY;
+
+	return remap_vmalloc_range(vma, meminst->data, vma->vm_pgoff);
+}
+
 static void preemptible_kernel_fpu_begin(struct fpu *dest_fpu)
 {
 	preempt_disable();
@@ -558,6 +701,42 @@ static long kwasmjit_unlocked_ioctl(struct file *filp,
 		retval = kwasmjit_error_message(self, &arg);
 		break;
 	}
+	case KWASMJIT_PERF_STATS: {
+		struct kwasmjit_perf_stats_args arg;
+		uint32_t version;
+
+		get_user(version, (uint32_t *) parg);
+		if (version > 0) {
+			retval = -EINVAL;
+			goto error;
+		}
+
+		if (copy_from_user(&arg, parg, sizeof(arg))) {
+			retval = -EFAULT;
+			goto error;
+		}
+
+		retval = kwasmjit_perf_stats(self, &arg);
+		break;
+	}
+	case KWASMJIT_EMSCRIPTEN_MOUNT: {
+		struct kwasmjit_emscripten_mount_args arg;
+		uint32_t version;
+
+		get_user(version, (uint32_t *) parg);
+		if (version > 0) {
+			retval = -EINVAL;
+			goto error;
+		}
+
+		if (copy_from_user(&arg, parg, sizeof(arg))) {
+			retval = -EFAULT;
+			goto error;
+		}
+
+		retval = kwasmjit_emscripten_mount(self, &arg);
+		break;
+	}
 	default:
 		retval = -EINVAL;
 		break;
@@ -579,7 +758,9 @@ static int kwasmjit_release(struct inode *inode,
 			    struct file *filp)
 {
 	struct kwasmjit_private *self = filp->private_data;
-	wasmjit_high_close(&self->high);
+	/* unmapping and freeing everything is slow, don't block close() */
+	wasmjit_high_close_deferred(&self->high);
+	mmdrop(self->mm);
 	kvfree(self);
 	return 0;
 }
@@ -588,6 +769,7 @@ struct file_operations kwasmjit_ops = {
 	.owner = THIS_MODULE,
 	.open = kwasmjit_open,
 	.unlocked_ioctl = kwasmjit_unlocked_ioctl,
+	.mmap = kwasmjit_mmap,
 	.release = kwasmjit_release,
 };
 
@@ -616,6 +798,8 @@ static int __init kwasmjit_init(void)
 	if (!wasmjit_emscripten_linux_kernel_init())
 		goto error;
 
+	wasmjit_code_gc_configure(code_gc_idle_ms);
+
 	device_number = register_chrdev(0, DEVICE_NAME, &kwasmjit_ops);
 	if (device_number < 0) {
 		goto error;
@@ -648,6 +832,9 @@ static int __init kwasmjit_init(void)
 static void __exit kwasmjit_exit(void)
 {
 	kwasmjit_cleanup_module();
+	wasmjit_reclaim_drain();
+	wasmjit_emscripten_dylink_clear_cache();
+	wasmjit_code_gc_shutdown();
 	printk(KERN_DEBUG "kwasmjit unloaded.\n");
 }
 
@@ -0,0 +1,68 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM wasmjit
+
+#if !defined(__KWASMJIT__TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __KWASMJIT__TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(wasmjit_span,
+
+	TP_PROTO(const char *name, const char *detail, long arg,
+		 u64 start, u64 end),
+
+	TP_ARGS(name, detail, arg, start, end),
+
+	TP_STRUCT__entry(
+		__string(name, name)
+		__string(detail, detail)
+		__field(long, arg)
+		__field(u64, start)
+		__field(u64, duration)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+		__assign_str(detail, detail);
+		__entry->arg = arg;
+		__entry->start = start;
+		__entry->duration = end - start;
+	),
+
+	TP_printk("%s detail=%s arg=%ld start=%llu duration=%llu",
+		  __get_str(name), __get_str(detail), __entry->arg,
+		  __entry->start, __entry->duration)
+);
+
+#endif
+
+/* found through -I$(src)/src */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH wasmjit
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE kwasmjit_trace
+#include <trace/define_trace.h>
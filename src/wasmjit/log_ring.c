@@ -0,0 +1,597 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/log_ring.h>
+
+#include <wasmjit/util.h>
+
+#include <wasmjit/sys.h>
+
+#ifdef __KERNEL__
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+struct LogRingWorker {
+	struct mutex lock;
+	struct delayed_work work;
+};
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+struct LogRingWorker {
+	/* held while draining */
+	pthread_mutex_t lock;
+	pthread_mutex_t wake_lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int pending, urgent, stop;
+};
+
+#endif
+
+#define LOG_RING_MAX_FDS 8
+/* how long a burst of records may sit in the ring before it's written */
+#define LOG_RING_INTERVAL_MS 10
+#define LOG_RING_MAX_SPANS 32
+
+struct LogRingRecord {
+	uint32_t slot;
+	uint32_t len;
+};
+
+/* records are padded so headers never wrap */
+#define LOG_RING_RECORD_SIZE(len) \
+	(sizeof(struct LogRingRecord) + (((size_t) (len) + 7) & ~(size_t) 7))
+
+struct LogRingFd {
+	int fd;
+	void *file;
+};
+
+struct LogRingSpan {
+	const char *base;
+	size_t len;
+};
+
+struct WasmJITLogRing {
+	char *data;
+	size_t size;
+	/* free running, head is only stored by the producer, tail by drains */
+	size_t head;
+	size_t tail;
+	size_t n_fds;
+	struct LogRingFd fds[LOG_RING_MAX_FDS];
+	struct LogRingWorker worker;
+	/* on the list of live rings */
+	struct WasmJITLogRing *next;
+};
+
+static struct WasmJITLogRing *rings;
+
+static int log_ring_start(struct WasmJITLogRing *ring);
+static void log_ring_stop(struct WasmJITLogRing *ring);
+static void log_ring_kick(struct WasmJITLogRing *ring, int urgent);
+static void log_ring_lock(struct WasmJITLogRing *ring);
+static void log_ring_unlock(struct WasmJITLogRing *ring);
+static int log_ring_open_fd(struct LogRingFd *lfd, int fd);
+static void log_ring_close_fd(struct LogRingFd *lfd);
+static void log_ring_write(struct LogRingFd *lfd,
+			   struct LogRingSpan *spans, size_t n_spans);
+static void rings_lock(void);
+static void rings_unlock(void);
+
+struct WasmJITLogRing *wasmjit_log_ring_create(size_t size)
+{
+	struct WasmJITLogRing *ring;
+	size_t rsize = 64;
+
+	while (rsize < size) {
+		if (rsize > SIZE_MAX / 2)
+			return NULL;
+		rsize <<= 1;
+	}
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		goto error;
+
+	ring->data = malloc(rsize);
+	if (!ring->data)
+		goto error;
+	ring->size = rsize;
+
+	if (!log_ring_start(ring))
+		goto error;
+
+	rings_lock();
+	ring->next = rings;
+	rings = ring;
+	rings_unlock();
+
+	return ring;
+
+ error:
+	if (ring) {
+		if (ring->data)
+			free(ring->data);
+		free(ring);
+	}
+	return NULL;
+}
+
+/* must be called with the ring locked */
+static void log_ring_drain(struct WasmJITLogRing *ring)
+{
+	size_t mask = ring->size - 1;
+
+	for (;;) {
+		struct LogRingSpan spans[LOG_RING_MAX_SPANS];
+		size_t head, tail, n_spans = 0;
+		uint32_t slot = 0;
+
+		/* pairs with the store of head in append */
+		head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+		tail = ring->tail;
+		if (head == tail)
+			break;
+
+		/* consecutive records for the same fd go out in one write */
+		while (tail != head && n_spans + 2 <= LOG_RING_MAX_SPANS) {
+			struct LogRingRecord rec;
+			size_t off, first;
+
+			memcpy(&rec, ring->data + (tail & mask), sizeof(rec));
+			if (n_spans && rec.slot != slot)
+				break;
+			slot = rec.slot;
+
+			off = (tail + sizeof(rec)) & mask;
+			first = MMIN(rec.len, ring->size - off);
+			if (first) {
+				spans[n_spans].base = ring->data + off;
+				spans[n_spans].len = first;
+				n_spans++;
+			}
+			if (rec.len > first) {
+				spans[n_spans].base = ring->data;
+				spans[n_spans].len = rec.len - first;
+				n_spans++;
+			}
+
+			tail += LOG_RING_RECORD_SIZE(rec.len);
+		}
+
+		if (n_spans)
+			log_ring_write(&ring->fds[slot], spans, n_spans);
+
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+	}
+}
+
+void wasmjit_log_ring_flush(struct WasmJITLogRing *ring)
+{
+	log_ring_lock(ring);
+	log_ring_drain(ring);
+	log_ring_unlock(ring);
+}
+
+static int find_slot(struct WasmJITLogRing *ring, int fd, uint32_t *slot)
+{
+	size_t i, free_slot = ring->n_fds;
+
+	for (i = 0; i < ring->n_fds; ++i) {
+		if (ring->fds[i].fd == fd) {
+			*slot = i;
+			return 1;
+		}
+		if (ring->fds[i].fd < 0 && free_slot == ring->n_fds)
+			free_slot = i;
+	}
+
+	if (free_slot == LOG_RING_MAX_FDS ||
+	    !log_ring_open_fd(&ring->fds[free_slot], fd))
+		return 0;
+
+	if (free_slot == ring->n_fds)
+		ring->n_fds++;
+
+	*slot = free_slot;
+	return 1;
+}
+
+int wasmjit_log_ring_append(struct WasmJITLogRing *ring, int fd,
+			    const void *buf, size_t len)
+{
+	struct LogRingRecord rec;
+	size_t head, tail, off, first, need;
+	size_t mask = ring->size - 1;
+
+	if (len > ring->size / 4 || !find_slot(ring, fd, &rec.slot))
+		return -1;
+	rec.len = len;
+
+	need = LOG_RING_RECORD_SIZE(len);
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail + need > ring->size)
+		wasmjit_log_ring_flush(ring);
+
+	off = head & mask;
+	memcpy(ring->data + off, &rec, sizeof(rec));
+	off = (off + sizeof(rec)) & mask;
+	first = MMIN(len, ring->size - off);
+	memcpy(ring->data + off, buf, first);
+	memcpy(ring->data, (const char *) buf + first, len - first);
+
+	__atomic_store_n(&ring->head, head + need, __ATOMIC_SEQ_CST);
+
+	/* a drain that found the ring empty won't look again on its own */
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+	if (tail == head)
+		log_ring_kick(ring, 0);
+	else if (head - tail <= ring->size / 2 &&
+		 head + need - tail > ring->size / 2)
+		log_ring_kick(ring, 1);
+
+	return 0;
+}
+
+void wasmjit_log_ring_sync_fd(struct WasmJITLogRing *ring, int fd, int forget)
+{
+	size_t i;
+
+	for (i = 0; i < ring->n_fds; ++i) {
+		if (ring->fds[i].fd == fd)
+			break;
+	}
+
+	if (i == ring->n_fds)
+		return;
+
+	log_ring_lock(ring);
+	log_ring_drain(ring);
+	if (forget) {
+		log_ring_close_fd(&ring->fds[i]);
+		ring->fds[i].fd = -1;
+	}
+	log_ring_unlock(ring);
+}
+
+void wasmjit_log_ring_free(struct WasmJITLogRing *ring)
+{
+	struct WasmJITLogRing **prev;
+	size_t i;
+
+	rings_lock();
+	for (prev = &rings; *prev != ring; prev = &(*prev)->next)
+		;
+	*prev = ring->next;
+	rings_unlock();
+
+	log_ring_stop(ring);
+
+	log_ring_drain(ring);
+
+	for (i = 0; i < ring->n_fds; ++i) {
+		if (ring->fds[i].fd >= 0)
+			log_ring_close_fd(&ring->fds[i]);
+	}
+
+	free(ring->data);
+	free(ring);
+}
+
+void wasmjit_log_ring_flush_all(void)
+{
+	struct WasmJITLogRing *ring;
+
+	rings_lock();
+	for (ring = rings; ring; ring = ring->next)
+		wasmjit_log_ring_flush(ring);
+	rings_unlock();
+}
+
+/* platform specific */
+
+#ifdef __KERNEL__
+
+static void log_ring_work_fn(struct work_struct *work)
+{
+	struct WasmJITLogRing *ring =
+		container_of(to_delayed_work(work), struct WasmJITLogRing,
+			     worker.work);
+
+	wasmjit_log_ring_flush(ring);
+}
+
+static int log_ring_start(struct WasmJITLogRing *ring)
+{
+	mutex_init(&ring->worker.lock);
+	INIT_DELAYED_WORK(&ring->worker.work, log_ring_work_fn);
+	return 1;
+}
+
+static void log_ring_stop(struct WasmJITLogRing *ring)
+{
+	cancel_delayed_work_sync(&ring->worker.work);
+}
+
+static void log_ring_kick(struct WasmJITLogRing *ring, int urgent)
+{
+	if (urgent)
+		mod_delayed_work(system_wq, &ring->worker.work, 0);
+	else
+		schedule_delayed_work(&ring->worker.work,
+				      msecs_to_jiffies(LOG_RING_INTERVAL_MS));
+}
+
+static void log_ring_lock(struct WasmJITLogRing *ring)
+{
+	mutex_lock(&ring->worker.lock);
+}
+
+static void log_ring_unlock(struct WasmJITLogRing *ring)
+{
+	mutex_unlock(&ring->worker.lock);
+}
+
+static DEFINE_MUTEX(rings_mutex);
+
+static void rings_lock(void)
+{
+	mutex_lock(&rings_mutex);
+}
+
+static void rings_unlock(void)
+{
+	mutex_unlock(&rings_mutex);
+}
+
+/* the worker has no fd table, so it keeps the file itself */
+static int log_ring_open_fd(struct LogRingFd *lfd, int fd)
+{
+	struct file *file;
+
+	file = fget(fd);
+	if (!file)
+		return 0;
+
+	if (!(file->f_mode & FMODE_WRITE)) {
+		fput(file);
+		return 0;
+	}
+
+	lfd->fd = fd;
+	lfd->file = file;
+	return 1;
+}
+
+static void log_ring_close_fd(struct LogRingFd *lfd)
+{
+	fput(lfd->file);
+}
+
+static void log_ring_write(struct LogRingFd *lfd,
+			   struct LogRingSpan *spans, size_t n_spans)
+{
+	struct file *file = lfd->file;
+	loff_t pos = file->f_pos;
+	size_t i;
+
+	for (i = 0; i < n_spans; ++i) {
+		const char *base = spans[i].base;
+		size_t len = spans[i].len;
+
+		while (len) {
+			ssize_t ret;
+
+			ret = kernel_write(file, base, len, &pos);
+			if (ret <= 0)
+				goto out;
+
+			base += ret;
+			len -= ret;
+		}
+	}
+
+ out:
+	file->f_pos = pos;
+}
+
+#else
+
+static void *log_ring_worker(void *arg)
+{
+	struct WasmJITLogRing *ring = arg;
+	struct LogRingWorker *worker = &ring->worker;
+
+	pthread_mutex_lock(&worker->wake_lock);
+	while (!worker->stop) {
+		if (!worker->pending) {
+			pthread_cond_wait(&worker->cond, &worker->wake_lock);
+			continue;
+		}
+
+		/* let the rest of the burst accumulate */
+		if (!worker->urgent) {
+			struct timespec deadline;
+
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += LOG_RING_INTERVAL_MS * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec += 1;
+				deadline.tv_nsec -= 1000000000L;
+			}
+
+			while (!worker->urgent && !worker->stop &&
+			       pthread_cond_timedwait(&worker->cond,
+						      &worker->wake_lock,
+						      &deadline) != ETIMEDOUT)
+				;
+		}
+
+		worker->pending = 0;
+		worker->urgent = 0;
+		pthread_mutex_unlock(&worker->wake_lock);
+
+		wasmjit_log_ring_flush(ring);
+
+		pthread_mutex_lock(&worker->wake_lock);
+	}
+	pthread_mutex_unlock(&worker->wake_lock);
+
+	return NULL;
+}
+
+static int log_ring_start(struct WasmJITLogRing *ring)
+{
+	struct LogRingWorker *worker = &ring->worker;
+
+	pthread_mutex_init(&worker->lock, NULL);
+	pthread_mutex_init(&worker->wake_lock, NULL);
+	pthread_cond_init(&worker->cond, NULL);
+
+	if (pthread_create(&worker->thread, NULL, &log_ring_worker, ring)) {
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->wake_lock);
+		pthread_mutex_destroy(&worker->lock);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void log_ring_stop(struct WasmJITLogRing *ring)
+{
+	struct LogRingWorker *worker = &ring->worker;
+
+	pthread_mutex_lock(&worker->wake_lock);
+	worker->stop = 1;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->wake_lock);
+
+	pthread_join(worker->thread, NULL);
+
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->wake_lock);
+	pthread_mutex_destroy(&worker->lock);
+}
+
+static void log_ring_kick(struct WasmJITLogRing *ring, int urgent)
+{
+	struct LogRingWorker *worker = &ring->worker;
+
+	pthread_mutex_lock(&worker->wake_lock);
+	worker->pending = 1;
+	if (urgent)
+		worker->urgent = 1;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->wake_lock);
+}
+
+static void log_ring_lock(struct WasmJITLogRing *ring)
+{
+	pthread_mutex_lock(&ring->worker.lock);
+}
+
+static void log_ring_unlock(struct WasmJITLogRing *ring)
+{
+	pthread_mutex_unlock(&ring->worker.lock);
+}
+
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void rings_lock(void)
+{
+	pthread_mutex_lock(&rings_mutex);
+}
+
+static void rings_unlock(void)
+{
+	pthread_mutex_unlock(&rings_mutex);
+}
+
+static int log_ring_open_fd(struct LogRingFd *lfd, int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || (flags & O_ACCMODE) == O_RDONLY)
+		return 0;
+
+	lfd->fd = fd;
+	lfd->file = NULL;
+	return 1;
+}
+
+static void log_ring_close_fd(struct LogRingFd *lfd)
+{
+	(void)lfd;
+}
+
+static void log_ring_write(struct LogRingFd *lfd,
+			   struct LogRingSpan *spans, size_t n_spans)
+{
+	struct iovec iov[LOG_RING_MAX_SPANS];
+	size_t i;
+
+	for (i = 0; i < n_spans; ++i) {
+		iov[i].iov_base = (void *) spans[i].base;
+		iov[i].iov_len = spans[i].len;
+	}
+
+	i = 0;
+	while (i < n_spans) {
+		ssize_t ret;
+
+		ret = writev(lfd->fd, &iov[i], n_spans - i);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			/* nobody to report to, the records are dropped */
+			break;
+		}
+
+		while (i < n_spans && (size_t) ret >= iov[i].iov_len) {
+			ret -= iov[i].iov_len;
+			i++;
+		}
+		if (i < n_spans) {
+			iov[i].iov_base = (char *) iov[i].iov_base + ret;
+			iov[i].iov_len -= ret;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,63 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__LOG_RING_H__
+#define __WASMJIT__LOG_RING_H__
+
+#include <wasmjit/sys.h>
+
+/*
+  single-producer ring of (fd, bytes) records. the producer only copies
+  into the ring, a worker writes records out to their fds in batches.
+  all calls but wasmjit_log_ring_create() must come from the producer
+*/
+struct WasmJITLogRing;
+
+/* size is rounded up to a power of two, NULL on failure */
+struct WasmJITLogRing *wasmjit_log_ring_create(size_t size);
+
+/*
+  queues len bytes for fd, returns 0 on success or -1 when the caller
+  has to write them itself (too large, fd not writable, out of fd slots)
+*/
+int wasmjit_log_ring_append(struct WasmJITLogRing *ring, int fd,
+			    const void *buf, size_t len);
+
+/* writes out everything queued so far */
+void wasmjit_log_ring_flush(struct WasmJITLogRing *ring);
+
+/*
+  call before fd is written to or closed directly, so queued records
+  aren't reordered or sent to whatever fd is reused for. if forget is
+  set the ring drops its reference to fd
+*/
+void wasmjit_log_ring_sync_fd(struct WasmJITLogRing *ring, int fd, int forget);
+
+/* flushes, stops the worker and frees the ring */
+void wasmjit_log_ring_free(struct WasmJITLogRing *ring);
+
+/* writes out every ring, before an abort prints to stderr itself */
+void wasmjit_log_ring_flush_all(void);
+
+#endif
@@ -31,8 +31,14 @@
 #include <wasmjit/emscripten_runtime.h>
 #include <wasmjit/dynamic_emscripten_runtime.h>
 #include <wasmjit/elf_relocatable.h>
+#include <wasmjit/c_source.h>
 #include <wasmjit/util.h>
 #include <wasmjit/high_level.h>
+#include <wasmjit/trace.h>
+#include <wasmjit/emscripten_heatmap.h>
+#include <wasmjit/emscripten_checkpoint.h>
+#include <wasmjit/code_gc.h>
+#include <wasmjit/emscripten_memfs.h>
 
 #include <assert.h>
 #include <inttypes.h>
@@ -43,9 +49,11 @@
 #include <string.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <regex.h>
 #include <unistd.h>
 
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #ifdef __linux__
@@ -137,6 +145,7 @@ static int parse_module(const char *filename, struct Module *module)
 	int ret, result;
 	size_t size;
 	struct ParseState pstate;
+	uint64_t trace_start;
 
 	buf = wasmjit_load_file(filename, &size);
 	if (!buf)
@@ -146,9 +155,11 @@ static int parse_module(const char *filename, struct Module *module)
 	if (!ret)
 		goto error;
 
+	WASMJIT_TRACE_BEGIN(trace_start);
 	ret = read_module(&pstate, module, NULL, 0);
 	if (!ret)
 		goto error;
+	WASMJIT_TRACE_END(trace_start, "read_module", filename, (long) size);
 
 	result = 0;
 
@@ -188,6 +199,11 @@ static int dump_wasm_module(const char *filename)
 		struct CodeSectionCode *code =
 			&module.code_section.codes[i];
 
+		if (!read_code(code)) {
+			fprintf(stderr, "Error reading code #%" PRIu32 "\n", i);
+			goto error;
+		}
+
 		type =
 			&module.type_section.types[module.function_section.
 						   typeidxs[i]];
@@ -249,23 +265,119 @@ static int lpow(long base, long exp, long *out)
 	return 0;
 }
 
-static int get_static_bump(const char *filename, uint32_t *static_bump)
+/*
+  Emscripten runtime parameters are looked for in a custom section
+  embedded in the module, then in a "<name>.wasmjit" sidecar holding
+  the same section, and finally by scanning the generated "<name>.js".
+  Both the section and the sidecar can be created at build time with
+  `wasmjit -m`.
+*/
+
+#define EMSCRIPTEN_METADATA_SECTION "wasmjit_emscripten"
+#define EMSCRIPTEN_METADATA_VERSION 0
+
+static char *sibling_path(const char *filename, const char *ext)
+{
+	char *path;
+	size_t fnlen;
+
+	fnlen = strlen(filename);
+	if (fnlen < 4)
+		return NULL;
+
+	path = malloc(fnlen - 4 + strlen(ext) + 1);
+	if (!path)
+		return NULL;
+
+	memcpy(path, filename, fnlen - 4);
+	strcpy(&path[fnlen - 4], ext);
+
+	return path;
+}
+
+static int get_static_bump_from_module(const struct Module *module,
+				       uint32_t *static_bump)
+{
+	uint32_t i;
+
+	for (i = 0; i < module->custom_section.n_customs; ++i) {
+		struct CustomSectionCustom *custom =
+			&module->custom_section.customs[i];
+		struct ParseState pstate;
+		uint32_t version;
+
+		if (strcmp(custom->name, EMSCRIPTEN_METADATA_SECTION))
+			continue;
+
+		if (!init_pstate(&pstate, custom->payload, custom->payload_size))
+			return -1;
+
+		if (!read_uleb_uint32_t(&pstate, &version) ||
+		    version != EMSCRIPTEN_METADATA_VERSION)
+			return -1;
+
+		if (!read_uleb_uint32_t(&pstate, static_bump))
+			return -1;
+
+		return 0;
+	}
+
+	return -1;
+}
+
+static int get_static_bump_from_sidecar(const char *filename,
+					uint32_t *static_bump)
+{
+	char *path = NULL, *buf = NULL;
+	size_t size;
+	struct ParseState pstate;
+	struct Module sidecar;
+	int ret;
+
+	wasmjit_init_module(&sidecar);
+
+	path = sibling_path(filename, "wasmjit");
+	if (!path)
+		goto error;
+
+	buf = wasmjit_load_file(path, &size);
+	if (!buf)
+		goto error;
+
+	if (!init_pstate(&pstate, buf, size))
+		goto error;
+
+	if (!read_module_sections(&pstate, &sidecar, NULL, 0))
+		goto error;
+
+	ret = get_static_bump_from_module(&sidecar, static_bump);
+
+	if (0) {
+	error:
+		ret = -1;
+	}
+
+	wasmjit_free_module(&sidecar);
+	if (buf)
+		wasmjit_unload_file(buf, size);
+	free(path);
+
+	return ret;
+}
+
+static int get_static_bump_from_js(const char *filename, uint32_t *static_bump)
 {
 	char *js_path = NULL, *filebuf = NULL, *filebuf2 = NULL;
-	size_t fnlen, filesize;
+	size_t filesize;
 	regex_t re;
 	regmatch_t pmatch[5];
 	int ret, compiled = 0;
 	long result;
 
-	fnlen = strlen(filename);
-	if (fnlen < 4)
+	js_path = sibling_path(filename, "js");
+	if (!js_path)
 		goto error;
 
-	js_path = malloc(fnlen + 1);
-	memcpy(js_path, filename, fnlen - 4);
-	strcpy(&js_path[fnlen - 4], "js");
-
 	filebuf = wasmjit_load_file(js_path, &filesize);
 	if (!filebuf)
 		goto error;
@@ -331,23 +443,17 @@ static int get_static_bump(const char *filename, uint32_t *static_bump)
 }
 
 static int get_emscripten_runtime_parameters(const char *filename,
+					     const struct Module *module,
 					     uint32_t *static_bump,
 					     int *has_table,
 					     size_t *tablemin, size_t *tablemax)
 {
 	size_t i;
-	int ret;
-	struct Module module;
-
-	wasmjit_init_module(&module);
-
-	if (parse_module(filename, &module))
-		goto error;
 
 	/* find correct tablemin and tablemax */
-	for (i = 0; i < module.import_section.n_imports; ++i) {
+	for (i = 0; i < module->import_section.n_imports; ++i) {
 		struct ImportSectionImport *import;
-		import = &module.import_section.imports[i];
+		import = &module->import_section.imports[i];
 		if (strcmp(import->module, "env") ||
 		    strcmp(import->name, "table") ||
 		    import->desc_type != IMPORT_DESC_TYPE_TABLE)
@@ -358,28 +464,128 @@ static int get_emscripten_runtime_parameters(const char *filename,
 		break;
 	}
 
-	*has_table = i != module.import_section.n_imports;
+	*has_table = i != module->import_section.n_imports;
 
-	ret = get_static_bump(filename, static_bump);
-	if (ret) {
-		fprintf(stderr, "Couldn't get static bump!\n");
+	if (!get_static_bump_from_module(module, static_bump) ||
+	    !get_static_bump_from_sidecar(filename, static_bump) ||
+	    !get_static_bump_from_js(filename, static_bump))
+		return 0;
+
+	fprintf(stderr, "Couldn't get static bump!\n");
+	return -1;
+}
+
+static int write_emscripten_metadata(uint32_t static_bump)
+{
+	struct SizedBuffer payloadv = { 0, NULL }, sectionv = { 0, NULL };
+	struct SizedBuffer *payload = &payloadv, *section = &sectionv;
+	char byt;
+	int ret;
+
+#define OUT_ULEB(output, val)					\
+	do {							\
+		uint32_t __v = (val);				\
+		do {						\
+			byt = __v & 0x7f;			\
+			__v >>= 7;				\
+			if (__v)				\
+				byt |= 0x80;			\
+			if (!output_buf((output), &byt, 1))	\
+				goto error;			\
+		} while (__v);					\
+	} while (0)
+
+	OUT_ULEB(payload, strlen(EMSCRIPTEN_METADATA_SECTION));
+	if (!output_buf(payload, EMSCRIPTEN_METADATA_SECTION,
+			strlen(EMSCRIPTEN_METADATA_SECTION)))
 		goto error;
-	}
+	OUT_ULEB(payload, EMSCRIPTEN_METADATA_VERSION);
+	OUT_ULEB(payload, static_bump);
+
+	/* custom section id */
+	byt = 0;
+	if (!output_buf(section, &byt, 1))
+		goto error;
+	OUT_ULEB(section, payload->n_elts);
+	if (!output_buf(section, payload->elts, payload->n_elts))
+		goto error;
+
+#undef OUT_ULEB
+
+	if (fwrite(section->elts, 1, section->n_elts, stdout) != section->n_elts)
+		goto error;
+
+	ret = 0;
 
 	if (0) {
 	error:
 		ret = -1;
 	}
 
-	wasmjit_free_module(&module);
+	free(payload->elts);
+	free(section->elts);
 
 	return ret;
 }
 
+#define HEATMAP_INTERVAL_MS 10
+
+static void print_perf_stats(struct WasmJITHigh *high)
+{
+	struct WasmJITPerfExportStats *stats;
+	size_t i, n_total;
+
+	if (wasmjit_high_perf_stats(high, "asm", NULL, 0, &n_total))
+		return;
+
+	stats = calloc(n_total, sizeof(stats[0]));
+	if (n_total && !stats)
+		return;
+
+	if (wasmjit_high_perf_stats(high, "asm", stats, n_total, &n_total))
+		goto error;
+
+	fprintf(stderr, "%-32s %12s", "export", "calls");
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i)
+		fprintf(stderr, " %14s", wasmjit_perf_counter_name(i));
+	fprintf(stderr, " %6s\n", "IPC");
+
+	for (i = 0; i < n_total; ++i) {
+		struct WasmJITPerfStats *s = &stats[i].stats;
+		unsigned j;
+
+		fprintf(stderr, "%-32s %12" PRIu64, stats[i].name, s->invocations);
+		for (j = 0; j < WASMJIT_PERF_N_COUNTERS; ++j) {
+			if (s->valid & (1U << j))
+				fprintf(stderr, " %14" PRIu64, s->counts[j]);
+			else
+				fprintf(stderr, " %14s", "-");
+		}
+
+		if ((s->valid & (1U << WASMJIT_PERF_COUNTER_CYCLES)) &&
+		    (s->valid & (1U << WASMJIT_PERF_COUNTER_INSTRUCTIONS)) &&
+		    s->counts[WASMJIT_PERF_COUNTER_CYCLES])
+			fprintf(stderr, " %6.2f\n",
+				(double) s->counts[WASMJIT_PERF_COUNTER_INSTRUCTIONS] /
+				s->counts[WASMJIT_PERF_COUNTER_CYCLES]);
+		else
+			fprintf(stderr, " %6s\n", "-");
+	}
+
+ error:
+	free(stats);
+}
+
 static int run_emscripten_file(const char *filename,
+			       struct Module *module,
 			       uint32_t static_bump,
 			       int has_table,
 			       size_t tablemin, size_t tablemax,
+			       int perf_stats, int shared_memory,
+			       const char *heatmap_path,
+			       const char *resume_path,
+			       const char *memfs_path,
+			       size_t n_side_modules, char **side_modules,
 			       int argc, char **argv, char **envp)
 {
 	struct WasmJITHigh high;
@@ -388,6 +594,7 @@ static int run_emscripten_file(const char *filename,
 	int high_init = 0;
 	const char *msg;
 	uint32_t flags = 0;
+	size_t i;
 
 	stack_top = get_stack_top();
 	if (!stack_top) {
@@ -404,6 +611,8 @@ static int run_emscripten_file(const char *filename,
 
 	if (!has_table)
 		flags |= WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_NO_TABLE;
+	if (shared_memory)
+		flags |= WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_SHARED_MEMORY;
 
 	if (wasmjit_high_instantiate_emscripten_runtime(&high,
 							static_bump,
@@ -412,19 +621,74 @@ static int run_emscripten_file(const char *filename,
 		goto error;
 	}
 
-	if (wasmjit_high_instantiate(&high, filename, "asm", 0)) {
+	if (memfs_path && wasmjit_high_emscripten_mount(&high, memfs_path)) {
+		msg = "failed to mount archive";
+		goto error;
+	}
+
+	if (wasmjit_high_instantiate_parsed(&high, filename, module, "asm", 0)) {
 		msg = "failed to instantiate module";
 		goto error;
 	}
 
-	ret = wasmjit_high_emscripten_invoke_main(&high, "asm",
-						  argc, argv, envp, 0);
+	/* the parsed module is no longer needed once instantiated */
+	wasmjit_free_module(module);
+	wasmjit_init_module(module);
+
+	for (i = 0; i < n_side_modules; ++i) {
+		if (wasmjit_high_instantiate(&high, side_modules[i],
+					     side_modules[i],
+					     WASMJIT_HIGH_INSTANTIATE_FLAGS_SIDE_MODULE)) {
+			msg = "failed to load side module";
+			goto error;
+		}
+	}
+
+	flags = 0;
+	if (perf_stats)
+		flags |= WASMJIT_HIGH_EMSCRIPTEN_INVOKE_MAIN_FLAGS_PERF_COUNTERS;
+
+	if (heatmap_path) {
+		struct WasmJITEmscriptenMemoryGlobals globals;
+		struct MemInst *meminst = NULL;
+
+		/* linear memory isn't ours to protect under the kernel module */
+		if (high.emscripten_env_module)
+			meminst = wasmjit_get_export(high.emscripten_env_module,
+						     "memory",
+						     IMPORT_DESC_TYPE_MEM).mem;
+
+		wasmjit_emscripten_derive_memory_globals(static_bump, &globals);
+
+		if (!meminst ||
+		    wasmjit_emscripten_heatmap_start(meminst, &globals,
+						     HEATMAP_INTERVAL_MS)) {
+			fprintf(stderr, "warning: memory heatmap not available\n");
+			heatmap_path = NULL;
+		}
+	}
+
+	if (resume_path)
+		ret = wasmjit_high_emscripten_resume(&high, "asm", resume_path,
+						     envp, flags);
+	else
+		ret = wasmjit_high_emscripten_invoke_main(&high, "asm",
+							  argc, argv, envp, flags);
+
+	if (heatmap_path && wasmjit_emscripten_heatmap_stop(heatmap_path))
+		fprintf(stderr, "warning: couldn't write heatmap: %s\n",
+			heatmap_path);
+
+	if (perf_stats)
+		print_perf_stats(&high);
 
 	if (WASMJIT_IS_TRAP_ERROR(ret)) {
 		fprintf(stderr, "TRAP: %s\n",
 			wasmjit_trap_reason_to_string(WASMJIT_DECODE_TRAP_ERROR(ret)));
 	} else if (ret < 0) {
-		msg = "failed to invoke main";
+		msg = resume_path
+			? "failed to resume from checkpoint"
+			: "failed to invoke main";
 		goto error;
 	}
 
@@ -448,21 +712,158 @@ static int run_emscripten_file(const char *filename,
 	return ret;
 }
 
+/* written beside archive_path and renamed over it, mounts keep the old file */
+static int pack_memfs(const char *archive_path,
+		      size_t n_specs, char *const *specs)
+{
+	int fd, ret;
+	char why[256];
+	char *tmp_path;
+
+	tmp_path = malloc(strlen(archive_path) + sizeof(".XXXXXX"));
+	if (!tmp_path) {
+		fprintf(stderr, "Couldn't create archive: %s\n", archive_path);
+		return -1;
+	}
+	sprintf(tmp_path, "%s.XXXXXX", archive_path);
+
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		fprintf(stderr, "Couldn't create archive: %s\n", archive_path);
+		free(tmp_path);
+		return -1;
+	}
+
+	ret = wasmjit_memfs_pack(fd, n_specs, specs, why, sizeof(why));
+	if (ret)
+		fprintf(stderr, "Couldn't pack archive: %s\n", why);
+
+	if ((fchmod(fd, 0644) || close(fd)) && !ret) {
+		fprintf(stderr, "Couldn't write archive: %s\n", archive_path);
+		ret = -1;
+	}
+
+	if (!ret && rename(tmp_path, archive_path)) {
+		fprintf(stderr, "Couldn't replace archive: %s\n", archive_path);
+		ret = -1;
+	}
+
+	if (ret)
+		unlink(tmp_path);
+	free(tmp_path);
+
+	return ret;
+}
+
+static void print_c_string(const char *str)
+{
+	putchar('"');
+	for (; *str; ++str) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20 || c >= 0x7f)
+			printf("\\%03o", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
 extern char **environ;
 int main(int argc, char *argv[])
 {
 	int ret;
 	char *filename;
 	int dump_module, create_relocatable, create_relocatable_helper, opt;
-	int has_table;
+	int create_metadata, create_c_source, direct_host_calls;
+	int has_table, perf_stats, shared_memory;
+	const char *trace_path = NULL, *heatmap_path = NULL;
+	const char *resume_path = NULL;
+	const char *memfs_path = NULL, *pack_path = NULL;
 	size_t tablemin = 0, tablemax = 0;
 	uint32_t static_bump = 0;
+	size_t zerocopy_threshold = 0;
+	size_t n_side_modules = 0;
+	char **side_modules = NULL;
+	struct Module module;
 
 	dump_module =  0;
 	create_relocatable =  0;
 	create_relocatable_helper =  0;
-	while ((opt = getopt(argc, argv, "dop")) != -1) {
+	create_metadata = 0;
+	create_c_source = 0;
+	direct_host_calls = 0;
+	perf_stats = 0;
+	shared_memory = 0;
+	while ((opt = getopt(argc, argv, "dopmclsMC:F:G:H:L:P:R:t:z:")) != -1) {
 		switch (opt) {
+		case 'C':
+			wasmjit_emscripten_set_checkpoint_path(optarg);
+			break;
+		case 'L': {
+			char **new_side_modules;
+
+			new_side_modules = realloc(side_modules,
+						   (n_side_modules + 1) *
+						   sizeof(side_modules[0]));
+			if (!new_side_modules) {
+				free(side_modules);
+				return -1;
+			}
+			side_modules = new_side_modules;
+			side_modules[n_side_modules++] = optarg;
+			break;
+		}
+		case 'R':
+			resume_path = optarg;
+			break;
+		case 'F':
+			memfs_path = optarg;
+			break;
+		case 'P':
+			pack_path = optarg;
+			break;
+		case 'H':
+			heatmap_path = optarg;
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		case 's':
+			perf_stats = 1;
+			break;
+		case 'M':
+			shared_memory = 1;
+			break;
+		case 'G': {
+			char *end;
+			unsigned long idle_ms = strtoul(optarg, &end, 10);
+			if (!*optarg || *end || idle_ms > UINT_MAX / 2) {
+				fprintf(stderr, "Bad code GC idle time: %s\n", optarg);
+				return -1;
+			}
+			wasmjit_code_gc_configure(idle_ms);
+			break;
+		}
+		case 'z': {
+			char *end;
+			zerocopy_threshold = strtoul(optarg, &end, 10);
+			if (!*optarg || *end) {
+				fprintf(stderr, "Bad zerocopy threshold: %s\n", optarg);
+				return -1;
+			}
+			break;
+		}
+		case 'l':
+			direct_host_calls = 1;
+			break;
+		case 'c':
+			create_c_source = 1;
+			break;
+		case 'm':
+			create_metadata = 1;
+			break;
 		case 'o':
 			create_relocatable = 1;
 			break;
@@ -477,6 +878,14 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (pack_path) {
+		if (optind >= argc) {
+			fprintf(stderr, "Need files to pack\n");
+			return -1;
+		}
+		return pack_memfs(pack_path, argc - optind, &argv[optind]);
+	}
+
 	if (optind >= argc) {
 		fprintf(stderr, "Need an input file\n");
 		return -1;
@@ -487,7 +896,7 @@ int main(int argc, char *argv[])
 	if (dump_module)
 		return dump_wasm_module(filename);
 
-	if (create_relocatable) {
+	if (create_relocatable || create_c_source) {
 		struct Module module;
 
 		wasmjit_init_module(&module);
@@ -495,7 +904,24 @@ int main(int argc, char *argv[])
 		if (!parse_module(filename, &module)) {
 			void *a_out;
 			size_t size;
-			a_out = wasmjit_output_elf_relocatable("asm", &module, &size);
+			if (!create_relocatable) {
+				uint32_t flags = 0;
+				if (direct_host_calls)
+					flags |= WASMJIT_OUTPUT_C_SOURCE_FLAGS_DIRECT_HOST_CALLS;
+				a_out = wasmjit_output_c_source("asm", &module,
+								flags, &size);
+			} else {
+				uint32_t flags = 0;
+				if (create_c_source)
+					flags |= WASMJIT_OUTPUT_ELF_RELOCATABLE_FLAGS_EXTERNAL_CODE;
+				a_out = wasmjit_output_elf_relocatable("asm", &module,
+								       flags, &size);
+			}
+			if (!a_out) {
+				fprintf(stderr, "Error generating output\n");
+				wasmjit_free_module(&module);
+				return -1;
+			}
 			ret = write(1, a_out, size);
 			free(a_out);
 			ret = ret >= 0 ? 0 : -1;
@@ -508,18 +934,57 @@ int main(int argc, char *argv[])
 		return ret;
 	}
 
-	ret = get_emscripten_runtime_parameters(filename, &static_bump, &has_table, &tablemin, &tablemax);
-	if (ret)
+	if (trace_path && wasmjit_trace_open(trace_path)) {
+		fprintf(stderr, "Couldn't open trace file: %s\n", trace_path);
 		return -1;
+	}
+
+	wasmjit_init_module(&module);
+
+	if (parse_module(filename, &module)) {
+		ret = -1;
+		goto error;
+	}
+
+	ret = get_emscripten_runtime_parameters(filename, &module,
+						&static_bump, &has_table,
+						&tablemin, &tablemax);
+	if (ret)
+		goto error;
 
-	if (create_relocatable_helper) {
+	if (create_metadata) {
+		ret = write_emscripten_metadata(static_bump);
+	} else if (create_relocatable_helper) {
 		struct WasmJITEmscriptenMemoryGlobals globals;
 
 		wasmjit_emscripten_derive_memory_globals(static_bump, &globals);
 
+		printf("#include <wasmjit/emscripten_runtime.h>\n");
 		printf("#include <wasmjit/static_runtime.h>\n");
 		printf("#define CURRENT_MODULE env\n");
 
+		if (zerocopy_threshold) {
+			printf("__attribute__((constructor))\n"
+			       "static void init_zerocopy(void)\n"
+			       "{\n"
+			       "\twasmjit_emscripten_set_zerocopy_threshold(%zu);\n"
+			       "}\n",
+			       zerocopy_threshold);
+		}
+
+		if (memfs_path) {
+			printf("#include <stdlib.h>\n"
+			       "extern struct EmscriptenContext g_emscripten_ctx;\n"
+			       "__attribute__((constructor))\n"
+			       "static void init_memfs(void)\n"
+			       "{\n"
+			       "\tif (wasmjit_emscripten_mount_memfs(&g_emscripten_ctx, ");
+			print_c_string(memfs_path);
+			printf("))\n"
+			       "\t\tabort();\n"
+			       "}\n");
+		}
+
 		if (has_table) {
 			printf("DEFINE_WASM_TABLE(table, ELEMTYPE_ANYFUNC, %zu, %zu)\n",
 			       tablemin, tablemax);
@@ -536,10 +1001,24 @@ int main(int argc, char *argv[])
 		printf("DEFINE_WASM_GLOBAL(STACK_MAX, %" PRIu32 ", VALTYPE_I32, i32, 0)\n",
 		       globals.STACK_MAX);
 
-		return 0;
+		ret = 0;
+	} else {
+		wasmjit_emscripten_set_zerocopy_threshold(zerocopy_threshold);
+		ret = run_emscripten_file(filename, &module,
+					  static_bump, has_table, tablemin, tablemax,
+					  perf_stats, shared_memory,
+					  heatmap_path, resume_path, memfs_path,
+					  n_side_modules, side_modules,
+					  argc - optind, &argv[optind], environ);
 	}
 
-	return run_emscripten_file(filename,
-				   static_bump, has_table, tablemin, tablemax,
-				   argc - optind, &argv[optind], environ);
+ error:
+	wasmjit_free_module(&module);
+
+	if (side_modules)
+		free(side_modules);
+
+	wasmjit_trace_close();
+
+	return ret;
 }
@@ -24,9 +24,15 @@
 
 #include <wasmjit/parse.h>
 #include <wasmjit/util.h>
+#include <wasmjit/trace.h>
 
 #include <wasmjit/sys.h>
 
+#ifndef __KERNEL__
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #define BLOCK_TERMINAL 0x0B
 #define ELSE_TERMINAL 0x05
 #define WASM_MAGIC 0x6d736100
@@ -120,6 +126,13 @@ DEFINE_INT_READER(uint8_t);
 DEFINE_INT_READER(float);
 DEFINE_INT_READER(double);
 
+/* maximum number of bytes in a valid LEB128 encoding of type */
+#define LEB_MAX_BYTES(type) ((sizeof(type) * 8 + 6) / 7)
+
+/*
+  when the whole encoding is known to be in bounds we decode
+  straight from the input without going through read_uint8_t()
+*/
 #define DEFINE_ULEB_READER(type)					\
 	int read_uleb_##type(struct ParseState *pstate, type *data)	\
 	{								\
@@ -128,6 +141,22 @@ DEFINE_INT_READER(double);
 									\
 		*data = 0;						\
 		shift = 0;						\
+									\
+		if (pstate->amt_left >= LEB_MAX_BYTES(type)) {		\
+			const uint8_t *p = (const uint8_t *) pstate->input; \
+			const uint8_t *end = p + LEB_MAX_BYTES(type);	\
+			do {						\
+				byt = *p++;				\
+				*data |= ((type) (byt & 0x7f)) << shift; \
+				shift += 7;				\
+			} while ((byt & 0x80) && p < end);		\
+			if (byt & 0x80)					\
+				return 0;				\
+			pstate->amt_left -= p - (const uint8_t *) pstate->input; \
+			pstate->input = (const char *) p;		\
+			return 1;					\
+		}							\
+									\
 		while (1) {						\
 			int ret;					\
 			ret = read_uint8_t(pstate, &byt);		\
@@ -155,14 +184,29 @@ DEFINE_ULEB_READER(uint64_t);
 									\
 		*data = 0;						\
 		shift = 0;						\
-		while (1) {						\
-			int ret;					\
-			ret = read_uint8_t(pstate, &byt);		\
-			if (!ret) return ret;				\
-			*data |= ((type) (byt & 0x7f)) << shift;	\
-			shift += 7;					\
-			if (!(byt & 0x80)) {				\
-				break;					\
+									\
+		if (pstate->amt_left >= LEB_MAX_BYTES(type)) {		\
+			const uint8_t *p = (const uint8_t *) pstate->input; \
+			const uint8_t *end = p + LEB_MAX_BYTES(type);	\
+			do {						\
+				byt = *p++;				\
+				*data |= ((type) (byt & 0x7f)) << shift; \
+				shift += 7;				\
+			} while ((byt & 0x80) && p < end);		\
+			if (byt & 0x80)					\
+				return 0;				\
+			pstate->amt_left -= p - (const uint8_t *) pstate->input; \
+			pstate->input = (const char *) p;		\
+		} else {						\
+			while (1) {					\
+				int ret;				\
+				ret = read_uint8_t(pstate, &byt);	\
+				if (!ret) return ret;			\
+				*data |= ((type) (byt & 0x7f)) << shift; \
+				shift += 7;				\
+				if (!(byt & 0x80)) {			\
+					break;				\
+				}					\
 			}						\
 		}							\
 									\
@@ -1280,12 +1324,195 @@ int read_element_section(struct ParseState *pstate,
 	return 0;
 }
 
+int read_code(struct CodeSectionCode *code)
+{
+	int ret;
+	struct ParseState pstatev;
+	struct ParseState *pstate = &pstatev;
+
+	if (code->decoded)
+		return 1;
+
+	if (!init_pstate(pstate, code->body, code->size))
+		goto error;
+
+	ret = read_uleb_uint32_t(pstate, &code->n_locals);
+	if (!ret)
+		goto error;
+
+	if (code->n_locals) {
+		uint32_t j;
+
+		code->locals =
+		    calloc(code->n_locals,
+			   sizeof(struct CodeSectionCodeLocal));
+		if (!code->locals)
+			goto error;
+
+		for (j = 0; j < code->n_locals; ++j) {
+			struct CodeSectionCodeLocal
+			*code_local = &code->locals[j];
+
+			ret =
+			    read_uleb_uint32_t(pstate,
+					       &code_local->
+					       count);
+			if (!ret)
+				goto error;
+
+			ret =
+			    read_uint8_t(pstate,
+					 &code_local->valtype);
+			if (!ret)
+				goto error;
+		}
+	}
+
+	ret =
+	    read_instructions(pstate,
+			      &code->instructions,
+			      &code->n_instructions);
+	if (!ret)
+		goto error;
+
+	/* body must be exactly consumed */
+	if (pstate->amt_left)
+		goto error;
+
+	code->decoded = 1;
+
+	return 1;
+
+ error:
+	/* leave the body undecoded so it can be read again */
+	if (code->locals) {
+		free(code->locals);
+		code->locals = NULL;
+	}
+	code->n_locals = 0;
+	if (code->instructions) {
+		free_instructions(code->instructions, code->n_instructions);
+		code->instructions = NULL;
+	}
+	code->n_instructions = 0;
+	return 0;
+}
+
+#ifndef __KERNEL__
+
+/* below this it's not worth starting threads */
+#define PARALLEL_DECODE_MIN_SIZE (256 * 1024)
+#define PARALLEL_DECODE_MAX_THREADS 16
+#define PARALLEL_DECODE_BATCH 16
+
+struct ReadCodesState {
+	struct CodeSection *code_section;
+	uint32_t next;
+	int failed;
+};
+
+static void *read_codes_worker(void *arg)
+{
+	struct ReadCodesState *state = arg;
+	uint32_t n_codes = state->code_section->n_codes;
+
+	while (!__atomic_load_n(&state->failed, __ATOMIC_RELAXED)) {
+		uint32_t i, start;
+
+		start = __atomic_fetch_add(&state->next, PARALLEL_DECODE_BATCH,
+					   __ATOMIC_RELAXED);
+		if (start >= n_codes)
+			break;
+
+		for (i = start; i < n_codes && i - start < PARALLEL_DECODE_BATCH; ++i) {
+			if (!read_code(&state->code_section->codes[i])) {
+				__atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+#endif
+
+int read_codes(struct CodeSection *code_section)
+{
+	uint32_t i;
+
+#ifndef __KERNEL__
+	if (code_section->buf_size >= PARALLEL_DECODE_MIN_SIZE) {
+		pthread_t threads[PARALLEL_DECODE_MAX_THREADS - 1];
+		struct ReadCodesState state;
+		long n_cpus;
+		size_t n_threads;
+
+		state.code_section = code_section;
+		state.next = 0;
+		state.failed = 0;
+
+		n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n_cpus < 1)
+			n_cpus = 1;
+
+		/* if we fail to start a thread, we just do more work ourselves */
+		for (n_threads = 0;
+		     n_threads + 1 < MMIN((size_t) n_cpus, PARALLEL_DECODE_MAX_THREADS);
+		     ++n_threads) {
+			if (pthread_create(&threads[n_threads], NULL,
+					   read_codes_worker, &state))
+				break;
+		}
+
+		read_codes_worker(&state);
+
+		for (i = 0; i < n_threads; ++i) {
+			pthread_join(threads[i], NULL);
+		}
+
+		return !state.failed;
+	}
+#endif
+
+	for (i = 0; i < code_section->n_codes; ++i) {
+		if (!read_code(&code_section->codes[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
 int read_code_section(struct ParseState *pstate,
-		      struct CodeSection *code_section)
+		      struct CodeSection *code_section,
+		      uint32_t size)
 {
 	int ret;
+	struct ParseState bufstatev;
+	struct ParseState *bufstate = &bufstatev;
+
+	/*
+	  only record where each body is, bodies are
+	  decoded on demand by read_code()
+	*/
+	if (pstate->amt_left < size) {
+		pstate->eof = 1;
+		goto error;
+	}
+
+	code_section->buf = malloc(size);
+	if (size && !code_section->buf)
+		goto error;
+	memcpy(code_section->buf, pstate->input, size);
+	code_section->buf_size = size;
+
+	if (!advance_parser(pstate, size))
+		goto error;
+
+	if (!init_pstate(bufstate, code_section->buf, size))
+		goto error;
 
-	ret = read_uleb_uint32_t(pstate, &code_section->n_codes);
+	ret = read_uleb_uint32_t(bufstate, &code_section->n_codes);
 	if (!ret)
 		goto error;
 
@@ -1301,46 +1528,13 @@ int read_code_section(struct ParseState *pstate,
 		for (i = 0; i < code_section->n_codes; ++i) {
 			struct CodeSectionCode *code = &code_section->codes[i];
 
-			ret = read_uleb_uint32_t(pstate, &code->size);
+			ret = read_uleb_uint32_t(bufstate, &code->size);
 			if (!ret)
 				goto error;
 
-			ret = read_uleb_uint32_t(pstate, &code->n_locals);
-			if (!ret)
-				goto error;
-
-			if (code->n_locals) {
-				uint32_t j;
-
-				code->locals =
-				    calloc(code->n_locals,
-					   sizeof(struct CodeSectionCodeLocal));
-				if (!code->locals)
-					goto error;
-
-				for (j = 0; j < code->n_locals; ++j) {
-					struct CodeSectionCodeLocal
-					*code_local = &code->locals[j];
-
-					ret =
-					    read_uleb_uint32_t(pstate,
-							       &code_local->
-							       count);
-					if (!ret)
-						goto error;
-
-					ret =
-					    read_uint8_t(pstate,
-							 &code_local->valtype);
-					if (!ret)
-						goto error;
-				}
-			}
+			code->body = bufstate->input;
 
-			ret =
-			    read_instructions(pstate,
-					      &code->instructions,
-					      &code->n_instructions);
+			ret = advance_parser(bufstate, code->size);
 			if (!ret)
 				goto error;
 		}
@@ -1396,6 +1590,78 @@ int read_data_section(struct ParseState *pstate,
 	return 0;
 }
 
+/* custom sections the runtime reads, others are kept by name only */
+static const char *const kept_custom_sections[] = {
+	"dylink",
+	"dylink.0",
+	"wasmjit_emscripten",
+};
+
+static int keep_custom_section(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(kept_custom_sections) /
+		     sizeof(kept_custom_sections[0]); ++i) {
+		if (!strcmp(name, kept_custom_sections[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+int read_custom_section(struct ParseState *pstate,
+			struct CustomSection *custom_section,
+			uint32_t size)
+{
+	struct CustomSectionCustom *custom, *new_customs;
+	size_t amt_left;
+	uint32_t payload_size;
+
+	new_customs = realloc(custom_section->customs,
+			      (custom_section->n_customs + 1) *
+			      sizeof(custom_section->customs[0]));
+	if (!new_customs)
+		goto error;
+	custom_section->customs = new_customs;
+
+	custom = &custom_section->customs[custom_section->n_customs];
+	memset(custom, 0, sizeof(*custom));
+	custom_section->n_customs += 1;
+
+	amt_left = pstate->amt_left;
+
+	custom->name = read_string(pstate);
+	if (!custom->name)
+		goto error;
+
+	if (amt_left - pstate->amt_left > size)
+		goto error;
+
+	payload_size = size - (amt_left - pstate->amt_left);
+
+	if (pstate->amt_left < payload_size) {
+		pstate->eof = 1;
+		goto error;
+	}
+
+	if (keep_custom_section(custom->name)) {
+		custom->payload = malloc(payload_size);
+		if (payload_size && !custom->payload)
+			goto error;
+		memcpy(custom->payload, pstate->input, payload_size);
+		custom->payload_size = payload_size;
+	}
+
+	pstate->input += payload_size;
+	pstate->amt_left -= payload_size;
+
+	return 1;
+
+ error:
+	return 0;
+}
+
 int read_module(struct ParseState *pstate, struct Module *module,
 		char *why, size_t why_size)
 {
@@ -1457,10 +1723,32 @@ int read_module(struct ParseState *pstate, struct Module *module,
 
 	}
 
+	return read_module_sections(pstate, module, why, why_size);
+}
+
+static const char *const section_names[] = {
+	"custom",
+	"type",
+	"import",
+	"function",
+	"table",
+	"memory",
+	"global",
+	"export",
+	"start",
+	"element",
+	"code",
+	"data",
+};
+
+int read_module_sections(struct ParseState *pstate, struct Module *module,
+			 char *why, size_t why_size)
+{
 	/* read sections */
 	while (1) {
 		uint8_t id;
 		uint32_t size;
+		uint64_t trace_start;
 
 		{
 			int ret;
@@ -1478,9 +1766,12 @@ int read_module(struct ParseState *pstate, struct Module *module,
 		}
 		READ("size", read_uleb_uint32_t, &size);
 
+		WASMJIT_TRACE_BEGIN(trace_start);
+
 		switch (id) {
 		case SECTION_ID_CUSTOM:
-			READ("custom section", advance_parser, size);
+			READ("custom section", read_custom_section,
+			     &module->custom_section, size);
 			break;
 		case SECTION_ID_TYPE:
 			READ("type section", read_type_section,
@@ -1520,7 +1811,7 @@ int read_module(struct ParseState *pstate, struct Module *module,
 			break;
 		case SECTION_ID_CODE:
 			READ("code section", read_code_section,
-			     &module->code_section);
+			     &module->code_section, size);
 			break;
 		case SECTION_ID_DATA:
 			READ("data section", read_data_section,
@@ -1533,6 +1824,9 @@ int read_module(struct ParseState *pstate, struct Module *module,
 			}
 			return 0;
 		}
+
+		WASMJIT_TRACE_END(trace_start, "read_section",
+				  section_names[id], (long) size);
 	}
 	return 1;
 }
@@ -38,6 +38,17 @@ struct ParseState {
 int read_module(struct ParseState *pstate, struct Module *module,
 		char *why, size_t why_size);
 
+/* reads a bare sequence of sections, i.e. a module without its header */
+int read_module_sections(struct ParseState *pstate, struct Module *module,
+			 char *why, size_t why_size);
+
+int read_uleb_uint32_t(struct ParseState *pstate, uint32_t *data);
+
+/* function bodies are decoded lazily, these must be called before
+   accessing a code's locals or instructions */
+int read_code(struct CodeSectionCode *code);
+int read_codes(struct CodeSection *code_section);
+
 int init_pstate(struct ParseState *pstate, const char *buf, size_t size);
 
 #endif
@@ -0,0 +1,292 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/perf_counters.h>
+
+#include <wasmjit/sys.h>
+
+static const char *const counter_names[WASMJIT_PERF_N_COUNTERS] = {
+	"cycles",
+	"instructions",
+	"cache-misses",
+	"branch-misses",
+};
+
+const char *wasmjit_perf_counter_name(unsigned counter)
+{
+	if (counter >= WASMJIT_PERF_N_COUNTERS)
+		return NULL;
+	return counter_names[counter];
+}
+
+void wasmjit_perf_stats_add(struct WasmJITPerfStats *stats,
+			    uint32_t valid,
+			    const uint64_t *before,
+			    const uint64_t *after)
+{
+	unsigned i;
+
+	stats->invocations += 1;
+	stats->valid |= valid;
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i) {
+		if (valid & (1U << i))
+			stats->counts[i] += after[i] - before[i];
+	}
+}
+
+/* platform specific */
+
+#if defined(__KERNEL__) || defined(__linux__)
+
+#include <linux/perf_event.h>
+
+static const uint64_t counter_configs[WASMJIT_PERF_N_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static void init_attr(struct perf_event_attr *attr, unsigned counter)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->type = PERF_TYPE_HARDWARE;
+	attr->size = sizeof(*attr);
+	attr->config = counter_configs[counter];
+	attr->exclude_hv = 1;
+}
+
+#endif
+
+#ifdef __KERNEL__
+
+#include <wasmjit/ktls.h>
+
+/*
+  wasm code runs in ring 0 here, so kernel mode is counted,
+  counters live in the per-ioctl thread local
+*/
+
+int wasmjit_perf_counters_open(void)
+{
+	struct KernelThreadLocal *ktls = wasmjit_get_ktls();
+	unsigned i;
+	int valid = 0;
+
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i) {
+		struct perf_event_attr attr;
+		struct perf_event *event;
+
+		init_attr(&attr, i);
+		event = perf_event_create_kernel_counter(&attr, -1, current,
+							 NULL, NULL);
+		if (IS_ERR(event)) {
+			ktls->perf_events[i] = NULL;
+			continue;
+		}
+
+		ktls->perf_events[i] = event;
+		valid |= 1 << i;
+	}
+
+	ktls->perf_enabled = 1;
+
+	return valid;
+}
+
+void wasmjit_perf_counters_close(void)
+{
+	struct KernelThreadLocal *ktls = wasmjit_get_ktls();
+	unsigned i;
+
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i) {
+		if (ktls->perf_events[i]) {
+			perf_event_release_kernel(ktls->perf_events[i]);
+			ktls->perf_events[i] = NULL;
+		}
+	}
+
+	ktls->perf_enabled = 0;
+}
+
+int wasmjit_perf_counters_enabled(void)
+{
+	return wasmjit_get_ktls()->perf_enabled;
+}
+
+uint32_t wasmjit_perf_counters_read(uint64_t *counts)
+{
+	struct KernelThreadLocal *ktls = wasmjit_get_ktls();
+	unsigned i;
+	uint32_t valid = 0;
+
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i) {
+		u64 enabled, running;
+
+		if (!ktls->perf_events[i]) {
+			counts[i] = 0;
+			continue;
+		}
+
+		counts[i] = perf_event_read_value(ktls->perf_events[i],
+						  &enabled, &running);
+		valid |= 1U << i;
+	}
+
+	return valid;
+}
+
+#elif defined(__linux__)
+
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/*
+  the counters are opened as a single group so each sample
+  is one read(), they measure the calling thread in user mode only
+*/
+
+static int perf_enabled;
+static int perf_leader = -1;
+static int perf_fds[WASMJIT_PERF_N_COUNTERS];
+/* position of each valid counter in the group read */
+static unsigned perf_group_index[WASMJIT_PERF_N_COUNTERS];
+static unsigned perf_group_size;
+static uint32_t perf_valid;
+
+int wasmjit_perf_counters_open(void)
+{
+	unsigned i;
+
+	perf_leader = -1;
+	perf_group_size = 0;
+	perf_valid = 0;
+
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i) {
+		struct perf_event_attr attr;
+		long fd;
+
+		init_attr(&attr, i);
+		attr.exclude_kernel = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, perf_leader,
+			     PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0) {
+			perf_fds[i] = -1;
+			continue;
+		}
+
+		if (perf_leader < 0)
+			perf_leader = fd;
+
+		perf_fds[i] = fd;
+		perf_group_index[i] = perf_group_size++;
+		perf_valid |= 1U << i;
+	}
+
+	perf_enabled = 1;
+
+	return perf_valid;
+}
+
+void wasmjit_perf_counters_close(void)
+{
+	unsigned i;
+
+	if (!perf_enabled)
+		return;
+
+	/* close the group leader last */
+	for (i = WASMJIT_PERF_N_COUNTERS; i > 0; --i) {
+		if (perf_fds[i - 1] >= 0)
+			(void)close(perf_fds[i - 1]);
+	}
+
+	perf_leader = -1;
+	perf_valid = 0;
+	perf_group_size = 0;
+	perf_enabled = 0;
+}
+
+int wasmjit_perf_counters_enabled(void)
+{
+	return perf_enabled;
+}
+
+uint32_t wasmjit_perf_counters_read(uint64_t *counts)
+{
+	uint64_t buf[1 + WASMJIT_PERF_N_COUNTERS];
+	unsigned i;
+
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i)
+		counts[i] = 0;
+
+	if (perf_leader < 0)
+		return 0;
+
+	if (read(perf_leader, buf, sizeof(buf[0]) * (1 + perf_group_size)) < 0 ||
+	    buf[0] != perf_group_size)
+		return 0;
+
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i) {
+		if (perf_valid & (1U << i))
+			counts[i] = buf[1 + perf_group_index[i]];
+	}
+
+	return perf_valid;
+}
+
+#else
+
+/* no counting interface, only invocations are recorded */
+
+static int perf_enabled;
+
+int wasmjit_perf_counters_open(void)
+{
+	perf_enabled = 1;
+	return 0;
+}
+
+void wasmjit_perf_counters_close(void)
+{
+	perf_enabled = 0;
+}
+
+int wasmjit_perf_counters_enabled(void)
+{
+	return perf_enabled;
+}
+
+uint32_t wasmjit_perf_counters_read(uint64_t *counts)
+{
+	unsigned i;
+	for (i = 0; i < WASMJIT_PERF_N_COUNTERS; ++i)
+		counts[i] = 0;
+	return 0;
+}
+
+#endif
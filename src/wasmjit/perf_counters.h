@@ -0,0 +1,71 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__PERF_COUNTERS_H__
+#define __WASMJIT__PERF_COUNTERS_H__
+
+#include <wasmjit/sys.h>
+
+/*
+  counting-mode hardware counters sampled around
+  wasmjit_invoke_function(), counts include nested invocations
+*/
+
+enum {
+	WASMJIT_PERF_COUNTER_CYCLES,
+	WASMJIT_PERF_COUNTER_INSTRUCTIONS,
+	WASMJIT_PERF_COUNTER_CACHE_MISSES,
+	WASMJIT_PERF_COUNTER_BRANCH_MISSES,
+	WASMJIT_PERF_N_COUNTERS,
+};
+
+struct WasmJITPerfStats {
+	uint64_t invocations;
+	/* bit i is set if counts[i] was measured */
+	uint32_t valid;
+	uint64_t counts[WASMJIT_PERF_N_COUNTERS];
+};
+
+struct WasmJITPerfExportStats {
+	char name[64];
+	struct WasmJITPerfStats stats;
+};
+
+/*
+  returns a bitmask of the counters that could be opened,
+  invocations are counted even if it is zero
+*/
+int wasmjit_perf_counters_open(void);
+void wasmjit_perf_counters_close(void);
+int wasmjit_perf_counters_enabled(void);
+/* returns the valid mask, unmeasured counts are zeroed */
+uint32_t wasmjit_perf_counters_read(uint64_t *counts);
+const char *wasmjit_perf_counter_name(unsigned counter);
+
+void wasmjit_perf_stats_add(struct WasmJITPerfStats *stats,
+			    uint32_t valid,
+			    const uint64_t *before,
+			    const uint64_t *after);
+
+#endif
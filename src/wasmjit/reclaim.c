@@ -0,0 +1,412 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/reclaim.h>
+
+#include <wasmjit/runtime.h>
+#include <wasmjit/code_gc.h>
+
+#include <wasmjit/sys.h>
+
+/*
+  freed linear memories kept around, the worker releases their pages.
+  where that isn't possible (the kernel) they're freed instead
+*/
+#define RECLAIM_POOL_MAX_REGIONS 8
+#define RECLAIM_POOL_MAX_BYTES ((size_t) 128 * 1024 * 1024)
+
+struct ReclaimEntry {
+	struct ModuleInst *module;
+	struct ReclaimEntry *next;
+};
+
+struct MemoryRegion {
+	void *data;
+	size_t size;
+};
+
+static struct ReclaimEntry *pending_head;
+static struct ReclaimEntry **pending_tail = &pending_head;
+
+static struct MemoryRegion pool[RECLAIM_POOL_MAX_REGIONS];
+static size_t pool_n_regions, pool_bytes;
+
+static void reclaim_lock(void);
+static void reclaim_unlock(void);
+/* wakes the worker up, returns 0 if there is no worker */
+static int reclaim_schedule(void);
+
+void *wasmjit_reclaim_memory(size_t size)
+{
+	size_t i;
+	void *data = NULL;
+
+	reclaim_lock();
+	for (i = 0; i < pool_n_regions; ++i) {
+		if (pool[i].size == size) {
+			data = pool[i].data;
+			pool_bytes -= size;
+			pool[i] = pool[--pool_n_regions];
+			break;
+		}
+	}
+	reclaim_unlock();
+
+	return data;
+}
+
+static int pool_has_room(size_t size)
+{
+	int ret;
+
+	reclaim_lock();
+	ret = pool_n_regions < RECLAIM_POOL_MAX_REGIONS &&
+		size <= RECLAIM_POOL_MAX_BYTES - pool_bytes;
+	reclaim_unlock();
+
+	return ret;
+}
+
+/* only the worker adds to the pool, so room can't disappear */
+static int pool_put(void *data, size_t size)
+{
+	/* other processes may still have shared memory mapped */
+	if (wasmjit_shared_memory_fd(data) >= 0 ||
+	    !pool_has_room(size) ||
+	    !wasmjit_discard_memory(data, size))
+		return 0;
+
+	reclaim_lock();
+	pool[pool_n_regions].data = data;
+	pool[pool_n_regions].size = size;
+	pool_n_regions++;
+	pool_bytes += size;
+	reclaim_unlock();
+
+	return 1;
+}
+
+#ifndef __KERNEL__
+
+#include <unistd.h>
+
+static int compare_regions(const void *a, const void *b)
+{
+	const struct MemoryRegion *ra = a, *rb = b;
+
+	if ((uintptr_t) ra->data < (uintptr_t) rb->data)
+		return -1;
+	return (uintptr_t) ra->data > (uintptr_t) rb->data;
+}
+
+/*
+  code segments of a module tend to be mapped next to each other,
+  unmapping runs of them at once saves syscalls and TLB shootdowns
+*/
+static void unmap_code_regions(struct MemoryRegion *regions, size_t n_regions)
+{
+	uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+	size_t i, j;
+
+	qsort(regions, n_regions, sizeof(regions[0]), &compare_regions);
+
+	for (i = 0; i < n_regions; i = j) {
+		uintptr_t start = (uintptr_t) regions[i].data;
+		uintptr_t end = (start + regions[i].size + page_mask) & ~page_mask;
+
+		for (j = i + 1;
+		     j < n_regions && (uintptr_t) regions[j].data == end;
+		     ++j) {
+			end = ((uintptr_t) regions[j].data + regions[j].size +
+			       page_mask) & ~page_mask;
+		}
+
+		wasmjit_unmap_code_segment((void *) start, end - start);
+	}
+}
+
+#endif
+
+static void reclaim_modules(struct ReclaimEntry *entries)
+{
+	struct ReclaimEntry *entry;
+	struct MemoryRegion *code_regions = NULL;
+	size_t n_code_regions = 0;
+
+#ifndef __KERNEL__
+	{
+		size_t max_code_regions = 0;
+
+		for (entry = entries; entry; entry = entry->next) {
+			struct ModuleInst *module = entry->module;
+			max_code_regions += 2 *
+				(module->funcs.n_elts - module->n_imported_funcs);
+		}
+
+		/* without it, code is unmapped one segment at a time */
+		if (max_code_regions)
+			code_regions = calloc(max_code_regions,
+					      sizeof(code_regions[0]));
+	}
+#endif
+
+	while (entries) {
+		struct ModuleInst *module = entries->module;
+		size_t i;
+
+		entry = entries;
+		entries = entries->next;
+
+		for (i = module->n_imported_mems; i < module->mems.n_elts; ++i) {
+			struct MemInst *meminst = module->mems.elts[i];
+
+			if (meminst->data && pool_put(meminst->data, meminst->size))
+				meminst->data = NULL;
+		}
+
+		for (i = module->n_imported_funcs;
+		     code_regions && i < module->funcs.n_elts; ++i) {
+			struct FuncInst *funcinst = module->funcs.elts[i];
+
+			/* unmapped with the module's shared code */
+			if (funcinst->code_shared)
+				continue;
+
+			if (funcinst->compiled_code) {
+				code_regions[n_code_regions].data = funcinst->compiled_code;
+				code_regions[n_code_regions].size = funcinst->compiled_code_size;
+				n_code_regions++;
+				funcinst->compiled_code = NULL;
+			}
+
+			if (funcinst->invoker) {
+				code_regions[n_code_regions].data = funcinst->invoker;
+				code_regions[n_code_regions].size = funcinst->invoker_size;
+				n_code_regions++;
+				funcinst->invoker = NULL;
+			}
+		}
+
+		wasmjit_free_module_inst(module);
+		free(entry);
+	}
+
+#ifndef __KERNEL__
+	if (code_regions) {
+		unmap_code_regions(code_regions, n_code_regions);
+		free(code_regions);
+	}
+#else
+	(void)n_code_regions;
+#endif
+}
+
+/* takes everything queued so far */
+static struct ReclaimEntry *take_pending(void)
+{
+	struct ReclaimEntry *entries;
+
+	entries = pending_head;
+	pending_head = NULL;
+	pending_tail = &pending_head;
+
+	return entries;
+}
+
+void wasmjit_free_module_inst_deferred(struct ModuleInst *module)
+{
+	struct ReclaimEntry *entry;
+
+	/* its memory may be reused before the worker gets to it */
+	wasmjit_code_gc_release(module);
+
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		goto sync;
+
+	entry->module = module;
+	entry->next = NULL;
+
+	reclaim_lock();
+	*pending_tail = entry;
+	pending_tail = &entry->next;
+	reclaim_unlock();
+
+	if (reclaim_schedule())
+		return;
+
+	/* no worker, free whatever is queued ourselves */
+	reclaim_lock();
+	entry = take_pending();
+	reclaim_unlock();
+	reclaim_modules(entry);
+	return;
+
+ sync:
+	wasmjit_free_module_inst(module);
+}
+
+static void pool_release(void)
+{
+	reclaim_lock();
+	while (pool_n_regions) {
+		pool_n_regions--;
+		wasmjit_unmap_memory(pool[pool_n_regions].data,
+				     pool[pool_n_regions].size);
+	}
+	pool_bytes = 0;
+	reclaim_unlock();
+}
+
+void wasmjit_reclaim_drain(void)
+{
+	wasmjit_reclaim_flush();
+	pool_release();
+}
+
+/* platform specific */
+
+#ifdef __KERNEL__
+
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+static DEFINE_MUTEX(reclaim_mutex);
+
+static void reclaim_lock(void)
+{
+	mutex_lock(&reclaim_mutex);
+}
+
+static void reclaim_unlock(void)
+{
+	mutex_unlock(&reclaim_mutex);
+}
+
+static void reclaim_work_fn(struct work_struct *work)
+{
+	struct ReclaimEntry *entries;
+
+	(void)work;
+
+	for (;;) {
+		reclaim_lock();
+		entries = take_pending();
+		reclaim_unlock();
+
+		if (!entries)
+			break;
+
+		reclaim_modules(entries);
+	}
+}
+
+static DECLARE_WORK(reclaim_work, reclaim_work_fn);
+
+static int reclaim_schedule(void)
+{
+	schedule_work(&reclaim_work);
+	return 1;
+}
+
+void wasmjit_reclaim_flush(void)
+{
+	flush_work(&reclaim_work);
+}
+
+#else
+
+#include <pthread.h>
+
+static pthread_mutex_t reclaim_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* signaled when work is queued and when the worker goes idle */
+static pthread_cond_t reclaim_cond = PTHREAD_COND_INITIALIZER;
+static int worker_started, worker_busy;
+
+static void reclaim_lock(void)
+{
+	pthread_mutex_lock(&reclaim_mutex);
+}
+
+static void reclaim_unlock(void)
+{
+	pthread_mutex_unlock(&reclaim_mutex);
+}
+
+static void *reclaim_worker(void *arg)
+{
+	struct ReclaimEntry *entries;
+
+	(void)arg;
+
+	reclaim_lock();
+	for (;;) {
+		while (!pending_head)
+			pthread_cond_wait(&reclaim_cond, &reclaim_mutex);
+
+		entries = take_pending();
+		worker_busy = 1;
+		reclaim_unlock();
+
+		reclaim_modules(entries);
+
+		reclaim_lock();
+		worker_busy = 0;
+		pthread_cond_broadcast(&reclaim_cond);
+	}
+
+	return NULL;
+}
+
+static int reclaim_schedule(void)
+{
+	int ret = 1;
+
+	reclaim_lock();
+	if (!worker_started) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, &reclaim_worker, NULL)) {
+			ret = 0;
+		} else {
+			pthread_detach(thread);
+			worker_started = 1;
+		}
+	}
+	if (ret)
+		pthread_cond_broadcast(&reclaim_cond);
+	reclaim_unlock();
+
+	return ret;
+}
+
+void wasmjit_reclaim_flush(void)
+{
+	reclaim_lock();
+	while (pending_head || worker_busy)
+		pthread_cond_wait(&reclaim_cond, &reclaim_mutex);
+	reclaim_unlock();
+}
+
+#endif
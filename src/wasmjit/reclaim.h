@@ -0,0 +1,51 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__RECLAIM_H__
+#define __WASMJIT__RECLAIM_H__
+
+#include <wasmjit/sys.h>
+
+struct ModuleInst;
+
+/*
+  like wasmjit_free_module_inst() but the instance is freed later by a
+  background worker, in a batch with others that died around the same
+  time. the instance must not be used or referenced by live modules.
+*/
+void wasmjit_free_module_inst_deferred(struct ModuleInst *module);
+
+/* waits until every deferred instance has been freed */
+void wasmjit_reclaim_flush(void);
+
+/*
+  returns zeroed memory of size bytes recycled from a freed instance's
+  linear memory, NULL if there is none
+*/
+void *wasmjit_reclaim_memory(size_t size);
+
+/* flushes and then releases the recycled memory */
+void wasmjit_reclaim_drain(void);
+
+#endif
@@ -26,6 +26,7 @@
 
 #include <wasmjit/ast.h>
 #include <wasmjit/util.h>
+#include <wasmjit/code_gc.h>
 
 #include <wasmjit/sys.h>
 
@@ -70,18 +71,21 @@ union ExportPtr wasmjit_get_export(const struct ModuleInst *module_inst,
 
 void wasmjit_free_func_inst(struct FuncInst *funcinst)
 {
-	if (funcinst->invoker)
+	if (funcinst->invoker && !funcinst->code_shared)
 		wasmjit_unmap_code_segment(funcinst->invoker,
 					   funcinst->invoker_size);
-	if (funcinst->compiled_code)
+	if (funcinst->compiled_code && !funcinst->code_shared)
 		wasmjit_unmap_code_segment(funcinst->compiled_code,
 					   funcinst->compiled_code_size);
+	if (funcinst->perf_stats)
+		free(funcinst->perf_stats);
 	free(funcinst);
 }
 
 void wasmjit_free_module_inst(struct ModuleInst *module)
 {
 	size_t i;
+	wasmjit_code_gc_release(module);
 	if (module->free_private_data)
 		module->free_private_data(module->private_data);
 	free(module->types.elts);
@@ -89,13 +93,16 @@ void wasmjit_free_module_inst(struct ModuleInst *module)
 		wasmjit_free_func_inst(module->funcs.elts[i]);
 	}
 	free(module->funcs.elts);
+	if (module->shared_code)
+		wasmjit_unmap_shared_code(module->shared_code);
 	for (i = module->n_imported_tables; i < module->tables.n_elts; ++i) {
 		free(module->tables.elts[i]->data);
 		free(module->tables.elts[i]);
 	}
 	free(module->tables.elts);
 	for (i = module->n_imported_mems; i < module->mems.n_elts; ++i) {
-		free(module->mems.elts[i]->data);
+		wasmjit_unmap_memory(module->mems.elts[i]->data,
+				     module->mems.elts[i]->size);
 		free(module->mems.elts[i]);
 	}
 	free(module->mems.elts);
@@ -49,10 +49,48 @@ struct FuncInst {
 	*/
 	void *compiled_code;
 	size_t compiled_code_size;
+	/* set by calls when compiled with WASMJIT_COMPILE_FLAG_CODE_GC */
+	unsigned char code_used;
+	/* other modules embed compiled_code, it may not be collected */
+	unsigned char code_pinned;
+	/*
+	  compiled_code and invoker lie in module_inst's shared_code,
+	  they are unmapped along with it
+	*/
+	unsigned char code_shared;
 	union ValueUnion (*invoker)(union ValueUnion *);
 	size_t invoker_size;
 	size_t stack_usage;
+	/*
+	  bound on the native stack used by a call to this function,
+	  including everything it calls, 0 if unbounded (recursion)
+	*/
+	size_t max_stack_usage;
+	/*
+	  set for functions provided by the host runtime,
+	  wasm functions may only call these indirectly
+	*/
+	unsigned host_function;
+	/*
+	  set for host functions that call the entry of table 0
+	  indexed by their first argument (e.g. Emscripten's invoke_*)
+	*/
+	unsigned host_calls_table;
+	/* set when the function does nothing but return this global */
+	struct GlobalInst *returns_global;
+	/* for host functions calls may be compiled to instead */
+	const struct WasmJITIntrinsic *intrinsic;
+	/*
+	  host function behind compiled_code, its trampoline is only
+	  compiled once the function is imported,
+	  see wasmjit_bind_host_function()
+	*/
+	void *host_fptr;
+	/* host_fptr takes its arguments as an array */
+	unsigned host_takes_values;
 	struct FuncType type;
+	/* allocated on first invocation while perf counters are enabled */
+	struct WasmJITPerfStats *perf_stats;
 };
 
 struct TableInst {
@@ -98,6 +136,10 @@ struct ModuleInst {
 		n_imported_mems, n_imported_globals;
 	void *private_data;
 	void (*free_private_data)(void *);
+	/* non-NULL when cold code may be collected, see code_gc.h */
+	struct WasmJITCodeGC *code_gc;
+	/* non-NULL when the functions' code is shared with other instances */
+	struct WasmJITSharedCodeMapping *shared_code;
 };
 
 DECLARE_VECTOR_GROW(func_types, struct FuncTypeVector);
@@ -109,6 +151,9 @@ struct NamedModule {
 
 #define IS_HOST(funcinst) ((funcinst)->host_function)
 
+/* native stack assumed for a host function, enough for a syscall */
+#define WASMJIT_HOST_STACK_RESERVE ((size_t) 16 * 1024)
+
 #define WASM_PAGE_SIZE ((size_t) (64 * 1024))
 
 void _wasmjit_create_func_type(struct FuncType *ft,
@@ -173,6 +218,12 @@ static const char *wasmjit_trap_reason_to_string(int reason) {
 	case WASMJIT_TRAP_STACK_OVERFLOW:
 		msg = "stack overflow";
 		break;
+	case WASMJIT_TRAP_ABORT:
+		msg = "abort";
+		break;
+	case WASMJIT_TRAP_INTEGER_OVERFLOW:
+		msg = "integer overflow";
+		break;
 	default:
 		assert(0);
 		__builtin_unreachable();
@@ -193,6 +244,41 @@ void *wasmjit_map_code_segment(size_t code_size);
 int wasmjit_mark_code_segment_executable(void *code, size_t code_size);
 int wasmjit_unmap_code_segment(void *code, size_t code_size);
 
+/*
+  read-only code any number of instances map, each mapping is followed
+  by a private, read-only table of refs_size bytes starting
+  wasmjit_shared_code_refs_offset() past the code
+*/
+struct WasmJITSharedCode;
+struct WasmJITSharedCodeMapping;
+
+size_t wasmjit_shared_code_refs_offset(size_t code_size);
+struct WasmJITSharedCode *wasmjit_create_shared_code(const void *code,
+						     size_t code_size);
+/* mappings made so far stay valid */
+void wasmjit_free_shared_code(struct WasmJITSharedCode *shared);
+/* returns the address of the code, NULL on failure */
+void *wasmjit_map_shared_code(const struct WasmJITSharedCode *shared,
+			      const void *refs, size_t refs_size,
+			      struct WasmJITSharedCodeMapping **mapping);
+void wasmjit_unmap_shared_code(struct WasmJITSharedCodeMapping *mapping);
+
+/* zeroed, page-aligned backing for linear memory */
+void *wasmjit_map_memory(size_t size);
+int wasmjit_unmap_memory(void *data, size_t size);
+/* returns the whole pages within [data, data + size) to the system,
+   they read back as zeros. returns 0 if they couldn't be released,
+   always in the kernel */
+int wasmjit_discard_memory(void *data, size_t size);
+/*
+  like wasmjit_map_memory() but backed by a memfd other processes can
+  map, NULL where that isn't available. the fd belongs to the mapping
+  and is closed by wasmjit_unmap_memory()
+*/
+void *wasmjit_map_shared_memory(size_t size);
+/* the memfd behind memory from wasmjit_map_shared_memory(), or -1 */
+int wasmjit_shared_memory_fd(const void *data);
+
 int wasmjit_set_stack_top(void *stack_top);
 int wasmjit_set_jmp_buf(jmp_buf *jmpbuf);
 jmp_buf *wasmjit_get_jmp_buf(void);
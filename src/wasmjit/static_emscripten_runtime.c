@@ -276,8 +276,10 @@ int main(int argc, char *argv[]) {
 	ret = wasmjit_emscripten_build_environment(&WASM_FUNC_SYMBOL(asm, ___emscripten_environ_constructor));
 	if (ret)
 		return -1;
-	return wasmjit_emscripten_invoke_main(&WASM_MEMORY_SYMBOL(env, memory),
-					      &WASM_FUNC_SYMBOL(asm, stackAlloc),
-					      &WASM_FUNC_SYMBOL(asm, _main),
-					      argc, argv);
+	ret = wasmjit_emscripten_invoke_main(&WASM_MEMORY_SYMBOL(env, memory),
+					     &WASM_FUNC_SYMBOL(asm, stackAlloc),
+					     &WASM_FUNC_SYMBOL(asm, _main),
+					     argc, argv);
+	wasmjit_emscripten_flush_log(&g_emscripten_ctx);
+	return ret;
 }
@@ -0,0 +1,17 @@
+#include <wasmjit/emscripten_runtime.h>
+#include <wasmjit/static_runtime.h>
+#define CURRENT_MODULE env
+#include <stdlib.h>
+extern struct EmscriptenContext g_emscripten_ctx;
+__attribute__((constructor))
+static void init_memfs(void)
+{
+	if (wasmjit_emscripten_mount_memfs(&g_emscripten_ctx, "/tmp/mfs/a.img"))
+		abort();
+}
+DEFINE_WASM_TABLE(table, ELEMTYPE_ANYFUNC, 8, 8)
+DEFINE_WASM_GLOBAL(memoryBase, 1024, VALTYPE_I32, i32, 0)
+DEFINE_WASM_GLOBAL(tempDoublePtr, 17424, VALTYPE_I32, i32, 0)
+DEFINE_WASM_GLOBAL(DYNAMICTOP_PTR, 17440, VALTYPE_I32, i32, 0)
+DEFINE_WASM_GLOBAL(STACKTOP, 17440, VALTYPE_I32, i32, 0)
+DEFINE_WASM_GLOBAL(STACK_MAX, 5260320, VALTYPE_I32, i32, 0)
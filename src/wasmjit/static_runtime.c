@@ -25,10 +25,14 @@
 #include <wasmjit/static_runtime.h>
 
 #include <wasmjit/runtime.h>
+#include <wasmjit/code_gc.h>
 
 #include <stdint.h>
 #include <stdio.h>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 int wasmjit_unmap_code_segment(void *code, size_t code_size)
 {
 	(void)code;
@@ -36,6 +40,59 @@ int wasmjit_unmap_code_segment(void *code, size_t code_size)
 	return 1;
 }
 
+void wasmjit_unmap_shared_code(struct WasmJITSharedCodeMapping *mapping)
+{
+	(void)mapping;
+}
+
+int wasmjit_unmap_memory(void *data, size_t size)
+{
+	(void)data;
+	(void)size;
+	return 1;
+}
+
+int wasmjit_discard_memory(void *data, size_t size)
+{
+	uintptr_t page_size, start, end;
+	void *ret;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	start = ((uintptr_t) data + page_size - 1) & ~(page_size - 1);
+	end = ((uintptr_t) data + size) & ~(page_size - 1);
+	if (start >= end)
+		return 1;
+
+	/* the memory buffer lives in .bss, replacing its pages with a
+	   fresh anonymous mapping keeps them zero-filled */
+	ret = mmap((void *) start, end - start, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	return ret != MAP_FAILED;
+}
+
+void *wasmjit_map_shared_memory(size_t size)
+{
+	(void)size;
+	return NULL;
+}
+
+int wasmjit_shared_memory_fd(const void *data)
+{
+	(void)data;
+	return -1;
+}
+
+/* compiled ahead of time, there's no code to collect */
+void wasmjit_code_gc_poll(const struct MemInst *meminst)
+{
+	(void)meminst;
+}
+
+void wasmjit_code_gc_release(struct ModuleInst *module_inst)
+{
+	(void)module_inst;
+}
+
 __attribute__((noreturn))
 void wasmjit_trap(int reason)
 {
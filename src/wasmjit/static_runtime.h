@@ -144,7 +144,7 @@ void wasmjit_init_static_module(struct StaticModuleInst *smi);
 		union ValueUnion rout;					\
 		(void)args;						\
 		(*_fptr)(EXPAND_VALUES(_n, ##__VA_ARGS__) COMMA_IF_NOT_EMPTY(_n) &WASM_FUNC_SYMBOL(_module, _name));	\
-		memset(&rout.null, 0, sizeof(rout.null));		\
+		memset(&rout, 0, sizeof(rout));			\
 		return rout;						\
 	}								\
 
@@ -178,6 +178,7 @@ void wasmjit_init_static_module(struct StaticModuleInst *smi);
 		.module_inst = &WASM_MODULE_SYMBOL(_module).module,	\
 		.compiled_code = CAT(CAT(CAT(_module,  __), _name),  __emscripten__hostfunc__),	\
 		.invoker = CAT(CAT(CAT(_module,  __), _name),  __emscripten__hostfunc__invoker), \
+		.host_function = 1,					\
 		.type = {						\
 			.n_inputs = _n,		\
 			.input_types = { __VA_ARGS__ },			\
@@ -200,7 +201,8 @@ void wasmjit_init_static_module(struct StaticModuleInst *smi);
 #define DEFINE_WASM_TABLE(...) _DEFINE_WASM_TABLE(CURRENT_MODULE, __VA_ARGS__)
 
 #define _DEFINE_WASM_MEMORY(_module, _name, _min, _max)	\
-	char WASM_SYMBOL(_module, _name,  buffer)[(_min) * WASM_PAGE_SIZE]; \
+	char WASM_SYMBOL(_module, _name,  buffer)[(_min) * WASM_PAGE_SIZE] \
+	__attribute__((aligned(4096)));					\
 	struct MemInst WASM_MEMORY_SYMBOL(_module, _name) = {\
 		.data = WASM_SYMBOL(_module, _name, buffer),		\
 		.size = (_min) * WASM_PAGE_SIZE,			\
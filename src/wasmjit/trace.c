@@ -0,0 +1,167 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <wasmjit/trace.h>
+
+#include <wasmjit/sys.h>
+
+/* platform specific */
+
+#ifdef __KERNEL__
+
+#include <linux/timekeeping.h>
+
+#define CREATE_TRACE_POINTS
+#include <wasmjit/kwasmjit_trace.h>
+
+int wasmjit_trace_enabled(void)
+{
+	return trace_wasmjit_span_enabled();
+}
+
+uint64_t wasmjit_trace_now(void)
+{
+	return ktime_get_ns();
+}
+
+void wasmjit_trace_span(const char *name, const char *detail,
+			long arg, uint64_t start)
+{
+	trace_wasmjit_span(name, detail ? detail : "", arg,
+			   start, ktime_get_ns());
+}
+
+#else
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+static FILE *trace_file;
+static int trace_n_events;
+
+int wasmjit_trace_open(const char *path)
+{
+	trace_file = fopen(path, "w");
+	if (!trace_file)
+		return -1;
+
+	trace_n_events = 0;
+	fprintf(trace_file, "[\n");
+
+	return 0;
+}
+
+void wasmjit_trace_close(void)
+{
+	if (!trace_file)
+		return;
+
+	fprintf(trace_file, "\n]\n");
+	(void)fclose(trace_file);
+	trace_file = NULL;
+}
+
+int wasmjit_trace_enabled(void)
+{
+	return trace_file != NULL;
+}
+
+uint64_t wasmjit_trace_now(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 1;
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long trace_tid(void)
+{
+#ifdef __linux__
+	return syscall(SYS_gettid);
+#else
+	return getpid();
+#endif
+}
+
+static void write_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; ++s) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+void wasmjit_trace_span(const char *name, const char *detail,
+			long arg, uint64_t start)
+{
+	uint64_t end = wasmjit_trace_now();
+	FILE *f = trace_file;
+
+	if (!f)
+		return;
+
+	/* keep each event contiguous when spans end on several threads */
+	flockfile(f);
+
+	if (trace_n_events++)
+		fprintf(f, ",\n");
+
+	fprintf(f, "{\"name\":");
+	write_json_string(f, name);
+	fprintf(f, ",\"cat\":\"wasmjit\",\"ph\":\"X\""
+		",\"pid\":%ld,\"tid\":%ld,\"ts\":%" PRIu64 ".%03u"
+		",\"dur\":%" PRIu64 ".%03u",
+		(long) getpid(), trace_tid(),
+		start / 1000, (unsigned) (start % 1000),
+		(end - start) / 1000, (unsigned) ((end - start) % 1000));
+
+	if (detail || arg >= 0) {
+		fprintf(f, ",\"args\":{");
+		if (detail) {
+			fprintf(f, "\"detail\":");
+			write_json_string(f, detail);
+		}
+		if (arg >= 0)
+			fprintf(f, "%s\"arg\":%ld", detail ? "," : "", arg);
+		fprintf(f, "}");
+	}
+
+	fprintf(f, "}");
+
+	funlockfile(f);
+}
+
+#endif
@@ -0,0 +1,56 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT__TRACE_H__
+#define __WASMJIT__TRACE_H__
+
+#include <wasmjit/sys.h>
+
+/*
+  timeline spans of the startup phases, written as Chrome
+  trace-event JSON in user mode and as tracepoints in the kernel
+*/
+
+int wasmjit_trace_enabled(void);
+uint64_t wasmjit_trace_now(void);
+/* detail may be NULL, arg is an index or a size and omitted if negative */
+void wasmjit_trace_span(const char *name, const char *detail,
+			long arg, uint64_t start);
+
+#ifndef __KERNEL__
+int wasmjit_trace_open(const char *path);
+void wasmjit_trace_close(void);
+#endif
+
+#define WASMJIT_TRACE_BEGIN(start)					\
+	((start) = wasmjit_trace_enabled() ? wasmjit_trace_now() : 0)
+
+#define WASMJIT_TRACE_END(start, name, detail, arg)			\
+	do {								\
+		if (start)						\
+			wasmjit_trace_span((name), (detail), (arg), (start)); \
+	}								\
+	while (0)
+
+#endif
@@ -0,0 +1,107 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT_BENCH__BENCH_MODULES_H__
+#define __WASMJIT_BENCH__BENCH_MODULES_H__
+
+/*
+  Emscripten-style programs for the benchmarks, they import "memory"
+  and export _main, stackAlloc, _malloc and _free. their STATIC_BUMP
+  is BENCH_STATIC_BUMP
+*/
+
+#define BENCH_STATIC_BUMP 16384
+
+/* main() returns 0 right away */
+static const unsigned char empty_main_module[] = {
+	0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0e, 0x03, 0x60,
+	0x00, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x00,
+	0x02, 0x10, 0x01, 0x03, 0x65, 0x6e, 0x76, 0x06, 0x6d, 0x65, 0x6d, 0x6f,
+	0x72, 0x79, 0x02, 0x00, 0x80, 0x02, 0x03, 0x05, 0x04, 0x00, 0x01, 0x01,
+	0x02, 0x07, 0x28, 0x04, 0x05, 0x5f, 0x6d, 0x61, 0x69, 0x6e, 0x00, 0x00,
+	0x0a, 0x73, 0x74, 0x61, 0x63, 0x6b, 0x41, 0x6c, 0x6c, 0x6f, 0x63, 0x00,
+	0x01, 0x07, 0x5f, 0x6d, 0x61, 0x6c, 0x6c, 0x6f, 0x63, 0x00, 0x02, 0x05,
+	0x5f, 0x66, 0x72, 0x65, 0x65, 0x00, 0x03, 0x0a, 0x16, 0x04, 0x04, 0x00,
+	0x41, 0x00, 0x0b, 0x05, 0x00, 0x41, 0x80, 0x08, 0x0b, 0x06, 0x00, 0x41,
+	0x80, 0xc0, 0x00, 0x0b, 0x02, 0x00, 0x0b,
+};
+/*
+  16 MiB of memory and an 8 entry table, main() calls 32 functions
+  that each store to their own page of memory, then returns 0
+*/
+static const unsigned char density_module[] = {
+	0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x11, 0x04, 0x60,
+	0x00, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x00,
+	0x60, 0x00, 0x00, 0x02, 0x1f, 0x02, 0x03, 0x65, 0x6e, 0x76, 0x06, 0x6d,
+	0x65, 0x6d, 0x6f, 0x72, 0x79, 0x02, 0x00, 0x80, 0x02, 0x03, 0x65, 0x6e,
+	0x76, 0x05, 0x74, 0x61, 0x62, 0x6c, 0x65, 0x01, 0x70, 0x01, 0x08, 0x08,
+	0x03, 0x25, 0x24, 0x00, 0x01, 0x01, 0x02, 0x03, 0x03, 0x03, 0x03, 0x03,
+	0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+	0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,
+	0x03, 0x03, 0x03, 0x07, 0x28, 0x04, 0x05, 0x5f, 0x6d, 0x61, 0x69, 0x6e,
+	0x00, 0x00, 0x0a, 0x73, 0x74, 0x61, 0x63, 0x6b, 0x41, 0x6c, 0x6c, 0x6f,
+	0x63, 0x00, 0x01, 0x07, 0x5f, 0x6d, 0x61, 0x6c, 0x6c, 0x6f, 0x63, 0x00,
+	0x02, 0x05, 0x5f, 0x66, 0x72, 0x65, 0x65, 0x00, 0x03, 0x0a, 0xd6, 0x03,
+	0x24, 0x44, 0x00, 0x10, 0x04, 0x10, 0x05, 0x10, 0x06, 0x10, 0x07, 0x10,
+	0x08, 0x10, 0x09, 0x10, 0x0a, 0x10, 0x0b, 0x10, 0x0c, 0x10, 0x0d, 0x10,
+	0x0e, 0x10, 0x0f, 0x10, 0x10, 0x10, 0x11, 0x10, 0x12, 0x10, 0x13, 0x10,
+	0x14, 0x10, 0x15, 0x10, 0x16, 0x10, 0x17, 0x10, 0x18, 0x10, 0x19, 0x10,
+	0x1a, 0x10, 0x1b, 0x10, 0x1c, 0x10, 0x1d, 0x10, 0x1e, 0x10, 0x1f, 0x10,
+	0x20, 0x10, 0x21, 0x10, 0x22, 0x10, 0x23, 0x41, 0x00, 0x0b, 0x05, 0x00,
+	0x41, 0x80, 0x08, 0x0b, 0x06, 0x00, 0x41, 0x80, 0xc0, 0x00, 0x0b, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0x80, 0x04, 0x41, 0x00, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xa0, 0x04, 0x41, 0x01, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xc0, 0x04, 0x41, 0x02, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xe0, 0x04, 0x41, 0x03, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0x80, 0x05, 0x41, 0x04, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xa0, 0x05, 0x41, 0x05, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xc0, 0x05, 0x41, 0x06, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xe0, 0x05, 0x41, 0x07, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0x80, 0x06, 0x41, 0x08, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xa0, 0x06, 0x41, 0x09, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xc0, 0x06, 0x41, 0x0a, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xe0, 0x06, 0x41, 0x0b, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0x80, 0x07, 0x41, 0x0c, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xa0, 0x07, 0x41, 0x0d, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xc0, 0x07, 0x41, 0x0e, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xe0, 0x07, 0x41, 0x0f, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0x80, 0x08, 0x41, 0x10, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xa0, 0x08, 0x41, 0x11, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xc0, 0x08, 0x41, 0x12, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xe0, 0x08, 0x41, 0x13, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0x80, 0x09, 0x41, 0x14, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xa0, 0x09, 0x41, 0x15, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xc0, 0x09, 0x41, 0x16, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xe0, 0x09, 0x41, 0x17, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0x80, 0x0a, 0x41, 0x18, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xa0, 0x0a, 0x41, 0x19, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xc0, 0x0a, 0x41, 0x1a, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xe0, 0x0a, 0x41, 0x1b, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0x80, 0x0b, 0x41, 0x1c, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xa0, 0x0b, 0x41, 0x1d, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xc0, 0x0b, 0x41, 0x1e, 0x36, 0x02,
+	0x00, 0x0b, 0x0b, 0x00, 0x41, 0x80, 0xe0, 0x0b, 0x41, 0x1f, 0x36, 0x02,
+	0x00, 0x0b,
+};
+#endif
@@ -0,0 +1,531 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+/*
+  measures the cost of crossing each boundary of the runtime and prints
+  it as JSON, in ns per crossing. every benchmark is warmed up and
+  calibrated to run for -t milliseconds, then repeated -r times.
+
+    invoke_function      host -> wasm through wasmjit_invoke_function()
+                         (setjmp() and the invoker)
+    invoke_function_raw  host -> wasm through the invoker alone
+    trap                 an unreachable trap delivered by longjmp()
+    loop                 an empty wasm loop, subtracted for net_ns
+    call_host            wasm -> host through a wasmjit_compile_hostfunc()
+                         trampoline
+    call_wasm            wasm -> wasm call
+    call_indirect        wasm -> wasm call_indirect through a table
+    invoke_main          an empty Emscripten main(), through the
+                         /dev/wasm ioctl when the kernel module is loaded
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <wasmjit/ast.h>
+#include <wasmjit/compile.h>
+#include <wasmjit/emscripten_runtime.h>
+#include <wasmjit/high_level.h>
+#include <wasmjit/instantiate.h>
+#include <wasmjit/parse.h>
+#include <wasmjit/runtime.h>
+#include <wasmjit/vector.h>
+
+#include <wasmjit_bench/bench_modules.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+  (module
+    (import "env" "bench_host" (func $host (param i32) (result i32)))
+    (table 1 anyfunc) (elem (i32.const 0) $inc)
+    (func (export "nop") (result i32) (i32.const 0))
+    ;; each loop runs its body $n times on $acc and returns $acc
+    (func (export "loop") (param $n i32) (result i32) ...)
+    (func (export "call_host") (param $n i32) (result i32)
+      ... (set_local $acc (call $host (get_local $acc))) ...)
+    (func (export "call_wasm") (param $n i32) (result i32)
+      ... (set_local $acc (call $inc (get_local $acc))) ...)
+    (func (export "call_indirect") (param $n i32) (result i32)
+      ... (set_local $acc (call_indirect (param i32) (result i32)
+                             (get_local $acc) (i32.const 0))) ...)
+    (func $inc (param i32) (result i32) (i32.add (get_local 0) (i32.const 1)))
+    (func (export "trap") unreachable))
+*/
+static const unsigned char boundary_module[] = {
+	0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0d, 0x03, 0x60,
+	0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x01, 0x7f, 0x60, 0x00, 0x00, 0x02,
+	0x12, 0x01, 0x03, 0x65, 0x6e, 0x76, 0x0a, 0x62, 0x65, 0x6e, 0x63, 0x68,
+	0x5f, 0x68, 0x6f, 0x73, 0x74, 0x00, 0x00, 0x03, 0x08, 0x07, 0x01, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x02, 0x04, 0x04, 0x01, 0x70, 0x00, 0x01, 0x07,
+	0x3d, 0x06, 0x03, 0x6e, 0x6f, 0x70, 0x00, 0x01, 0x04, 0x6c, 0x6f, 0x6f,
+	0x70, 0x00, 0x02, 0x09, 0x63, 0x61, 0x6c, 0x6c, 0x5f, 0x68, 0x6f, 0x73,
+	0x74, 0x00, 0x03, 0x09, 0x63, 0x61, 0x6c, 0x6c, 0x5f, 0x77, 0x61, 0x73,
+	0x6d, 0x00, 0x04, 0x0d, 0x63, 0x61, 0x6c, 0x6c, 0x5f, 0x69, 0x6e, 0x64,
+	0x69, 0x72, 0x65, 0x63, 0x74, 0x00, 0x05, 0x04, 0x74, 0x72, 0x61, 0x70,
+	0x00, 0x07, 0x09, 0x07, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x01, 0x06, 0x0a,
+	0x73, 0x07, 0x04, 0x00, 0x41, 0x00, 0x0b, 0x12, 0x01, 0x01, 0x7f, 0x03,
+	0x40, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x22, 0x00, 0x0d, 0x00, 0x0b, 0x20,
+	0x01, 0x0b, 0x18, 0x01, 0x01, 0x7f, 0x03, 0x40, 0x20, 0x01, 0x10, 0x00,
+	0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x22, 0x00, 0x0d, 0x00, 0x0b,
+	0x20, 0x01, 0x0b, 0x18, 0x01, 0x01, 0x7f, 0x03, 0x40, 0x20, 0x01, 0x10,
+	0x06, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x22, 0x00, 0x0d, 0x00,
+	0x0b, 0x20, 0x01, 0x0b, 0x1b, 0x01, 0x01, 0x7f, 0x03, 0x40, 0x20, 0x01,
+	0x41, 0x00, 0x11, 0x00, 0x00, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b,
+	0x22, 0x00, 0x0d, 0x00, 0x0b, 0x20, 0x01, 0x0b, 0x07, 0x00, 0x20, 0x00,
+	0x41, 0x01, 0x6a, 0x0b, 0x03, 0x00, 0x00, 0x0b,
+};
+#define BENCH_STACK_SIZE ((size_t) 1024 * 1024)
+#define BENCH_MAX_OPS ((uint64_t) 1 << 30)
+
+struct BenchContext {
+	struct FuncInst *nop, *loop, *call_host, *call_wasm,
+		*call_indirect, *trap;
+	struct WasmJITHigh high;
+	int have_high;
+};
+
+struct Bench {
+	const char *name;
+	/* performs n crossings */
+	int (*run)(struct BenchContext *ctx, uint32_t n);
+	/* runs inside the wasm loop, so "loop" is their baseline */
+	int in_loop;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t bench_host(uint32_t value, struct FuncInst *funcinst)
+{
+	(void)funcinst;
+	return value + 1;
+}
+
+static int run_invoke_function(struct BenchContext *ctx, uint32_t n)
+{
+	union ValueUnion out;
+
+	while (n--) {
+		if (wasmjit_invoke_function(ctx->nop, NULL, &out))
+			return -1;
+	}
+	return 0;
+}
+
+static int run_invoke_function_raw(struct BenchContext *ctx, uint32_t n)
+{
+	while (n--)
+		(void)wasmjit_invoke_function_raw(ctx->nop, NULL);
+	return 0;
+}
+
+static int run_trap(struct BenchContext *ctx, uint32_t n)
+{
+	while (n--) {
+		if (!wasmjit_invoke_function(ctx->trap, NULL, NULL))
+			return -1;
+	}
+	return 0;
+}
+
+static int run_wasm_loop(struct FuncInst *funcinst, uint32_t n)
+{
+	union ValueUnion arg, out;
+
+	if (!n)
+		return 0;
+	arg.i32 = n;
+	return wasmjit_invoke_function(funcinst, &arg, &out);
+}
+
+static int run_loop(struct BenchContext *ctx, uint32_t n)
+{
+	return run_wasm_loop(ctx->loop, n);
+}
+
+static int run_call_host(struct BenchContext *ctx, uint32_t n)
+{
+	return run_wasm_loop(ctx->call_host, n);
+}
+
+static int run_call_wasm(struct BenchContext *ctx, uint32_t n)
+{
+	return run_wasm_loop(ctx->call_wasm, n);
+}
+
+static int run_call_indirect(struct BenchContext *ctx, uint32_t n)
+{
+	return run_wasm_loop(ctx->call_indirect, n);
+}
+
+static int run_invoke_main(struct BenchContext *ctx, uint32_t n)
+{
+	char *argv[] = {"bench", NULL};
+	char *envp[] = {NULL};
+
+	while (n--) {
+		if (wasmjit_high_emscripten_invoke_main(&ctx->high, "asm",
+							1, argv, envp, 0))
+			return -1;
+	}
+	return 0;
+}
+
+static const struct Bench benches[] = {
+	{"invoke_function", run_invoke_function, 0},
+	{"invoke_function_raw", run_invoke_function_raw, 0},
+	{"trap", run_trap, 0},
+	{"loop", run_loop, 0},
+	{"call_host", run_call_host, 1},
+	{"call_wasm", run_call_wasm, 1},
+	{"call_indirect", run_call_indirect, 1},
+	{"invoke_main", run_invoke_main, 0},
+};
+
+static struct ModuleInst *make_host_module(void)
+{
+	struct ModuleInst *module;
+	struct FuncInst *funcinst = NULL;
+	struct Export *export;
+
+	module = calloc(1, sizeof(*module));
+	if (!module)
+		goto error;
+
+	funcinst = calloc(1, sizeof(*funcinst));
+	if (!funcinst)
+		goto error;
+	funcinst->module_inst = module;
+	funcinst->host_function = 1;
+	funcinst->type.n_inputs = 1;
+	funcinst->type.input_types[0] = VALTYPE_I32;
+	funcinst->type.output_type = VALTYPE_I32;
+	/* compiled when the benchmark module imports it */
+	funcinst->host_fptr = &bench_host;
+
+	if (!VECTOR_GROW(&module->funcs, 1))
+		goto error;
+	module->funcs.elts[module->funcs.n_elts - 1] = funcinst;
+	funcinst = NULL;
+
+	if (!VECTOR_GROW(&module->exports, 1))
+		goto error;
+	export = &module->exports.elts[module->exports.n_elts - 1];
+	export->name = strdup("bench_host");
+	export->type = IMPORT_DESC_TYPE_FUNC;
+	export->value.func = module->funcs.elts[0];
+	if (!export->name)
+		goto error;
+
+	if (0) {
+	error:
+		if (funcinst)
+			wasmjit_free_func_inst(funcinst);
+		if (module)
+			wasmjit_free_module_inst(module);
+		module = NULL;
+	}
+
+	return module;
+}
+
+static struct ModuleInst *instantiate_boundary_module(struct ModuleInst *env)
+{
+	struct Module module;
+	struct ParseState pstate;
+	struct NamedModule import;
+	struct ModuleInst *module_inst = NULL;
+	char why[256];
+
+	wasmjit_init_module(&module);
+
+	if (!init_pstate(&pstate, (const char *) boundary_module,
+			 sizeof(boundary_module)) ||
+	    !read_module(&pstate, &module, why, sizeof(why))) {
+		fprintf(stderr, "failed to parse benchmark module\n");
+		goto error;
+	}
+
+	import.name = "env";
+	import.module = env;
+	module_inst = wasmjit_instantiate(&module, 1, &import,
+					  why, sizeof(why));
+	if (!module_inst)
+		fprintf(stderr, "failed to instantiate benchmark module: %s\n",
+			why);
+
+ error:
+	wasmjit_free_module(&module);
+	return module_inst;
+}
+
+/* the kernel module reads programs from a file */
+static int instantiate_empty_main(struct WasmJITHigh *high)
+{
+	char path[] = "/tmp/wasmjit_bench_XXXXXX";
+	int fd, ret = -1;
+	ssize_t written;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+
+	written = write(fd, empty_main_module, sizeof(empty_main_module));
+	close(fd);
+	if (written != (ssize_t) sizeof(empty_main_module))
+		goto error;
+
+	if (wasmjit_high_instantiate_emscripten_runtime(high, BENCH_STATIC_BUMP, 0, 0,
+							WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_NO_TABLE))
+		goto error;
+
+	if (wasmjit_high_instantiate(high, path, "asm", 0))
+		goto error;
+
+	ret = 0;
+
+ error:
+	unlink(path);
+	return ret;
+}
+
+static int pin_cpu(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+
+	if (cpu < 0)
+		cpu = sched_getcpu();
+	if (cpu < 0)
+		return -1;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		return -1;
+	return cpu;
+#else
+	(void)cpu;
+	return -1;
+#endif
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double da = *(const double *) a, db = *(const double *) b;
+	return da < db ? -1 : da > db;
+}
+
+/* fills the median and minimum ns per op over n_repeats runs */
+static int measure(struct BenchContext *ctx, const struct Bench *bench,
+		   uint64_t run_ns, size_t n_repeats,
+		   double *median, double *min, uint64_t *n_ops)
+{
+	uint64_t n = 1, elapsed = 0, start;
+	double *samples;
+	size_t i;
+
+	/* doubling up to a tenth of the run time doubles as warmup */
+	for (;;) {
+		start = now_ns();
+		if (bench->run(ctx, n))
+			return -1;
+		elapsed = now_ns() - start;
+		if (elapsed >= run_ns / 10 || n >= BENCH_MAX_OPS)
+			break;
+		n *= 2;
+	}
+
+	if (elapsed)
+		n = n * run_ns / elapsed;
+	if (!n)
+		n = 1;
+	if (n > BENCH_MAX_OPS)
+		n = BENCH_MAX_OPS;
+
+	samples = calloc(n_repeats, sizeof(samples[0]));
+	if (!samples)
+		return -1;
+
+	for (i = 0; i < n_repeats; ++i) {
+		start = now_ns();
+		if (bench->run(ctx, n)) {
+			free(samples);
+			return -1;
+		}
+		samples[i] = (double) (now_ns() - start) / n;
+	}
+
+	qsort(samples, n_repeats, sizeof(samples[0]), compare_doubles);
+	*median = samples[n_repeats / 2];
+	*min = samples[0];
+	*n_ops = n;
+	free(samples);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-c cpu] [-t ms_per_run] [-r repeats] [benchmark...]\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct BenchContext ctx;
+	struct ModuleInst *env = NULL, *module_inst = NULL;
+	int opt, cpu = -1, ret = -1, first = 1;
+	unsigned long run_ms = 100, n_repeats = 5;
+	double loop_ns = 0;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "c:t:r:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 't':
+			run_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			n_repeats = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (!run_ms || !n_repeats) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	cpu = pin_cpu(cpu);
+	if (cpu < 0)
+		fprintf(stderr, "warning: not pinned to a CPU\n");
+
+	/* nothing here recurses */
+	wasmjit_set_stack_top((char *) __builtin_frame_address(0) -
+			      BENCH_STACK_SIZE);
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	env = make_host_module();
+	if (!env)
+		goto error;
+
+	module_inst = instantiate_boundary_module(env);
+	if (!module_inst)
+		goto error;
+
+	ctx.nop = wasmjit_get_export(module_inst, "nop", IMPORT_DESC_TYPE_FUNC).func;
+	ctx.loop = wasmjit_get_export(module_inst, "loop", IMPORT_DESC_TYPE_FUNC).func;
+	ctx.call_host = wasmjit_get_export(module_inst, "call_host", IMPORT_DESC_TYPE_FUNC).func;
+	ctx.call_wasm = wasmjit_get_export(module_inst, "call_wasm", IMPORT_DESC_TYPE_FUNC).func;
+	ctx.call_indirect = wasmjit_get_export(module_inst, "call_indirect", IMPORT_DESC_TYPE_FUNC).func;
+	ctx.trap = wasmjit_get_export(module_inst, "trap", IMPORT_DESC_TYPE_FUNC).func;
+
+	if (!wasmjit_high_init(&ctx.high)) {
+		ctx.have_high = 1;
+		if (instantiate_empty_main(&ctx.high)) {
+			fprintf(stderr, "warning: skipping invoke_main\n");
+			wasmjit_high_close(&ctx.high);
+			ctx.have_high = 0;
+		}
+	}
+
+	printf("{\n  \"cpu\": %d,\n  \"kernel\": %s,\n  \"compile_flags\": %u,\n"
+	       "  \"results\": [",
+	       cpu,
+#ifdef WASMJIT_CAN_USE_DEVICE
+	       ctx.have_high && ctx.high.fd >= 0 ? "true" : "false",
+#else
+	       "false",
+#endif
+	       wasmjit_detect_retpoline_flags());
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+		const struct Bench *bench = &benches[i];
+		double median, min;
+		uint64_t n_ops;
+		int j;
+
+		if (optind < argc) {
+			for (j = optind; j < argc; ++j) {
+				if (!strcmp(argv[j], bench->name))
+					break;
+			}
+			/* the loop baseline is needed for net_ns */
+			if (j == argc && strcmp(bench->name, "loop"))
+				continue;
+		}
+
+		if (bench->run == run_invoke_main && !ctx.have_high)
+			continue;
+
+		if (measure(&ctx, bench, (uint64_t) run_ms * 1000000,
+			    n_repeats, &median, &min, &n_ops)) {
+			fprintf(stderr, "%s failed\n", bench->name);
+			goto error;
+		}
+
+		if (bench->run == run_loop)
+			loop_ns = median;
+
+		printf("%s\n    {\"name\": \"%s\", \"ns\": %.2f, \"min_ns\": %.2f, "
+		       "\"ops\": %" PRIu64,
+		       first ? "" : ",", bench->name, median, min, n_ops);
+		if (bench->in_loop)
+			printf(", \"net_ns\": %.2f", median - loop_ns);
+		printf("}");
+		first = 0;
+	}
+
+	printf("\n  ]\n}\n");
+	ret = 0;
+
+ error:
+	if (ctx.have_high)
+		wasmjit_high_close(&ctx.high);
+	if (module_inst)
+		wasmjit_free_module_inst(module_inst);
+	if (env)
+		wasmjit_free_module_inst(env);
+	return ret;
+}
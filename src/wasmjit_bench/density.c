@@ -0,0 +1,381 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+/*
+  instantiates copies of one Emscripten program, through the kernel
+  module when it's loaded, until -n instances exist or instantiation
+  fails. at 1, 2, 4, ... instances it prints (as JSON) the average
+  instantiation time, per-instance growth of RSS, vmalloc and page
+  tables since the start, compiled code and linear memory per
+  instance, and how many main() calls per second all instances
+  sustain round-robin.
+
+  the program defaults to a built-in one (see bench_modules.h), -b
+  gives the STATIC_BUMP of another one.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <wasmjit/ast.h>
+#include <wasmjit/high_level.h>
+#include <wasmjit/parse.h>
+#include <wasmjit/runtime.h>
+#include <wasmjit/util.h>
+
+#include <wasmjit_bench/bench_modules.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+
+struct MemoryUsage {
+	/* -1 where unknown */
+	long long rss, vmalloc, page_tables;
+};
+
+struct Program {
+	const char *path;
+	struct Module module;
+	uint32_t static_bump;
+	int has_table;
+	size_t tablemin, tablemax;
+	size_t memory_size;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the value of "key:  N kB" in a /proc file, in bytes */
+static long long read_proc_kb(const char *path, const char *key)
+{
+	FILE *f;
+	char line[256];
+	long long ret = -1;
+	size_t key_len = strlen(key);
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, key, key_len) && line[key_len] == ':') {
+			ret = strtoll(line + key_len + 1, NULL, 10) * 1024;
+			break;
+		}
+	}
+
+	fclose(f);
+	return ret;
+}
+
+static void read_memory_usage(struct MemoryUsage *usage)
+{
+	usage->rss = read_proc_kb("/proc/self/status", "VmRSS");
+	usage->page_tables = read_proc_kb("/proc/self/status", "VmPTE");
+	usage->vmalloc = read_proc_kb("/proc/meminfo", "VmallocUsed");
+}
+
+/* compiled code and invokers, every one is mapped on its own pages */
+static long long code_size(const struct WasmJITHigh *high)
+{
+	size_t i, j, page_size = sysconf(_SC_PAGESIZE);
+	long long total = 0;
+
+#ifdef WASMJIT_CAN_USE_DEVICE
+	if (high->fd >= 0)
+		return -1;
+#endif
+
+	for (i = 0; i < high->n_modules; ++i) {
+		const struct ModuleInst *module_inst = high->modules[i].module;
+
+		for (j = module_inst->n_imported_funcs;
+		     j < module_inst->funcs.n_elts; ++j) {
+			const struct FuncInst *funcinst = module_inst->funcs.elts[j];
+
+			total += (funcinst->compiled_code_size + page_size - 1) &
+				~(page_size - 1);
+			total += (funcinst->invoker_size + page_size - 1) &
+				~(page_size - 1);
+		}
+	}
+
+	return total;
+}
+
+static int load_program(struct Program *program)
+{
+	struct ParseState pstate;
+	char *buf = NULL;
+	size_t size, i;
+	int ret = -1;
+
+	wasmjit_init_module(&program->module);
+
+	buf = wasmjit_load_file(program->path, &size);
+	if (!buf)
+		goto error;
+
+	if (!init_pstate(&pstate, buf, size) ||
+	    !read_module(&pstate, &program->module, NULL, 0))
+		goto error;
+
+	for (i = 0; i < program->module.import_section.n_imports; ++i) {
+		struct ImportSectionImport *import =
+			&program->module.import_section.imports[i];
+
+		if (strcmp(import->module, "env"))
+			continue;
+
+		if (!strcmp(import->name, "table") &&
+		    import->desc_type == IMPORT_DESC_TYPE_TABLE) {
+			program->has_table = 1;
+			program->tablemin = import->desc.tabletype.limits.min;
+			program->tablemax = import->desc.tabletype.limits.max;
+		} else if (!strcmp(import->name, "memory") &&
+			   import->desc_type == IMPORT_DESC_TYPE_MEM) {
+			program->memory_size = (size_t) import->desc.memtype.limits.min *
+				WASM_PAGE_SIZE;
+		}
+	}
+
+	ret = 0;
+
+ error:
+	if (buf)
+		wasmjit_unload_file(buf, size);
+	return ret;
+}
+
+static int instantiate_program(struct WasmJITHigh *high,
+			       struct Program *program)
+{
+	uint32_t flags = 0;
+
+	if (wasmjit_high_init(high))
+		return -1;
+
+	if (!program->has_table)
+		flags |= WASMJIT_HIGH_INSTANTIATE_EMSCRIPTEN_RUNTIME_FLAGS_NO_TABLE;
+
+	if (wasmjit_high_instantiate_emscripten_runtime(high,
+							program->static_bump,
+							program->tablemin,
+							program->tablemax,
+							flags) ||
+	    wasmjit_high_instantiate_parsed(high, program->path,
+					    &program->module, "asm", 0)) {
+		wasmjit_high_close(high);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* main() calls per second over all instances, round-robin */
+static double measure_throughput(struct WasmJITHigh *highs, size_t n,
+				 uint64_t min_ns)
+{
+	char *argv[] = {"bench", NULL};
+	char *envp[] = {NULL};
+	uint64_t start, elapsed;
+	size_t i, n_calls = 0;
+
+	start = now_ns();
+	do {
+		for (i = 0; i < n; ++i) {
+			if (wasmjit_high_emscripten_invoke_main(&highs[i], "asm",
+								1, argv, envp, 0))
+				return -1;
+		}
+		n_calls += n;
+		elapsed = now_ns() - start;
+	} while (elapsed < min_ns);
+
+	return n_calls * 1e9 / elapsed;
+}
+
+static void print_per_instance(const char *key, long long now,
+			       long long base, size_t n)
+{
+	if (now < 0 || base < 0)
+		printf(", \"%s\": null", key);
+	else
+		printf(", \"%s\": %lld", key, (now - base) / (long long) n);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-n max_instances] [-t ms_per_throughput] "
+		"[-b static_bump program.wasm]\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct Program program;
+	struct WasmJITHigh *highs = NULL;
+	struct MemoryUsage base, current;
+	struct rlimit rlim;
+	char tmp_path[] = "/tmp/wasmjit_bench_XXXXXX";
+	int opt, ret = -1, first = 1, tmp_fd = -1;
+	unsigned long max_instances = 1024, throughput_ms = 100;
+	uint64_t instantiate_ns = 0;
+	size_t n = 0, next_report = 1;
+	const char *stopped = "limit";
+
+	memset(&program, 0, sizeof(program));
+	program.static_bump = BENCH_STATIC_BUMP;
+
+	while ((opt = getopt(argc, argv, "n:t:b:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			max_instances = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			throughput_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			program.static_bump = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (!max_instances) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (optind < argc) {
+		program.path = argv[optind];
+	} else {
+		/* the kernel module reads programs from a file */
+		tmp_fd = mkstemp(tmp_path);
+		if (tmp_fd < 0 ||
+		    write(tmp_fd, density_module, sizeof(density_module)) !=
+		    (ssize_t) sizeof(density_module)) {
+			fprintf(stderr, "failed to write the built-in program\n");
+			goto error;
+		}
+		program.path = tmp_path;
+	}
+
+	if (load_program(&program)) {
+		fprintf(stderr, "failed to parse %s\n", program.path);
+		goto error;
+	}
+
+	/* every kernel instance holds a /dev/wasm fd */
+	if (!getrlimit(RLIMIT_NOFILE, &rlim)) {
+		rlim.rlim_cur = rlim.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	/* nothing here recurses */
+	wasmjit_set_stack_top((char *) __builtin_frame_address(0) -
+			      (size_t) 1024 * 1024);
+
+	highs = calloc(max_instances, sizeof(highs[0]));
+	if (!highs)
+		goto error;
+
+	read_memory_usage(&base);
+
+	printf("{\n  \"program\": \"%s\",\n  \"linear_memory\": %zu,\n"
+	       "  \"steps\": [",
+	       optind < argc ? program.path : "built-in",
+	       program.memory_size);
+
+	while (n < max_instances) {
+		uint64_t start;
+
+		start = now_ns();
+		if (instantiate_program(&highs[n], &program)) {
+			stopped = "error";
+			break;
+		}
+		instantiate_ns += now_ns() - start;
+		n += 1;
+
+		if (n != next_report && n != max_instances)
+			continue;
+		next_report *= 2;
+
+		read_memory_usage(&current);
+
+		printf("%s\n    {\"instances\": %zu, "
+		       "\"instantiate_us\": %.1f",
+		       first ? "" : ",", n,
+		       instantiate_ns / 1e3 / n);
+		print_per_instance("rss", current.rss, base.rss, n);
+		print_per_instance("vmalloc", current.vmalloc, base.vmalloc, n);
+		print_per_instance("page_tables", current.page_tables,
+				   base.page_tables, n);
+		print_per_instance("code", code_size(&highs[0]), 0, 1);
+		printf(", \"mains_per_sec\": %.0f}",
+		       measure_throughput(highs, n,
+					  (uint64_t) throughput_ms * 1000000));
+		fflush(stdout);
+		first = 0;
+	}
+
+	printf("\n  ],\n  \"instances\": %zu,\n  \"kernel\": %s,\n"
+	       "  \"stopped\": \"%s\"\n}\n",
+	       n,
+#ifdef WASMJIT_CAN_USE_DEVICE
+	       n && highs[0].fd >= 0 ? "true" : "false",
+#else
+	       "false",
+#endif
+	       stopped);
+	ret = 0;
+
+ error:
+	while (n)
+		wasmjit_high_close(&highs[--n]);
+	if (highs)
+		free(highs);
+	if (program.path)
+		wasmjit_free_module(&program.module);
+	if (tmp_fd >= 0) {
+		close(tmp_fd);
+		unlink(tmp_path);
+	}
+	return ret;
+}
@@ -0,0 +1,77 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT_GUEST__WASMJIT_LOG_H__
+#define __WASMJIT_GUEST__WASMJIT_LOG_H__
+
+/*
+  guest side of the wasmjit logging ring. records are copied into host
+  memory and written out to fd in batches by the runtime, instead of
+  costing a write(2) each. records to one fd stay in order with each
+  other and with plain write()s and close()s of that fd.
+
+  link with -s ERROR_ON_UNDEFINED_SYMBOLS=0, wasmjit_log() is provided
+  by the runtime.
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/* longer wasmjit_logf() lines are truncated */
+#ifndef WASMJIT_LOG_LINE_MAX
+#define WASMJIT_LOG_LINE_MAX 512
+#endif
+
+/* returns len or a negative errno, like write(2) */
+int wasmjit_log(int fd, const void *buf, size_t len);
+
+static inline int wasmjit_logs(int fd, const char *s)
+{
+	return wasmjit_log(fd, s, strlen(s));
+}
+
+static inline int wasmjit_logf(int fd, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static inline int wasmjit_logf(int fd, const char *fmt, ...)
+{
+	char line[WASMJIT_LOG_LINE_MAX];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return len;
+	if ((size_t) len >= sizeof(line))
+		len = sizeof(line) - 1;
+
+	return wasmjit_log(fd, line, len);
+}
+
+#endif
@@ -0,0 +1,71 @@
+/* -*-mode:c; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+  Copyright (c) 2018 Rian Hunter
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#ifndef __WASMJIT_GUEST__WASMJIT_SHARED_H__
+#define __WASMJIT_GUEST__WASMJIT_SHARED_H__
+
+/*
+  guest side of memfd-backed linear memory (wasmjit -M). the memory fd
+  can be sent to a sidecar process over a unix socket with SCM_RIGHTS,
+  which mmap()s it MAP_SHARED and sees the guest's addresses at the
+  same offsets. an eventfd serves as a doorbell in either direction:
+  write() an 8 byte count to ring it, read() or poll() it to wait.
+
+  link with -s ERROR_ON_UNDEFINED_SYMBOLS=0, these are provided by
+  the runtime.
+*/
+
+#include <stdint.h>
+#include <unistd.h>
+
+#define WASMJIT_EFD_SEMAPHORE 1
+#define WASMJIT_EFD_NONBLOCK 04000
+#define WASMJIT_EFD_CLOEXEC 02000000
+
+/*
+  a new fd for linear memory, the caller closes it. -ENOSYS when
+  memory isn't shared
+*/
+int wasmjit_memory_fd(void);
+
+/* eventfd(2), returns the fd or a negative errno */
+int wasmjit_eventfd(unsigned int initval, int flags);
+
+static inline int wasmjit_doorbell_ring(int efd)
+{
+	uint64_t one = 1;
+
+	return write(efd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+/* blocks unless efd is non-blocking, returns the rings since the last wait */
+static inline int64_t wasmjit_doorbell_wait(int efd)
+{
+	uint64_t count;
+
+	return read(efd, &count, sizeof(count)) == sizeof(count)
+		? (int64_t) count : -1;
+}
+
+#endif